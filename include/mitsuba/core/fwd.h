@@ -67,6 +67,7 @@ struct RayDifferential;
 class RemoteProcess;
 class RemoteWorker;
 class RemoteWorkerReader;
+class ResourceChunkCache;
 class Scheduler;
 class SerializableObject;
 struct SHRotation;
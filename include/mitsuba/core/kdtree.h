@@ -22,6 +22,15 @@
 
 #include <mitsuba/core/aabb.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/sse.h>
+#include <atomic>
+#include <thread>
+
+/// Subtrees of \ref PointKDTree with at least this many points are built on a separate thread
+#define MTS_KDTREE_PARALLEL_THRESHOLD 65536
+
+/// Ranges of \ref PointKDTree with at least this many points use a parallel median selection
+#define MTS_KDTREE_PARALLEL_SELECT_THRESHOLD 1048576
 
 MTS_NAMESPACE_BEGIN
 
@@ -285,7 +294,7 @@ public:
 	 * number of points
 	 */
 	inline PointKDTree(size_t nodes = 0, EHeuristic heuristic = ESlidingMidpoint)
-		: m_nodes(nodes), m_heuristic(heuristic), m_depth(0) { }
+		: m_nodes(nodes), m_heuristic(heuristic), m_depth(0), m_parallelBuild(true) { }
 
 	// =============================================================
 	//! @{ \name \c stl::vector-like interface
@@ -320,6 +329,10 @@ public:
 	inline size_t getDepth() const { return m_depth; }
 	/// Set the depth of the constructed KD-tree (be careful with this)
 	inline void setDepth(size_t depth) { m_depth = depth; }
+	/// Specify whether the tree should be constructed using multiple threads (default: \c true)
+	inline void setParallelBuild(bool parallel) { m_parallelBuild = parallel; }
+	/// Return whether the tree is constructed using multiple threads
+	inline bool getParallelBuild() const { return m_parallelBuild; }
 
 	/// Construct the KD-tree hierarchy
 	void build(bool recomputeAABB = false) {
@@ -350,17 +363,27 @@ public:
 		for (size_t i=0; i<m_nodes.size(); ++i)
 			indirection[i] = (IndexType) i;
 
-		m_depth = 0;
+		/* Large trees are built in parallel: subtrees are handed to separate
+		   threads, and the median selection of the top levels is split
+		   into chunks that are processed concurrently */
+		BuildContext ctx;
+		ctx.base = indirection.begin();
+		ctx.parallel = m_parallelBuild && m_nodes.size() >= MTS_KDTREE_PARALLEL_THRESHOLD;
+		ctx.maxThreads = ctx.parallel ? std::max(0, getCoreCount() - 1) : 0;
+		ctx.threads = 0;
+		if (ctx.maxThreads > 0 && m_nodes.size() >= MTS_KDTREE_PARALLEL_SELECT_THRESHOLD)
+			ctx.scratch.resize(m_nodes.size());
+
 		int constructionTime;
 		if (NodeType::leftBalancedLayout) {
 			std::vector<IndexType> permutation(m_nodes.size());
-			buildLB(0, 1, indirection.begin(), indirection.begin(),
+			m_depth = buildLB(ctx, 0, 1, m_aabb, indirection.begin(),
 				indirection.end(), permutation);
 			constructionTime = timer->getMilliseconds();
 			timer->reset();
 			permute_inplace(&m_nodes[0], permutation);
 		} else {
-			build(1, indirection.begin(), indirection.begin(), indirection.end());
+			m_depth = build(ctx, 1, m_aabb, indirection.begin(), indirection.end());
 			constructionTime = timer->getMilliseconds();
 			timer->reset();
 			permute_inplace(&m_nodes[0], indirection);
@@ -590,6 +613,52 @@ public:
 		return nnSearch(p, searchRadiusSqr, k, results);
 	}
 
+	/**
+	 * \brief Run a batch of k-nearest-neighbor search queries
+	 *
+	 * This is equivalent to calling \ref nnSearch() for each query. On
+	 * SSE-enabled builds, single precision trees over 3D points process
+	 * the queries in packets of four that traverse the tree together,
+	 * evaluating the distances between a node and all queries of the
+	 * packet at once. Packets are formed from consecutive queries, hence
+	 * coherent query orders (e.g. sorted along a space-filling curve)
+	 * perform best.
+	 *
+	 * \param p Array of \c count search positions
+	 * \param count Number of queries
+	 * \param sqrSearchRadius
+	 *      Array with the squared maximum search radius of each query.
+	 *      The entries are updated as in \ref nnSearch(). When set to
+	 *      \c NULL, the search radius is unbounded.
+	 * \param k Maximum number of search results per query
+	 * \param results
+	 *      Target array for search results. The results of query \c i
+	 *      start at <tt>results + i*(k+1)</tt>, hence the array must
+	 *      contain storage for <tt>count*(k+1)</tt> entries
+	 * \param resultCount
+	 *      Array that receives the number of search results of each query
+	 */
+	void nnSearchBatch(const PointType *p, size_t count, Float *sqrSearchRadius,
+			size_t k, SearchResult *results, size_t *resultCount) const {
+		size_t i = 0;
+#if defined(MTS_SSE)
+		if (PointType::dim == 3 && sizeof(Scalar) == sizeof(float)
+				&& sizeof(Float) == sizeof(float) && m_nodes.size() > 0) {
+			for (; i<count; i += 4)
+				nnSearchPacket(p + i, (int) std::min(count - i, (size_t) 4),
+					sqrSearchRadius ? sqrSearchRadius + i : NULL, k,
+					results + i * (k+1), resultCount + i);
+		}
+#endif
+		for (; i<count; ++i) {
+			Float radius = sqrSearchRadius ? sqrSearchRadius[i]
+				: std::numeric_limits<Float>::infinity();
+			resultCount[i] = nnSearch(p[i], radius, k, results + i * (k+1));
+			if (sqrSearchRadius)
+				sqrSearchRadius[i] = radius;
+		}
+	}
+
 	/**
 	 * \brief Execute a search query and run the specified functor on them,
 	 * which potentially modifies the nodes themselves
@@ -810,6 +879,131 @@ public:
 		}
 	}
 protected:
+#if defined(MTS_SSE)
+	/// Process up to four k-nn queries as a packet (see \ref nnSearchBatch())
+	void nnSearchPacket(const PointType *p, int n, Float *sqrSearchRadius,
+			size_t k, SearchResult *results, size_t *resultCount) const {
+		struct StackEntry {
+			IndexType index;
+			int mask;
+		};
+
+		/* Unused lanes replicate the first query, but are never active */
+		MM_ALIGN16 float qx[4], qy[4], qz[4], radius[4];
+		SearchResult *laneResults[4];
+		size_t laneCount[4];
+		bool isHeap[4];
+		for (int i=0; i<4; ++i) {
+			const int j = i < n ? i : 0;
+			qx[i] = (float) p[j][0];
+			qy[i] = (float) p[j][1];
+			qz[i] = (float) p[j][2];
+			radius[i] = sqrSearchRadius ? (float) sqrSearchRadius[j]
+				: std::numeric_limits<float>::infinity();
+			laneResults[i] = results + j * (k+1);
+			laneCount[i] = 0;
+			isHeap[i] = false;
+		}
+
+		const __m128 px = _mm_load_ps(qx), py = _mm_load_ps(qy), pz = _mm_load_ps(qz);
+		__m128 sqrRadius = _mm_load_ps(radius);
+
+		StackEntry *stack = (StackEntry *) alloca((m_depth+1) * sizeof(StackEntry));
+		IndexType index = 0, stackPos = 0;
+		int mask = (1 << n) - 1;
+
+		while (true) {
+			const NodeType &node = m_nodes[index];
+			const PointType &pos = node.getPosition();
+
+			/* Check if the current point is within the search radius of the active queries */
+			const __m128
+				dx = _mm_sub_ps(px, _mm_set1_ps((float) pos[0])),
+				dy = _mm_sub_ps(py, _mm_set1_ps((float) pos[1])),
+				dz = _mm_sub_ps(pz, _mm_set1_ps((float) pos[2])),
+				pointDistSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+					_mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			const int found = _mm_movemask_ps(_mm_cmplt_ps(pointDistSquared, sqrRadius)) & mask;
+
+			if (found) {
+				MM_ALIGN16 float distSquared[4];
+				_mm_store_ps(distSquared, pointDistSquared);
+				for (int i=0; i<4; ++i) {
+					if (!(found & (1 << i)))
+						continue;
+					SearchResult *target = laneResults[i];
+					if (laneCount[i] < k) {
+						target[laneCount[i]++] = SearchResult(distSquared[i], index);
+					} else {
+						if (!isHeap[i]) {
+							std::make_heap(target, target + laneCount[i],
+									SearchResultComparator());
+							isHeap[i] = true;
+						}
+						target[laneCount[i]] = SearchResult(distSquared[i], index);
+						std::push_heap(target, target + laneCount[i] + 1, SearchResultComparator());
+						std::pop_heap(target, target + laneCount[i] + 1, SearchResultComparator());
+						radius[i] = target[0].distSquared;
+					}
+				}
+				sqrRadius = _mm_load_ps(radius);
+			}
+
+			/* Recurse on inner nodes, restricted to the queries that need each side */
+			if (!node.isLeaf()) {
+				const int axis = node.getAxis();
+				const __m128 distToPlane = _mm_sub_ps(axis == 0 ? px : (axis == 1 ? py : pz),
+					_mm_set1_ps((float) pos[axis]));
+				const int searchBoth = _mm_movemask_ps(_mm_cmple_ps(
+					_mm_mul_ps(distToPlane, distToPlane), sqrRadius)) & mask;
+				const int rightSide = _mm_movemask_ps(_mm_cmpgt_ps(
+					distToPlane, _mm_setzero_ps())) & mask;
+				const int leftMask = (mask & ~rightSide) | searchBoth,
+					rightMask = hasRightChild(index) ? (rightSide | searchBoth) : 0;
+				const IndexType leftIndex = node.getLeftIndex(index),
+					rightIndex = node.getRightIndex(index);
+
+				if (leftMask && rightMask) {
+					/* Visit the side containing most of the queries first */
+					static const int bitCount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+					if (bitCount[rightSide] > bitCount[mask & ~rightSide]) {
+						stack[stackPos].index = leftIndex;
+						stack[stackPos++].mask = leftMask;
+						index = rightIndex;
+						mask = rightMask;
+					} else {
+						stack[stackPos].index = rightIndex;
+						stack[stackPos++].mask = rightMask;
+						index = leftIndex;
+						mask = leftMask;
+					}
+					continue;
+				} else if (leftMask) {
+					index = leftIndex;
+					mask = leftMask;
+					continue;
+				} else if (rightMask) {
+					index = rightIndex;
+					mask = rightMask;
+					continue;
+				}
+			}
+
+			if (stackPos == 0)
+				break;
+			--stackPos;
+			index = stack[stackPos].index;
+			mask = stack[stackPos].mask;
+		}
+
+		for (int i=0; i<n; ++i) {
+			resultCount[i] = laneCount[i];
+			if (sqrSearchRadius)
+				sqrSearchRadius[i] = radius[i];
+		}
+	}
+#endif
+
 	struct CoordinateOrdering {
 	public:
 		inline CoordinateOrdering(const std::vector<NodeType> &nodes, int axis)
@@ -872,14 +1066,169 @@ protected:
 		return p - 1;
 	}
 
-	/// Left-balanced tree construction routine
-	void buildLB(IndexType idx, size_t depth,
-			  typename std::vector<IndexType>::iterator base,
-			  typename std::vector<IndexType>::iterator rangeStart,
-			  typename std::vector<IndexType>::iterator rangeEnd,
-			  typename std::vector<IndexType> &permutation) {
-		m_depth = std::max(depth, m_depth);
+	typedef typename std::vector<IndexType>::iterator IndexIterator;
+
+	/// Shared state of a (potentially parallel) tree construction
+	struct BuildContext {
+		/// Start of the indirection table
+		IndexIterator base;
+		/// Temporary storage for the parallel median selection (same size as the table)
+		std::vector<IndexType> scratch;
+		bool parallel;
+		int maxThreads;
+		std::atomic<int> threads;
+
+		/// Reserve one of the worker threads, if available
+		inline bool acquireThread() {
+			if (threads.fetch_add(1) < maxThreads)
+				return true;
+			--threads;
+			return false;
+		}
+	};
+
+	/// Run \c functor(chunk) for <tt>chunk=0..chunks-1</tt>, each on its own thread
+	template <typename Functor> static void runChunks(int chunks, const Functor &functor) {
+		std::vector<std::thread> workers;
+		for (int i=1; i<chunks; ++i)
+			workers.push_back(std::thread(functor, i));
+		functor(0);
+		for (size_t i=0; i<workers.size(); ++i)
+			workers[i].join();
+	}
 
+	/// Reserve all available worker threads and return the number of chunks to use
+	inline int acquireChunks(BuildContext &ctx) const {
+		int chunks = 1;
+		while (chunks <= ctx.maxThreads && ctx.acquireThread())
+			++chunks;
+		return chunks;
+	}
+
+	/// Return whether a range is large enough to be processed using \ref runChunks()
+	inline bool useChunks(const BuildContext &ctx, IndexIterator rangeStart,
+			IndexIterator rangeEnd) const {
+		return !ctx.scratch.empty() && rangeEnd - rangeStart >= MTS_KDTREE_PARALLEL_SELECT_THRESHOLD;
+	}
+
+	/**
+	 * \brief Rearrange a range so that \c split holds the element that
+	 * would be there if the range was sorted along \c axis, with no
+	 * larger elements before and no smaller ones after it
+	 * (i.e. \c std::nth_element)
+	 *
+	 * Large ranges are first partitioned in parallel into three groups
+	 * using an interval around the split estimated from a regular sample.
+	 * The sequential selection then only has to process one of them.
+	 */
+	void select(BuildContext &ctx, IndexIterator rangeStart, IndexIterator split,
+			IndexIterator rangeEnd, int axis) {
+		if (!useChunks(ctx, rangeStart, rangeEnd)) {
+			std::nth_element(rangeStart, split, rangeEnd,
+				CoordinateOrdering(m_nodes, axis));
+			return;
+		}
+
+		const size_t count = (size_t) (rangeEnd - rangeStart),
+			rank = (size_t) (split - rangeStart);
+		const size_t sampleCount = 1024, margin = 64;
+		std::vector<Scalar> sample(sampleCount);
+		for (size_t i=0; i<sampleCount; ++i)
+			sample[i] = m_nodes[rangeStart[(i * count) / sampleCount]].getPosition()[axis];
+		std::sort(sample.begin(), sample.end());
+		const size_t sampleRank = (rank * sampleCount) / count;
+		const Scalar lo = sample[sampleRank > margin ? sampleRank - margin : 0],
+			hi = sample[std::min(sampleRank + margin, sampleCount - 1)];
+
+		const int chunks = acquireChunks(ctx);
+		const size_t chunkSize = (count + chunks - 1) / chunks;
+		std::vector<size_t> offsets(3 * chunks, 0);
+		IndexType *scratch = &ctx.scratch[rangeStart - ctx.base];
+
+		/* Count the elements below, within and above the interval */
+		runChunks(chunks, [&](int chunk) {
+			IndexIterator it = rangeStart + std::min(chunk * chunkSize, count),
+				end = rangeStart + std::min((chunk + 1) * chunkSize, count);
+			size_t *counts = &offsets[3 * chunk];
+			for (; it != end; ++it) {
+				Scalar value = m_nodes[*it].getPosition()[axis];
+				++counts[value < lo ? 0 : (value <= hi ? 1 : 2)];
+			}
+		});
+
+		size_t offset = 0;
+		for (int group=0; group<3; ++group) {
+			for (int chunk=0; chunk<chunks; ++chunk) {
+				size_t groupCount = offsets[3 * chunk + group];
+				offsets[3 * chunk + group] = offset;
+				offset += groupCount;
+			}
+		}
+		const size_t lessCount = offsets[1], greaterStart = offsets[2];
+
+		/* Scatter the elements into the scratch space, then copy them back */
+		runChunks(chunks, [&](int chunk) {
+			IndexIterator it = rangeStart + std::min(chunk * chunkSize, count),
+				end = rangeStart + std::min((chunk + 1) * chunkSize, count);
+			size_t *targets = &offsets[3 * chunk];
+			for (; it != end; ++it) {
+				Scalar value = m_nodes[*it].getPosition()[axis];
+				scratch[targets[value < lo ? 0 : (value <= hi ? 1 : 2)]++] = *it;
+			}
+		});
+		runChunks(chunks, [&](int chunk) {
+			size_t start = std::min(chunk * chunkSize, count),
+				end = std::min((chunk + 1) * chunkSize, count);
+			std::copy(scratch + start, scratch + end, rangeStart + start);
+		});
+		ctx.threads -= chunks - 1;
+
+		/* Finish the selection within the group containing the split */
+		if (rank < lessCount) {
+			rangeEnd = rangeStart + lessCount;
+		} else if (rank < greaterStart) {
+			rangeEnd = rangeStart + greaterStart;
+			rangeStart += lessCount;
+		} else {
+			rangeStart += greaterStart;
+		}
+		std::nth_element(rangeStart, split, rangeEnd,
+			CoordinateOrdering(m_nodes, axis));
+	}
+
+	/// Count the elements of a range whose coordinate along \c axis is <= \c value
+	size_t countLessOrEqual(BuildContext &ctx, IndexIterator rangeStart,
+			IndexIterator rangeEnd, int axis, Scalar value) {
+		if (!useChunks(ctx, rangeStart, rangeEnd))
+			return std::count_if(rangeStart, rangeEnd,
+				LessThanOrEqual(m_nodes, axis, value));
+
+		const size_t count = (size_t) (rangeEnd - rangeStart);
+		const int chunks = acquireChunks(ctx);
+		const size_t chunkSize = (count + chunks - 1) / chunks;
+		std::vector<size_t> counts(chunks);
+		runChunks(chunks, [&](int chunk) {
+			counts[chunk] = std::count_if(
+				rangeStart + std::min(chunk * chunkSize, count),
+				rangeStart + std::min((chunk + 1) * chunkSize, count),
+				LessThanOrEqual(m_nodes, axis, value));
+		});
+		ctx.threads -= chunks - 1;
+
+		size_t result = 0;
+		for (int i=0; i<chunks; ++i)
+			result += counts[i];
+		return result;
+	}
+
+	/**
+	 * \brief Left-balanced tree construction routine
+	 *
+	 * \return The depth of the deepest leaf in the subtree
+	 */
+	size_t buildLB(BuildContext &ctx, IndexType idx, size_t depth, const AABBType &aabb,
+			  IndexIterator rangeStart, IndexIterator rangeEnd,
+			  std::vector<IndexType> &permutation) {
 		IndexType count = (IndexType) (rangeEnd-rangeStart);
 		SAssert(count > 0);
 
@@ -887,14 +1236,12 @@ protected:
 			/* Create a leaf node */
 			m_nodes[*rangeStart].setLeaf(true);
 			permutation[idx] = *rangeStart;
-			return;
+			return depth;
 		}
 
-		typename std::vector<IndexType>::iterator split
-			= rangeStart + leftSubtreeSize(count);
-		int axis = m_aabb.getLargestAxis();
-		std::nth_element(rangeStart, split, rangeEnd,
-			CoordinateOrdering(m_nodes, axis));
+		IndexIterator split = rangeStart + leftSubtreeSize(count);
+		int axis = aabb.getLargestAxis();
+		select(ctx, rangeStart, split, rangeEnd, axis);
 
 		NodeType &splitNode = m_nodes[*split];
 		splitNode.setAxis(axis);
@@ -902,65 +1249,75 @@ protected:
 		permutation[idx] = *split;
 
 		/* Recursively build the children */
-		Scalar temp = m_aabb.max[axis],
-			splitPos = splitNode.getPosition()[axis];
-		m_aabb.max[axis] = splitPos;
-		buildLB(2*idx+1, depth+1, base, rangeStart, split, permutation);
-		m_aabb.max[axis] = temp;
-
-		if (split+1 != rangeEnd) {
-			temp = m_aabb.min[axis];
-			m_aabb.min[axis] = splitPos;
-			buildLB(2*idx+2, depth+1, base, split+1, rangeEnd, permutation);
-			m_aabb.min[axis] = temp;
+		Scalar splitPos = splitNode.getPosition()[axis];
+		AABBType leftAABB(aabb), rightAABB(aabb);
+		leftAABB.max[axis] = rightAABB.min[axis] = splitPos;
+		size_t leftDepth = depth, rightDepth = depth;
+
+		std::thread worker;
+		if (ctx.parallel && split - rangeStart >= MTS_KDTREE_PARALLEL_THRESHOLD
+				&& rangeEnd - split >= MTS_KDTREE_PARALLEL_THRESHOLD && ctx.acquireThread()) {
+			worker = std::thread([&]() {
+				leftDepth = buildLB(ctx, 2*idx+1, depth+1, leftAABB, rangeStart, split, permutation);
+			});
+		} else {
+			leftDepth = buildLB(ctx, 2*idx+1, depth+1, leftAABB, rangeStart, split, permutation);
 		}
-	}
 
-	/// Default tree construction routine
-	void build(size_t depth,
-			  typename std::vector<IndexType>::iterator base,
-			  typename std::vector<IndexType>::iterator rangeStart,
-			  typename std::vector<IndexType>::iterator rangeEnd) {
-		m_depth = std::max(depth, m_depth);
+		if (split+1 != rangeEnd)
+			rightDepth = buildLB(ctx, 2*idx+2, depth+1, rightAABB, split+1, rangeEnd, permutation);
+
+		if (worker.joinable()) {
+			worker.join();
+			--ctx.threads;
+		}
+
+		return std::max(leftDepth, rightDepth);
+	}
 
+	/**
+	 * \brief Default tree construction routine
+	 *
+	 * \return The depth of the deepest leaf in the subtree
+	 */
+	size_t build(BuildContext &ctx, size_t depth, const AABBType &aabb,
+			  IndexIterator rangeStart, IndexIterator rangeEnd) {
 		IndexType count = (IndexType) (rangeEnd-rangeStart);
 		SAssert(count > 0);
 
 		if (count == 1) {
 			/* Create a leaf node */
 			m_nodes[*rangeStart].setLeaf(true);
-			return;
+			return depth;
 		}
 
 		int axis = 0;
-		typename std::vector<IndexType>::iterator split;
+		IndexIterator split;
 
 		switch (m_heuristic) {
 			case EBalanced: {
 					split = rangeStart + count/2;
-					axis = m_aabb.getLargestAxis();
-					std::nth_element(rangeStart, split, rangeEnd,
-						CoordinateOrdering(m_nodes, axis));
+					axis = aabb.getLargestAxis();
+					select(ctx, rangeStart, split, rangeEnd, axis);
 				};
 				break;
 
 			case ELeftBalanced: {
 					split = rangeStart + leftSubtreeSize(count);
-					axis = m_aabb.getLargestAxis();
-					std::nth_element(rangeStart, split, rangeEnd,
-						CoordinateOrdering(m_nodes, axis));
+					axis = aabb.getLargestAxis();
+					select(ctx, rangeStart, split, rangeEnd, axis);
 				};
 				break;
 
 			case ESlidingMidpoint: {
 					/* Sliding midpoint rule: find a split that is close to the spatial median */
-					axis = m_aabb.getLargestAxis();
+					axis = aabb.getLargestAxis();
 
 					Scalar midpoint = (Scalar) 0.5f
-						* (m_aabb.max[axis]+m_aabb.min[axis]);
+						* (aabb.max[axis]+aabb.min[axis]);
 
-					size_t nLT = std::count_if(rangeStart, rangeEnd,
-							LessThanOrEqual(m_nodes, axis, midpoint));
+					size_t nLT = countLessOrEqual(ctx, rangeStart, rangeEnd,
+							axis, midpoint);
 
 					/* Re-adjust the split to pass through a nearby point */
 					split = rangeStart + nLT;
@@ -970,8 +1327,7 @@ protected:
 					else if (split == rangeEnd)
 						--split;
 
-					std::nth_element(rangeStart, split, rangeEnd,
-						CoordinateOrdering(m_nodes, axis));
+					select(ctx, rangeStart, split, rangeEnd, axis);
 				};
 				break;
 
@@ -983,9 +1339,9 @@ protected:
 							CoordinateOrdering(m_nodes, dim));
 
 						size_t numLeft = 1, numRight = count-2;
-						AABBType leftAABB(m_aabb), rightAABB(m_aabb);
-						Float invVolume = 1.0f / m_aabb.getVolume();
-						for (typename std::vector<IndexType>::iterator it = rangeStart+1;
+						AABBType leftAABB(aabb), rightAABB(aabb);
+						Float invVolume = 1.0f / aabb.getVolume();
+						for (IndexIterator it = rangeStart+1;
 								it != rangeEnd; ++it) {
 							++numLeft; --numRight;
 							Float pos = m_nodes[*it].getPosition()[dim];
@@ -1011,34 +1367,47 @@ protected:
 		splitNode.setLeaf(false);
 
 		if (split+1 != rangeEnd)
-			splitNode.setRightIndex((IndexType) (rangeStart - base),
-					(IndexType) (split + 1 - base));
+			splitNode.setRightIndex((IndexType) (rangeStart - ctx.base),
+					(IndexType) (split + 1 - ctx.base));
 		else
-			splitNode.setRightIndex((IndexType) (rangeStart - base), 0);
+			splitNode.setRightIndex((IndexType) (rangeStart - ctx.base), 0);
 
-		splitNode.setLeftIndex((IndexType) (rangeStart - base),
-				(IndexType) (rangeStart + 1 - base));
+		splitNode.setLeftIndex((IndexType) (rangeStart - ctx.base),
+				(IndexType) (rangeStart + 1 - ctx.base));
 		std::iter_swap(rangeStart, split);
 
 		/* Recursively build the children */
-		Scalar temp = m_aabb.max[axis],
-			splitPos = splitNode.getPosition()[axis];
-		m_aabb.max[axis] = splitPos;
-		build(depth+1, base, rangeStart+1, split+1);
-		m_aabb.max[axis] = temp;
-
-		if (split+1 != rangeEnd) {
-			temp = m_aabb.min[axis];
-			m_aabb.min[axis] = splitPos;
-			build(depth+1, base, split+1, rangeEnd);
-			m_aabb.min[axis] = temp;
+		Scalar splitPos = splitNode.getPosition()[axis];
+		AABBType leftAABB(aabb), rightAABB(aabb);
+		leftAABB.max[axis] = rightAABB.min[axis] = splitPos;
+		size_t leftDepth = depth, rightDepth = depth;
+
+		std::thread worker;
+		if (ctx.parallel && split - rangeStart >= MTS_KDTREE_PARALLEL_THRESHOLD
+				&& rangeEnd - split >= MTS_KDTREE_PARALLEL_THRESHOLD && ctx.acquireThread()) {
+			worker = std::thread([&]() {
+				leftDepth = build(ctx, depth+1, leftAABB, rangeStart+1, split+1);
+			});
+		} else {
+			leftDepth = build(ctx, depth+1, leftAABB, rangeStart+1, split+1);
 		}
+
+		if (split+1 != rangeEnd)
+			rightDepth = build(ctx, depth+1, rightAABB, split+1, rangeEnd);
+
+		if (worker.joinable()) {
+			worker.join();
+			--ctx.threads;
+		}
+
+		return std::max(leftDepth, rightDepth);
 	}
 protected:
 	std::vector<NodeType> m_nodes;
 	AABBType m_aabb;
 	EHeuristic m_heuristic;
 	size_t m_depth;
+	bool m_parallelBuild;
 };
 
 MTS_NAMESPACE_END
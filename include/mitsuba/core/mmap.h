@@ -59,6 +59,9 @@ public:
 	/// Return whether the mapped memory region is read-only
 	bool isReadOnly() const;
 
+	/// Return whether changes to the mapped memory stay private to this process
+	bool isCopyOnWrite() const;
+
 	/// Return a string representation
 	std::string toString() const;
 
@@ -70,6 +73,16 @@ public:
 	 */
 	static ref<MemoryMappedFile> createTemporary(size_t size);
 
+	/**
+	 * \brief Map the specified file into memory with copy-on-write semantics
+	 *
+	 * The mapped region is writable, but modifications are private to the
+	 * calling process and never reach the file. Only pages that are written
+	 * to are copied, hence this is a cheap way of loading data that is
+	 * usually read as-is but occasionally modified in place.
+	 */
+	static ref<MemoryMappedFile> mapCopyOnWrite(fs::pathstr const& filename);
+
 	MTS_DECLARE_CLASS()
 protected:
 	/// Internal constructor
@@ -22,6 +22,9 @@
 
 #include <mitsuba/mitsuba.h>
 
+/// Distributions with at least this many entries are sampled using an alias table
+#define MTS_ALIAS_THRESHOLD 64
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -315,6 +318,288 @@ namespace math {
 	}
 };
 
+/**
+ * \brief Discrete probability distribution that is sampled in constant
+ * time using Walker's alias method
+ *
+ * This class provides the same interface as \ref DiscreteDistribution.
+ * Inverting the CDF requires a binary search, which causes O(log n) cache
+ * misses on large distributions (e.g. the triangles of an emitting mesh).
+ * The alias table only needs two memory accesses per sample. However, it
+ * preserves the stratification of QMC sample sequences less well. For this
+ * reason, distributions with fewer than \ref MTS_ALIAS_THRESHOLD entries are
+ * still sampled by inverting their CDF.
+ *
+ * The alias table is created by \ref normalize(), which runs in linear time.
+ *
+ * \ingroup libcore
+ */
+struct AliasDistribution {
+public:
+	typedef math::AliasTableEntry<Float, uint32_t> Entry;
+
+	/// Allocate memory for a distribution with the given number of entries
+	explicit inline AliasDistribution(size_t nEntries = 0) {
+		reserve(nEntries);
+		clear();
+	}
+
+	/// Clear all entries
+	inline void clear() {
+		m_pmf.clear();
+		m_table.clear();
+		m_cdf.clear();
+		m_sum = m_normalization = 0.0f;
+		m_normalized = false;
+	}
+
+	/// Reserve memory for a certain number of entries
+	inline void reserve(size_t nEntries) {
+		m_pmf.reserve(nEntries);
+	}
+
+	/// Append an entry with the specified discrete probability
+	inline void append(Float pdfValue) {
+		m_pmf.push_back(pdfValue);
+	}
+
+	/// Return the number of entries so far
+	inline size_t size() const {
+		return m_pmf.size();
+	}
+
+	/// Access an entry by its index
+	inline Float operator[](size_t entry) const {
+		return m_pmf[entry];
+	}
+
+	/// Have the probability densities been normalized?
+	inline bool isNormalized() const {
+		return m_normalized;
+	}
+
+	/// Does this distribution use an alias table (as opposed to CDF inversion)?
+	inline bool usesAliasTable() const {
+		return !m_table.empty();
+	}
+
+	/**
+	 * \brief Return the original (unnormalized) sum of all PDF entries
+	 *
+	 * This assumes that \ref normalize() has previously been called
+	 */
+	inline Float getSum() const {
+		return m_sum;
+	}
+
+	/**
+	 * \brief Return the normalization factor (i.e. the inverse of \ref getSum())
+	 *
+	 * This assumes that \ref normalize() has previously been called
+	 */
+	inline Float getNormalization() const {
+		return m_normalization;
+	}
+
+	/**
+	 * \brief Normalize the distribution and create the sampling data structures
+	 *
+	 * Throws an exception when no entries were previously
+	 * added to the distribution.
+	 *
+	 * \return Sum of the (previously unnormalized) entries
+	 */
+	Float normalize() {
+		SAssert(m_pmf.size() > 0);
+		/* Accumulate in double precision: there may be many millions of entries */
+		double sum = 0;
+		for (size_t i=0; i<m_pmf.size(); ++i)
+			sum += m_pmf[i];
+		m_sum = (Float) sum;
+		m_table.clear();
+		m_cdf.clear();
+
+		if (sum > 0) {
+			m_normalization = (Float) (1.0 / sum);
+			for (size_t i=0; i<m_pmf.size(); ++i)
+				m_pmf[i] = (Float) (m_pmf[i] / sum);
+			if (m_pmf.size() >= MTS_ALIAS_THRESHOLD) {
+				buildTable();
+			} else {
+				m_cdf.reserve(m_pmf.size());
+				for (size_t i=0; i<m_pmf.size(); ++i)
+					m_cdf.append(m_pmf[i]);
+				m_cdf.normalize();
+			}
+			m_normalized = true;
+		} else {
+			m_normalization = 0.0f;
+		}
+		return m_sum;
+	}
+
+	/**
+	 * \brief %Transform a uniformly distributed sample to the stored distribution
+	 *
+	 * \param[in] sampleValue
+	 *     An uniformly distributed sample on [0,1]
+	 * \return
+	 *     The discrete index associated with the sample
+	 */
+	inline size_t sample(Float sampleValue) const {
+		if (m_table.empty())
+			return m_cdf.sample(sampleValue);
+		double scaled = (double) sampleValue * m_table.size();
+		uint32_t column = (uint32_t) std::min((double) (m_table.size() - 1), scaled);
+		const Entry &entry = m_table[column];
+		return (Float) (scaled - column) < entry.prob ? column : entry.index;
+	}
+
+	/**
+	 * \brief %Transform a uniformly distributed sample to the stored distribution
+	 *
+	 * \param[in] sampleValue
+	 *     An uniformly distributed sample on [0,1]
+	 * \param[out] pdf
+	 *     Probability value of the sample
+	 * \return
+	 *     The discrete index associated with the sample
+	 */
+	inline size_t sample(Float sampleValue, Float &pdf) const {
+		size_t index = sample(sampleValue);
+		pdf = m_pmf[index];
+		return index;
+	}
+
+	/**
+	 * \brief %Transform a uniformly distributed sample to the stored distribution
+	 *
+	 * The original sample is value adjusted so that it can be "reused".
+	 *
+	 * \param[in, out] sampleValue
+	 *     An uniformly distributed sample on [0,1]
+	 * \return
+	 *     The discrete index associated with the sample
+	 */
+	inline size_t sampleReuse(Float &sampleValue) const {
+		if (m_table.empty())
+			return m_cdf.sampleReuse(sampleValue);
+		double scaled = (double) sampleValue * m_table.size();
+		uint32_t column = (uint32_t) std::min((double) (m_table.size() - 1), scaled);
+		const Entry &entry = m_table[column];
+		Float offset = std::min((Float) (scaled - column), ONE_MINUS_EPS);
+		if (entry.prob >= 1) {
+			sampleValue = offset;
+			return column;
+		} else if (offset < entry.prob) {
+			sampleValue = offset / entry.prob;
+			return column;
+		} else {
+			sampleValue = (offset - entry.prob) / (1 - entry.prob);
+			return entry.index;
+		}
+	}
+
+	/**
+	 * \brief %Transform a uniformly distributed sample.
+	 *
+	 * The original sample is value adjusted so that it can be "reused".
+	 *
+	 * \param[in,out]
+	 *     An uniformly distributed sample on [0,1]
+	 * \param[out] pdf
+	 *     Probability value of the sample
+	 * \return
+	 *     The discrete index associated with the sample
+	 */
+	inline size_t sampleReuse(Float &sampleValue, Float &pdf) const {
+		size_t index = sampleReuse(sampleValue);
+		pdf = m_pmf[index];
+		return index;
+	}
+
+	/**
+	 * \brief Turn the underlying distribution into a
+	 * human-readable string format
+	 */
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "AliasDistribution[sum=" << m_sum << ", normalized="
+			<< (int) m_normalized << ", aliasTable=" << (int) usesAliasTable()
+			<< ", pmf={";
+		for (size_t i=0; i<m_pmf.size(); ++i) {
+			oss << m_pmf[i];
+			if (i != m_pmf.size()-1)
+				oss << ", ";
+		}
+		oss << "}]";
+		return oss.str();
+	}
+private:
+	/// Create the alias table from the normalized PMF (Vose's method)
+	void buildTable() {
+		SAssert(m_pmf.size() < (size_t) std::numeric_limits<uint32_t>::max());
+		uint32_t size = (uint32_t) m_pmf.size();
+		m_table.resize(size);
+
+		/* Entries with too little probability mass are stored at the
+		   front of 'work', and ones with too much mass at the back */
+		std::vector<uint32_t> work(size);
+		uint32_t smallCount = 0, largeStart = size, positive = size;
+		for (uint32_t i=0; i<size; ++i) {
+			Float value = (Float) ((double) m_pmf[i] * size);
+			m_table[i].prob = value;
+			m_table[i].index = i;
+			if (value < 1)
+				work[smallCount++] = i;
+			else
+				work[--largeStart] = i;
+			if (m_pmf[i] > 0)
+				positive = i;
+		}
+
+		/* Fill up the small entries using mass from the large ones */
+		uint32_t smallPos = 0;
+		while (smallPos < smallCount && largeStart < size) {
+			uint32_t large = work[largeStart++];
+			double prob = m_table[large].prob;
+			while (prob >= 1 && smallPos < smallCount) {
+				uint32_t small = work[smallPos++];
+				m_table[small].index = large;
+				prob -= 1 - (double) m_table[small].prob;
+			}
+			m_table[large].prob = (Float) prob;
+			if (prob < 1) {
+				/* The large entry has now become a small one. 'work' has
+				   room for it since all earlier small entries were used. */
+				work[--smallPos] = large;
+			} else {
+				work[--largeStart] = large;
+				break;
+			}
+		}
+
+		/* Remaining entries are (up to roundoff) exactly full */
+		for (uint32_t i=smallPos; i<smallCount; ++i) {
+			Entry &entry = m_table[work[i]];
+			if (m_pmf[work[i]] > 0) {
+				entry.prob = 1.0f;
+			} else {
+				entry.prob = 0.0f;
+				entry.index = positive;
+			}
+		}
+		for (uint32_t i=largeStart; i<size; ++i)
+			m_table[work[i]].prob = 1.0f;
+	}
+
+	std::vector<Float> m_pmf;
+	std::vector<Entry> m_table;
+	DiscreteDistribution m_cdf;
+	Float m_sum, m_normalization;
+	bool m_normalized;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_CORE_PMF_H_ */
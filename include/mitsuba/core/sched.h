@@ -22,13 +22,18 @@
 
 #include <mitsuba/core/serialization.h>
 #include <mitsuba/core/lock.h>
+#include <atomic>
 #include <deque>
+#include <mutex>
 
 /**
  * Uncomment this to enable scheduling debug messages
  */
 //#define DEBUG_SCHED 1
 
+/// Number of work units a local worker generates at once in work-stealing mode
+#define MTS_SCHED_STEAL_BATCH 4
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -345,6 +350,15 @@ class Worker;
  * units from the scheduler, which are then executed on the current machine
  * or sent to remote nodes over a network connection.
  *
+ * By default, every worker acquires its work units one at a time from a
+ * central queue that is protected by the scheduler mutex. With many local
+ * workers and small work units, they spend a noticeable amount of time
+ * waiting on that mutex. In work-stealing mode (see \ref setWorkStealing()),
+ * every local worker instead generates \ref MTS_SCHED_STEAL_BATCH work units
+ * at once into its own queue and processes them from there. Workers that run
+ * out of work take units from the other queues before waiting. Remote workers
+ * are not affected.
+ *
  * \ingroup libcore
  * \ingroup libpython
  */
@@ -480,6 +494,37 @@ public:
 	/// Is the scheduler currently executing work?
 	bool isBusy() const;
 
+	/**
+	 * \brief Enable or disable work stealing between local workers
+	 *
+	 * Can only be changed while the scheduler is not running.
+	 */
+	void setWorkStealing(bool enabled);
+
+	/// Do local workers steal work units from each other?
+	inline bool getWorkStealing() const { return m_workStealing; }
+
+	/// Statistics of a single worker (see \ref getWorkerStatistics())
+	struct WorkerStatistics {
+		/// Name of the worker thread
+		std::string name;
+		/// Number of work units acquired
+		size_t workUnits;
+		/// Number of work units taken from another worker's queue
+		size_t steals;
+		/// Time spent acquiring work units in seconds (waiting for work or the scheduler lock)
+		Float idleTime;
+	};
+
+	/// Return the statistics of all workers since the last reset
+	std::vector<WorkerStatistics> getWorkerStatistics() const;
+
+	/// Return a human-readable summary of \ref getWorkerStatistics()
+	std::string getWorkerStatisticsString() const;
+
+	/// Reset the statistics of all workers
+	void resetWorkerStatistics();
+
 	/// Initialize the scheduler of this process -- called once in main()
 	static void staticInitialization();
 
@@ -497,8 +542,9 @@ public:
 		int inflight;
 		/* Is the parallel process still generating work */
 		bool morework;
-		/* Was the process cancelled using \c cancel()?*/
-		bool cancelled;
+		/* Was the process cancelled using \c cancel()? (also read
+		   without holding the lock in work-stealing mode) */
+		std::atomic<bool> cancelled;
 		/* Is the process currently in the queue? */
 		bool active;
 		/* Signaled every time a work unit arrives */
@@ -650,6 +696,33 @@ protected:
 
 	/// Announces the termination of a process
 	void signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec);
+
+	/// Work unit that has been generated in advance (work-stealing mode)
+	struct QueuedWorkUnit {
+		int id;
+		ref<WorkUnit> workUnit;
+	};
+
+	/// Queue of pre-generated work units owned by a local worker
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<QueuedWorkUnit> units;
+	};
+
+	/// May the given worker process work units of a process?
+	bool isWorkerInRange(const ProcessRecord *rec, int workerIndex) const;
+
+	/// Variant of \ref acquireWork() for local workers in work-stealing mode
+	EStatus acquireWorkStealing(Item &item);
+
+	/// Prepare \c item to process a pre-generated work unit
+	void beginQueuedWork(Item &item, QueuedWorkUnit &unit);
+
+	/// Remove the pre-generated work units of a process (the caller must hold \c m_mutex)
+	void discardQueuedWork(ProcessRecord *rec);
+
+	/// Create a queue for every local worker and move the pending work units into them
+	void rebuildWorkQueues();
 private:
 	/// Global scheduler instance
 	static ref<Scheduler> m_scheduler;
@@ -671,6 +744,9 @@ private:
 	bool m_running;
 	int m_nextWorkerOffset;
 	int m_maxWorkersPerProcess;
+	bool m_workStealing;
+	/// Work-stealing mode: queue of every worker (NULL for remote workers)
+	std::vector<WorkQueue *> m_workQueues;
 };
 
 /**
@@ -754,6 +830,9 @@ protected:
 	Scheduler::Item m_schedItem;
 	size_t m_coreCount;
 	bool m_isRemote;
+	/* Statistics (only written by the worker itself) */
+	std::atomic<size_t> m_statsWorkUnits, m_statsSteals;
+	std::atomic<int64_t> m_statsIdleTime;
 };
 
 /**
@@ -21,6 +21,8 @@
 #define __MITSUBA_CORE_SCHED_REMOTE_H_
 
 #include <mitsuba/core/sched.h>
+#include <memory>
+#include <list>
 #include <set>
 
 /// Default port of <tt>mtssrv</tt>
@@ -35,6 +37,14 @@
    continue sending batches of work units */
 #define MTS_CONTINUE_FACTOR 2
 
+/// Default memory budget of the resource chunk cache in MiB (see \ref ResourceChunkCache)
+#define MTS_CHUNKCACHE_DEFAULT_BUDGET 512
+
+/** Version of the messages exchanged between \ref RemoteWorker and \ref StreamBackend,
+   which must match when connecting. Increase it whenever the protocol changes
+   (1: chunked resource transfer, 0: all earlier releases) */
+#define MTS_REMOTE_PROTOCOL_VERSION 1
+
 MTS_NAMESPACE_BEGIN
 
 class RemoteWorkerReader;
@@ -77,9 +87,18 @@ protected:
 		m_inFlight--;
 		m_finishCond->signal();
 	}
+
+	/// Called by the reader thread when the answer to a chunk query arrives
+	inline void signalChunkQueryResult(std::vector<uint8_t> &missing) {
+		LockGuard lock(m_mutex);
+		m_chunkQuery.swap(missing);
+		m_chunkQueryPending = false;
+		m_chunkCond->signal();
+	}
 protected:
 	ref<Mutex> m_mutex;
 	ref<ConditionVariable> m_finishCond;
+	ref<ConditionVariable> m_chunkCond;
 	ref<MemoryStream> m_memStream;
 	ref<Stream> m_stream;
 	ref<RemoteWorkerReader> m_reader;
@@ -91,6 +110,14 @@ protected:
 	std::set<std::string> m_plugins;
 	std::string m_nodeName;
 	size_t m_inFlight;
+
+	/* Answer of the remote side to the last chunk query */
+	std::vector<uint8_t> m_chunkQuery;
+	bool m_chunkQueryPending;
+	/* Process that is sent once the chunk query is answered,
+	   and whether it was cancelled in the meantime */
+	int m_pendingProcess;
+	bool m_pendingCancelled;
 };
 
 /**
@@ -186,6 +213,98 @@ private:
 	bool m_done;
 };
 
+/**
+ * \brief Content-addressed cache of resource data on a processing node
+ *
+ * Before a \ref RemoteWorker transmits a resource, it splits the serialized
+ * resource into content-defined chunks (the chunk boundaries are found using
+ * a rolling hash, hence local edits only affect nearby chunks) and asks the
+ * remote side which of them it does not have yet. Only those are sent, in
+ * compressed form. Received chunks are kept in this cache, which is shared by
+ * all connections of a server process. Consequently, rendering a sequence of
+ * similar scenes (e.g. the frames of an animation) on a set of <tt>mtssrv</tt>
+ * nodes only transfers the scene data that actually changed.
+ *
+ * The least recently used chunks are evicted once the memory budget is
+ * exhausted. It can be set using \ref setMemoryBudget() or the
+ * <tt>-C</tt> parameter of <tt>mtssrv</tt> (in MiB, default: 512).
+ *
+ * \ingroup libcore
+ */
+class MTS_EXPORT_CORE ResourceChunkCache : public Object {
+public:
+	/// 128-bit content hash identifying a chunk
+	struct Key {
+		uint64_t h0, h1;
+
+		inline bool operator<(const Key &key) const {
+			return h0 < key.h0 || (h0 == key.h0 && h1 < key.h1);
+		}
+
+		inline bool operator==(const Key &key) const {
+			return h0 == key.h0 && h1 == key.h1;
+		}
+	};
+
+	/// Location and hash of a chunk within a resource stream
+	struct Chunk {
+		Key key;
+		size_t offset;
+		size_t size;
+	};
+
+	typedef std::shared_ptr<const std::vector<uint8_t> > ChunkPtr;
+
+	/// Return the cache of the current process
+	static ResourceChunkCache *getInstance();
+
+	/// Split a memory region into content-defined chunks
+	static void split(const uint8_t *data, size_t size, std::vector<Chunk> &chunks);
+
+	/// Compute the key of a chunk
+	static Key computeKey(const uint8_t *data, size_t size);
+
+	/// Look up a chunk (returns an empty pointer when it is not cached)
+	ChunkPtr get(const Key &key);
+
+	/// Insert a chunk into the cache
+	void put(const Key &key, const ChunkPtr &chunk);
+
+	/// Set the memory budget in bytes
+	void setMemoryBudget(size_t bytes);
+
+	/// Return the memory budget in bytes
+	inline size_t getMemoryBudget() const { return m_budget; }
+
+	/// Return the memory occupied by the cached chunks
+	inline size_t getMemoryUsage() const { return m_memoryUsage; }
+
+	/// Remove all chunks from the cache
+	void clear();
+
+	/// Return a human-readable string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	typedef std::list<std::pair<Key, ChunkPtr> > ChunkList;
+
+	/// Create a cache with the given memory budget
+	ResourceChunkCache(size_t budget);
+
+	/// Virtual destructor
+	virtual ~ResourceChunkCache();
+
+	/// Evict chunks until the budget is met (the caller must hold \c m_mutex)
+	void evict();
+private:
+	ref<Mutex> m_mutex;
+	ChunkList m_chunks;
+	std::map<Key, ChunkList::iterator> m_index;
+	size_t m_budget;
+	size_t m_memoryUsage;
+};
+
 /**
  * \brief Network processing communication backend
  *
@@ -233,6 +352,9 @@ protected:
 		EResourceExpired,
 		EQuit,
 		EIncompatible,
+		EQueryChunks,
+		EChunkQueryResult,
+		ENewChunkedResource,
 		EHello = 0x1bcd
 	};
 
@@ -241,6 +363,7 @@ protected:
 	virtual void run();
 	void sendWorkResult(int id, const WorkResult *result, bool cancelled);
 	void sendCancellation(int id, int numLost);
+	void sendChunkQueryResult(const std::vector<uint8_t> &missing);
 private:
 	Scheduler *m_scheduler;
 	std::string m_nodeName;
@@ -248,6 +371,8 @@ private:
 	ref<MemoryStream> m_memStream;
 	std::map<int, RemoteProcess *> m_processes;
 	std::map<int, int> m_resources;
+	/* Cached chunks referenced by the last chunk query */
+	std::map<ResourceChunkCache::Key, ResourceChunkCache::ChunkPtr> m_queriedChunks;
 	ref<Mutex> m_sendMutex;
 	bool m_detach;
 };
@@ -100,6 +100,21 @@ namespace math {
 		return _mm_max_ps(_mm_min_ps(x, maxVal), minVal);
 	}
 
+	/// Component-wise absolute value
+	inline __m128 abs_ps(__m128 x) {
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+	}
+
+	/// Component-wise signum function (returns the FP sign, never zero)
+	inline __m128 signum_ps(__m128 x) {
+		return _mm_or_ps(_mm_and_ps(_mm_set1_ps(-0.0f), x), _mm_set1_ps(1.0f));
+	}
+
+	/// Component-wise square root that returns zero for negative arguments
+	inline __m128 safe_sqrt_ps(__m128 x) {
+		return _mm_sqrt_ps(_mm_max_ps(x, _mm_setzero_ps()));
+	}
+
 	/// Sum of all elements in the vector
 	inline float hsum_ps(__m128 vec) {
 		__m128 tmp = _mm_shuffle_ps(vec, vec,  _MM_SHUFFLE(1,0,3,2));
@@ -65,6 +65,21 @@ enum EStatsType {
 #define MTS_32BIT_COUNTERS 1
 #endif
 
+/**
+ * When defined, every thread owns one of the \ref NUM_COUNTERS slots of each
+ * counter and increments it without atomic read-modify-write operations. The
+ * last slot is shared (and updated atomically) by all threads that are started
+ * while the other slots are taken. Define \c MTS_HASHED_STATISTICS to instead
+ * select the slot by hashing \ref Thread::getID(), which lets threads whose
+ * identifiers collide contend for the same cache line.
+ */
+#if !defined(MTS_HASHED_STATISTICS) && !defined(MTS_32BIT_COUNTERS)
+#define MTS_PER_THREAD_STATISTICS 1
+#endif
+
+/// Index of the counter slot shared by threads without a slot of their own
+#define MTS_STATS_SHARED_SLOT (NUM_COUNTERS-1)
+
 /**
  * \brief Counter data structure, which is suitable for ccNUMA/SMP machines
  *
@@ -110,48 +125,17 @@ public:
 
 	/// Increment the counter value by one
 	inline uint64_t operator++() {
-#if defined(MTS_NO_STATISTICS)
-		// do nothing
-		return 0;
-#elif defined(_MSC_VER) && defined(_WIN64)
-		const int offset = Thread::getID() & NUM_COUNTERS_MASK;
-		_InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_value[offset].value), 1);
-		return m_value[offset].value;
-#elif defined(_MSC_VER) && defined(_WIN32)
-		const int offset = Thread::getID() & NUM_COUNTERS_MASK;
-		_InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_value[offset].value), 1);
-		return m_value[offset].value;
-#elif defined(__POWERPC__) && !defined(_LP64)
-		return (uint64_t) __sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, 1);
-#else
-		return __sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, 1);
-#endif
+		return add(m_value, 1);
 	}
 
 	/// Increment the counter by the specified amount
 	inline void operator+=(size_t amount) {
-#ifdef MTS_NO_STATISTICS
-		/// do nothing
-#elif defined(_MSC_VER) && defined(_WIN64)
-		_InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
-#elif defined(_MSC_VER) && defined(_WIN32)
-		_InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
-#else
-		__sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, amount);
-#endif
+		add(m_value, amount);
 	}
 
 	/// Increment the base counter by the specified amount (only for use with EPercentage/EAverage)
 	inline void incrementBase(size_t amount = 1) {
-#ifdef MTS_NO_STATISTICS
-		/// do nothing
-#elif defined(_MSC_VER) && defined(_WIN64)
-		_InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
-#elif defined(_WIN32)
-		_InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
-#else
-		__sync_fetch_and_add(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value, amount);
-#endif
+		add(m_base, amount);
 	}
 
 	/**
@@ -159,7 +143,17 @@ public:
 	 * an observation of the quantity whose minimum is to be determined
 	 */
 	inline void recordMinimum(size_t value) {
+#if defined(MTS_PER_THREAD_STATISTICS)
+		const int slot = getSlot();
+		if (EXPECT_TAKEN(slot != MTS_STATS_SHARED_SLOT)) {
+			if ((int64_t) value < (int64_t) loadRelaxed(m_value[slot].value))
+				storeRelaxed(m_value[slot].value, value);
+			return;
+		}
+		int id = slot;
+#else
 		int id = Thread::getID() & NUM_COUNTERS_MASK;
+#endif
 		#if MTS_32BIT_COUNTERS == 1
 			volatile int32_t *ptr =
 				(volatile int32_t *) &m_value[id].value;
@@ -187,7 +181,17 @@ public:
 	 * an observation of the quantity whose maximum is to be determined
 	 */
 	inline void recordMaximum(size_t value) {
+#if defined(MTS_PER_THREAD_STATISTICS)
+		const int slot = getSlot();
+		if (EXPECT_TAKEN(slot != MTS_STATS_SHARED_SLOT)) {
+			if ((int64_t) value > (int64_t) loadRelaxed(m_value[slot].value))
+				storeRelaxed(m_value[slot].value, value);
+			return;
+		}
+		int id = slot;
+#else
 		int id = Thread::getID() & NUM_COUNTERS_MASK;
+#endif
 		#if MTS_32BIT_COUNTERS == 1
 			volatile int32_t *ptr =
 				(volatile int32_t *) &m_value[id].value;
@@ -210,6 +214,19 @@ public:
 		} while (!atomicCompareAndExchange(ptr, newMaximum, curMaximum));
 	}
 
+	/**
+	 * \brief Return the counter slot owned by the calling thread
+	 *
+	 * A slot is assigned on the first call and returned to the pool when
+	 * the thread exits. The values accumulated in a slot are kept, so that
+	 * the counter sums remain correct. Returns \ref MTS_STATS_SHARED_SLOT
+	 * when all other slots are taken.
+	 */
+	static int getSlot();
+
+	/// Return the number of threads that currently own a counter slot
+	static int getSlotCount();
+
 	/// Return the name of this counter
 	inline const std::string &getName() const { return m_name; }
 
@@ -269,6 +286,57 @@ public:
 	/// Sorting by name (for the statistics)
 	bool operator<(const StatsCounter &v) const;
 private:
+#if MTS_32BIT_COUNTERS == 1
+	typedef uint32_t ValueType;
+#else
+	typedef uint64_t ValueType;
+#endif
+
+	/// Read a slot that may concurrently be written by its owner
+	static inline ValueType loadRelaxed(const ValueType &value) {
+#if defined(__GNUC__)
+		return __atomic_load_n(&value, __ATOMIC_RELAXED);
+#else
+		return *((const volatile ValueType *) &value);
+#endif
+	}
+
+	/// Write a slot that may concurrently be read by other threads
+	static inline void storeRelaxed(ValueType &target, uint64_t value) {
+#if defined(__GNUC__)
+		__atomic_store_n(&target, (ValueType) value, __ATOMIC_RELAXED);
+#else
+		*((volatile ValueType *) &target) = (ValueType) value;
+#endif
+	}
+
+	/// Add to the calling thread's slot and return its previous value
+	static inline uint64_t add(CacheLineCounter *counters, size_t amount) {
+#if defined(MTS_NO_STATISTICS)
+		// do nothing
+		return 0;
+#else
+	#if defined(MTS_PER_THREAD_STATISTICS)
+		const int offset = getSlot();
+		if (EXPECT_TAKEN(offset != MTS_STATS_SHARED_SLOT)) {
+			/* Only the owning thread writes to this slot */
+			const uint64_t value = loadRelaxed(counters[offset].value);
+			storeRelaxed(counters[offset].value, value + amount);
+			return value;
+		}
+	#else
+		const int offset = Thread::getID() & NUM_COUNTERS_MASK;
+	#endif
+	#if defined(_MSC_VER) && defined(_WIN64)
+		return (uint64_t) _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&counters[offset].value), (__int64) amount);
+	#elif defined(_MSC_VER) && defined(_WIN32)
+		return (uint64_t) _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&counters[offset].value), (long) amount);
+	#else
+		return (uint64_t) __sync_fetch_and_add(&counters[offset].value, (ValueType) amount);
+	#endif
+#endif
+	}
+
 	std::string m_category;
 	std::string m_name;
 	EStatsType m_type;
@@ -330,8 +398,8 @@ private:
 /** \brief Collects various rendering statistics and presents them
  * in a human-readable form.
  *
- * \remark Only the \ref getInstance(), \ref getStats(), and
- * \ref printStats() functions are implemented in the Python bindings.
+ * \remark Only the \ref getInstance(), \ref getStats(), \ref getStatsJSON()
+ * and \ref printStats() functions are implemented in the Python bindings.
  *
  * \ingroup libcore
  * \ingroup libpython
@@ -353,6 +421,36 @@ public:
 	/// Return a string containing gathered statistics
 	std::string getStats();
 
+	/**
+	 * \brief Return a snapshot of the gathered statistics in JSON format
+	 *
+	 * The snapshot is a single line containing an object with the time in
+	 * seconds since the statistics collector was created (\c "time"), the
+	 * loaded plugins (\c "plugins") and the raw values of all counters
+	 * (\c "counters"). Every counter entry lists its \c "category",
+	 * \c "name", \c "type" and \c "value", as well as \c "base" for
+	 * percentages and averages. Unlike \ref getStats(), counters that are
+	 * still zero are included, so that successive snapshots can be compared
+	 * entry by entry.
+	 *
+	 * The values are read while other threads may still be updating them,
+	 * hence a snapshot taken during a render is not an atomic cut.
+	 */
+	std::string getStatsJSON();
+
+	/**
+	 * \brief Periodically append snapshots to a file
+	 *
+	 * Starts a background thread that appends the output of \ref
+	 * getStatsJSON() as a separate line to the given file every
+	 * \c intervalMs milliseconds (and once more when recording stops).
+	 * An earlier recording is stopped first.
+	 */
+	void startRecording(const fs::pathstr &filename, int intervalMs = 1000);
+
+	/// Stop a recording started by \ref startRecording()
+	void stopRecording();
+
 	/// Reset all statistics counters
 	void resetAll();
 
@@ -367,7 +465,7 @@ protected:
 	/// Create a statistics instance
 	Statistics();
 	/// Virtual destructor
-	virtual ~Statistics() { }
+	virtual ~Statistics();
 private:
 	struct compareCategory {
 		bool operator()(const StatsCounter *c1, const StatsCounter *c2) {
@@ -381,6 +479,8 @@ private:
 	std::vector<const StatsCounter *> m_counters;
 	std::vector<std::pair<std::string, std::string> > m_plugins;
 	ref<Mutex> m_mutex;
+	ref<Timer> m_timer;
+	ref<Thread> m_recorder;
 };
 
 MTS_NAMESPACE_END
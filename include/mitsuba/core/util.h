@@ -136,6 +136,14 @@ extern MTS_EXPORT_CORE size_t getTotalSystemMemory();
 /// Return the fully qualified domain name of this machine
 extern MTS_EXPORT_CORE std::string getFQDN();
 
+/**
+ * \brief Compute a 64-bit non-cryptographic hash of a memory region
+ *
+ * Intended for content-based cache keys. Larger keys can be
+ * assembled by passing the previous result as \c seed.
+ */
+extern MTS_EXPORT_CORE uint64_t hashBuffer(const void *ptr, size_t size, uint64_t seed = 0);
+
 /**
  * \brief Enable floating point exceptions (to catch NaNs, overflows,
  * arithmetic with infinity).
@@ -0,0 +1,120 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_CORE_WORKERPOOL_H_)
+#define __MITSUBA_CORE_WORKERPOOL_H_
+
+#include <mitsuba/mitsuba.h>
+#include <functional>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Pool of persistent, parked worker threads
+ *
+ * Interactive renderers restart their workers whenever the camera or the
+ * scene changes. Spawning a \ref Thread per restart pays for thread
+ * creation, affinity setup and thread-local storage initialization each
+ * time. The workers of this pool are created once and then parked on a
+ * condition variable between runs; a restart merely bumps a generation
+ * counter and wakes them up. Thread-local state (e.g. \ref ThreadLocal
+ * caches of integrators) survives across generations.
+ *
+ * The pool also measures the restart latency: the time from a call to
+ * \ref run() until all workers are awake, and the time until the first
+ * worker reports a sample via \ref notifyFirstSample().
+ *
+ * \ingroup libcore
+ */
+class MTS_EXPORT_CORE WorkerPool : public Object {
+public:
+	/// Task executed by each worker, receives the worker index
+	typedef std::function<void (int)> Task;
+
+	/**
+	 * \brief Create a new (empty) worker pool
+	 *
+	 * \param name
+	 *    Name prefix of the worker threads (shown in debug messages)
+	 * \param maxWorkers
+	 *    Maximum number of workers. The threads are spawned lazily
+	 *    on the first call to \ref run() that needs them.
+	 * \param coreAffinity
+	 *    Pin worker \c i to core \c i?
+	 */
+	WorkerPool(const std::string &name, int maxWorkers, bool coreAffinity = false);
+
+	/**
+	 * \brief Run \c task on \c workerCount workers and wait for completion
+	 *
+	 * Worker \c i invokes <tt>task(i)</tt>. A negative count uses all
+	 * workers of the pool. Exceptions thrown by the task are caught in the
+	 * worker and the first one is rethrown here once all workers are done.
+	 */
+	void run(const Task &task, int workerCount = -1);
+
+	/**
+	 * \brief Record that a worker produced its first sample
+	 *
+	 * Can be called from any worker at any time; only the first call of
+	 * the current generation is used to measure the restart latency.
+	 *
+	 * \return \c true if this was the first call of the current generation
+	 */
+	bool notifyFirstSample();
+
+	/// Return the maximum number of workers
+	inline int getMaxWorkers() const { return m_maxWorkers; }
+
+	/// Return the number of worker threads spawned so far
+	int getWorkerCount() const;
+
+	/// Return the number of runs so far
+	uint64_t getGeneration() const;
+
+	/// Return the time (ms) from the last restart until all workers were awake
+	Float getWakeupLatency() const;
+
+	/**
+	 * \brief Return the time (ms) from the last restart until the first
+	 * sample was reported, or a negative value if none was reported yet
+	 */
+	Float getFirstSampleLatency() const;
+
+	/// Return the worst first-sample latency (ms) over all restarts
+	Float getMaxFirstSampleLatency() const;
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Wakes up and joins all workers
+	virtual ~WorkerPool();
+private:
+	struct WorkerPoolPrivate;
+	class Worker;
+
+	std::unique_ptr<WorkerPoolPrivate> d;
+	int m_maxWorkers;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_CORE_WORKERPOOL_H_ */
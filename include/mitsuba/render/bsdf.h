@@ -192,6 +192,77 @@ public:
 	int sampledComponent;
 };
 
+/**
+ * \brief Structure-of-arrays description of a batch of BSDF queries
+ *
+ * This is the batched counterpart of \ref BSDFSamplingRecord, which is
+ * used by \ref BSDF::evalBatch(), \ref BSDF::pdfBatch() and
+ * \ref BSDF::sampleBatch(). Integrators that process many surface
+ * interactions at once (e.g. wavefront-style renderers) can use it to
+ * amortize the virtual function call and texture lookup overheads, and
+ * BSDF implementations can override the batched methods to evaluate
+ * several queries at once using SIMD instructions.
+ *
+ * The directions are given in the local coordinate system of the
+ * respective intersection and are stored as separate arrays per
+ * coordinate. The \c wo arrays are inputs for evaluation and outputs
+ * when sampling. The remaining parameters apply to all queries.
+ *
+ * \ingroup librender
+ */
+struct MTS_EXPORT_RENDER BSDFQueryBatch {
+public:
+	/// Create an empty query batch (all queries evaluate all components)
+	inline BSDFQueryBatch();
+
+	/// Create a BSDF sampling record referring to the query with index \c i
+	inline BSDFSamplingRecord getRecord(size_t i) const;
+
+	/// Store the sampled direction and component of the query with index \c i
+	inline void putRecord(size_t i, const BSDFSamplingRecord &bRec) const;
+
+	/// Return a string representation
+	std::string toString() const;
+public:
+	/// Number of queries
+	size_t size;
+
+	/// Pointers to the underlying surface interactions (one per query)
+	const Intersection * const *its;
+
+	/**
+	 * \brief Pointer to a \ref Sampler instance (optional).
+	 *
+	 * Used by BSDF implementations that need more than the supplied
+	 * 2D samples (see \ref BSDFSamplingRecord::sampler)
+	 */
+	Sampler *sampler;
+
+	/// Incident directions in local coordinates
+	const Float *wiX, *wiY, *wiZ;
+
+	/// Outgoing directions in local coordinates
+	Float *woX, *woY, *woZ;
+
+	/// Relative index of refraction in the sampled direction (optional output)
+	Float *eta;
+
+	/// Component types sampled by \ref BSDF::sampleBatch() (optional output)
+	unsigned int *sampledType;
+
+	/// Component indices sampled by \ref BSDF::sampleBatch() (optional output)
+	int *sampledComponent;
+
+	/// Transported mode (radiance or importance)
+	ETransportMode mode;
+
+	/// Bit mask containing the requested BSDF component types
+	unsigned int typeMask;
+
+	/// Requested BSDF component index (-1: all components)
+	int component;
+};
+
 
 /**
  * \brief Abstract %BSDF base-class.
@@ -440,6 +511,64 @@ public:
 	virtual Float pdf(const BSDFSamplingRecord &bRec,
 		EMeasure measure = ESolidAngle) const = 0;
 
+	/**
+	 * \brief Evaluate the BSDF for a batch of queries
+	 *
+	 * Equivalent to calling \ref eval() for each query of the batch.
+	 * The default implementation does exactly that; BSDFs can override
+	 * it with a vectorized version.
+	 *
+	 * \param batch
+	 *     Description of the queries
+	 * \param result
+	 *     Array with <tt>batch.size</tt> entries that will receive
+	 *     the BSDF values
+	 * \param measure
+	 *     Specifies the measure of the component (see \ref eval())
+	 */
+	virtual void evalBatch(const BSDFQueryBatch &batch, Spectrum *result,
+		EMeasure measure = ESolidAngle) const;
+
+	/**
+	 * \brief Compute the sampling density for a batch of queries
+	 *
+	 * Equivalent to calling \ref pdf() for each query of the batch.
+	 *
+	 * \param batch
+	 *     Description of the queries
+	 * \param result
+	 *     Array with <tt>batch.size</tt> entries that will receive
+	 *     the probability densities
+	 * \param measure
+	 *     Specifies the measure of the component (see \ref pdf())
+	 */
+	virtual void pdfBatch(const BSDFQueryBatch &batch, Float *result,
+		EMeasure measure = ESolidAngle) const;
+
+	/**
+	 * \brief Importance sample the BSDF for a batch of queries
+	 *
+	 * Equivalent to calling <tt>sample(bRec, pdf, sample)</tt> for
+	 * each query of the batch. The sampled directions are written to
+	 * the \c wo arrays of the batch, and the sampled index of refraction
+	 * and component to the respective arrays (if present). These outputs
+	 * are unspecified for failed samples.
+	 *
+	 * \param batch
+	 *     Description of the queries
+	 * \param sample
+	 *     Array with one uniformly distributed 2D sample per query
+	 * \param weight
+	 *     Array that will receive the sample weights (i.e. the BSDF
+	 *     value divided by the probability density, multiplied by the
+	 *     cosine foreshortening factor). Zero denotes a failed sample.
+	 * \param pdf
+	 *     Optional array that will receive the probability densities
+	 *     (zero for failed samples)
+	 */
+	virtual void sampleBatch(const BSDFQueryBatch &batch, const Point2 *sample,
+		Spectrum *weight, Float *pdf = NULL) const;
+
 	/**
 	 * \brief For transmissive BSDFs: return the material's
 	 * relative index of refraction
@@ -362,6 +362,13 @@ public:
 	/// Return the shape, to which the emitter is currently attached (const version)
 	inline const Shape *getShape() const { return m_shape; }
 
+	/**
+	 * \brief Recompute quantities that depend on the attached shape
+	 * (e.g. the emitted power), after it was transformed using
+	 * \ref Shape::applyTransform(). The default implementation does nothing.
+	 */
+	virtual void updateShape();
+
 	/**
 	 * \brief Create a special shape that represents the emitter
 	 *
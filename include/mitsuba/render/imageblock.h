@@ -30,6 +30,8 @@
 
 MTS_NAMESPACE_BEGIN
 
+class SplatTiles;
+
 /**
  * \brief Storage for an image sub-block (a.k.a render bucket)
  *
@@ -61,6 +63,16 @@ public:
 	ImageBlock(Bitmap::EPixelFormat fmt, const Vector2i &size,
 			const ReconstructionFilter *filter = NULL, int channels = -1, bool warn = true);
 
+	/**
+	 * \brief Construct a per-thread view of a shared image block that
+	 * defers atomic splats
+	 *
+	 * The view shares the bitmap of \c target. Calls to \ref putAtomic()
+	 * are redirected to slot \c slot of \c tiles, which merges them into
+	 * the shared bitmap without contention (see \ref SplatTiles).
+	 */
+	ImageBlock(ImageBlock *target, SplatTiles *tiles, int slot);
+
 	/// Set the current block offset
 	inline void setOffset(const Point2i &offset) { m_offset = offset; }
 
@@ -106,6 +118,17 @@ public:
 	/// Clear everything to zero
 	inline void clear() { m_bitmap->clear(); }
 
+	/// Return the deferred splat storage of a per-thread view (or \c NULL)
+	inline SplatTiles *getSplatTiles() { return m_splatTiles; }
+
+	/**
+	 * \brief Merge deferred splats of this view into the shared bitmap
+	 * if a flush was requested, does nothing for regular blocks
+	 *
+	 * Must be called by the thread owning the view.
+	 */
+	void syncSplats();
+
 	/// Accumulate another image block into this one
 	inline void put(const ImageBlock *block) {
 		m_bitmap->accumulate(block->getBitmap(),
@@ -221,6 +244,9 @@ public:
 	}
 #ifndef MTS_NO_ATOMIC_SPLAT
 	FINLINE bool putAtomic(const Point2 &_pos, const Float *aligned_value) {
+		if (m_splatTiles)
+			return putDeferred(_pos, aligned_value);
+
 		const int channels = m_bitmap->getChannelCount();
 
 		/* Check if all sample values are valid */
@@ -348,6 +374,9 @@ public:
 protected:
 	/// Virtual destructor
 	virtual ~ImageBlock();
+
+	/// Redirect a splat to the deferred splat storage
+	bool putDeferred(const Point2 &pos, const Float *value);
 protected:
 	ref<Bitmap> m_bitmap;
 	Point2i m_offset;
@@ -356,6 +385,8 @@ protected:
 	const ReconstructionFilter *m_filter;
 	Float *m_weightsX, *m_weightsY;
 	bool m_warn;
+	ref<SplatTiles> m_splatTiles;
+	int m_splatSlot;
 };
 
 
@@ -23,6 +23,9 @@
 #include <mitsuba/core/object.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/render/shape.h>
+#include <mitsuba/core/atomic.h>
+#include <atomic>
+#include <memory>
 
 MTS_NAMESPACE_BEGIN
 
@@ -91,6 +94,22 @@ public:
 	*/
 	virtual char const* getRealtimeStatistics();
 
+	/**
+	 * \brief Does the integrator take more samples in some pixels than in others?
+	 *
+	 * The framebuffers then need a weight channel (e.g. \ref Bitmap::ESpectrumAlphaWeight),
+	 * which normalizes every pixel by its own sample count. False by default.
+	 */
+	virtual bool isAdaptive() const;
+
+	/**
+	 * \brief Discard the state gathered while rendering (e.g. per-pixel error estimates).
+	 *
+	 * Called whenever the framebuffers are cleared to restart rendering;
+	 * the default implementation does nothing.
+	 */
+	virtual void reset();
+
 	MTS_DECLARE_CLASS()
 
 	/// Create a integrator
@@ -100,10 +119,26 @@ public:
 };
 
 /** \brief Abstract base class, which describes integrators scheduled per pixel.
+ *
+ * By default, every pixel receives one sample per sampling round. When the
+ * \c adaptive property is set, the relative standard error of every pixel's
+ * mean luminance is tracked instead (see \ref recordSample()). Once a pixel
+ * has received \c adaptiveMinSpp samples (default: 16), it is skipped as long
+ * as the errors in its 3x3 neighborhood stay below \c adaptiveThreshold
+ * (default: 0.05), which steers the samples towards the noisy regions. Rendering stops when the mean error over all pixels reaches
+ * \c adaptiveErrorTarget (default and minimum: equal to the threshold). Adaptive sampling
+ * requires framebuffers with a weight channel; otherwise it is disabled.
+ * It is opt-in for derived classes: only those that call \ref recordSample()
+ * for every sample override \ref isAdaptive() to return \c m_adaptive; for
+ * all others, the \c adaptive property is ignored.
+ *
  * \ingroup librender
  */
 class MTS_EXPORT_RENDER ImageOrderIntegrator : public ResponsiveIntegrator {
 public:
+	/// Return code of \ref render() when the adaptive error target has been reached
+	static const int EErrorTargetReached = 102;
+
 	/**
 	 * \brief Render the scene as seen by the given sensor (or default sensor, for some path-space algorithms).
 	 */
@@ -116,6 +151,13 @@ public:
 	int render(const Scene &scene, const Sensor &sensor, Sampler &sampler, ImageBlock& target
 		, Controls controls, int threadIdx, int threadCount) override;
 
+	// error estimates of adaptive sampling
+	char const* getRealtimeStatistics() override;
+	void reset() override;
+
+	/// Return the mean relative error over all pixels (adaptive sampling only)
+	inline Float getAdaptiveError() const { return m_adaptiveError; }
+
 	MTS_DECLARE_CLASS()
 
 	/// Create a integrator
@@ -124,13 +166,50 @@ public:
 	virtual ~ImageOrderIntegrator();
 
 protected:
+	/// Sums over the samples taken in a pixel
+	struct PixelMoments {
+		float sum, sumSqr, count;
+	};
+
 	/**
 	 * \brief Actual render loop, for derived classes to call with additional data.
 	 */
 	int render(const Scene &scene, const Sensor &sensor, Sampler &sampler, ImageBlock& target
 		, Controls controls, int threadIdx, int threadCount, void* userData);
 
+	/**
+	 * \brief Record the value of a sample for adaptive sampling.
+	 * Derived classes that report \ref isAdaptive() must call this
+	 * for every sample taken in \ref render().
+	 */
+	inline void recordSample(const Point2i &pixel, const Spectrum &value) {
+		if (!m_adaptiveActive)
+			return;
+		PixelMoments &m = m_moments[pixel.y * m_resolution.x + pixel.x];
+		const float lum = (float) value.getLuminance();
+		if (!std::isfinite(lum))
+			return;
+		atomicAdd(&m.sum, lum);
+		atomicAdd(&m.sumSqr, lum * lum);
+		atomicAdd(&m.count, 1.0f);
+	}
+
+	/// Recompute the per-pixel convergence flags and the mean error
+	void updateAdaptiveState();
+
 	std::vector<int> m_pxPermutation;
+
+	/* Adaptive sampling */
+	bool m_adaptive, m_adaptiveActive;
+	Float m_adaptiveThreshold, m_adaptiveErrorTarget;
+	int m_adaptiveMinSpp;
+	Vector2i m_resolution;
+	std::vector<PixelMoments> m_moments;
+	std::vector<Float> m_pixelErrors;
+	std::unique_ptr<std::atomic<uint8_t>[]> m_converged;
+	std::atomic<bool> m_errorTargetReached;
+	Float m_adaptiveError, m_activeFraction;
+	char m_statisticsBuffer[128];
 };
 
 struct PixelSample {
@@ -172,6 +251,9 @@ public:
 	int render(SamplingIntegrator& threadLocalIntegrator, const Scene &scene, const Sensor &sensor, Sampler &sampler
 		, ImageBlock& target, Point2i pixel, int threadIdx, int threadCount);
 
+	// every sample is recorded, supports adaptive sampling
+	bool isAdaptive() const override;
+
 	MTS_DECLARE_CLASS()
 
 	/// Create a integrator
@@ -0,0 +1,166 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_LIGHTBVH_H_)
+#define __MITSUBA_RENDER_LIGHTBVH_H_
+
+#include <mitsuba/render/emitter.h>
+#include <mitsuba/core/aabb.h>
+#include <mitsuba/core/pmf.h>
+#include <unordered_map>
+
+/// Subtrees below this depth are split at the median instead of using the heuristic
+#define MTS_LIGHTBVH_MAXDEPTH 48
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Bounding volume hierarchy over the emitters of a scene, which
+ * enables spatially-aware emitter selection for direct illumination
+ *
+ * Every node stores the bounds of the emitters below it, a cone bounding
+ * their directions of emission, and their total sampling weight (see
+ * \ref Emitter::getSamplingWeight()). Given a reference point, a leaf is
+ * chosen by a random walk from the root, where each child is picked with
+ * a probability proportional to a conservative estimate of its contribution
+ * ("Importance Sampling of Many Lights with Adaptive Tree Splitting" by
+ * Conty Estevez and Kulla). The tree is built using the binned surface area
+ * orientation heuristic from the same paper.
+ *
+ * Emitters without finite bounds (e.g. environment or directional emitters)
+ * are kept outside of the tree and are chosen in proportion to their
+ * sampling weight.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER LightBVH : public Object {
+public:
+	/// Build a hierarchy over the given list of emitters
+	LightBVH(ref_vector<Emitter> &emitters);
+
+	/**
+	 * \brief Choose an emitter for direct illumination sampling
+	 *
+	 * \param p
+	 *    Reference point
+	 * \param n
+	 *    Surface normal at the reference point, or a zero vector if
+	 *    emitters on both sides of the point are relevant
+	 * \param sample
+	 *    A uniformly distributed sample on <tt>[0, 1]</tt>, which is
+	 *    rescaled to be reused in the same manner as
+	 *    \ref DiscreteDistribution::sampleReuse().
+	 * \param pdf
+	 *    Used to return the discrete probability of the chosen emitter
+	 * \return
+	 *    Index of the emitter in the list passed to the constructor,
+	 *    or <tt>(size_t) -1</tt> when no emitter can contribute to \c p
+	 */
+	size_t sampleReuse(const Point &p, const Normal &n,
+		Float &sample, Float &pdf) const;
+
+	/// Return the probability of choosing \c emitter in \ref sampleReuse()
+	Float pdf(const Point &p, const Normal &n, const Emitter *emitter) const;
+
+	/// Return the number of tree nodes
+	inline size_t getNodeCount() const { return m_nodes.size(); }
+
+	/// Return the number of emitters that were not placed in the tree
+	inline size_t getInfiniteEmitterCount() const { return m_infinite.size(); }
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Cone of directions: an axis and the cosine of the half-angle
+	struct DirectionCone {
+		Vector axis;
+		Float cosTheta;
+
+		inline DirectionCone() : axis(0.0f, 0.0f, 1.0f), cosTheta(1.0f) { }
+		inline DirectionCone(const Vector &axis, Float cosTheta)
+			: axis(axis), cosTheta(cosTheta) { }
+
+		/// Return a cone containing all directions
+		static inline DirectionCone entireSphere() {
+			return DirectionCone(Vector(0.0f, 0.0f, 1.0f), -1.0f);
+		}
+	};
+
+	struct Node {
+		/// Bounds of the emitters below this node
+		AABB aabb;
+		/// Cone bounding the surface normals of the emitters
+		DirectionCone normals;
+		/// Cosine of the maximal emission angle relative to a normal
+		Float cosThetaE;
+		/// Total sampling weight of the emitters
+		Float power;
+		/// Index of the parent node (the root refers to itself)
+		uint32_t parent;
+		/// Index of the right child (inner nodes) or of the emitter (leaves)
+		uint32_t data;
+		/// Is this a leaf node?
+		bool leaf;
+	};
+
+	/// Per-emitter information used during the build
+	struct BuildItem {
+		AABB aabb;
+		Point center;
+		DirectionCone normals;
+		Float power;
+		const Emitter *object;
+		uint32_t emitter;
+	};
+
+	virtual ~LightBVH() { }
+
+	/// Recursively build the subtree over <tt>items[start..end)</tt>
+	uint32_t build(std::vector<BuildItem> &items, size_t start,
+		size_t end, uint32_t parent, int depth);
+
+	/// Compute a cone bounding the normals of an area emitter
+	static DirectionCone computeNormalCone(Emitter *emitter);
+
+	/// Return the smallest cone that contains two given cones
+	static DirectionCone merge(const DirectionCone &a, const DirectionCone &b);
+
+	/// Measure of the directions emitted by a node (used by the build heuristic)
+	static Float orientationMeasure(const DirectionCone &cone, Float cosThetaE);
+
+	/// Conservative estimate of the contribution of a node to a reference point
+	Float importance(const Node &node, const Point &p, const Normal &n) const;
+private:
+	std::vector<Node> m_nodes;
+	/// Maps emitters in the tree to their leaf node
+	std::unordered_map<const Emitter *, uint32_t> m_leaves;
+	/// Maps the remaining emitters to their entry in \c m_infinite
+	std::unordered_map<const Emitter *, uint32_t> m_infiniteIndex;
+	/// Indices of the emitters that are not part of the tree
+	std::vector<uint32_t> m_infinite;
+	DiscreteDistribution m_infinitePDF;
+	/// Probability of choosing an emitter from \c m_infinite
+	Float m_infiniteProb;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_LIGHTBVH_H_ */
@@ -27,6 +27,7 @@
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/filesystem.h>
+#include <mitsuba/render/texcache.h>
 #include <fstream>
 
 MTS_NAMESPACE_BEGIN
@@ -40,6 +41,12 @@ MTS_NAMESPACE_BEGIN
 /// MIP map cache file version
 #define MTS_MIPMAP_CACHE_VERSION 0x01
 
+/// Version of MIP map cache files that store the levels as tiles
+#define MTS_MIPMAP_TILED_VERSION 0x02
+
+/// Tile size of tiled MIP map cache files (log2)
+#define MTS_MIPMAP_LOG_TILE_SIZE 6
+
 /// Make sure that the actual cache contents start on a cache line
 #define MTS_MIPMAP_CACHE_ALIGNMENT 64
 
@@ -77,6 +84,13 @@ enum EMIPFilterType {
  * Generating good mip maps is costly, and therefore this class provides
  * the means to cache them on disk if desired.
  *
+ * Alternatively, the MIP map can be stored as a \a tiled cache file (see
+ * \ref writeTiledFile()), in which every level is split into square tiles of
+ * 2^\ref MTS_MIPMAP_LOG_TILE_SIZE texels. A MIP map opened from such a file
+ * keeps no texture data of its own: tiles are loaded on demand during lookups
+ * and shared with all other tiled textures in the \ref TextureCache, which
+ * bounds the total memory use.
+ *
  * \tparam Value
  *    This class can be parameterized to yield MIP map classes for
  *    RGB values, color spectra, or just plain floats. This parameter
@@ -166,7 +180,7 @@ public:
 			Float maxValue = 1.0f,
 			Spectrum::EConversionIntent intent = Spectrum::EReflectance)
 		: m_pixelFormat(pixelFormat), m_bcu(bcu), m_bcv(bcv), m_filterType(filterType),
-		  m_weightLut(NULL), m_maxAnisotropy(maxAnisotropy) {
+		  m_weightLut(NULL), m_maxAnisotropy(maxAnisotropy), m_tileCache(NULL) {
 
 		/* Keep track of time */
 		ref<Timer> timer = new Timer();
@@ -310,6 +324,8 @@ public:
 	 *    Filename of a memory-mapped cache file that is used to keep
 	 *    MIP map data out of core, and to avoid having to load and
 	 *    downsample textures over and over again in subsequent Mitsuba runs.
+	 *    Tiled cache files are not mapped; their tiles are instead loaded
+	 *    through the \ref TextureCache.
 	 *
 	 * \param maxAnisotropy
 	 *    Denotes the highest tolerated anisotropy of the lookup
@@ -318,19 +334,15 @@ public:
 	 *    cache file that was previously created.
 	 */
 	TMIPMap(fs::pathstr cacheFilename, Float maxAnisotropy = 20.0f)
-			: m_weightLut(NULL), m_maxAnisotropy(maxAnisotropy) {
-		m_mmap = new MemoryMappedFile(cacheFilename);
-		uint8_t *mmapPtr = (uint8_t *) m_mmap->getData();
-		Log(EInfo, "Mapped MIP map cache file \"%s\" into memory (%s).", cacheFilename.s.c_str(),
-			memString(m_mmap->getSize()).c_str());
-
-		stats::mipStorage += m_mmap->getSize();
-
+			: m_weightLut(NULL), m_maxAnisotropy(maxAnisotropy), m_tileCache(NULL) {
 		/* Load the file header, and run some santity checks */
 		MIPMapHeader header;
-		memcpy(&header, mmapPtr, sizeof(MIPMapHeader));
+		ref<FileStream> fstream = new FileStream(cacheFilename, FileStream::EReadOnly);
+		fstream->read(&header, sizeof(MIPMapHeader));
+		fstream->close();
 		Assert(header.identifier[0] == 'M' && header.identifier[1] == 'I'
-			&& header.identifier[2] == 'P' && header.version == MTS_MIPMAP_CACHE_VERSION);
+			&& header.identifier[2] == 'P' && (header.version == MTS_MIPMAP_CACHE_VERSION
+			|| header.version == MTS_MIPMAP_TILED_VERSION));
 		m_pixelFormat = (Bitmap::EPixelFormat) header.pixelFormat;
 		m_levels = (int) header.levels;
 		m_bcu = (EBoundaryCondition) header.bcu;
@@ -344,14 +356,32 @@ public:
 		size_t padding = sizeof(MIPMapHeader) % MTS_MIPMAP_CACHE_ALIGNMENT;
 		if (padding)
 			padding = MTS_MIPMAP_CACHE_ALIGNMENT - padding;
-		mmapPtr += sizeof(MIPMapHeader) + padding;
+
+		uint8_t *mmapPtr = NULL;
+		if (header.version == MTS_MIPMAP_TILED_VERSION) {
+			/* Only record the level sizes, the data is accessed via tiles */
+			m_tiledFile = new TiledTextureFile(cacheFilename,
+				sizeof(MIPMapHeader) + padding, getTileBufferSize());
+			m_tileCache = TextureCache::getInstance();
+			Log(EInfo, "Opened tiled MIP map cache file \"%s\" (%u tiles of %s).",
+				cacheFilename.s.c_str(), m_tiledFile->getTileCount(),
+				memString(getTileBufferSize()).c_str());
+		} else {
+			m_mmap = new MemoryMappedFile(cacheFilename);
+			mmapPtr = (uint8_t *) m_mmap->getData();
+			Log(EInfo, "Mapped MIP map cache file \"%s\" into memory (%s).", cacheFilename.s.c_str(),
+				memString(m_mmap->getSize()).c_str());
+			stats::mipStorage += m_mmap->getSize();
+			mmapPtr += sizeof(MIPMapHeader) + padding;
+		}
 
 		/* Map the highest resolution level */
 		m_pyramid = new Array2DType[m_levels];
 		m_sizeRatio = new Vector2[m_levels];
 		Vector2i size(header.width, header.height);
 		m_pyramid[0].map(mmapPtr, size);
-		mmapPtr += m_pyramid[0].getBufferSize();
+		if (mmapPtr)
+			mmapPtr += m_pyramid[0].getBufferSize();
 		m_sizeRatio[0] = Vector2(1, 1);
 
 		if (m_filterType != ENearest && m_filterType != EBilinear) {
@@ -364,11 +394,21 @@ public:
 				m_sizeRatio[level] = Vector2(
 					(Float) size.x / (Float) m_pyramid[0].getWidth(),
 					(Float) size.y / (Float) m_pyramid[0].getHeight());
-				mmapPtr += m_pyramid[level++].getBufferSize();
+				if (mmapPtr)
+					mmapPtr += m_pyramid[level].getBufferSize();
+				++level;
 			}
 			Assert(level == m_levels);
 		}
 
+		if (m_tiledFile.get()) {
+			uint32_t tileCount = computeTileLayout(
+				Vector2i(header.width, header.height), m_levels, &m_tileOffset, &m_tilesX);
+			if (tileCount > m_tiledFile->getTileCount())
+				Log(EError, "The tiled MIP map cache file \"%s\" is truncated!",
+					cacheFilename.s.c_str());
+		}
+
 		if (m_filterType == EEWA) {
 			m_weightLut = static_cast<Float *>(allocAligned(sizeof(Float) * MTS_MIPMAP_LUT_SIZE));
 			for (int i=0; i<MTS_MIPMAP_LUT_SIZE; ++i) {
@@ -401,11 +441,14 @@ public:
 	 * \param gamma
 	 *    If nonzero, it is verified that the provided gamma value
 	 *    matches that of the cache file.
+	 * \param tiled
+	 *    Check for a tiled cache file (see \ref writeTiledFile())?
 	 * \return \c true if the texture file is good for use
 	 */
 	static bool validateCacheFile(const fs::pathstr &path, uint64_t timestamp,
 			Bitmap::EPixelFormat pixelFormat, EBoundaryCondition bcu,
-			EBoundaryCondition bcv, EMIPFilterType filterType, Float gamma) {
+			EBoundaryCondition bcv, EMIPFilterType filterType, Float gamma,
+			bool tiled = false) {
 		std::ifstream is(decode_pathstr(path).string().c_str());
 		if (!is.good())
 			return false;
@@ -416,8 +459,8 @@ public:
 			return false;
 
 		if (header.identifier[0] != 'M' || header.identifier[1] != 'I'
-			|| header.identifier[2] != 'P' || header.version != MTS_MIPMAP_CACHE_VERSION
-			|| header.timestamp != timestamp
+			|| header.identifier[2] != 'P' || header.timestamp != timestamp
+			|| header.version != (tiled ? MTS_MIPMAP_TILED_VERSION : MTS_MIPMAP_CACHE_VERSION)
 			|| header.bcu != (uint8_t) bcu || header.bcv != (uint8_t) bcv
 			|| header.pixelFormat != (uint8_t) pixelFormat
 			|| header.filterType != (uint8_t) filterType)
@@ -432,9 +475,15 @@ public:
 			padding = MTS_MIPMAP_CACHE_ALIGNMENT - padding;
 
 		Vector2i size(header.width, header.height);
-		size_t expectedFileSize = sizeof(MIPMapHeader) + padding
-			+ Array2DType::bufferSize(size);
+		size_t expectedFileSize = sizeof(MIPMapHeader) + padding;
 
+		if (tiled) {
+			expectedFileSize += computeTileLayout(size, header.levels)
+				* getTileBufferSize();
+			return fs::file_size(fs::decode_pathstr(path)) == expectedFileSize;
+		}
+
+		expectedFileSize += Array2DType::bufferSize(size);
 		if (filterType != ENearest && filterType != EBilinear) {
 			while (size.x > 1 || size.y > 1) {
 				size.x = std::max(1, (size.x + 1) / 2);
@@ -446,6 +495,72 @@ public:
 		return fs::file_size(fs::decode_pathstr(path)) == expectedFileSize;
 	}
 
+	/**
+	 * \brief Write the MIP map to a tiled cache file
+	 *
+	 * The file can be opened using the cache file constructor, which results
+	 * in a MIP map whose tiles are loaded on demand.
+	 *
+	 * \param path
+	 *    File system path of the new cache file
+	 * \param timestamp
+	 *    Timestamp of the original texture file
+	 * \param gamma
+	 *    Gamma value of the original texture file
+	 */
+	void writeTiledFile(const fs::pathstr &path, uint64_t timestamp, Float gamma) const {
+		const int tileSize = 1 << MTS_MIPMAP_LOG_TILE_SIZE;
+		ref<Timer> timer = new Timer();
+
+		MIPMapHeader header = MIPMapHeader();
+		memcpy(header.identifier, "MIP", 3);
+		header.version = MTS_MIPMAP_TILED_VERSION;
+		header.pixelFormat = (uint8_t) m_pixelFormat;
+		header.levels = (uint8_t) m_levels;
+		header.bcu = (uint8_t) m_bcu;
+		header.bcv = (uint8_t) m_bcv;
+		header.filterType = (uint8_t) m_filterType;
+		header.gamma = (float) gamma;
+		header.width = getWidth();
+		header.height = getHeight();
+		header.timestamp = timestamp;
+		header.minimum = m_minimum;
+		header.maximum = m_maximum;
+		header.average = m_average;
+
+		size_t padding = sizeof(MIPMapHeader) % MTS_MIPMAP_CACHE_ALIGNMENT;
+		if (padding)
+			padding = MTS_MIPMAP_CACHE_ALIGNMENT - padding;
+
+		ref<FileStream> fstream = new FileStream(path, FileStream::ETruncWrite);
+		fstream->write(&header, sizeof(MIPMapHeader));
+		const QuantizedValue zero((typename QuantizedValue::Scalar) 0.0f);
+		std::vector<QuantizedValue> tile(tileSize * tileSize, zero);
+		fstream->write(&tile[0], padding);
+
+		/* Write the tiles of every level in row-major order,
+		   padding the ones at the boundary with zeros */
+		for (int level=0; level<m_levels; ++level) {
+			const Vector2i &size = m_pyramid[level].getSize();
+			for (int ty=0; ty<size.y; ty += tileSize) {
+				for (int tx=0; tx<size.x; tx += tileSize) {
+					std::fill(tile.begin(), tile.end(), zero);
+					for (int y=ty; y<std::min(ty + tileSize, size.y); ++y)
+						for (int x=tx; x<std::min(tx + tileSize, size.x); ++x)
+							tile[(y-ty) * tileSize + (x-tx)] = lookupTexel(level, x, y);
+					fstream->write(&tile[0], getTileBufferSize());
+				}
+			}
+		}
+		fstream->close();
+
+		Log(EDebug, "Wrote tiled MIP map cache file \"%s\" in %i ms", path.s.c_str(),
+			timer->getMilliseconds());
+	}
+
+	/// Return whether the texture data is loaded on demand from a tiled cache file
+	inline bool isTiled() const { return m_tiledFile.get() != NULL; }
+
 	/// Return the size of all buffers
 	size_t getBufferSize() const {
 		size_t size = 0;
@@ -478,7 +593,7 @@ public:
 	/// Get the component-wise average
 	inline const Value &getAverage() const { return m_average; }
 
-	/// Return the blocked array used to store a given MIP level
+	/// Return the blocked array used to store a given MIP level (not available when tiled)
 	inline const Array2DType &getArray(int level = 0) const {
 		return m_pyramid[level];
 	}
@@ -492,7 +607,14 @@ public:
 			array.getSize()
 		);
 
-		array.copyTo((QuantizedValue *) result->getData());
+		if (m_tiledFile.get()) {
+			QuantizedValue *target = (QuantizedValue *) result->getData();
+			for (int y=0; y<array.getHeight(); ++y)
+				for (int x=0; x<array.getWidth(); ++x)
+					*target++ = lookupTiled(level, x, y);
+		} else {
+			array.copyTo((QuantizedValue *) result->getData());
+		}
 
 		return result;
 	}
@@ -560,7 +682,7 @@ public:
 			}
 		}
 
-		return Value(m_pyramid[level](x, y));
+		return Value(lookupTexel(level, x, y));
 	}
 
 	/// Evaluate the texture at the given resolution using a box filter
@@ -722,7 +844,7 @@ public:
 			<< "   pixelFormat = " << m_pixelFormat << "," << endl
 			<< "   size = " << memString(getBufferSize()) << "," << endl
 			<< "   levels = " << m_levels << "," << endl
-			<< "   cached = " << (m_mmap.get() ? "yes" : "no") << "," << endl
+			<< "   cached = " << (m_mmap.get() ? "yes" : (m_tiledFile.get() ? "tiled" : "no")) << "," << endl
 			<< "   filterType = ";
 
 		switch (m_filterType) {
@@ -761,6 +883,53 @@ protected:
 	};
 
 
+	/// Return the size of a tile in tiled cache files
+	static inline size_t getTileBufferSize() {
+		return sizeof(QuantizedValue) << (2 * MTS_MIPMAP_LOG_TILE_SIZE);
+	}
+
+	/**
+	 * \brief Compute the tile layout of a tiled MIP map
+	 *
+	 * Returns the total number of tiles. Optionally, it stores the index of
+	 * the first tile and the number of tile columns of each level.
+	 */
+	static uint32_t computeTileLayout(Vector2i size, int levels,
+			std::vector<uint32_t> *offsets = NULL, std::vector<uint32_t> *columns = NULL) {
+		const int tileSize = 1 << MTS_MIPMAP_LOG_TILE_SIZE;
+		uint32_t tileCount = 0;
+		for (int level=0; level<levels; ++level) {
+			uint32_t tilesX = (uint32_t) ((size.x + tileSize - 1) / tileSize),
+			         tilesY = (uint32_t) ((size.y + tileSize - 1) / tileSize);
+			if (offsets)
+				offsets->push_back(tileCount);
+			if (columns)
+				columns->push_back(tilesX);
+			tileCount += tilesX * tilesY;
+			size.x = std::max(1, (size.x + 1) / 2);
+			size.y = std::max(1, (size.y + 1) / 2);
+		}
+		return tileCount;
+	}
+
+	/// Fetch a texel from the tiled cache file (coordinates must be in range)
+	inline QuantizedValue lookupTiled(int level, int x, int y) const {
+		const int mask = (1 << MTS_MIPMAP_LOG_TILE_SIZE) - 1;
+		const uint32_t index = m_tileOffset[level]
+			+ (uint32_t) (y >> MTS_MIPMAP_LOG_TILE_SIZE) * m_tilesX[level]
+			+ (uint32_t) (x >> MTS_MIPMAP_LOG_TILE_SIZE);
+		const QuantizedValue *tile = reinterpret_cast<const QuantizedValue *>(
+			m_tileCache->lookup(m_tiledFile.get(), index));
+		return tile[((y & mask) << MTS_MIPMAP_LOG_TILE_SIZE) + (x & mask)];
+	}
+
+	/// Fetch a texel from memory or the tiled cache file (coordinates must be in range)
+	inline QuantizedValue lookupTexel(int level, int x, int y) const {
+		if (EXPECT_NOT_TAKEN(m_tiledFile.get() != NULL))
+			return lookupTiled(level, x, y);
+		return m_pyramid[level](x, y);
+	}
+
 	/// Calculate the elliptically weighted average of a sample and associated Jacobian
 	Value evalEWA(int level, const Point2 &uv, Float A, Float B, Float C) const {
 		Assert(A > 0);
@@ -846,6 +1015,10 @@ private:
 	Value m_minimum;
 	Value m_maximum;
 	Value m_average;
+	ref<TiledTextureFile> m_tiledFile;
+	TextureCache *m_tileCache;
+	std::vector<uint32_t> m_tileOffset;
+	std::vector<uint32_t> m_tilesX;
 };
 
 template <typename Value, typename QuantizedValue>
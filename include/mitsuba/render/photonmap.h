@@ -56,7 +56,7 @@ public:
 	//! @{ \name \c stl::vector-like interface
 	// =============================================================
 	/// Clear the kd-tree array
-	inline void clear() { m_kdtree.clear(); }
+	inline void clear() { m_kdtree.clear(); m_gridCells.clear(); }
 	/// Resize the kd-tree array
 	inline void resize(size_t size) { m_kdtree.resize(size); }
 	/// Reserve a certain amount of memory for the kd-tree array
@@ -129,6 +129,41 @@ public:
 	size_t estimateRadianceRaw(const Intersection &its,
 		Float searchRadius, Spectrum &result, int maxDepth) const;
 
+	/**
+	 * \brief Call the functor on all photons within the specified
+	 * radius using the hash grid (see \ref buildHashGrid())
+	 *
+	 * \return The number of photons within the radius
+	 */
+	template <typename Functor> size_t executeGridQuery(const Point &p,
+			Float searchRadius, Functor &functor) const {
+		const Float distSquared = searchRadius*searchRadius;
+		const Point3i lo = getGridCell(p - Vector(searchRadius)),
+		              hi = getGridCell(p + Vector(searchRadius));
+		size_t found = 0;
+
+		for (int z=lo.z; z<=hi.z; ++z) {
+			for (int y=lo.y; y<=hi.y; ++y) {
+				for (int x=lo.x; x<=hi.x; ++x) {
+					const Point3i cell(x, y, z);
+					const uint32_t slot = getGridSlot(cell);
+					const uint32_t end = m_gridCells[slot+1];
+					for (uint32_t i=m_gridCells[slot]; i<end; ++i) {
+						const Photon &photon = m_kdtree[i];
+						if ((photon.getPosition() - p).lengthSquared() >= distSquared)
+							continue;
+						/* Skip photons of other cells that share the slot */
+						if (getGridCell(photon.getPosition()) != cell)
+							continue;
+						++found;
+						functor(photon);
+					}
+				}
+			}
+		}
+		return found;
+	}
+
 	/// Perform a nearest-neighbor query, see \ref PointKDTree for details
 	inline size_t nnSearch(const Point &p, Float &sqrSearchRadius,
 		size_t k, SearchResult *results) const {
@@ -170,7 +205,28 @@ public:
 	 * This has to be done once after all photons have been stored,
 	 * but prior to executing any queries.
 	 */
-	inline void build(bool recomputeAABB = false) { m_kdtree.build(recomputeAABB); }
+	inline void build(bool recomputeAABB = false) {
+		m_gridCells.clear();
+		m_kdtree.build(recomputeAABB);
+	}
+
+	/**
+	 * \brief Sort the photons into a hash grid instead of building a kd-tree
+	 *
+	 * The photons are binned into uniform cells of the given size, which
+	 * are stored in a hash table with one slot per photon. Unlike \ref build(),
+	 * the construction runs in parallel, which pays off for large photon
+	 * counts. Afterwards, only \ref estimateRadianceRaw() and \ref
+	 * executeGridQuery() may be used. This changes the order of the photons.
+	 *
+	 * \param cellSize
+	 *     Edge length of the grid cells. Queries are cheapest when it is
+	 *     about twice the typical search radius.
+	 */
+	void buildHashGrid(Float cellSize);
+
+	/// Return whether the photons have been sorted into a hash grid
+	inline bool hasHashGrid() const { return !m_gridCells.empty(); }
 
 	/// Return the depth of the constructed KD-tree
 	inline size_t getDepth() const { return m_kdtree.getDepth(); }
@@ -193,9 +249,26 @@ public:
 protected:
 	/// Virtual destructor
 	virtual ~PhotonMap();
+
+	/// Return the hash grid cell containing a given position
+	inline Point3i getGridCell(const Point &p) const {
+		return Point3i(
+			math::floorToInt(p.x * m_gridInvCellSize),
+			math::floorToInt(p.y * m_gridInvCellSize),
+			math::floorToInt(p.z * m_gridInvCellSize));
+	}
+
+	/// Return the hash table slot of a grid cell
+	inline uint32_t getGridSlot(const Point3i &cell) const {
+		return (((uint32_t) cell.x * 73856093u) ^ ((uint32_t) cell.y * 19349663u)
+			^ ((uint32_t) cell.z * 83492791u)) & m_gridMask;
+	}
 protected:
 	PhotonTree m_kdtree;
 	Float m_scale;
+	std::vector<uint32_t> m_gridCells;
+	Float m_gridInvCellSize;
+	uint32_t m_gridMask;
 };
 
 MTS_NAMESPACE_END
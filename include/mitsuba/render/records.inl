@@ -41,6 +41,32 @@ void BSDFSamplingRecord::reverse() {
 	mode = (ETransportMode) (1-mode);
 }
 
+inline BSDFQueryBatch::BSDFQueryBatch()
+	: size(0), its(NULL), sampler(NULL), wiX(NULL), wiY(NULL), wiZ(NULL),
+	woX(NULL), woY(NULL), woZ(NULL), eta(NULL), sampledType(NULL),
+	sampledComponent(NULL), mode(ERadiance), typeMask(BSDF::EAll), component(-1) {
+}
+
+inline BSDFSamplingRecord BSDFQueryBatch::getRecord(size_t i) const {
+	BSDFSamplingRecord bRec(*its[i], Vector(wiX[i], wiY[i], wiZ[i]),
+		Vector(woX[i], woY[i], woZ[i]), mode);
+	bRec.sampler = sampler;
+	bRec.typeMask = typeMask;
+	bRec.component = component;
+	bRec.eta = 1.0f;
+	return bRec;
+}
+
+inline void BSDFQueryBatch::putRecord(size_t i, const BSDFSamplingRecord &bRec) const {
+	woX[i] = bRec.wo.x; woY[i] = bRec.wo.y; woZ[i] = bRec.wo.z;
+	if (eta)
+		eta[i] = bRec.eta;
+	if (sampledType)
+		sampledType[i] = bRec.sampledType;
+	if (sampledComponent)
+		sampledComponent[i] = bRec.sampledComponent;
+}
+
 inline bool Intersection::hasSubsurface() const {
 	return shape->hasSubsurface();
 }
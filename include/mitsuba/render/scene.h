@@ -33,6 +33,7 @@
 #include <mitsuba/render/medium.h>
 #include <mitsuba/render/volume.h>
 #include <mitsuba/render/phase.h>
+#include <mitsuba/render/lightbvh.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -89,6 +90,50 @@ public:
 	 */
 	void initializeBidirectional();
 
+	/**
+	 * \brief Update the scene after shapes have been transformed
+	 *
+	 * Used for incremental edits in interactive sessions: after moving shapes
+	 * using \ref Shape::applyTransform(), this updates the acceleration data
+	 * structure (see \ref ShapeKDTree::update()), the scene bounds and, if
+	 * there are area emitters, the emitter sampling structures without
+	 * reconfiguring the scene. The integrator must be preprocessed
+	 * again afterwards, if it depends on the geometry.
+	 *
+	 * Rendering must be stopped first: the acceleration data structure is
+	 * modified in place, and the samples rendered before the edit should
+	 * be discarded (see \ref ResponsiveIntegrator::reset()).
+	 */
+	void updateGeometry();
+
+	/**
+	 * \brief Replace a BSDF on all shapes that reference it
+	 *
+	 * Used for material and texture edits in interactive sessions, which
+	 * don't touch the geometry. Shapes within instanced shape groups are
+	 * not visited. Rendering must be stopped first, since the replaced
+	 * BSDF may be released.
+	 *
+	 * \return The number of shapes that were updated
+	 */
+	size_t replaceBSDF(const BSDF *oldBSDF, BSDF *newBSDF);
+
+	/**
+	 * \brief Replace an emitter by a configured new one
+	 *
+	 * An area emitter is attached to the shape of the emitter it replaces.
+	 * Only the emitter sampling distribution is recomputed (see \ref
+	 * updateEmitters()). Rendering must be stopped first, since the
+	 * replaced emitter may be released.
+	 */
+	void replaceEmitter(Emitter *oldEmitter, Emitter *newEmitter);
+
+	/**
+	 * \brief Recompute the emitter sampling distribution, e.g. after the
+	 * sampling weight of an emitter has changed
+	 */
+	void updateEmitters();
+
 	/**
 	 * \brief Perform any pre-processing steps before rendering
 	 *
@@ -844,6 +889,10 @@ public:
 	/**
 	 * \brief Return the discrete probability of choosing a
 	 * certain emitter in <tt>sampleEmitter*</tt>
+	 *
+	 * When a light BVH is used (see \ref setUseLightBVH()), the
+	 * <tt>sample*EmitterDirect</tt> methods choose emitters
+	 * differently, and this function does not apply to them.
 	 */
 	inline Float pdfEmitterDiscrete(const Emitter *emitter) const {
 		return emitter->getSamplingWeight() * m_emitterPDF.getNormalization();
@@ -1071,6 +1120,23 @@ public:
 	/// Return the scene's kd-tree accelerator
 	inline const ShapeKDTree *getKDTree() const { return m_kdtree.get(); }
 
+	/**
+	 * \brief Specify whether direct illumination sampling should choose
+	 * emitters using a light BVH
+	 *
+	 * By default, emitters are chosen in proportion to their power. The
+	 * light BVH additionally accounts for their distance and orientation
+	 * relative to the reference point, which greatly reduces noise in scenes
+	 * with many emitters. This only affects the <tt>sample*EmitterDirect</tt>
+	 * and \ref pdfEmitterDirect() methods and must be set before the scene
+	 * is initialized.
+	 */
+	inline void setUseLightBVH(bool value) { m_useLightBVH = value; }
+	/// Return whether direct illumination sampling uses a light BVH
+	inline bool getUseLightBVH() const { return m_useLightBVH; }
+	/// Return the light BVH (or \c NULL when it is not used)
+	inline const LightBVH *getLightBVH() const { return m_lightBVH.get(); }
+
 	/// Return the a list of all subsurface integrators
 	inline ref_vector<Subsurface> &getSubsurfaceIntegrators() { return m_ssIntegrators; }
 	/// Return the a list of all subsurface integrators
@@ -1148,8 +1214,16 @@ protected:
 	/// Add a shape to the scene
 	void addShape(Shape *shape);
 	/// \endcond
+
+	/// Choose an emitter for direct illumination sampling (returns \c NULL on failure)
+	const Emitter *chooseEmitterDirect(const DirectSamplingRecord &dRec,
+		Float &sample, Float &pdf) const;
+
+	/// (Re-)build the emitter selection data structures
+	void buildEmitterPDF();
 private:
 	ref<ShapeKDTree> m_kdtree;
+	ref<LightBVH> m_lightBVH;
 	ref<Sensor> m_sensor;
 	ref<Integrator> m_integrator;
 	ref<Sampler> m_sampler;
@@ -1165,11 +1239,12 @@ private:
 	std::vector<TriMesh *> m_meshes;
 	fs::pathstr *m_sourceFile;
 	fs::pathstr *m_destinationFile;
-	DiscreteDistribution m_emitterPDF;
+	AliasDistribution m_emitterPDF;
 	AABB m_aabb;
 	uint32_t m_blockSize;
 	bool m_degenerateSensor;
 	bool m_degenerateEmitters;
+	bool m_useLightBVH;
 	bool m_scenePreprocessed;
 	bool m_integratorPreprocessed;
 };
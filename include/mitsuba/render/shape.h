@@ -229,6 +229,18 @@ public:
 	 */
 	virtual ref<TriMesh> createTriMesh();
 
+	/**
+	 * \brief Apply a transformation to the shape after it has been
+	 * configured
+	 *
+	 * This is used for interactive editing. Afterwards, the scene must
+	 * be informed using \ref Scene::updateGeometry().
+	 *
+	 * The default implementation does nothing and returns \c false,
+	 * which indicates that the shape does not support this operation.
+	 */
+	virtual bool applyTransform(const Transform &trafo);
+
 	//! @}
 	// =============================================================
 
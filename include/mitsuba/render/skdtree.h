@@ -23,6 +23,8 @@
 #include <mitsuba/render/shape.h>
 #include <mitsuba/render/sahkdtree3.h>
 #include <mitsuba/render/triaccel.h>
+#include <mitsuba/render/wbvh.h>
+#include <mitsuba/core/mmap.h>
 
 #if defined(MTS_KD_CONSERVE_MEMORY)
 #if defined(MTS_HAS_COHERENT_RT)
@@ -62,6 +64,17 @@ typedef const Shape * ConstShapePtr;
  * test is used instead, which doesn't need any extra storage. However, it also
  * tends to be quite a bit slower.
  *
+ * For very large scenes, the kd-tree can be replaced by a 4- or 8-wide BVH
+ * (see \ref setAccelerator() and \ref WideBVH), which builds much faster
+ * and needs less memory. The ray tracing interface stays the same, though
+ * direct access to the kd-tree nodes (\ref getRoot()) is then unavailable.
+ *
+ * Building the kd-tree of a large scene can take minutes. When a cache
+ * directory is specified (see \ref setCacheDirectory()), the finished tree
+ * is written to a file named after a hash of the geometry and the build
+ * parameters, and later builds of the same scene map this file into memory
+ * instead of repeating the construction.
+ *
  * \sa GenericKDTree
  * \ingroup librender
  */
@@ -70,16 +83,54 @@ class MTS_EXPORT_RENDER ShapeKDTree : public SAHKDTree3D<ShapeKDTree> {
 	friend class GenericKDTree<AABB, SurfaceAreaHeuristic3, ShapeKDTree>;
 	friend class SAHKDTree3D<ShapeKDTree>;
 	friend class Instance;
+	friend class InstanceArray;
 	friend class AnimatedInstance;
 	friend class SingleScatter;
 
 public:
+	/// Available acceleration data structures
+	enum EAccelerator {
+		/// SAH kd-tree (default)
+		EKDTree = 0,
+		/// 4-wide BVH with quantized node bounds
+		EWideBVH4,
+		/// 8-wide BVH with quantized node bounds
+		EWideBVH8
+	};
+
 	// =============================================================
 	//! @{ \name Initialization and tree construction
 	// =============================================================
 	/// Create an empty kd-tree
 	ShapeKDTree();
 
+	/// Select the acceleration data structure built by \ref build()
+	inline void setAccelerator(EAccelerator accel) { m_accelerator = accel; }
+
+	/// Return the acceleration data structure built by \ref build()
+	inline EAccelerator getAccelerator() const { return m_accelerator; }
+
+	/// Look up an accelerator by name ("kdtree", "bvh4" or "bvh8")
+	static EAccelerator getAccelerator(const std::string &name);
+
+	/// Return the name of an accelerator
+	static std::string getAcceleratorName(EAccelerator accel);
+
+	/**
+	 * \brief Set a directory for caching built kd-trees on disk
+	 *
+	 * An empty path (the default, unless the environment variable
+	 * \c MITSUBA_KDCACHE is set) disables the cache. Only applies
+	 * when the accelerator is \ref EKDTree.
+	 */
+	inline void setCacheDirectory(const fs::pathstr &path) { m_cacheDirectory = path; }
+
+	/// Return the directory used for caching built kd-trees
+	inline const fs::pathstr &getCacheDirectory() const { return m_cacheDirectory; }
+
+	/// Return whether the kd-tree was loaded from the on-disk cache
+	inline bool isCached() const { return m_cacheFile.get() != NULL; }
+
 	/// Add a shape to the kd-tree
 	void addShape(const Shape *shape);
 
@@ -100,6 +151,27 @@ public:
 	/// Build the kd-tree (needs to be called before tracing any rays)
 	void build();
 
+	/**
+	 * \brief Update the acceleration data structure after shapes have
+	 * been transformed (see \ref Shape::applyTransform())
+	 *
+	 * The set of shapes must not have changed since \ref build(). A BVH
+	 * is refit to the new primitive bounds while keeping its topology.
+	 * The kd-tree is rebuilt, since its split planes can't be refit;
+	 * kd-trees nested in instanced shape groups are reused in either case.
+	 *
+	 * \return \c true if the hierarchy was refit, \c false if it was rebuilt
+	 */
+	bool update();
+
+	/// Return whether or not the acceleration data structure has been built
+	inline bool isBuilt() const {
+		return m_accelerator == EKDTree ? m_nodes != NULL : m_built;
+	}
+
+	/// Return the memory used by the acceleration data structure in bytes
+	size_t getMemoryUsage() const;
+
 	//! @}
 	// =============================================================
 
@@ -427,6 +499,29 @@ protected:
 		its.wi = its.toLocal(-ray.d);
 	}
 
+	/**
+	 * \brief Traverse the active acceleration data structure
+	 *
+	 * Same conventions as \ref SAHKDTree3D::rayIntersectHavran().
+	 */
+	template<bool shadowRay> FINLINE bool rayIntersectAccel(const Ray &ray,
+			Float mint, Float maxt, Float &t, void *temp) const {
+		if (EXPECT_TAKEN(m_accelerator == EKDTree))
+			return rayIntersectHavran<shadowRay>(ray, mint, maxt, t, temp);
+
+		auto intersectPrim = [&](uint32_t idx, Float primMint, Float primMaxt, Float &primT) {
+			if (shadowRay)
+				return intersect(ray, idx, primMint, primMaxt);
+			return intersect(ray, idx, primMint, primMaxt, primT, temp);
+		};
+		bool hit = m_accelerator == EWideBVH4
+			? m_bvh4.rayIntersect<shadowRay>(ray, mint, maxt, intersectPrim)
+			: m_bvh8.rayIntersect<shadowRay>(ray, mint, maxt, intersectPrim);
+		if (hit && !shadowRay)
+			t = maxt;
+		return hit;
+	}
+
 	/// Plain shadow ray query (used by the 'instance' plugin)
 	inline bool rayIntersect(const Ray &ray, Float _mint, Float _maxt) const {
 		Float mint, maxt, tempT = std::numeric_limits<Float>::infinity();
@@ -435,7 +530,7 @@ protected:
 			if (_maxt < maxt) maxt = _maxt;
 
 			if (EXPECT_TAKEN(maxt > mint))
-				return rayIntersectHavran<true>(ray, mint, maxt, tempT, NULL);
+				return rayIntersectAccel<true>(ray, mint, maxt, tempT, NULL);
 		}
 		return false;
 	}
@@ -448,7 +543,7 @@ protected:
 			if (_maxt < maxt) maxt = _maxt;
 
 			if (EXPECT_TAKEN(maxt > mint)) {
-				if (rayIntersectHavran<false>(ray, mint, maxt, tempT, temp)) {
+				if (rayIntersectAccel<false>(ray, mint, maxt, tempT, temp)) {
 					t = tempT;
 					return true;
 				}
@@ -459,6 +554,23 @@ protected:
 
 	/// Virtual destructor
 	virtual ~ShapeKDTree();
+
+	/// Set the (enlarged) scene bounds from the bounds of the BVH
+	void updateBVHBounds();
+
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	/// Precompute the triangle intersection information
+	void buildTriAccel();
+#endif
+
+	/// Hash the geometry and build parameters to identify a cached tree
+	uint64_t computeCacheKey() const;
+
+	/// Try to map a cached kd-tree into memory
+	bool loadCache(const fs::pathstr &path, uint64_t key);
+
+	/// Write the kd-tree to the cache
+	void saveCache(const fs::pathstr &path, uint64_t key) const;
 private:
 	std::vector<const Shape *> m_shapes;
 	std::vector<bool> m_triangleFlag;
@@ -466,6 +578,12 @@ private:
 #if !defined(MTS_KD_CONSERVE_MEMORY)
 	TriAccel *m_triAccel;
 #endif
+	EAccelerator m_accelerator;
+	WideBVH<4> m_bvh4;
+	WideBVH<8> m_bvh8;
+	bool m_built;
+	fs::pathstr m_cacheDirectory;
+	ref<MemoryMappedFile> m_cacheFile;
 };
 
 MTS_NAMESPACE_END
@@ -0,0 +1,135 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_SPARSEVOL_H_)
+#define __MITSUBA_RENDER_SPARSEVOL_H_
+
+#include <mitsuba/mitsuba.h>
+
+/// Current version of the sparse volume file format
+#define MTS_SPARSEVOL_VERSION 1
+
+/// Brick index entry of bricks that only contain zeros
+#define MTS_SPARSEVOL_EMPTY 0xFFFFFFFFu
+
+/// Alignment of the sections and bricks of a sparse volume file in bytes
+#define MTS_SPARSEVOL_ALIGNMENT 64
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Header of a sparse volume file
+ *
+ * Sparse volume files are read by the \c sparsevolume plugin and can be
+ * created from dense volumes using <tt>mtsutil sparsevol</tt>. The volume
+ * is split into bricks of <tt>brickSize^3</tt> cells. Each brick stores
+ * the <tt>(brickSize+1)^3</tt> samples at the corners of its cells, hence
+ * a trilinear lookup only ever touches a single brick. Bricks containing
+ * only zeros are not stored.
+ *
+ * A file consists of this header, the brick index (one 32 bit entry per
+ * brick with the number of the stored brick or \ref MTS_SPARSEVOL_EMPTY),
+ * one \ref SparseVolumeBrick record per stored brick and finally the
+ * sample data of the stored bricks. The sections and the data of each
+ * brick start at multiples of \ref MTS_SPARSEVOL_ALIGNMENT bytes, so that
+ * the file can be used directly after mapping it into memory. All values
+ * use a little endian encoding.
+ *
+ * \ingroup librender
+ */
+struct SparseVolumeHeader {
+	/// Encoding of the samples
+	enum EEncoding {
+		/// Single precision values
+		EFloat32 = 0,
+		/// 8 bit values, dequantized using the per-brick offset and scale
+		EUInt8 = 1
+	};
+
+	char magic[4];        ///< ASCII bytes 'S', 'V', 'O', and 'L'
+	uint32_t version;     ///< File format version (\ref MTS_SPARSEVOL_VERSION)
+	uint32_t channels;    ///< Number of channels (1 or 3)
+	uint32_t encoding;    ///< Sample encoding (\ref EEncoding)
+	int32_t res[3];       ///< Number of samples along each axis
+	uint32_t brickSize;   ///< Number of cells per brick along each axis (power of two)
+	float aabbMin[3];     ///< Bounding box of the data
+	float aabbMax[3];
+	uint32_t brickCount;  ///< Number of stored bricks
+	uint32_t reserved;
+
+	/// Round a file offset up to the next multiple of the alignment
+	static inline size_t align(size_t offset) {
+		return (offset + MTS_SPARSEVOL_ALIGNMENT - 1) & ~((size_t) MTS_SPARSEVOL_ALIGNMENT - 1);
+	}
+
+	/// Return the number of bricks along an axis
+	inline int getBrickRes(int axis) const {
+		return (res[axis] - 2) / (int) brickSize + 1;
+	}
+
+	/// Return the number of entries in the brick index
+	inline size_t getIndexSize() const {
+		return (size_t) getBrickRes(0) * (size_t) getBrickRes(1) * (size_t) getBrickRes(2);
+	}
+
+	/// Return the number of samples stored per brick and channel
+	inline size_t getBrickSampleCount() const {
+		return (size_t) (brickSize + 1) * (brickSize + 1) * (brickSize + 1);
+	}
+
+	/// Return the number of bytes used by the data of each brick
+	inline size_t getBrickDataSize() const {
+		return align(getBrickSampleCount() * channels
+			* (encoding == EFloat32 ? sizeof(float) : sizeof(uint8_t)));
+	}
+
+	/// Return the file offset of the brick index
+	inline size_t getIndexOffset() const {
+		return align(sizeof(SparseVolumeHeader));
+	}
+
+	/// Return the file offset of the brick records
+	inline size_t getBrickOffset() const {
+		return align(getIndexOffset() + getIndexSize() * sizeof(uint32_t));
+	}
+
+	/// Return the file offset of the brick data
+	inline size_t getDataOffset() const;
+
+	/// Return the total size of the file
+	inline size_t getFileSize() const {
+		return getDataOffset() + brickCount * getBrickDataSize();
+	}
+};
+
+/// Record of a brick stored in a sparse volume file
+struct SparseVolumeBrick {
+	float maxValue;       ///< Maximum of the first channel within the brick
+	float offset[3];      ///< Dequantization offset per channel (\c EUInt8 encoding)
+	float scale[3];       ///< Dequantization scale per channel (\c EUInt8 encoding)
+	uint32_t reserved;
+};
+
+inline size_t SparseVolumeHeader::getDataOffset() const {
+	return align(getBrickOffset() + brickCount * sizeof(SparseVolumeBrick));
+}
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_SPARSEVOL_H_ */
@@ -0,0 +1,146 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_SPLATTILES_H_)
+#define __MITSUBA_RENDER_SPLATTILES_H_
+
+#include <mitsuba/render/imageblock.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Contention-free splatting into an image block shared by many threads
+ *
+ * Splatting integrators (MLT, ERPT, BDPT light paths, ..) that share one
+ * \ref ImageBlock among several threads go through the atomic compare-and-
+ * exchange loop of \ref ImageBlock::putAtomic() for every sample. On bright
+ * pixels, the resulting cache line ping-pong dominates the run time.
+ *
+ * This class instead gives every thread (\a slot) a small, sparse set of
+ * image tiles. Splats are accumulated into the slot's tiles, and the tiles
+ * are merged into the shared target with lock-free atomic additions once per
+ * pixel only when the slot runs out of tiles, when a flush was requested
+ * (see \ref requestFlush()), or at develop time (see \ref flushAll()).
+ * Memory is bounded by the number of tiles per slot instead of one
+ * full-resolution buffer per thread.
+ *
+ * Access to the tiles of a slot is guarded by a small spin lock, which lives
+ * on the slot's own cache line. The owning thread is the only one taking it,
+ * except while \ref flushAll() merges the slot from another thread; the
+ * splatting path is therefore not strictly lock-free, but it never waits
+ * outside of such a merge.
+ *
+ * Threads normally do not use this class directly, but splat into the
+ * per-thread views created by \ref ImageBlock::ImageBlock(ImageBlock *, SplatTiles *, int),
+ * which redirect \ref ImageBlock::putAtomic() here.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER SplatTiles : public Object {
+public:
+	/**
+	 * \brief Create tile storage for splatting into \c target
+	 *
+	 * \param target
+	 *    Shared image block receiving the merged tiles
+	 * \param slotCount
+	 *    Number of threads splatting concurrently (one slot each)
+	 * \param maxTilesPerSlot
+	 *    Maximum number of tiles held by one slot before it is merged
+	 * \param tileSize
+	 *    Edge length of a tile in pixels
+	 */
+	SplatTiles(ImageBlock *target, int slotCount, int maxTilesPerSlot = 256, int tileSize = 16);
+
+	/**
+	 * \brief Accumulate a filtered sample into the tiles of \c slot
+	 *
+	 * Must only be called by the thread owning \c slot.
+	 * Follows the conventions of \ref ImageBlock::put().
+	 */
+	bool put(int slot, const Point2 &pos, const Float *value);
+
+	/// Merge the tiles of \c slot into the target
+	void flush(int slot);
+
+	/// Merge \c slot if a flush was requested since its last merge
+	void sync(int slot);
+
+	/**
+	 * \brief Ask all slots to merge their tiles on their next splat
+	 * or \ref sync() call
+	 *
+	 * This is safe to call while other threads are splatting.
+	 */
+	void requestFlush();
+
+	/**
+	 * \brief Merge all slots into the target
+	 *
+	 * This is safe to call while other threads are splatting, e.g.
+	 * to develop an intermediate image. The splatting threads briefly
+	 * wait while their slot is being merged.
+	 */
+	void flushAll();
+
+	/// Discard all pending splats, requires that no thread is splatting
+	void clear();
+
+	/// Return the shared target block
+	inline ImageBlock *getTarget() { return m_target; }
+
+	/// Return the number of slots
+	inline int getSlotCount() const { return (int) m_slots.size(); }
+
+	/// Return the edge length of a tile in pixels
+	inline int getTileSize() const { return m_tileSize; }
+
+	/// Return the maximum number of tiles per slot
+	inline int getMaxTilesPerSlot() const { return m_maxTiles; }
+
+	/// Return the number of slot merges performed so far
+	size_t getFlushCount() const;
+
+	/// Return the memory used by the tile storage in bytes
+	size_t getMemoryUsage() const;
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~SplatTiles();
+private:
+	struct Slot;
+	struct SlotLock;
+
+	/// Merge the tiles of a slot, whose lock is held by the caller
+	void flushLocked(Slot &slot);
+
+	ref<ImageBlock> m_target;
+	std::vector<Slot *> m_slots;
+	int m_tileSize, m_maxTiles;
+	int m_tilesX;
+	volatile int m_flushEpoch;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_SPLATTILES_H_ */
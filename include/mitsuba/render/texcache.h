@@ -0,0 +1,220 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_TEXCACHE_H_)
+#define __MITSUBA_RENDER_TEXCACHE_H_
+
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/lrucache.h>
+#include <mitsuba/core/lock.h>
+#include <mitsuba/core/statistics.h>
+#include <atomic>
+#include <memory>
+
+/// Number of independently locked parts of the shared tile cache
+#define MTS_TEXCACHE_SHARDS 16
+
+/// Number of tiles each thread keeps referenced without locking
+#define MTS_TEXCACHE_LOCAL_TILES 16
+
+/// Default memory budget of the tile cache in MiB (see \ref TextureCache)
+#define MTS_TEXCACHE_DEFAULT_BUDGET 1024
+
+MTS_NAMESPACE_BEGIN
+
+/* Some statistics counters */
+namespace stats {
+	extern MTS_EXPORT_RENDER StatsCounter texCacheHits;
+};
+
+/**
+ * \brief File consisting of a header followed by tiles of equal size
+ *
+ * The tiles are read through a file stream that is shared by all threads.
+ * Loaded tiles are kept in the \ref TextureCache.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER TiledTextureFile : public Object {
+public:
+	/**
+	 * \brief Open a tiled file
+	 *
+	 * \param filename
+	 *    Path of the file
+	 * \param dataOffset
+	 *    Offset of the first tile in bytes
+	 * \param tileSize
+	 *    Size of every tile in bytes
+	 */
+	TiledTextureFile(const fs::pathstr &filename, size_t dataOffset, size_t tileSize);
+
+	/// Return a unique identifier of the file, which is never reused
+	inline uint32_t getID() const { return m_id; }
+
+	/// Return the size of a tile in bytes
+	inline size_t getTileSize() const { return m_tileSize; }
+
+	/// Return the number of tiles in the file
+	inline uint32_t getTileCount() const { return m_tileCount; }
+
+	/// Return the path of the file
+	inline const fs::pathstr &getFilename() const { return m_filename; }
+
+	/// Read a tile into the given buffer of \ref getTileSize() bytes
+	void readTile(uint32_t index, uint8_t *target) const;
+
+	/// Return a human-readable string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~TiledTextureFile();
+private:
+	fs::pathstr m_filename;
+	mutable ref<FileStream> m_stream;
+	mutable ref<Mutex> m_mutex;
+	size_t m_dataOffset, m_tileSize;
+	uint32_t m_tileCount;
+	uint32_t m_id;
+};
+
+/**
+ * \brief Shared cache of texture tiles that are read from disk on demand
+ *
+ * Out-of-core textures (e.g. tiled MIP maps, see \ref TMIPMap) store their
+ * contents as fixed-size tiles in a file. This cache keeps the recently used
+ * tiles of all such files in memory and evicts the least recently used ones
+ * once the memory budget is exhausted. The budget is set using \ref
+ * setMemoryBudget() or the \c MITSUBA_TEXCACHE_SIZE environment variable
+ * (in MiB, default: 1024).
+ *
+ * The cache is split into \ref MTS_TEXCACHE_SHARDS parts with separate locks
+ * and LRU lists. In addition, every thread holds on to its
+ * \ref MTS_TEXCACHE_LOCAL_TILES most recently used tiles, which are found
+ * without any locking. These tiles may outlive their eviction from the shared
+ * cache, hence the memory usage can exceed the budget by that many tiles per
+ * thread.
+ *
+ * Hit and miss counts are reported in the "Texture cache" statistics category.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER TextureCache : public Object {
+public:
+	/// A tile that has been loaded into memory
+	struct Tile {
+		std::unique_ptr<uint8_t[]> data;
+		size_t size;
+	};
+
+	typedef std::shared_ptr<const Tile> TilePtr;
+
+	/// Return the global texture cache
+	static TextureCache *getInstance();
+
+	/**
+	 * \brief Return the contents of a tile, loading it if necessary
+	 *
+	 * The returned pointer remains valid until the next lookup
+	 * performed by the calling thread.
+	 */
+	inline const uint8_t *lookup(const TiledTextureFile *file, uint32_t index) {
+		const uint64_t key = ((uint64_t) file->getID() << 32) | index;
+		LocalTiles &local = getLocalTiles();
+		const uint32_t slot = (uint32_t) hashKey(key) & (MTS_TEXCACHE_LOCAL_TILES-1);
+		stats::texCacheHits.incrementBase();
+		if (EXPECT_TAKEN(local.keys[slot] == key)) {
+			++stats::texCacheHits;
+			return local.tiles[slot]->data.get();
+		}
+		local.tiles[slot] = lookupShared(file, index, key);
+		local.keys[slot] = key;
+		return local.tiles[slot]->data.get();
+	}
+
+	/// Set the memory budget of the shared cache in bytes (flushes the cache)
+	void setMemoryBudget(size_t bytes);
+
+	/// Return the memory budget of the shared cache in bytes
+	inline size_t getMemoryBudget() const { return m_budget; }
+
+	/// Return the memory occupied by the tiles in the shared cache
+	inline size_t getMemoryUsage() const { return m_memoryUsage; }
+
+	/// Remove all tiles from the shared cache
+	void flush();
+
+	/// Return a human-readable string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Tiles referenced by the current thread
+	struct LocalTiles {
+		uint64_t keys[MTS_TEXCACHE_LOCAL_TILES];
+		TilePtr tiles[MTS_TEXCACHE_LOCAL_TILES];
+
+		LocalTiles();
+	};
+
+	typedef LRUCache<uint64_t, std::less<uint64_t>, TilePtr> TileLRUCache;
+
+	/// Part of the shared cache with its own lock
+	struct Shard {
+		ref<Mutex> mutex;
+		ref<TileLRUCache> cache;
+	};
+
+	/// Create a cache with the given memory budget
+	TextureCache(size_t budget);
+
+	/// Virtual destructor
+	virtual ~TextureCache();
+
+	/// Look up a tile in the shared cache and load it on a miss
+	TilePtr lookupShared(const TiledTextureFile *file, uint32_t index, uint64_t key);
+
+	/// Ensure that tiles of the given size fit into the budget
+	void registerTileSize(size_t tileSize);
+
+	/// Recreate the shards (the caller must hold \c m_mutex)
+	void reset();
+
+	static LocalTiles &getLocalTiles();
+
+	static inline uint64_t hashKey(uint64_t key) {
+		key ^= key >> 29;
+		key *= 0xBF58476D1CE4E5B9ULL;
+		return key ^ (key >> 32);
+	}
+
+	friend class TiledTextureFile;
+private:
+	Shard m_shards[MTS_TEXCACHE_SHARDS];
+	ref<Mutex> m_mutex;
+	size_t m_budget;
+	size_t m_maxTileSize;
+	std::atomic<size_t> m_memoryUsage;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_TEXCACHE_H_ */
@@ -111,6 +111,9 @@ public:
 	 */
 	ref<TriMesh> createTriMesh();
 
+	/// Transform the vertex positions, normals and tangents in place
+	bool applyTransform(const Transform &trafo);
+
 	//! @}
 	// =============================================================
 
@@ -161,6 +164,15 @@ public:
 	/// Does the mesh have UV tangent information?
 	inline bool hasUVTangents() const { return m_tangents != NULL; };
 
+	/**
+	 * \brief Return the memory-mapped file holding the mesh data, if any
+	 *
+	 * Meshes loaded from the aligned variant of the serialized format
+	 * (see \ref serializeAligned()) refer to the mapped file instead of
+	 * owning copies of their arrays.
+	 */
+	inline const MemoryMappedFile *getMapping() const { return m_mapping.get(); }
+
 	//! @}
 	// =============================================================
 
@@ -251,6 +263,16 @@ public:
 	 */
 	void serialize(Stream *stream) const;
 
+	/**
+	 * \brief Serialize to an uncompressed file that can be memory-mapped
+	 *
+	 * Writes the same data as \ref serialize(Stream *), but leaves it
+	 * uncompressed and aligns all arrays to 64-byte file offsets. Meshes
+	 * stored in this way can be loaded without copying by mapping the file
+	 * into memory. The stream position must correspond to the file offset.
+	 */
+	void serializeAligned(Stream *stream) const;
+
 	/**
 	 * \brief Build a discrete probability distribution
 	 * for sampling.
@@ -324,6 +346,20 @@ protected:
 	/// Load a Mitsuba compressed triangle mesh substream
 	void loadCompressed(Stream *stream, int idx = 0);
 
+	/**
+	 * \brief Load the triangle mesh stored at the given offset of a
+	 * memory-mapped serialized file
+	 *
+	 * Meshes in the aligned format are used in place: the mesh arrays
+	 * point into the mapping, which should be copy-on-write (see
+	 * \ref MemoryMappedFile::mapCopyOnWrite()) when the mesh might
+	 * later be modified. Other meshes are decompressed as usual.
+	 */
+	void loadMapped(MemoryMappedFile *file, size_t offset);
+
+	/// Does the given file version store meshes in the aligned format?
+	static bool isAlignedVersion(short version);
+
 	/**
 	 * \brief Reads the header information of a compressed file, returning
 	 * the version ID.
@@ -352,6 +388,16 @@ protected:
 
 	/// Prepare internal tables for sampling uniformly wrt. area
 	void prepareSamplingTable();
+
+	/// Release a mesh array unless it lives in the memory-mapped file
+	template <typename T> inline void freeArray(T *&ptr) {
+		if (ptr && !isMapped(ptr))
+			delete[] ptr;
+		ptr = NULL;
+	}
+
+	/// Does the pointer refer to the memory-mapped file?
+	bool isMapped(const void *ptr) const;
 protected:
 	AABB m_aabb;
 	Triangle *m_triangles;
@@ -364,9 +410,10 @@ protected:
 	size_t m_vertexCount;
 	bool m_flipNormals;
 	bool m_faceNormals;
+	ref<MemoryMappedFile> m_mapping;
 
 	/* Surface and distribution -- generated on demand */
-	DiscreteDistribution m_areaDistr;
+	AliasDistribution m_areaDistr;
 	Float m_surfaceArea;
 	Float m_invSurfaceArea;
 	ref<Mutex> m_mutex;
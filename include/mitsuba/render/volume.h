@@ -71,6 +71,15 @@ public:
 	 */
 	virtual Float getMaximumFloatValue() const = 0;
 
+	/**
+	 * \brief Return the maximum floating point value that could be
+	 * returned by \ref lookupFloat within the given region.
+	 *
+	 * This is used to build local majorants for Woodcock-Tracking. The
+	 * default implementation returns \ref getMaximumFloatValue().
+	 */
+	virtual Float getLocalMaximumFloatValue(const AABB &aabb) const;
+
 	MTS_DECLARE_CLASS()
 protected:
 	/// Virtual destructor
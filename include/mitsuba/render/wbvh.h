@@ -0,0 +1,302 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_WBVH_H_)
+#define __MITSUBA_RENDER_WBVH_H_
+
+#include <mitsuba/core/aabb.h>
+#include <mitsuba/core/sse.h>
+#include <cstring>
+
+/// Maximum depth of a wide BVH (deeper subtrees are split at the median)
+#define MTS_WBVH_MAXDEPTH 64
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Wide bounding volume hierarchy with quantized node bounds
+ *
+ * Alternative to the SAH kd-tree for very large scenes: the tree is built
+ * with a binned surface area heuristic in time O(n log n) and only stores
+ * every primitive once. Each node holds up to \c Width (4 or 8) children,
+ * whose bounding boxes are quantized to 8 bits per coordinate relative to
+ * the node bounds. This shrinks an 8-wide node to 128 bytes, and all child
+ * boxes of a node are tested at once using SSE.
+ *
+ * The hierarchy only refers to primitives by index. Intersection of the
+ * primitives themselves is delegated to a functor passed to \ref rayIntersect(),
+ * which allows \ref ShapeKDTree to reuse its primitive intersection code.
+ *
+ * \ingroup librender
+ */
+template <int Width> class MTS_EXPORT_RENDER WideBVH {
+public:
+	BOOST_STATIC_ASSERT(Width == 4 || Width == 8);
+
+	/// Compressed node: child bounds are stored relative to the node bounds
+	struct MM_ALIGN16 Node {
+		/// Lower corner of the node bounds
+		float origin[3];
+		/// Quantization step per axis (a power of two)
+		float scale[3];
+		/// Quantized lower child bounds per axis
+		uint8_t lower[3][Width];
+		/// Quantized upper child bounds per axis
+		uint8_t upper[3][Width];
+		/// Index of an inner child node, or first index entry of a leaf
+		uint32_t child[Width];
+		/// Zero for inner children, otherwise the primitive count of a leaf
+		uint8_t count[Width];
+		/// Bit \c i is set if child \c i is in use
+		uint32_t validMask;
+	};
+
+	/// Create an empty hierarchy
+	WideBVH() : m_maxLeafSize(4), m_parallelBuild(true), m_depth(0) { }
+
+	/**
+	 * \brief Build the hierarchy over \c primCount primitives
+	 *
+	 * \param bounds
+	 *    Bounding box of every primitive
+	 * \param primCount
+	 *    Number of primitives
+	 */
+	void build(const AABB *bounds, uint32_t primCount);
+
+	/**
+	 * \brief Recompute the node bounds after the primitives have moved
+	 *
+	 * The topology of the hierarchy is kept, which is much faster than a
+	 * rebuild but degrades the traversal performance after large motions.
+	 *
+	 * \param bounds
+	 *    New bounding box of every primitive (the primitive count must
+	 *    be the same as in the last call to \ref build())
+	 */
+	void refit(const AABB *bounds);
+
+	/// Set the maximum number of primitives in a leaf (at most 16)
+	inline void setMaxLeafSize(int size) { m_maxLeafSize = std::max(1, std::min(size, 16)); }
+
+	/// Return the maximum number of primitives in a leaf
+	inline int getMaxLeafSize() const { return m_maxLeafSize; }
+
+	/// Build large subtrees on multiple threads?
+	inline void setParallelBuild(bool parallel) { m_parallelBuild = parallel; }
+
+	/// Return whether large subtrees are built on multiple threads
+	inline bool getParallelBuild() const { return m_parallelBuild; }
+
+	/// Return whether the hierarchy has been built
+	inline bool isBuilt() const { return !m_nodes.empty(); }
+
+	/// Return the number of nodes
+	inline size_t getNodeCount() const { return m_nodes.size(); }
+
+	/// Return the depth of the hierarchy
+	inline int getDepth() const { return m_depth; }
+
+	/// Return the bounding box of all primitives
+	inline const AABB &getAABB() const { return m_aabb; }
+
+	/// Return the memory used by nodes and primitive indices in bytes
+	inline size_t getMemoryUsage() const {
+		return m_nodes.capacity() * sizeof(Node) + m_indices.capacity() * sizeof(uint32_t);
+	}
+
+	/**
+	 * \brief Find the closest (or any) primitive intersection
+	 *
+	 * \param mint
+	 *    Start of the search interval
+	 * \param maxt
+	 *    End of the search interval. When a hit is found and
+	 *    \c ShadowRay is \c false, receives its distance.
+	 * \param intersect
+	 *    Functor with signature <tt>bool (uint32_t prim, Float mint,
+	 *    Float maxt, Float &t)</tt>, which intersects a primitive and
+	 *    must only report hits within <tt>[mint, maxt]</tt>
+	 */
+	template <bool ShadowRay, typename Intersector> FINLINE bool rayIntersect(
+			const Ray &ray, Float mint, Float &maxt, const Intersector &intersect) const {
+		struct StackEntry {
+			uint32_t index;
+			uint32_t count;
+			Float tnear;
+		} stack[MTS_WBVH_MAXDEPTH * (Width - 1) + 1];
+
+		const RayInfo rayInfo(ray);
+		bool hit = false;
+		int stackIndex = 0;
+		stack[stackIndex].index = 0;
+		stack[stackIndex].count = 0;
+		stack[stackIndex].tnear = mint;
+		++stackIndex;
+
+		while (stackIndex > 0) {
+			const StackEntry entry = stack[--stackIndex];
+			if (entry.tnear > maxt)
+				continue;
+
+			if (entry.count == 0) {
+				/* Inner node: test all children at once */
+				const Node &node = m_nodes[entry.index];
+				Float tnear[Width];
+				uint32_t mask = intersectNode(node, rayInfo, mint, maxt, tnear);
+
+				/* Push the hit children, nearest on top */
+				int first = stackIndex;
+				while (mask) {
+					int i = firstBit(mask);
+					mask &= mask - 1;
+					StackEntry child;
+					child.index = node.child[i];
+					child.count = node.count[i];
+					child.tnear = tnear[i];
+					int j = stackIndex++;
+					if (!ShadowRay) {
+						while (j > first && stack[j-1].tnear < child.tnear) {
+							stack[j] = stack[j-1];
+							--j;
+						}
+					}
+					stack[j] = child;
+				}
+			} else {
+				/* Leaf node: intersect the primitives */
+				for (uint32_t i=0; i<entry.count; ++i) {
+					Float t;
+					if (intersect(m_indices[entry.index + i], mint, maxt, t)) {
+						if (ShadowRay)
+							return true;
+						maxt = t;
+						hit = true;
+					}
+				}
+			}
+		}
+
+		return hit;
+	}
+
+protected:
+	/// Per-ray data used for the node tests
+	struct RayInfo {
+		float o[3], dRcp[3];
+		int nearIsUpper[3];
+
+		inline RayInfo(const Ray &ray) {
+			for (int i=0; i<3; ++i) {
+				o[i] = (float) ray.o[i];
+				dRcp[i] = (float) ray.dRcp[i];
+				nearIsUpper[i] = ray.dRcp[i] < 0;
+			}
+		}
+	};
+
+	static FINLINE int firstBit(uint32_t mask) {
+#if defined(__MSVC__)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return (int) index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	/**
+	 * \brief Intersect a ray with the children of a node
+	 * \return Bit mask of the children hit within <tt>[mint, maxt]</tt>
+	 */
+	static FINLINE uint32_t intersectNode(const Node &node, const RayInfo &ray,
+			Float mint, Float maxt, Float *tnear) {
+		/* Slightly enlarge the exit distance to be robust
+		   against rounding errors in the slab test */
+		const float robust = 1.0f + 4 * std::numeric_limits<float>::epsilon();
+		uint32_t mask = 0;
+
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+		for (int g=0; g<Width; g += 4) {
+			__m128 tNear = _mm_set1_ps(mint), tFar = _mm_set1_ps(maxt);
+			for (int axis=0; axis<3; ++axis) {
+				const uint8_t *qNear = ray.nearIsUpper[axis] ? node.upper[axis] : node.lower[axis];
+				const uint8_t *qFar  = ray.nearIsUpper[axis] ? node.lower[axis] : node.upper[axis];
+				const __m128 origin = _mm_set1_ps(node.origin[axis] - ray.o[axis]),
+					scale = _mm_set1_ps(node.scale[axis]),
+					dRcp = _mm_set1_ps(ray.dRcp[axis]);
+				const __m128 t0 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(loadQuantized(qNear + g), scale), origin), dRcp);
+				const __m128 t1 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(loadQuantized(qFar + g), scale), origin), dRcp);
+				/* NaNs (0 * inf) in t0/t1 leave the interval unchanged */
+				tNear = _mm_max_ps(t0, tNear);
+				tFar = _mm_min_ps(t1, tFar);
+			}
+			tFar = _mm_mul_ps(tFar, _mm_set1_ps(robust));
+			mask |= (uint32_t) _mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) << g;
+			_mm_storeu_ps(tnear + g, tNear);
+		}
+#else
+		for (int i=0; i<Width; ++i) {
+			float tNear = (float) mint, tFar = (float) maxt;
+			for (int axis=0; axis<3; ++axis) {
+				const uint8_t qNear = ray.nearIsUpper[axis] ? node.upper[axis][i] : node.lower[axis][i];
+				const uint8_t qFar  = ray.nearIsUpper[axis] ? node.lower[axis][i] : node.upper[axis][i];
+				const float origin = node.origin[axis] - ray.o[axis];
+				const float t0 = (qNear * node.scale[axis] + origin) * ray.dRcp[axis];
+				const float t1 = (qFar * node.scale[axis] + origin) * ray.dRcp[axis];
+				if (t0 > tNear) tNear = t0;
+				if (t1 < tFar) tFar = t1;
+			}
+			if (tNear <= tFar * robust)
+				mask |= 1u << i;
+			tnear[i] = tNear;
+		}
+#endif
+		return mask & node.validMask;
+	}
+
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+	/// Convert four quantized coordinates to floating point
+	static FINLINE __m128 loadQuantized(const uint8_t *ptr) {
+		int32_t bytes;
+		memcpy(&bytes, ptr, sizeof(int32_t));
+		__m128i v = _mm_cvtsi32_si128(bytes);
+		v = _mm_unpacklo_epi8(v, _mm_setzero_si128());
+		v = _mm_unpacklo_epi16(v, _mm_setzero_si128());
+		return _mm_cvtepi32_ps(v);
+	}
+#endif
+
+protected:
+	struct BuildContext;
+
+	/// Refit the subtree below the given node and return its bounds
+	AABB refitNode(const AABB *bounds, uint32_t nodeIndex);
+
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_indices;
+	AABB m_aabb;
+	int m_maxLeafSize;
+	bool m_parallelBuild;
+	int m_depth;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_WBVH_H_ */
@@ -22,6 +22,7 @@
 #include <mitsuba/hw/basicshader.h>
 #endif
 #include <mitsuba/core/warp.h>
+#include "ssebsdf.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -151,6 +152,78 @@ public:
 		return m_reflectance->eval(bRec.its);
 	}
 
+#if defined(MTS_BSDF_BATCH_SSE)
+	void evalBatch(const BSDFQueryBatch &batch, Spectrum *result, EMeasure measure) const {
+		if (!(batch.typeMask & EDiffuseReflection) || measure != ESolidAngle) {
+			for (size_t i=0; i<batch.size; ++i)
+				result[i] = Spectrum(0.0f);
+			return;
+		}
+
+		const SSEVector4f zero = SSEVector4f::zero();
+		Spectrum reflectance[4];
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset);
+			SSEVector4f value = SSEVector4f(INV_PI) * packet.wo.z;
+			value &= (packet.wi.z > zero) & (packet.wo.z > zero);
+
+			MM_ALIGN16 float valueArray[4];
+			_mm_store_ps(valueArray, value);
+			packet.evalTexture(batch, m_reflectance.get(), reflectance);
+			for (size_t i=0; i<packet.count; ++i)
+				result[offset + i] = reflectance[i] * valueArray[i];
+		}
+	}
+
+	void pdfBatch(const BSDFQueryBatch &batch, Float *result, EMeasure measure) const {
+		if (!(batch.typeMask & EDiffuseReflection) || measure != ESolidAngle) {
+			for (size_t i=0; i<batch.size; ++i)
+				result[i] = 0.0f;
+			return;
+		}
+
+		const SSEVector4f zero = SSEVector4f::zero();
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset);
+			SSEVector4f value = SSEVector4f(INV_PI) * packet.wo.z;
+			packet.store(result, value & (packet.wi.z > zero) & (packet.wo.z > zero));
+		}
+	}
+
+	void sampleBatch(const BSDFQueryBatch &batch, const Point2 *sample,
+			Spectrum *weight, Float *pdf) const {
+		if (!(batch.typeMask & EDiffuseReflection)) {
+			for (size_t i=0; i<batch.size; ++i) {
+				weight[i] = Spectrum(0.0f);
+				if (pdf)
+					pdf[i] = 0.0f;
+			}
+			return;
+		}
+
+		const SSEVector4f zero = SSEVector4f::zero();
+		Spectrum reflectance[4];
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset, false);
+			SSEVector4f u1, u2;
+			packet.loadSamples(sample, u1, u2);
+
+			SSEVector3f wo = squareToCosineHemisphere(u1, u2);
+			SSEVector4f valid = packet.wi.z > zero;
+			packet.storeWo(batch, wo);
+			if (pdf)
+				packet.store(pdf, (SSEVector4f(INV_PI) * wo.z) & valid);
+
+			int validMask = _mm_movemask_ps(valid);
+			packet.evalTexture(batch, m_reflectance.get(), reflectance);
+			for (size_t i=0; i<packet.count; ++i) {
+				weight[offset + i] = (validMask & (1 << i)) ? reflectance[i] : Spectrum(0.0f);
+				packet.storeSampled(batch, i, 1.0f, EDiffuseReflection, 0);
+			}
+		}
+	}
+#endif
+
 	void addChild(const std::string &name, ConfigurableObject *child) {
 		if (child->getClass()->derivesFrom(MTS_CLASS(Texture))
 				&& (name == "reflectance" || name == "diffuseReflectance")) {
@@ -22,6 +22,7 @@
 #include <mitsuba/mitsuba.h>
 #include <mitsuba/core/frame.h>
 #include <mitsuba/core/properties.h>
+#include "ssebsdf.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -719,6 +720,221 @@ protected:
 	Float m_exponentU, m_exponentV;
 };
 
+#if defined(MTS_BSDF_BATCH_SSE)
+/**
+ * \brief Vectorized counterpart of \ref MicrofacetDistribution, which
+ * processes four queries with individual roughness values at once
+ *
+ * This class is used by the batched BSDF evaluation routines (see
+ * \ref BSDF::evalBatch()) and supports the Beckmann and GGX distributions.
+ * Visible normal sampling of the GGX distribution is fully vectorized;
+ * all other sampling techniques are delegated to the scalar implementation
+ * one lane at a time.
+ */
+class MicrofacetDistribution4 {
+public:
+	typedef MicrofacetDistribution::EType EType;
+
+	/// Create a vectorized microfacet distribution of the specified type
+	inline MicrofacetDistribution4(EType type, const SSEVector4f &alphaU,
+			const SSEVector4f &alphaV, bool sampleVisible = true)
+		: m_type(type), m_sampleVisible(sampleVisible) {
+		SAssert(type == MicrofacetDistribution::EBeckmann || type == MicrofacetDistribution::EGGX);
+		m_alphaU = max(alphaU, SSEVector4f(1e-4f));
+		m_alphaV = max(alphaV, SSEVector4f(1e-4f));
+	}
+
+	/// Scale the roughness values by some constant
+	inline void scaleAlpha(const SSEVector4f &value) {
+		m_alphaU *= value;
+		m_alphaV *= value;
+	}
+
+	/// Return the scalar microfacet distribution associated with lane \c i
+	inline MicrofacetDistribution getLane(int i) const {
+		return MicrofacetDistribution(m_type, extractLane(m_alphaU, i),
+			extractLane(m_alphaV, i), m_sampleVisible);
+	}
+
+	/// Evaluate the microfacet distribution function (see \ref MicrofacetDistribution::eval())
+	inline SSEVector4f eval(const SSEVector3f &m) const {
+		const SSEVector4f zero = SSEVector4f::zero();
+		SSEVector4f cosTheta2 = m.z * m.z;
+		SSEVector4f beckmannExponent = ((m.x*m.x) / (m_alphaU * m_alphaU)
+				+ (m.y*m.y) / (m_alphaV * m_alphaV)) / cosTheta2;
+
+		SSEVector4f result;
+		if (m_type == MicrofacetDistribution::EBeckmann) {
+			result = SSEVector4f(math::exp_ps(beckmannExponent ^ SSEVector4f(-0.0f))) /
+				(SSEVector4f((float) M_PI) * m_alphaU * m_alphaV * cosTheta2 * cosTheta2);
+		} else {
+			SSEVector4f root = (SSEVector4f(1.0f) + beckmannExponent) * cosTheta2;
+			result = SSEVector4f(1.0f) / (SSEVector4f((float) M_PI) * m_alphaU * m_alphaV * root * root);
+		}
+
+		/* Prevent potential numerical issues in other stages of the model */
+		SSEVector4f valid = (m.z > zero) & (result * m.z >= SSEVector4f(1e-20f));
+		return result & valid;
+	}
+
+	/// Smith's shadowing-masking function G1 (see \ref MicrofacetDistribution::smithG1())
+	inline SSEVector4f smithG1(const SSEVector3f &v, const SSEVector3f &m) const {
+		const SSEVector4f zero = SSEVector4f::zero(), one(1.0f);
+
+		/* Ensure consistent orientation (can't see the back
+		   of the microfacet from the front and vice versa) */
+		SSEVector4f valid = dot(v, m) * v.z > zero;
+
+		SSEVector4f sinTheta2 = one - v.z * v.z;
+		SSEVector4f tanTheta = math::abs_ps(SSEVector4f(_mm_sqrt_ps(
+			max(sinTheta2, zero))) / v.z) & (sinTheta2 > zero);
+
+		/* Compute the effective roughness projected on direction v */
+		SSEVector4f invSinTheta2 = one / sinTheta2;
+		SSEVector4f alpha = SSEVector4f(_mm_sqrt_ps(v.x * v.x * invSinTheta2 * m_alphaU * m_alphaU
+			+ v.y * v.y * invSinTheta2 * m_alphaV * m_alphaV));
+		alpha = select((m_alphaU == m_alphaV) | (invSinTheta2 <= zero), m_alphaU, alpha);
+
+		SSEVector4f result;
+		if (m_type == MicrofacetDistribution::EBeckmann) {
+			/* Use a fast and accurate (<0.35% rel. error) rational
+			   approximation to the shadowing-masking function */
+			SSEVector4f a = one / (alpha * tanTheta), aSqr = a*a;
+			result = (SSEVector4f(3.535f) * a + SSEVector4f(2.181f) * aSqr)
+				/ (one + SSEVector4f(2.276f) * a + SSEVector4f(2.577f) * aSqr);
+			result = select(a >= SSEVector4f(1.6f), one, result);
+		} else {
+			SSEVector4f root = alpha * tanTheta;
+			result = SSEVector4f(2.0f) / (one + SSEVector4f(_mm_sqrt_ps(one + root * root)));
+		}
+
+		/* Perpendicular incidence -- no shadowing/masking */
+		result = select(tanTheta == zero, one, result);
+
+		return result & valid;
+	}
+
+	/// Separable shadow-masking function based on Smith's one-dimensional masking model
+	inline SSEVector4f G(const SSEVector3f &wi, const SSEVector3f &wo, const SSEVector3f &m) const {
+		return smithG1(wi, m) * smithG1(wo, m);
+	}
+
+	/// Probability density of \ref sampleVisible()
+	inline SSEVector4f pdfVisible(const SSEVector3f &wi, const SSEVector3f &m) const {
+		SSEVector4f result = smithG1(wi, m) * math::abs_ps(dot(wi, m)) * eval(m)
+			/ SSEVector4f(math::abs_ps(wi.z));
+		return result & (wi.z != SSEVector4f::zero());
+	}
+
+	/// Probability density of \ref sample() (see \ref MicrofacetDistribution::pdf())
+	inline SSEVector4f pdf(const SSEVector3f &wi, const SSEVector3f &m) const {
+		if (m_sampleVisible)
+			return pdfVisible(wi, m);
+		else
+			return eval(m) * m.z;
+	}
+
+	/**
+	 * \brief Sample a microfacet normal for each lane and return the
+	 * associated probability densities (see \ref MicrofacetDistribution::sample())
+	 */
+	inline SSEVector3f sample(const SSEVector3f &wi, const SSEVector4f &u1,
+			const SSEVector4f &u2, SSEVector4f &pdf) const {
+		if (m_sampleVisible && m_type == MicrofacetDistribution::EGGX) {
+			SSEVector3f m = sampleVisibleGGX(wi, u1, u2);
+			pdf = pdfVisible(wi, m);
+			return m;
+		}
+
+		MM_ALIGN16 float mx[4], my[4], mz[4], tmpPdf[4], s1[4], s2[4];
+		_mm_store_ps(s1, u1); _mm_store_ps(s2, u2);
+		for (int i=0; i<4; ++i) {
+			Normal m = getLane(i).sample(wi.get(i), Point2(s1[i], s2[i]), tmpPdf[i]);
+			mx[i] = m.x; my[i] = m.y; mz[i] = m.z;
+		}
+		pdf = _mm_load_ps(tmpPdf);
+		return SSEVector3f(_mm_load_ps(mx), _mm_load_ps(my), _mm_load_ps(mz));
+	}
+
+protected:
+	/// Vectorized visible normal sampling for the GGX distribution
+	inline SSEVector3f sampleVisibleGGX(const SSEVector3f &_wi,
+			const SSEVector4f &u1, const SSEVector4f &_u2) const {
+		const SSEVector4f zero = SSEVector4f::zero(), one(1.0f);
+
+		/* Step 1: stretch wi */
+		SSEVector3f wi = normalize(SSEVector3f(m_alphaU * _wi.x, m_alphaV * _wi.y, _wi.z));
+
+		/* Get polar coordinates (the angles themselves are not needed) */
+		SSEVector4f normalIncidence = wi.z >= SSEVector4f(0.99999f);
+		SSEVector4f sinThetaI = SSEVector4f(_mm_sqrt_ps(wi.x * wi.x + wi.y * wi.y));
+		SSEVector4f hasPhi = andnot(normalIncidence, sinThetaI > zero);
+		SSEVector4f cosPhi = select(hasPhi, wi.x / sinThetaI, one),
+		            sinPhi = select(hasPhi, wi.y / sinThetaI, zero);
+		SSEVector4f tanThetaI = sinThetaI / wi.z;
+
+		/* Step 2: simulate P22_{wi}(slope.x, slope.y, 1, 1) */
+		SSEVector4f a = one / tanThetaI;
+		SSEVector4f G1 = SSEVector4f(2.0f) / (one + math::safe_sqrt_ps(one + one / (a*a)));
+
+		/* Simulate X component */
+		SSEVector4f A = SSEVector4f(2.0f) * u1 / G1 - one;
+		A = select(math::abs_ps(A) == one, A - SSEVector4f(math::signum_ps(A))
+			* SSEVector4f(Epsilon), A);
+		SSEVector4f tmp = one / (A*A - one);
+		SSEVector4f B = tanThetaI;
+		SSEVector4f D = math::safe_sqrt_ps(B*B*tmp*tmp - (A*A - B*B) * tmp);
+		SSEVector4f slopeX1 = B * tmp - D, slopeX2 = B * tmp + D;
+		SSEVector4f slopeX = select((A < zero) | (slopeX2 > a), slopeX1, slopeX2);
+
+		/* Simulate Y component */
+		SSEVector4f upper = _u2 > SSEVector4f(0.5f);
+		SSEVector4f S = select(upper, one, SSEVector4f(-1.0f));
+		SSEVector4f u2 = SSEVector4f(2.0f) * select(upper,
+			_u2 - SSEVector4f(0.5f), SSEVector4f(0.5f) - _u2);
+
+		/* Improved fit */
+		SSEVector4f z =
+			(u2 * (u2 * (u2 * SSEVector4f(-0.365728915865723f) + SSEVector4f(0.790235037209296f)) -
+				SSEVector4f(0.424965825137544f)) + SSEVector4f(0.000152998850436920f)) /
+			(u2 * (u2 * (u2 * (u2 * SSEVector4f(0.169507819808272f) - SSEVector4f(0.397203533833404f)) -
+				SSEVector4f(0.232500544458471f)) + one) - SSEVector4f(0.539825872510702f));
+		SSEVector4f slopeY = S * z * SSEVector4f(_mm_sqrt_ps(one + slopeX*slopeX));
+
+		/* Special case (normal incidence) */
+		if (_mm_movemask_ps(normalIncidence)) {
+			__m128 sinPhiN, cosPhiN;
+			math::sincos_ps(SSEVector4f((float) (2 * M_PI)) * _u2, &sinPhiN, &cosPhiN);
+			SSEVector4f r = math::safe_sqrt_ps(u1 / (one - u1));
+			slopeX = select(normalIncidence, r * SSEVector4f(cosPhiN), slopeX);
+			slopeY = select(normalIncidence, r * SSEVector4f(sinPhiN), slopeY);
+		}
+
+		/* Step 3: rotate */
+		SSEVector4f rotX = cosPhi * slopeX - sinPhi * slopeY,
+		            rotY = sinPhi * slopeX + cosPhi * slopeY;
+
+		/* Step 4: unstretch */
+		rotX *= m_alphaU;
+		rotY *= m_alphaV;
+
+		/* Step 5: compute normal */
+		SSEVector4f normalization = one / SSEVector4f(_mm_sqrt_ps(rotX*rotX + rotY*rotY + one));
+
+		return SSEVector3f(
+			(rotX * normalization) ^ SSEVector4f(-0.0f),
+			(rotY * normalization) ^ SSEVector4f(-0.0f),
+			normalization
+		);
+	}
+
+protected:
+	EType m_type;
+	SSEVector4f m_alphaU, m_alphaV;
+	bool m_sampleVisible;
+};
+#endif
+
 MTS_NAMESPACE_END
 
 #endif /* __MICROFACET_H */
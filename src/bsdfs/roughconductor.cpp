@@ -417,6 +417,167 @@ public:
 		return F * weight;
 	}
 
+#if defined(MTS_BSDF_BATCH_SSE)
+	void evalBatch(const BSDFQueryBatch &batch, Spectrum *result, EMeasure measure) const {
+		if (m_type == MicrofacetDistribution::EPhong) {
+			BSDF::evalBatch(batch, result, measure);
+			return;
+		}
+
+		/* Stop if this component was not requested */
+		if (measure != ESolidAngle ||
+			((batch.component != -1 && batch.component != 0) ||
+			!(batch.typeMask & EGlossyReflection))) {
+			for (size_t i=0; i<batch.size; ++i)
+				result[i] = Spectrum(0.0f);
+			return;
+		}
+
+		const SSEVector4f zero = SSEVector4f::zero();
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset);
+			const SSEVector3f &wi = packet.wi, &wo = packet.wo;
+
+			/* Calculate the reflection half-vector */
+			SSEVector3f H = normalize(wo + wi);
+
+			/* Construct the microfacet distributions matching the
+			   roughness values at the current surface positions. */
+			MicrofacetDistribution4 distr(
+				m_type,
+				packet.evalTextureAverage(batch, m_alphaU.get()),
+				packet.evalTextureAverage(batch, m_alphaV.get()),
+				m_sampleVisible
+			);
+
+			/* Microfacet distribution and Smith's shadow-masking function */
+			SSEVector4f model = distr.eval(H) * distr.G(wi, wo, H)
+				/ (SSEVector4f(4.0f) * wi.z);
+			model &= (wi.z > zero) & (wo.z > zero);
+
+			evalFresnel(batch, packet, dot(wi, H), model, result);
+		}
+	}
+
+	void pdfBatch(const BSDFQueryBatch &batch, Float *result, EMeasure measure) const {
+		if (m_type == MicrofacetDistribution::EPhong) {
+			BSDF::pdfBatch(batch, result, measure);
+			return;
+		}
+
+		if (measure != ESolidAngle ||
+			((batch.component != -1 && batch.component != 0) ||
+			!(batch.typeMask & EGlossyReflection))) {
+			for (size_t i=0; i<batch.size; ++i)
+				result[i] = 0.0f;
+			return;
+		}
+
+		const SSEVector4f zero = SSEVector4f::zero();
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset);
+			const SSEVector3f &wi = packet.wi, &wo = packet.wo;
+
+			/* Calculate the reflection half-vector */
+			SSEVector3f H = normalize(wo + wi);
+
+			MicrofacetDistribution4 distr(
+				m_type,
+				packet.evalTextureAverage(batch, m_alphaU.get()),
+				packet.evalTextureAverage(batch, m_alphaV.get()),
+				m_sampleVisible
+			);
+
+			SSEVector4f pdf;
+			if (m_sampleVisible)
+				pdf = distr.eval(H) * distr.smithG1(wi, H)
+					/ (SSEVector4f(4.0f) * wi.z);
+			else
+				pdf = distr.pdf(wi, H) / (SSEVector4f(4.0f)
+					* SSEVector4f(math::abs_ps(dot(wo, H))));
+
+			packet.store(result, pdf & (wi.z > zero) & (wo.z > zero));
+		}
+	}
+
+	void sampleBatch(const BSDFQueryBatch &batch, const Point2 *sample,
+			Spectrum *weight, Float *pdf) const {
+		if (m_type == MicrofacetDistribution::EPhong) {
+			BSDF::sampleBatch(batch, sample, weight, pdf);
+			return;
+		}
+
+		if ((batch.component != -1 && batch.component != 0) ||
+			!(batch.typeMask & EGlossyReflection)) {
+			for (size_t i=0; i<batch.size; ++i) {
+				weight[i] = Spectrum(0.0f);
+				if (pdf)
+					pdf[i] = 0.0f;
+			}
+			return;
+		}
+
+		const SSEVector4f zero = SSEVector4f::zero();
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset, false);
+			const SSEVector3f &wi = packet.wi;
+			SSEVector4f u1, u2;
+			packet.loadSamples(sample, u1, u2);
+
+			MicrofacetDistribution4 distr(
+				m_type,
+				packet.evalTextureAverage(batch, m_alphaU.get()),
+				packet.evalTextureAverage(batch, m_alphaV.get()),
+				m_sampleVisible
+			);
+
+			/* Sample M, the microfacet normal */
+			SSEVector4f microfacetPdf;
+			SSEVector3f m = distr.sample(wi, u1, u2, microfacetPdf);
+
+			/* Perfect specular reflection based on the microfacet normal */
+			SSEVector3f wo = mitsuba::reflect(wi, m);
+
+			/* Side check */
+			SSEVector4f valid = (wi.z >= zero) & (microfacetPdf != zero) & (wo.z > zero);
+
+			SSEVector4f sampleWeight;
+			if (m_sampleVisible)
+				sampleWeight = distr.smithG1(wo, m);
+			else
+				sampleWeight = distr.eval(m) * distr.G(wi, wo, m) * dot(wi, m)
+					/ (microfacetPdf * wi.z);
+
+			evalFresnel(batch, packet, dot(wi, m), sampleWeight & valid, weight);
+			packet.storeWo(batch, wo);
+			if (pdf) {
+				/* Jacobian of the half-direction mapping */
+				packet.store(pdf, (microfacetPdf / (SSEVector4f(4.0f) * dot(wo, m))) & valid);
+			}
+			for (size_t i=0; i<packet.count; ++i)
+				packet.storeSampled(batch, i, 1.0f, EGlossyReflection, 0);
+		}
+	}
+
+	/// Compute <tt>F(cosThetaI) * specularReflectance * scale</tt> for each query of a packet
+	inline void evalFresnel(const BSDFQueryBatch &batch, const BSDFQueryPacket &packet,
+			const SSEVector4f &cosThetaI, const SSEVector4f &scale, Spectrum *result) const {
+		MM_ALIGN16 float F[SPECTRUM_SAMPLES][4];
+		for (int c=0; c<SPECTRUM_SAMPLES; ++c)
+			_mm_store_ps(F[c], fresnelConductorExact(cosThetaI, m_eta[c], m_k[c]) * scale);
+
+		Spectrum specularReflectance[4];
+		packet.evalTexture(batch, m_specularReflectance.get(), specularReflectance);
+
+		for (size_t i=0; i<packet.count; ++i) {
+			Spectrum value;
+			for (int c=0; c<SPECTRUM_SAMPLES; ++c)
+				value[c] = F[c][i];
+			result[packet.offset + i] = value * specularReflectance[i];
+		}
+	}
+#endif
+
 	void addChild(const std::string &name, ConfigurableObject *child) {
 		if (child->getClass()->derivesFrom(MTS_CLASS(Texture))) {
 			if (name == "alpha")
@@ -617,6 +617,265 @@ public:
 		return weight;
 	}
 
+#if defined(MTS_BSDF_BATCH_SSE)
+	void evalBatch(const BSDFQueryBatch &batch, Spectrum *result, EMeasure measure) const {
+		bool hasReflection   = ((batch.component == -1 || batch.component == 0)
+							  && (batch.typeMask & EGlossyReflection)),
+		     hasTransmission = ((batch.component == -1 || batch.component == 1)
+							  && (batch.typeMask & EGlossyTransmission));
+
+		if (m_type == MicrofacetDistribution::EPhong) {
+			BSDF::evalBatch(batch, result, measure);
+			return;
+		} else if (measure != ESolidAngle || (!hasReflection && !hasTransmission)) {
+			for (size_t i=0; i<batch.size; ++i)
+				result[i] = Spectrum(0.0f);
+			return;
+		}
+
+		const SSEVector4f zero = SSEVector4f::zero(), one(1.0f);
+		Spectrum reflectance[4], transmittance[4];
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset);
+			const SSEVector3f &wi = packet.wi, &wo = packet.wo;
+
+			/* Determine the type of interaction */
+			SSEVector4f reflect = wi.z * wo.z > zero;
+			SSEVector4f eta = select(wi.z > zero, SSEVector4f(m_eta), SSEVector4f(m_invEta));
+
+			/* Calculate the reflection or transmission half-vector and ensure that
+			   it points into the same hemisphere as the macrosurface normal */
+			SSEVector3f H = normalize(select(reflect, wo + wi, wi + wo * eta));
+			H = H * SSEVector4f(math::signum_ps(H.z));
+
+			MicrofacetDistribution4 distr(
+				m_type,
+				packet.evalTextureAverage(batch, m_alphaU.get()),
+				packet.evalTextureAverage(batch, m_alphaV.get()),
+				m_sampleVisible
+			);
+
+			/* Microfacet distribution, Fresnel factor and Smith's shadow-masking function */
+			const SSEVector4f D = distr.eval(H);
+			const SSEVector4f F = fresnelDielectricExt(dot(wi, H), m_eta);
+			const SSEVector4f G = distr.G(wi, wo, H);
+			const SSEVector4f dotWiH = dot(wi, H), dotWoH = dot(wo, H);
+
+			/* Calculate the total amount of reflection */
+			SSEVector4f reflectValue = F * D * G / (SSEVector4f(4.0f) * math::abs_ps(wi.z));
+
+			/* Calculate the total amount of transmission */
+			SSEVector4f sqrtDenom = dotWiH + eta * dotWoH;
+			SSEVector4f transmitValue = ((one - F) * D * G * eta * eta * dotWiH * dotWoH)
+				/ (wi.z * sqrtDenom * sqrtDenom);
+
+			/* Account for the solid angle compression when tracing radiance */
+			if (batch.mode == ERadiance) {
+				SSEVector4f factor = select(wi.z > zero, SSEVector4f(m_invEta), SSEVector4f(m_eta));
+				transmitValue *= factor * factor;
+			}
+			transmitValue = math::abs_ps(transmitValue);
+
+			SSEVector4f valid = (wi.z != zero) & (D != zero);
+			reflectValue &= valid & reflect & laneMask(hasReflection);
+			transmitValue &= andnot(reflect, valid) & laneMask(hasTransmission);
+
+			MM_ALIGN16 float reflectArray[4], transmitArray[4];
+			_mm_store_ps(reflectArray, reflectValue);
+			_mm_store_ps(transmitArray, transmitValue);
+			if (hasReflection)
+				packet.evalTexture(batch, m_specularReflectance.get(), reflectance);
+			if (hasTransmission)
+				packet.evalTexture(batch, m_specularTransmittance.get(), transmittance);
+
+			for (size_t i=0; i<packet.count; ++i) {
+				Spectrum value(0.0f);
+				if (hasReflection)
+					value += reflectance[i] * reflectArray[i];
+				if (hasTransmission)
+					value += transmittance[i] * transmitArray[i];
+				result[offset + i] = value;
+			}
+		}
+	}
+
+	void pdfBatch(const BSDFQueryBatch &batch, Float *result, EMeasure measure) const {
+		bool hasReflection   = ((batch.component == -1 || batch.component == 0)
+							  && (batch.typeMask & EGlossyReflection)),
+		     hasTransmission = ((batch.component == -1 || batch.component == 1)
+							  && (batch.typeMask & EGlossyTransmission));
+
+		if (m_type == MicrofacetDistribution::EPhong) {
+			BSDF::pdfBatch(batch, result, measure);
+			return;
+		} else if (measure != ESolidAngle || (!hasReflection && !hasTransmission)) {
+			for (size_t i=0; i<batch.size; ++i)
+				result[i] = 0.0f;
+			return;
+		}
+
+		const SSEVector4f zero = SSEVector4f::zero(), one(1.0f);
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset);
+			const SSEVector3f &wi = packet.wi, &wo = packet.wo;
+
+			/* Determine the type of interaction */
+			SSEVector4f reflect = wi.z * wo.z > zero;
+			SSEVector4f eta = select(wi.z > zero, SSEVector4f(m_eta), SSEVector4f(m_invEta));
+
+			/* Calculate the half-vector and the Jacobian of the half-direction mapping */
+			SSEVector3f H = normalize(select(reflect, wo + wi, wi + wo * eta));
+			SSEVector4f dotWoH = dot(wo, H), sqrtDenom = dot(wi, H) + eta * dotWoH;
+			SSEVector4f dwh_dwo = select(reflect,
+				one / (SSEVector4f(4.0f) * dotWoH),
+				(eta * eta * dotWoH) / (sqrtDenom * sqrtDenom));
+
+			/* Ensure that the half-vector points into the
+			   same hemisphere as the macrosurface normal */
+			H = H * SSEVector4f(math::signum_ps(H.z));
+
+			MicrofacetDistribution4 sampleDistr(
+				m_type,
+				packet.evalTextureAverage(batch, m_alphaU.get()),
+				packet.evalTextureAverage(batch, m_alphaV.get()),
+				m_sampleVisible
+			);
+
+			/* Trick by Walter et al.: slightly scale the roughness values to
+			   reduce importance sampling weights. */
+			if (!m_sampleVisible)
+				sampleDistr.scaleAlpha(SSEVector4f(1.2f) - SSEVector4f(0.2f)
+					* SSEVector4f(_mm_sqrt_ps(math::abs_ps(wi.z))));
+
+			/* Evaluate the microfacet model sampling density function */
+			SSEVector4f prob = sampleDistr.pdf(wi * SSEVector4f(math::signum_ps(wi.z)), H);
+
+			if (hasTransmission && hasReflection) {
+				SSEVector4f F = fresnelDielectricExt(dot(wi, H), m_eta);
+				prob *= select(reflect, F, one - F);
+			}
+
+			SSEVector4f valid = select(reflect, laneMask(hasReflection),
+				laneMask(hasTransmission));
+			packet.store(result, math::abs_ps(prob * dwh_dwo) & valid);
+		}
+	}
+
+	void sampleBatch(const BSDFQueryBatch &batch, const Point2 *sample,
+			Spectrum *weight, Float *pdf) const {
+		bool hasReflection   = ((batch.component == -1 || batch.component == 0)
+							  && (batch.typeMask & EGlossyReflection)),
+		     hasTransmission = ((batch.component == -1 || batch.component == 1)
+							  && (batch.typeMask & EGlossyTransmission));
+
+		if (m_type == MicrofacetDistribution::EPhong) {
+			BSDF::sampleBatch(batch, sample, weight, pdf);
+			return;
+		} else if (!hasReflection && !hasTransmission) {
+			for (size_t i=0; i<batch.size; ++i) {
+				weight[i] = Spectrum(0.0f);
+				if (pdf)
+					pdf[i] = 0.0f;
+			}
+			return;
+		}
+
+		const SSEVector4f zero = SSEVector4f::zero(), one(1.0f);
+		Spectrum reflectance[4], transmittance[4];
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset, false);
+			const SSEVector3f &wi = packet.wi;
+			SSEVector4f u1, u2;
+			packet.loadSamples(sample, u1, u2);
+
+			MicrofacetDistribution4 distr(
+				m_type,
+				packet.evalTextureAverage(batch, m_alphaU.get()),
+				packet.evalTextureAverage(batch, m_alphaV.get()),
+				m_sampleVisible
+			);
+
+			/* Trick by Walter et al.: slightly scale the roughness values to
+			   reduce importance sampling weights. */
+			MicrofacetDistribution4 sampleDistr(distr);
+			if (!m_sampleVisible)
+				sampleDistr.scaleAlpha(SSEVector4f(1.2f) - SSEVector4f(0.2f)
+					* SSEVector4f(_mm_sqrt_ps(math::abs_ps(wi.z))));
+
+			/* Sample M, the microfacet normal */
+			SSEVector4f microfacetPdf;
+			const SSEVector3f m = sampleDistr.sample(wi * SSEVector4f(math::signum_ps(wi.z)),
+				u1, u2, microfacetPdf);
+
+			SSEVector4f cosThetaT;
+			SSEVector4f F = fresnelDielectricExt(dot(wi, m), cosThetaT, m_eta);
+			SSEVector4f sampleWeight(one), samplePdf(microfacetPdf), sampleReflection;
+
+			if (hasReflection && hasTransmission) {
+				/* Choose between reflection and transmission (consuming one
+				   random number per valid query, like the scalar version) */
+				MM_ALIGN16 float xi[4];
+				for (int i=0; i<4; ++i)
+					xi[i] = ((size_t) i < packet.count && extractLane(microfacetPdf, i) != 0)
+						? batch.sampler->next1D() : 0.0f;
+				sampleReflection = SSEVector4f(_mm_load_ps(xi)) <= F;
+				samplePdf *= select(sampleReflection, F, one - F);
+			} else {
+				sampleReflection = laneMask(hasReflection);
+				sampleWeight = hasReflection ? F : one - F;
+			}
+
+			/* Perfect specular reflection or transmission based on the microfacet normal */
+			SSEVector3f wo = select(sampleReflection, mitsuba::reflect(wi, m),
+				mitsuba::refract(wi, m, m_eta, cosThetaT));
+			SSEVector4f eta = select(sampleReflection, one,
+				select(cosThetaT < zero, SSEVector4f(m_eta), SSEVector4f(m_invEta)));
+
+			/* Side check */
+			SSEVector4f side = wi.z * wo.z;
+			SSEVector4f valid = (microfacetPdf != zero) & select(sampleReflection,
+				side > zero, (side < zero) & (cosThetaT != zero));
+
+			/* Radiance must be scaled to account for the solid angle compression
+			   that occurs when crossing the interface. */
+			if (batch.mode == ERadiance) {
+				SSEVector4f factor = select(cosThetaT < zero, SSEVector4f(m_invEta), SSEVector4f(m_eta));
+				sampleWeight *= select(sampleReflection, one, factor * factor);
+			}
+
+			/* Jacobian of the half-direction mapping */
+			SSEVector4f dotWoM = dot(wo, m), sqrtDenom = dot(wi, m) + eta * dotWoM;
+			SSEVector4f dwh_dwo = select(sampleReflection,
+				one / (SSEVector4f(4.0f) * dotWoM),
+				(eta * eta * dotWoM) / (sqrtDenom * sqrtDenom));
+
+			if (m_sampleVisible)
+				sampleWeight *= distr.smithG1(wo, m);
+			else
+				sampleWeight *= math::abs_ps(distr.eval(m) * distr.G(wi, wo, m)
+					* dot(wi, m) / (microfacetPdf * wi.z));
+
+			MM_ALIGN16 float weightArray[4], reflectArray[4];
+			_mm_store_ps(weightArray, sampleWeight & valid);
+			_mm_store_ps(reflectArray, sampleReflection);
+			if (hasReflection)
+				packet.evalTexture(batch, m_specularReflectance.get(), reflectance);
+			if (hasTransmission)
+				packet.evalTexture(batch, m_specularTransmittance.get(), transmittance);
+
+			for (size_t i=0; i<packet.count; ++i) {
+				bool reflected = reflectArray[i] != 0;
+				weight[offset + i] = (reflected ? reflectance[i] : transmittance[i]) * weightArray[i];
+				packet.storeSampled(batch, i, extractLane(eta, (int) i),
+					reflected ? EGlossyReflection : EGlossyTransmission, reflected ? 0 : 1);
+			}
+			packet.storeWo(batch, wo);
+			if (pdf)
+				packet.store(pdf, math::abs_ps(samplePdf * dwh_dwo) & valid);
+		}
+	}
+#endif
+
 	void addChild(const std::string &name, ConfigurableObject *child) {
 		if (child->getClass()->derivesFrom(MTS_CLASS(Texture))) {
 			if (name == "alpha")
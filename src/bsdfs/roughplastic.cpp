@@ -509,6 +509,233 @@ public:
 		return RoughPlastic::sample(bRec, pdf, sample);
 	}
 
+#if defined(MTS_BSDF_BATCH_SSE)
+	void evalBatch(const BSDFQueryBatch &batch, Spectrum *result, EMeasure measure) const {
+		bool hasSpecular = (batch.typeMask & EGlossyReflection) &&
+			(batch.component == -1 || batch.component == 0);
+		bool hasDiffuse = (batch.typeMask & EDiffuseReflection) &&
+			(batch.component == -1 || batch.component == 1);
+
+		if (m_type == MicrofacetDistribution::EPhong) {
+			BSDF::evalBatch(batch, result, measure);
+			return;
+		} else if (measure != ESolidAngle || (!hasSpecular && !hasDiffuse)) {
+			for (size_t i=0; i<batch.size; ++i)
+				result[i] = Spectrum(0.0f);
+			return;
+		}
+
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset);
+			SSEVector4f alpha = max(packet.evalTextureAverage(batch, m_alpha.get()),
+				SSEVector4f(1e-4f));
+			evalPacket(batch, packet, packet.wo, alpha, hasSpecular, hasDiffuse, result);
+		}
+	}
+
+	void pdfBatch(const BSDFQueryBatch &batch, Float *result, EMeasure measure) const {
+		bool hasSpecular = (batch.typeMask & EGlossyReflection) &&
+			(batch.component == -1 || batch.component == 0);
+		bool hasDiffuse = (batch.typeMask & EDiffuseReflection) &&
+			(batch.component == -1 || batch.component == 1);
+
+		if (m_type == MicrofacetDistribution::EPhong) {
+			BSDF::pdfBatch(batch, result, measure);
+			return;
+		} else if (measure != ESolidAngle || (!hasSpecular && !hasDiffuse)) {
+			for (size_t i=0; i<batch.size; ++i)
+				result[i] = 0.0f;
+			return;
+		}
+
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset);
+			SSEVector4f alpha = max(packet.evalTextureAverage(batch, m_alpha.get()),
+				SSEVector4f(1e-4f));
+			packet.store(result, pdfPacket(packet, packet.wo, alpha, hasSpecular, hasDiffuse));
+		}
+	}
+
+	void sampleBatch(const BSDFQueryBatch &batch, const Point2 *sample,
+			Spectrum *weight, Float *pdf) const {
+		bool hasSpecular = (batch.typeMask & EGlossyReflection) &&
+			(batch.component == -1 || batch.component == 0);
+		bool hasDiffuse = (batch.typeMask & EDiffuseReflection) &&
+			(batch.component == -1 || batch.component == 1);
+
+		if (m_type == MicrofacetDistribution::EPhong) {
+			BSDF::sampleBatch(batch, sample, weight, pdf);
+			return;
+		} else if (!hasSpecular && !hasDiffuse) {
+			for (size_t i=0; i<batch.size; ++i) {
+				weight[i] = Spectrum(0.0f);
+				if (pdf)
+					pdf[i] = 0.0f;
+			}
+			return;
+		}
+
+		const SSEVector4f zero = SSEVector4f::zero(), one(1.0f);
+		for (size_t offset=0; offset<batch.size; offset += 4) {
+			BSDFQueryPacket packet(batch, offset, false);
+			const SSEVector3f &wi = packet.wi;
+			SSEVector4f alpha = max(packet.evalTextureAverage(batch, m_alpha.get()),
+				SSEVector4f(1e-4f));
+			SSEVector4f u1, u2;
+			packet.loadSamples(sample, u1, u2);
+
+			/* Choose between the specular and diffuse component and reallocate samples */
+			SSEVector4f choseSpecular = laneMask(hasSpecular);
+			if (hasSpecular && hasDiffuse) {
+				SSEVector4f probSpecular = specularProbability(wi, alpha);
+				choseSpecular = u2 < probSpecular;
+				u2 = select(choseSpecular, u2 / probSpecular,
+					(u2 - probSpecular) / (one - probSpecular));
+			}
+
+			/* Perfect specular reflection based on the microfacet normal,
+			   or cosine-weighted sampling of the diffuse component */
+			SSEVector3f wo = squareToCosineHemisphere(u1, u2);
+			if (_mm_movemask_ps(choseSpecular)) {
+				MicrofacetDistribution4 distr(m_type, alpha, alpha, m_sampleVisible);
+				SSEVector4f microfacetPdf;
+				SSEVector3f m = distr.sample(wi, u1, u2, microfacetPdf);
+				wo = select(choseSpecular, mitsuba::reflect(wi, m), wo);
+			}
+			packet.storeWo(batch, wo);
+
+			/* Side check */
+			SSEVector4f valid = andnot(choseSpecular & (wo.z <= zero), wi.z > zero);
+
+			/* Guard against numerical imprecisions */
+			SSEVector4f samplePdf = pdfPacket(packet, wo, alpha, hasSpecular, hasDiffuse);
+			valid &= samplePdf != zero;
+			samplePdf &= valid;
+			evalPacket(batch, packet, wo, alpha, hasSpecular, hasDiffuse, weight);
+
+			MM_ALIGN16 float pdfArray[4];
+			_mm_store_ps(pdfArray, samplePdf);
+			int specularMask = _mm_movemask_ps(choseSpecular);
+			for (size_t i=0; i<packet.count; ++i) {
+				if (pdfArray[i] != 0)
+					weight[offset + i] /= pdfArray[i];
+				else
+					weight[offset + i] = Spectrum(0.0f);
+				if (specularMask & (1 << i))
+					packet.storeSampled(batch, i, 1.0f, EGlossyReflection, 0);
+				else
+					packet.storeSampled(batch, i, 1.0f, EDiffuseReflection, 1);
+			}
+			if (pdf)
+				packet.store(pdf, samplePdf);
+		}
+	}
+
+	/// Probability of sampling the specular component for a packet of queries
+	inline SSEVector4f specularProbability(const SSEVector3f &wi, const SSEVector4f &alpha) const {
+		MM_ALIGN16 float cosThetaI[4], alphaArray[4], prob[4];
+		_mm_store_ps(cosThetaI, wi.z);
+		_mm_store_ps(alphaArray, alpha);
+		for (int i=0; i<4; ++i)
+			prob[i] = cosThetaI[i] > 0 ? (1 - m_externalRoughTransmittance->eval(
+				cosThetaI[i], alphaArray[i])) : 0.0f;
+
+		/* Reallocate samples */
+		SSEVector4f probSpecular = _mm_load_ps(prob);
+		SSEVector4f weight(m_specularSamplingWeight), one(1.0f);
+		return (probSpecular * weight) / (probSpecular * weight
+			+ (one - probSpecular) * (one - weight));
+	}
+
+	/// Evaluate the model for a packet of queries with the given outgoing directions
+	void evalPacket(const BSDFQueryBatch &batch, const BSDFQueryPacket &packet,
+			const SSEVector3f &wo, const SSEVector4f &alpha, bool hasSpecular,
+			bool hasDiffuse, Spectrum *result) const {
+		const SSEVector3f &wi = packet.wi;
+		const SSEVector4f zero = SSEVector4f::zero();
+		const SSEVector4f valid = (wi.z > zero) & (wo.z > zero);
+		const int validMask = _mm_movemask_ps(valid);
+		MM_ALIGN16 float specular[4], diffuse[4], alphaArray[4];
+		Spectrum specularReflectance[4], diffuseReflectance[4];
+
+		if (hasSpecular) {
+			MicrofacetDistribution4 distr(m_type, alpha, alpha, m_sampleVisible);
+
+			/* Calculate the reflection half-vector */
+			SSEVector3f H = normalize(wo + wi);
+
+			/* Microfacet distribution, Fresnel factor and Smith's shadow-masking function */
+			SSEVector4f value = fresnelDielectricExt(dot(wi, H), m_eta)
+				* distr.eval(H) * distr.G(wi, wo, H) / (SSEVector4f(4.0f) * wi.z);
+			_mm_store_ps(specular, value & valid);
+			packet.evalTexture(batch, m_specularReflectance.get(), specularReflectance);
+		}
+
+		if (hasDiffuse) {
+			MM_ALIGN16 float cosThetaI[4], cosThetaO[4], trans[4];
+			_mm_store_ps(cosThetaI, wi.z);
+			_mm_store_ps(cosThetaO, wo.z);
+			_mm_store_ps(alphaArray, alpha);
+			for (int i=0; i<4; ++i)
+				trans[i] = (validMask & (1 << i)) ?
+					  m_externalRoughTransmittance->eval(cosThetaI[i], alphaArray[i])
+					* m_externalRoughTransmittance->eval(cosThetaO[i], alphaArray[i]) : 0.0f;
+			_mm_store_ps(diffuse, SSEVector4f(INV_PI * m_invEta2) * wo.z
+				* SSEVector4f(_mm_load_ps(trans)));
+			packet.evalTexture(batch, m_diffuseReflectance.get(), diffuseReflectance);
+		}
+
+		for (size_t i=0; i<packet.count; ++i) {
+			Spectrum value(0.0f);
+			if (hasSpecular)
+				value += specularReflectance[i] * specular[i];
+			if (hasDiffuse && diffuse[i] != 0) {
+				Spectrum diff = diffuseReflectance[i];
+				Float Fdr = 1-m_internalRoughTransmittance->evalDiffuse(alphaArray[i]);
+
+				if (m_nonlinear)
+					diff /= Spectrum(1.0f) - diff * Fdr;
+				else
+					diff /= 1-Fdr;
+
+				value += diff * diffuse[i];
+			}
+			result[packet.offset + i] = value;
+		}
+	}
+
+	/// Compute the sampling density for a packet of queries with the given outgoing directions
+	SSEVector4f pdfPacket(const BSDFQueryPacket &packet, const SSEVector3f &wo,
+			const SSEVector4f &alpha, bool hasSpecular, bool hasDiffuse) const {
+		const SSEVector3f &wi = packet.wi;
+		const SSEVector4f zero = SSEVector4f::zero(), one(1.0f);
+
+		SSEVector4f probSpecular(one), probDiffuse(one);
+		if (hasSpecular && hasDiffuse) {
+			probSpecular = specularProbability(wi, alpha);
+			probDiffuse = one - probSpecular;
+		}
+
+		SSEVector4f result(zero);
+		if (hasSpecular) {
+			MicrofacetDistribution4 distr(m_type, alpha, alpha, m_sampleVisible);
+
+			/* Calculate the reflection half-vector */
+			SSEVector3f H = normalize(wo + wi);
+
+			/* Jacobian of the half-direction mapping */
+			SSEVector4f dwh_dwo = one / (SSEVector4f(4.0f) * dot(wo, H));
+
+			result = distr.pdf(wi, H) * dwh_dwo * probSpecular;
+		}
+
+		if (hasDiffuse)
+			result += probDiffuse * SSEVector4f(INV_PI) * wo.z;
+
+		return result & (wi.z > zero) & (wo.z > zero);
+	}
+#endif
+
 	void addChild(const std::string &name, ConfigurableObject *child) {
 		if (child->getClass()->derivesFrom(MTS_CLASS(Texture))) {
 			if (name == "alpha")
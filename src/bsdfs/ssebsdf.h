@@ -0,0 +1,318 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__SSE_BSDF_H)
+#define __SSE_BSDF_H
+
+#include <mitsuba/render/bsdf.h>
+#include <mitsuba/render/texture.h>
+
+/* The vectorized implementations of the batched BSDF interface
+   require SSE and operate on single precision values */
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+#define MTS_BSDF_BATCH_SSE 1
+
+#include <mitsuba/core/ssevector.h>
+#include <mitsuba/core/ssemath.h>
+
+MTS_NAMESPACE_BEGIN
+
+using math::SSEVector4f;
+
+/**
+ * \brief Four three-dimensional vectors in structure-of-arrays
+ * form (one per SSE lane)
+ */
+struct SSEVector3f {
+	SSEVector4f x, y, z;
+
+	inline SSEVector3f() { }
+
+	inline SSEVector3f(const SSEVector4f &x, const SSEVector4f &y, const SSEVector4f &z)
+		: x(x), y(y), z(z) { }
+
+	inline SSEVector3f operator+(const SSEVector3f &v) const {
+		return SSEVector3f(x + v.x, y + v.y, z + v.z);
+	}
+
+	inline SSEVector3f operator-(const SSEVector3f &v) const {
+		return SSEVector3f(x - v.x, y - v.y, z - v.z);
+	}
+
+	inline SSEVector3f operator*(const SSEVector4f &f) const {
+		return SSEVector3f(x * f, y * f, z * f);
+	}
+
+	inline SSEVector3f operator-() const {
+		const SSEVector4f sign(-0.0f);
+		return SSEVector3f(x ^ sign, y ^ sign, z ^ sign);
+	}
+
+	/// Return the vector stored in lane \c i
+	inline Vector get(int i) const {
+		MM_ALIGN16 float tx[4], ty[4], tz[4];
+		_mm_store_ps(tx, x); _mm_store_ps(ty, y); _mm_store_ps(tz, z);
+		return Vector(tx[i], ty[i], tz[i]);
+	}
+};
+
+inline SSEVector4f dot(const SSEVector3f &a, const SSEVector3f &b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline SSEVector3f normalize(const SSEVector3f &v) {
+	return v * (SSEVector4f(1.0f) / SSEVector4f(_mm_sqrt_ps(dot(v, v))));
+}
+
+/// Reflect \c wi with respect to the normals \c n (see \ref reflect())
+inline SSEVector3f reflect(const SSEVector3f &wi, const SSEVector3f &n) {
+	return n * (SSEVector4f(2.0f) * dot(wi, n)) - wi;
+}
+
+/**
+ * \brief Refract \c wi with respect to the normals \c n using the
+ * cosines computed by \ref fresnelDielectricExt() (see \ref refract())
+ */
+inline SSEVector3f refract(const SSEVector3f &wi, const SSEVector3f &n,
+		Float eta, const SSEVector4f &cosThetaT) {
+	SSEVector4f scale = select(cosThetaT < SSEVector4f::zero(),
+		SSEVector4f(1 / eta), SSEVector4f(eta));
+	return n * (dot(wi, n) * scale + cosThetaT) - wi * scale;
+}
+
+/// Per-lane blend of two vectors <tt>(mask) ? a : b</tt>
+inline SSEVector3f select(const SSEVector4f &mask, const SSEVector3f &a, const SSEVector3f &b) {
+	return SSEVector3f(select(mask, a.x, b.x), select(mask, a.y, b.y), select(mask, a.z, b.z));
+}
+
+/**
+ * \brief Loads and stores groups of four consecutive queries
+ * of a \ref BSDFQueryBatch
+ *
+ * The last group of a batch may contain less than four queries. Its
+ * remaining lanes are padded with copies of the last valid query so
+ * that they never produce floating point exceptions; their results
+ * are simply discarded when storing.
+ */
+struct BSDFQueryPacket {
+	/// Index of the first query and number of valid queries
+	size_t offset, count;
+
+	/// Directions of the queries
+	SSEVector3f wi, wo;
+
+	inline BSDFQueryPacket(const BSDFQueryBatch &batch, size_t offset, bool loadWo = true)
+		: offset(offset), count(std::min(batch.size - offset, (size_t) 4)) {
+		wi = SSEVector3f(load(batch.wiX), load(batch.wiY), load(batch.wiZ));
+		if (loadWo)
+			wo = SSEVector3f(load(batch.woX), load(batch.woY), load(batch.woZ));
+	}
+
+	/// Load four values from an array
+	inline SSEVector4f load(const Float *values) const {
+		if (count == 4)
+			return _mm_loadu_ps(values + offset);
+		MM_ALIGN16 float tmp[4];
+		for (size_t i=0; i<4; ++i)
+			tmp[i] = values[offset + std::min(i, count - 1)];
+		return _mm_load_ps(tmp);
+	}
+
+	/// Store the values of the valid lanes into an array
+	inline void store(Float *target, const SSEVector4f &value) const {
+		if (count == 4) {
+			_mm_storeu_ps(target + offset, value);
+			return;
+		}
+		MM_ALIGN16 float tmp[4];
+		_mm_store_ps(tmp, value);
+		for (size_t i=0; i<count; ++i)
+			target[offset + i] = tmp[i];
+	}
+
+	/// Store the outgoing directions of the valid lanes into the batch
+	inline void storeWo(const BSDFQueryBatch &batch, const SSEVector3f &wo) const {
+		store(batch.woX, wo.x);
+		store(batch.woY, wo.y);
+		store(batch.woZ, wo.z);
+	}
+
+	/// Return the intersection record associated with lane \c i
+	inline const Intersection &its(const BSDFQueryBatch &batch, size_t i) const {
+		return *batch.its[offset + std::min(i, count - 1)];
+	}
+
+	/// Evaluate the average value of a texture for each lane
+	inline SSEVector4f evalTextureAverage(const BSDFQueryBatch &batch,
+			const Texture *texture) const {
+		if (texture->isConstant())
+			return SSEVector4f(texture->eval(its(batch, 0)).average());
+		MM_ALIGN16 float tmp[4];
+		for (size_t i=0; i<4; ++i)
+			tmp[i] = i < count ? texture->eval(its(batch, i)).average() : tmp[0];
+		return _mm_load_ps(tmp);
+	}
+
+	/// Evaluate a texture for each valid lane
+	inline void evalTexture(const BSDFQueryBatch &batch, const Texture *texture,
+			Spectrum *result) const {
+		if (texture->isConstant()) {
+			Spectrum value = texture->eval(its(batch, 0));
+			for (size_t i=0; i<count; ++i)
+				result[i] = value;
+		} else {
+			for (size_t i=0; i<count; ++i)
+				result[i] = texture->eval(its(batch, i));
+		}
+	}
+
+	/// Store the sampled relative IOR, component type and index of lane \c i (if requested)
+	inline void storeSampled(const BSDFQueryBatch &batch, size_t i, Float eta,
+			unsigned int type, int component) const {
+		if (batch.eta)
+			batch.eta[offset + i] = eta;
+		if (batch.sampledType)
+			batch.sampledType[offset + i] = type;
+		if (batch.sampledComponent)
+			batch.sampledComponent[offset + i] = component;
+	}
+
+	/// Load the 2D samples associated with the packet
+	inline void loadSamples(const Point2 *sample, SSEVector4f &u1, SSEVector4f &u2) const {
+		MM_ALIGN16 float tmp1[4], tmp2[4];
+		for (size_t i=0; i<4; ++i) {
+			const Point2 &s = sample[offset + std::min(i, count - 1)];
+			tmp1[i] = s.x; tmp2[i] = s.y;
+		}
+		u1 = _mm_load_ps(tmp1);
+		u2 = _mm_load_ps(tmp2);
+	}
+};
+
+/// Return a lane mask whose lanes are all set if \c value is \c true
+inline SSEVector4f laneMask(bool value) {
+	return _mm_castsi128_ps(_mm_set1_epi32(value ? -1 : 0));
+}
+
+/// Extract the value of lane \c i
+inline float extractLane(const SSEVector4f &value, int i) {
+	MM_ALIGN16 float tmp[4];
+	_mm_store_ps(tmp, value);
+	return tmp[i];
+}
+
+/// Vectorized version of \ref fresnelDielectricExt() for a fixed relative IOR
+inline SSEVector4f fresnelDielectricExt(const SSEVector4f &cosThetaI_,
+		SSEVector4f &cosThetaT_, Float eta) {
+	const SSEVector4f zero = SSEVector4f::zero();
+	if (EXPECT_NOT_TAKEN(eta == 1)) {
+		cosThetaT_ = cosThetaI_ ^ SSEVector4f(-0.0f);
+		return zero;
+	}
+
+	/* Using Snell's law, calculate the squared sine of the
+	   angle between the normal and the transmitted ray */
+	SSEVector4f entering = cosThetaI_ > zero;
+	SSEVector4f scale = select(entering, SSEVector4f(1/eta), SSEVector4f(eta)),
+	            cosThetaTSqr = SSEVector4f(1.0f) - (SSEVector4f(1.0f)
+	                - cosThetaI_ * cosThetaI_) * (scale * scale);
+
+	/* Check for total internal reflection */
+	SSEVector4f tir = cosThetaTSqr <= zero;
+
+	/* Find the absolute cosines of the incident/transmitted rays */
+	SSEVector4f cosThetaI = math::abs_ps(cosThetaI_);
+	SSEVector4f cosThetaT = math::safe_sqrt_ps(cosThetaTSqr);
+	SSEVector4f etaV(eta);
+
+	SSEVector4f Rs = (cosThetaI - etaV * cosThetaT)
+	               / (cosThetaI + etaV * cosThetaT);
+	SSEVector4f Rp = (etaV * cosThetaI - cosThetaT)
+	               / (etaV * cosThetaI + cosThetaT);
+
+	cosThetaT_ = select(tir, zero, select(entering,
+		cosThetaT ^ SSEVector4f(-0.0f), cosThetaT));
+
+	/* No polarization -- return the unpolarized reflectance */
+	return select(tir, SSEVector4f(1.0f),
+		SSEVector4f(0.5f) * (Rs * Rs + Rp * Rp));
+}
+
+/// Vectorized version of \ref fresnelDielectricExt() for a fixed relative IOR
+inline SSEVector4f fresnelDielectricExt(const SSEVector4f &cosThetaI, Float eta) {
+	SSEVector4f cosThetaT;
+	return fresnelDielectricExt(cosThetaI, cosThetaT, eta);
+}
+
+/// Vectorized version of \ref fresnelConductorExact() for a single wavelength
+inline SSEVector4f fresnelConductorExact(const SSEVector4f &cosThetaI, Float eta, Float k) {
+	/* Modified from "Optics" by K.D. Moeller, University Science Books, 1988 */
+
+	SSEVector4f cosThetaI2 = cosThetaI * cosThetaI,
+	            sinThetaI2 = SSEVector4f(1.0f) - cosThetaI2,
+	            sinThetaI4 = sinThetaI2 * sinThetaI2;
+
+	SSEVector4f temp1 = SSEVector4f(eta*eta - k*k) - sinThetaI2,
+	            a2pb2 = math::safe_sqrt_ps(temp1 * temp1 + SSEVector4f(4*k*k*eta*eta)),
+	            a     = math::safe_sqrt_ps(SSEVector4f(0.5f) * (a2pb2 + temp1));
+
+	SSEVector4f term1 = a2pb2 + cosThetaI2,
+	            term2 = SSEVector4f(2.0f) * a * cosThetaI;
+
+	SSEVector4f Rs2 = (term1 - term2) / (term1 + term2);
+
+	SSEVector4f term3 = a2pb2 * cosThetaI2 + sinThetaI4,
+	            term4 = term2 * sinThetaI2;
+
+	SSEVector4f Rp2 = Rs2 * (term3 - term4) / (term3 + term4);
+
+	return SSEVector4f(0.5f) * (Rp2 + Rs2);
+}
+
+/// Vectorized version of \ref warp::squareToCosineHemisphere()
+inline SSEVector3f squareToCosineHemisphere(const SSEVector4f &u1, const SSEVector4f &u2) {
+	/* Concentric disk mapping, see \ref warp::squareToUniformDiskConcentric() */
+	const SSEVector4f zero = SSEVector4f::zero();
+	SSEVector4f r1 = SSEVector4f(2.0f) * u1 - SSEVector4f(1.0f),
+	            r2 = SSEVector4f(2.0f) * u2 - SSEVector4f(1.0f);
+
+	SSEVector4f useR1 = r1 * r1 > r2 * r2,
+	            origin = (r1 == zero) & (r2 == zero);
+	SSEVector4f r = select(useR1, r1, r2),
+	            phi = select(useR1, SSEVector4f((float) (M_PI/4)) * (r2 / r1),
+	                SSEVector4f((float) (M_PI/2)) - (r1 / r2) * SSEVector4f((float) (M_PI/4)));
+	r = select(origin, zero, r);
+	phi = select(origin, zero, phi);
+
+	__m128 sinPhi, cosPhi;
+	math::sincos_ps(phi, &sinPhi, &cosPhi);
+
+	SSEVector4f x = r * SSEVector4f(cosPhi), y = r * SSEVector4f(sinPhi);
+	SSEVector4f z = math::safe_sqrt_ps(SSEVector4f(1.0f) - x*x - y*y);
+
+	/* Guard against numerical imprecisions */
+	z = select(z == zero, SSEVector4f(1e-10f), z);
+
+	return SSEVector3f(x, y, z);
+}
+
+MTS_NAMESPACE_END
+
+#endif /* MTS_SSE && SINGLE_PRECISION */
+
+#endif /* __SSE_BSDF_H */
@@ -18,6 +18,7 @@
 
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/filesystem.h>
+#include <mitsuba/render/trimesh.h>
 #include <set>
 
 using namespace mitsuba;
@@ -32,6 +33,7 @@ public:
 		m_packGeometry = true;
 		m_importMaterials = true;
 		m_importAnimations = false;
+		m_alignGeometry = false;
 	}
 
 	void convert(const fs::path &inputFile, 
@@ -47,6 +49,7 @@ public:
 	inline void setPackGeometry(bool packGeometry) { m_packGeometry = packGeometry; }
 	inline void setImportMaterials(bool importMaterials) { m_importMaterials = importMaterials; }
 	inline void setImportAnimations(bool importAnimations) { m_importAnimations = importAnimations; }
+	inline void setAlignGeometry(bool alignGeometry) { m_alignGeometry = alignGeometry; }
 	inline void setFilmType(const std::string &filmType) { m_filmType = filmType; }
 	inline const fs::path &getFilename() const { return m_filename; }
 private:
@@ -68,4 +71,13 @@ public:
 	fs::path m_geometryFileName;
 	std::vector<size_t> m_geometryDict;
 	bool m_packGeometry;
+	bool m_alignGeometry;
+
+	/// Write a mesh in the regular or the aligned (memory-mappable) format
+	inline void serializeMesh(const TriMesh *mesh, Stream *stream) const {
+		if (m_alignGeometry)
+			mesh->serializeAligned(stream);
+		else
+			mesh->serialize(stream);
+	}
 };
@@ -64,6 +64,7 @@ void help() {
 		<<  "   -m          Map the larger image side to the full field of view" << endl << endl
 		<<  "   -z          Import animations" << endl << endl
 		<<  "   -y          Don't pack all geometry data into a single file" << endl << endl
+		<<  "   -u          Write uncompressed geometry that can be memory-mapped" << endl << endl
 		<<  "   -n          Don't import any materials (an adjustments file will be necessary)" << endl << endl
 		<<  "   -l <type>   Override the type of film (e.g. 'hdrfilm', 'ldrfilm', ..)" << endl << endl
 		<<  "   -r <w>x<h>  Override the image resolution to e.g. 1920x1080" << endl << endl
@@ -79,11 +80,11 @@ int importMain(int argc, char **argv) {
 	FileResolver *fileResolver = Thread::getThread()->getFileResolver();
 	ELogLevel logLevel = EInfo;
 	bool packGeometry = true, importMaterials = true,
-		 importAnimations = false;
+		 importAnimations = false, alignGeometry = false;
 
 	optind = 1;
 
-	while ((optchar = getopt(argc, argv, "snzvyhmr:a:l:")) != -1) {
+	while ((optchar = getopt(argc, argv, "snzvyuhmr:a:l:")) != -1) {
 		switch (optchar) {
 			case 'a': {
 					std::vector<std::string> paths = tokenize(optarg, ";");
@@ -112,6 +113,9 @@ int importMain(int argc, char **argv) {
 			case 'y':
 				packGeometry = false;
 				break;
+			case 'u':
+				alignGeometry = true;
+				break;
 			case 'r': {
 					std::vector<std::string> tokens = tokenize(optarg, "x");
 					if (tokens.size() != 2)
@@ -146,6 +150,7 @@ int importMain(int argc, char **argv) {
 	converter.setImportAnimations(importAnimations);
 	converter.setMapSmallerSide(mapSmallerSide);
 	converter.setPackGeometry(packGeometry);
+	converter.setAlignGeometry(alignGeometry);
 	converter.setFilmType(filmType);
 
 	const Logger *logger = Thread::getThread()->getLogger();
@@ -197,12 +197,16 @@ public:
 
 			m_shape = shape;
 			m_shape->configure();
-			m_power = m_radiance * M_PI * m_shape->getSurfaceArea();
+			updateShape();
 		} else {
 			Log(EError, "An area light must be child of a shape instance");
 		}
 	}
 
+	void updateShape() {
+		m_power = m_radiance * M_PI * m_shape->getSurfaceArea();
+	}
+
 	AABB getAABB() const {
 		return m_shape->getAABB();
 	}
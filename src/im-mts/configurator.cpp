@@ -2,6 +2,7 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/integrator2.h>
+#include <mitsuba/render/bsdf.h>
 #include <imgui.h>
 #include <misc/cpp/imgui_stdlib.h>
 
@@ -202,6 +203,81 @@ namespace impl {
 		};
 		Configuration integrator, film, sensor;
 
+		// incremental edits, applied without reconfiguring the scene
+		struct Edits {
+			int shape = -1;
+			float translation[3] = { 0.0f, 0.0f, 0.0f };
+			float rotation = 0.0f, scale = 1.0f;
+			mitsuba::ref<mitsuba::Shape> transformed;
+			mitsuba::Transform trafo;
+			bool hadTransform = false;
+
+			std::vector<mitsuba::BSDF*> materials;
+			int material = -1, replacement = -1;
+			bool hadMaterial = false;
+
+			static std::string label(mitsuba::ConfigurableObject const* object, int idx) {
+				std::string name = object->getID();
+				if (name.empty() || name == "unnamed")
+					name = object->getProperties().getPluginName();
+				return std::to_string(idx) + ": " + name;
+			}
+
+			template <class T>
+			static bool select(char const* title, std::vector<T*> const& objects, int& selected) {
+				bool valid = selected >= 0 && selected < (int) objects.size();
+				bool changes = false;
+				if (ImGui::BeginCombo(title, valid ? label(objects[selected], selected).c_str() : "<none>")) {
+					for (int i = 0; i < (int) objects.size(); ++i) {
+						if (ImGui::Selectable(label(objects[i], i).c_str(), i == selected)) {
+							selected = i;
+							changes = true;
+						}
+					}
+					ImGui::EndCombo();
+				}
+				return changes;
+			}
+
+			bool shapeTab(mitsuba::Scene* scene) {
+				std::vector<mitsuba::Shape*> shapes(scene->getShapes().begin(), scene->getShapes().end());
+				select("Shape", shapes, shape);
+				ImGui::DragFloat3("Translate", translation, .01f);
+				ImGui::DragFloat("Rotate Y", &rotation, .5f);
+				ImGui::DragFloat("Scale", &scale, .01f, .01f, 100.f);
+				if (!ImGui::Button("Move") || shape < 0 || shape >= (int) shapes.size())
+					return false;
+
+				// relative to the center of the shape, then reset for the next edit
+				transformed = shapes[shape];
+				mitsuba::Point center = transformed->getAABB().getCenter();
+				trafo = mitsuba::Transform::translate(mitsuba::Vector(center) + mitsuba::Vector(translation[0], translation[1], translation[2]))
+					* mitsuba::Transform::rotate(mitsuba::Vector(0, 1, 0), rotation)
+					* mitsuba::Transform::scale(mitsuba::Vector(scale))
+					* mitsuba::Transform::translate(-mitsuba::Vector(center));
+				translation[0] = translation[1] = translation[2] = 0.0f;
+				rotation = 0.0f;
+				scale = 1.0f;
+				return hadTransform = true;
+			}
+
+			bool materialTab(mitsuba::Scene* scene) {
+				materials.clear();
+				for (auto& s : scene->getShapes()) {
+					mitsuba::BSDF* bsdf = s->getBSDF();
+					if (bsdf && std::find(materials.begin(), materials.end(), bsdf) == materials.end())
+						materials.push_back(bsdf);
+				}
+				select("Material", materials, material);
+				select("Replace with", materials, replacement);
+				bool valid = material >= 0 && material < (int) materials.size()
+					&& replacement >= 0 && replacement < (int) materials.size() && material != replacement;
+				if (!ImGui::Button("Assign") || !valid)
+					return false;
+				return hadMaterial = true;
+			}
+		} edits;
+
 		SceneConfigurator(mitsuba::Scene* scene) {
 			this->scene = scene;
 
@@ -274,6 +350,23 @@ namespace impl {
 			}
 			haveChanges |= sensor.hadChanges;
 
+			// edits are applied explicitly, regardless of auto apply
+			edits.hadTransform = false;
+			if (ImGui::BeginTabItem("Shapes")) {
+				applyChanges |= edits.shapeTab(scene);
+				tabChanges = nullptr;
+				ImGui::EndTabItem();
+			}
+			haveChanges |= edits.hadTransform;
+
+			edits.hadMaterial = false;
+			if (ImGui::BeginTabItem("Materials")) {
+				applyChanges |= edits.materialTab(scene);
+				tabChanges = nullptr;
+				ImGui::EndTabItem();
+			}
+			haveChanges |= edits.hadMaterial;
+
 			ImGui::EndTabBar();
 
 			if (ImGui::Button("Apply")) {
@@ -290,6 +383,9 @@ namespace impl {
 
 		struct Changes : ::SceneConfigurator::Changes {
 			mitsuba::Properties integrator, film, sensor;
+			mitsuba::ref<mitsuba::Shape> shape;
+			mitsuba::Transform trafo;
+			mitsuba::ref<mitsuba::BSDF> oldBSDF, newBSDF;
 
 			Changes(SceneConfigurator const* configurator) {
 				if (configurator->integrator.hadChanges)
@@ -298,9 +394,27 @@ namespace impl {
 					film = configurator->film.createParameters();
 				if (configurator->sensor.hadChanges)
 					sensor = configurator->sensor.createParameters();
+				if (configurator->edits.hadTransform) {
+					shape = configurator->edits.transformed;
+					trafo = configurator->edits.trafo;
+				}
+				if (configurator->edits.hadMaterial) {
+					oldBSDF = configurator->edits.materials[configurator->edits.material];
+					newBSDF = configurator->edits.materials[configurator->edits.replacement];
+				}
 			}
 
+			// called by the renderer while no rendering is in progress
 			void apply(mitsuba::Scene* scene) override {
+				if (shape) {
+					double ms = Scene::transformShapes(*scene, { shape.get() }, trafo);
+					SLog(mitsuba::EInfo, "Moved shape \"%s\" in %.2f ms", shape->getName().c_str(), ms);
+				}
+				if (oldBSDF && newBSDF) {
+					double ms = Scene::replaceMaterial(*scene, oldBSDF, newBSDF);
+					SLog(mitsuba::EInfo, "Replaced material in %.2f ms", ms);
+				}
+
 				if (!integrator.getPluginName().empty()) {
 					try {
 						mitsuba::ref<mitsuba::ConfigurableObject> newIntegrator
@@ -5,7 +5,9 @@
 #include <mitsuba/render/renderjob.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/thread.h>
+#include <mitsuba/core/workerpool.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
 #include <tinyfiledialogs.h>
 #include <cstdlib>
 
@@ -24,6 +26,7 @@ namespace impl {
 	struct Scene: ::Scene{
 		Scene(mitsuba::Scene* scene) {
 			this->scene = scene;
+			preferRefittableAccelerator();
 		}
 
 		Scene(fs::pathstr const& path) {
@@ -36,6 +39,14 @@ namespace impl {
 					throw;
 				this->scene = loader->load(path);
 			}
+			preferRefittableAccelerator();
+		}
+
+		// shape edits refit a BVH, whereas the kd-tree would be rebuilt from scratch
+		void preferRefittableAccelerator() {
+			mitsuba::ShapeKDTree* accel = this->scene->getKDTree();
+			if (!this->scene->getProperties().hasProperty("accelerator") && !accel->isBuilt())
+				accel->setAccelerator(mitsuba::ShapeKDTree::EWideBVH4);
 		}
 	};
 
@@ -115,6 +126,33 @@ mitsuba::ref<mitsuba::Scene> Scene::cloneScene(mitsuba::Scene& oldScene) {
 	return scene;
 }
 
+double Scene::transformShapes(mitsuba::Scene& scene, std::vector<mitsuba::Shape*> const& shapes, mitsuba::Transform const& trafo) {
+	mitsuba::ref<mitsuba::Timer> timer = new mitsuba::Timer();
+	bool changed = false;
+	for (auto* shape : shapes) {
+		if (shape->applyTransform(trafo))
+			changed = true;
+		else
+			SLog(mitsuba::EWarn, "Shape \"%s\" does not support transformations", shape->getName().c_str());
+	}
+	// BVH accelerators (the default in im-mts) are refit, a kd-tree is fully rebuilt
+	if (changed)
+		scene.updateGeometry();
+	return timer->getMicroseconds() / 1000.0;
+}
+
+double Scene::replaceMaterial(mitsuba::Scene& scene, mitsuba::BSDF const* oldBSDF, mitsuba::BSDF* newBSDF) {
+	mitsuba::ref<mitsuba::Timer> timer = new mitsuba::Timer();
+	scene.replaceBSDF(oldBSDF, newBSDF);
+	return timer->getMicroseconds() / 1000.0;
+}
+
+double Scene::replaceEmitter(mitsuba::Scene& scene, mitsuba::Emitter* oldEmitter, mitsuba::Emitter* newEmitter) {
+	mitsuba::ref<mitsuba::Timer> timer = new mitsuba::Timer();
+	scene.replaceEmitter(oldEmitter, newEmitter);
+	return timer->getMicroseconds() / 1000.0;
+}
+
 std::vector<std::string> Scene::availablePlugins(char const* symbol, bool refresh) {
 	static std::map<std::string, std::vector<std::string>> plugin_c;
 	auto& plugins = plugin_c[symbol];
@@ -283,7 +321,8 @@ namespace impl {
 		mitsuba::ref_vector<mitsuba::ImageBlock> framebuffersDouble;
 		std::vector<float volatile*> frambufferDataDouble;
 
-		mitsuba::ref_vector<mitsuba::Thread> workers;
+		// persistent workers, parked between frames
+		mitsuba::ref<mitsuba::WorkerPool> workers;
 
 		bool updateSamplersAndIntegrator() {
 			for (auto& s : samplers) {
@@ -305,6 +344,7 @@ namespace impl {
 
 			this->samplerPrototype = Scene::cloneSampler(*sampler);
 			this->samplers.resize(maxThreads);
+			this->workers = new mitsuba::WorkerPool("interactive", maxThreads);
 
 			mitsuba::Vector2i filmSize = scene->getFilm()->getSize();
 
@@ -350,6 +390,7 @@ namespace impl {
 
 			this->numActiveThreads = numThreads;
 			this->paused = false;
+			this->restartLatency = -1.0;
 			
 #ifdef ATOMIC_SPLAT
 			this->framebuffers[0]->clear();
@@ -357,6 +398,7 @@ namespace impl {
 			// Update synchronized in order to ensure consecutive sharing
 			this->imageData = this->frambufferData.data();
 
+			integrator->reset();
 			mitsuba::Statistics::getInstance()->resetAll();
 
 			volatile int returnCode = 0;
@@ -384,8 +426,11 @@ namespace impl {
 
 					int progress(mitsuba::ResponsiveIntegrator* integrator, const mitsuba::Scene &scene, const mitsuba::Sensor &sensor, mitsuba::Sampler &sampler, mitsuba::ImageBlock& target, double spp
 						, mitsuba::ResponsiveIntegrator::Controls controls, int threadIdx, int threadCount) override {
-						if (spp)
+						if (spp) {
 							m.sppTarget = spp + m.sppBase;
+							if (m.proc->workers->notifyFirstSample())
+								m.proc->restartLatency = m.proc->workers->getFirstSampleLatency();
+						}
 
 						if (m.proc->paused) {
 							std::unique_lock<std::mutex> lock(m.proc->pause_sync.mutex);
@@ -410,28 +455,6 @@ namespace impl {
 				// end of parallel execution
 			};
 
-			// build on mitsuba infrastructure instead of OpenMP b/c for classic mitsuba thread-local support etc.
-			if (numThreads > (int) workers.size())
-				workers.resize(numThreads);
-			for (int i = 0; i < numThreads; ++i) {
-				typedef decltype(parallel_execution) par_exe;
-				struct Thread : mitsuba::Thread {
-					int tid;
-					par_exe* parallel_execution;
-					Thread(int tid, par_exe* parallel_execution)
-						: mitsuba::Thread("interactive")
-						, tid(tid)
-						, parallel_execution(parallel_execution) { }
-					void run() override {
-						(*parallel_execution)(tid);
-					}
-				};
-				if (auto* w = workers[i].get())
-					((Thread*) w)->parallel_execution = &parallel_execution;
-				else
-					workers[i] = new Thread(i, &parallel_execution);
-			}
-
 			bool moreRounds = true;
 			int scramble = 0;
 			while (moreRounds) {
@@ -442,12 +465,8 @@ namespace impl {
 				else
 					std::copy_n(imageSamples, numThreads, this->sppBase.begin());
 
-				for (int i = 0; i < numThreads; ++i) {
-					workers[i]->start();
-				}
-				for (int i = numThreads; i-- > 0; ) {
-					workers[i]->join();
-				}
+				// build on mitsuba infrastructure instead of OpenMP b/c for classic mitsuba thread-local support etc.
+				workers->run(parallel_execution, numThreads);
 
 				initialRun = false;
 				moreRounds = (returnCode == 0);
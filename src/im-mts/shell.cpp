@@ -166,6 +166,8 @@ struct Document {
 		volatile int restart;
 		InteractiveSceneProcess::Controls controls = { };
 		bool skipInit = false, reconfig;
+		// scene edits invalidate anything the integrator precomputed
+		bool reinit = false;
 
 		std::unique_ptr<SceneConfigurator::Changes> pendingChanges;
 		ProcessConfig nextConfig;
@@ -203,6 +205,7 @@ struct Document {
 			pendingChanges->apply(scene);
 			if (oldInt != scene->getIntegrator() || oldFilm != scene->getFilm())
 				reconfig = true;
+			reinit = true;
 
 			pendingChanges.reset();
 			return true;
@@ -235,10 +238,12 @@ struct Document {
 
 			sensor->applyTo(scene->getSensor());
 
-			scene->setScenePreprocessed(isRestart && skipInit);
+			bool skip = isRestart && skipInit && !reinit;
+			reinit = false;
+			scene->setScenePreprocessed(skip);
 			scene->setIntegratorPreprocessed(true);
 			scene->preprocess(nullptr, nullptr, -1, -1, -1); // todo: this might crash for more advanced subsurf integrators ...?
-			if (!isRestart || !skipInit)
+			if (!skip)
 				integration.process->integrator->preprocess(scene, scene->getSensor(), scene->getSampler());
 			
 			integration.switchFrame();
@@ -777,6 +782,8 @@ void run(int argc, char** argv, Window window, ImGuiContext* ui_context) {
 					, spp
 					, sppPerS
 					, document->renderer.integration.process ? document->renderer.integration.process->numActiveThreads : 0 );
+				if (document->renderer.integration.process->restartLatency >= 0)
+					ImGui::Text("First sample after %.2f ms", document->renderer.integration.process->restartLatency);
 				if (mitsuba::ResponsiveIntegrator* igr = document->renderer.integration.process->integrator) {
 					if (char const* stats = igr->getRealtimeStatistics())
 						ImGui::Text("Stats: %s", stats);
@@ -24,6 +24,12 @@ struct Scene {
 	static mitsuba::ref<mitsuba::Sampler> cloneSampler(mitsuba::Sampler const& sampler, int scramble = 0, float sampleMultiplier = 1.0f);
 	static mitsuba::ref<mitsuba::Scene> cloneScene(mitsuba::Scene& scene);
 
+	// incremental edits without reconfiguring the scene, each returns the time taken in milliseconds;
+	// no rendering may be in progress, i.e. call them from SceneConfigurator::Changes::apply()
+	static double transformShapes(mitsuba::Scene& scene, std::vector<mitsuba::Shape*> const& shapes, mitsuba::Transform const& trafo);
+	static double replaceMaterial(mitsuba::Scene& scene, mitsuba::BSDF const* oldBSDF, mitsuba::BSDF* newBSDF);
+	static double replaceEmitter(mitsuba::Scene& scene, mitsuba::Emitter* oldEmitter, mitsuba::Emitter* newEmitter);
+
 	static std::vector<std::string> availablePlugins(char const* symbol, bool refresh);
 	static mitsuba::ref<mitsuba::ConfigurableObject> createTemplate(mitsuba::Properties const& properties, mitsuba::Class const* type = nullptr);
 	static mitsuba::ref<mitsuba::Sensor> createModifiedSensor(mitsuba::Properties const& properties, mitsuba::Sensor& sensor, mitsuba::Sampler* sampler = nullptr, mitsuba::Film* film = nullptr);
@@ -81,6 +87,8 @@ struct InteractiveSceneProcess {
 	float volatile* *volatile imageData;
 	int numActiveThreads;
 	int volatile paused;
+	/// Milliseconds from the last (re)start until the first sample arrived, negative while pending
+	double volatile restartLatency = -1.0;
 
 	static InteractiveSceneProcess* create(mitsuba::Scene* scene, mitsuba::Sampler* sampler, mitsuba::ResponsiveIntegrator* integrator, ProcessConfig const& config);
 	static InteractiveSceneProcess* create(mitsuba::Scene* scene, mitsuba::Sampler* sampler, mitsuba::Integrator* integrator, ProcessConfig const& config);
@@ -17,6 +17,7 @@
 */
 
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/timer.h>
 #include <mitsuba/render/gatherproc.h>
 #include <mitsuba/render/renderqueue.h>
 
@@ -45,6 +46,10 @@ MTS_NAMESPACE_BEGIN
  *	   }
  *     \parameter{maxPasses}{\Integer}{Maximum number of passes to render (where \code{-1}
  *        corresponds to rendering until stopped manually). \default{\code{-1}}}
+ *     \parameter{photonLookup}{\String}{Data structure used to find the photons
+ *        near a gather point. \code{kdtree} builds a photon kd-tree in every pass,
+ *        while \code{hashgrid} sorts the photons into a hash grid in parallel, which
+ *        is considerably faster for large photon counts. \default{\code{kdtree}}}
  * }
  * This plugin implements the progressive photon mapping algorithm by Hachisuka et al.
  * \cite{Hachisuka2008Progressive}. Progressive photon mapping is a variant of photon
@@ -113,6 +118,14 @@ public:
 		m_autoCancelGathering = props.getBoolean("autoCancelGathering", true);
         /* Maximum number of passes to render. -1 renders until the process is stopped. */
 		m_maxPasses = props.getInteger("maxPasses", -1);
+		/* Photon lookup data structure (kdtree or hashgrid) */
+		std::string photonLookup = to_lower_copy(props.getString("photonLookup", "kdtree"));
+		if (photonLookup == "kdtree")
+			m_hashGrid = false;
+		else if (photonLookup == "hashgrid")
+			m_hashGrid = true;
+		else
+			Log(EError, "Unknown photon lookup data structure \"%s\"!", photonLookup.c_str());
 
 		m_mutex = new Mutex();
 		if (m_maxDepth <= 1 && m_maxDepth != -1)
@@ -339,7 +352,12 @@ public:
 		sched->wait(proc);
 
 		ref<PhotonMap> photonMap = proc->getPhotonMap();
-		photonMap->build();
+		ref<Timer> timer = new Timer();
+		if (m_hashGrid)
+			photonMap->buildHashGrid(2 * averageRadius());
+		else
+			photonMap->build();
+		unsigned int buildTime = timer->getMilliseconds();
 		Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: "
 			SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
 
@@ -385,9 +403,28 @@ public:
 			LockGuard guard(m_mutex);
 			film->put(wu->block);
 		}
+		unsigned int gatherTime = timer->getMilliseconds() - buildTime;
+		Log(EInfo, "Built the photon %s over " SIZE_T_FMT " photons in %i ms, gathering took %i ms",
+			m_hashGrid ? "hash grid" : "kd-tree", photonMap->size(), buildTime, gatherTime);
 		queue->signalRefresh(job);
 	}
 
+	/// Return the average radius of the valid gather points
+	Float averageRadius() const {
+		double sum = 0;
+		size_t count = 0;
+		for (size_t i=0; i<m_workUnits.size(); ++i) {
+			const std::vector<GatherPoint> &gatherPoints = m_workUnits[i]->gatherPoints;
+			for (size_t j=0; j<gatherPoints.size(); ++j) {
+				if (gatherPoints[j].radius != 0) {
+					sum += gatherPoints[j].radius;
+					++count;
+				}
+			}
+		}
+		return count > 0 ? (Float) (sum / count) : m_initialRadius;
+	}
+
 	std::string toString() const {
 		std::ostringstream oss;
 		oss << "SPPMIntegrator[" << endl
@@ -397,7 +434,8 @@ public:
 			<< "  alpha = " << m_alpha << "," << endl
 			<< "  photonCount = " << m_photonCount << "," << endl
 			<< "  granularity = " << m_granularity << "," << endl
-			<< "  maxPasses = " << m_maxPasses << endl
+			<< "  maxPasses = " << m_maxPasses << "," << endl
+			<< "  photonLookup = " << (m_hashGrid ? "hashgrid" : "kdtree") << endl
 			<< "]";
 		return oss.str();
 	}
@@ -431,6 +469,7 @@ private:
 	int m_blockSize;
 	bool m_running;
 	bool m_autoCancelGathering;
+	bool m_hashGrid;
 	ref<Mutex> m_mutex;
 	int m_maxPasses;
 };
@@ -18,6 +18,7 @@
 
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/timer.h>
 #include <mitsuba/render/gatherproc.h>
 #include <mitsuba/render/renderqueue.h>
 
@@ -50,6 +51,10 @@ MTS_NAMESPACE_BEGIN
  *	   }
  *     \parameter{maxPasses}{\Integer}{Maximum number of passes to render (where \code{-1}
  *        corresponds to rendering until stopped manually). \default{\code{-1}}}
+ *     \parameter{photonLookup}{\String}{Data structure used to find the photons
+ *        near a gather point. \code{kdtree} builds a photon kd-tree in every pass,
+ *        while \code{hashgrid} sorts the photons into a hash grid in parallel, which
+ *        is considerably faster for large photon counts. \default{\code{kdtree}}}
  * }
  * This plugin implements stochastic progressive photon mapping by Hachisuka et al.
  * \cite{Hachisuka2009Stochastic}. This algorithm is an extension of progressive photon
@@ -105,6 +110,14 @@ public:
 		m_autoCancelGathering = props.getBoolean("autoCancelGathering", true);
 		/* Maximum number of passes to render. -1 renders until the process is stopped. */
 		m_maxPasses = props.getInteger("maxPasses", -1);
+		/* Photon lookup data structure (kdtree or hashgrid) */
+		std::string photonLookup = to_lower_copy(props.getString("photonLookup", "kdtree"));
+		if (photonLookup == "kdtree")
+			m_hashGrid = false;
+		else if (photonLookup == "hashgrid")
+			m_hashGrid = true;
+		else
+			Log(EError, "Unknown photon lookup data structure \"%s\"!", photonLookup.c_str());
 		m_mutex = new Mutex();
 		if (m_maxDepth <= 1 && m_maxDepth != -1)
 			Log(EError, "Maximum depth must be set to \"2\" or higher!");
@@ -329,7 +342,12 @@ public:
 		sched->wait(proc);
 
 		ref<PhotonMap> photonMap = proc->getPhotonMap();
-		photonMap->build();
+		ref<Timer> timer = new Timer();
+		if (m_hashGrid)
+			photonMap->buildHashGrid(2 * averageRadius());
+		else
+			photonMap->build();
+		unsigned int buildTime = timer->getMilliseconds();
 		Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: "
 			SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
 
@@ -376,10 +394,30 @@ public:
 				target[gp.pos.y * m_bitmap->getWidth() + gp.pos.x] = contrib;
 			}
 		}
+		unsigned int gatherTime = timer->getMilliseconds() - buildTime;
+		Log(EInfo, "Built the photon %s over " SIZE_T_FMT " photons in %i ms, gathering took %i ms",
+			m_hashGrid ? "hash grid" : "kd-tree", photonMap->size(), buildTime, gatherTime);
+
 		film->setBitmap(m_bitmap);
 		queue->signalRefresh(job);
 	}
 
+	/// Return the average radius of the valid gather points
+	Float averageRadius() const {
+		double sum = 0;
+		size_t count = 0;
+		for (size_t i=0; i<m_gatherBlocks.size(); ++i) {
+			for (size_t j=0; j<m_gatherBlocks[i].size(); ++j) {
+				const GatherPoint &gp = m_gatherBlocks[i][j];
+				if (gp.depth != -1) {
+					sum += gp.radius;
+					++count;
+				}
+			}
+		}
+		return count > 0 ? (Float) (sum / count) : m_initialRadius;
+	}
+
 	std::string toString() const {
 		std::ostringstream oss;
 		oss << "SPPMIntegrator[" << endl
@@ -389,7 +427,8 @@ public:
 			<< "  alpha = " << m_alpha << "," << endl
 			<< "  photonCount = " << m_photonCount << "," << endl
 			<< "  granularity = " << m_granularity << "," << endl
-			<< "  maxPasses = " << m_maxPasses << endl
+			<< "  maxPasses = " << m_maxPasses << "," << endl
+			<< "  photonLookup = " << (m_hashGrid ? "hashgrid" : "kdtree") << endl
 			<< "]";
 		return oss.str();
 	}
@@ -425,6 +464,7 @@ private:
 	size_t m_totalEmitted, m_totalPhotons;
 	bool m_running;
 	bool m_autoCancelGathering;
+	bool m_hashGrid;
 	int m_maxPasses;
 };
 
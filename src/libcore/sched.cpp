@@ -20,10 +20,19 @@
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/mstream.h>
 
+#include <chrono>
 #include <thread>
 
 MTS_NAMESPACE_BEGIN
 
+namespace {
+	/// Monotonic time in nanoseconds, used for the worker statistics
+	inline int64_t schedClock() {
+		return (int64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
 SerializableObject *WorkProcessor::getResource(const std::string &name) {
 	if (m_resources.find(name) == m_resources.end())
 		Log(EError, "Could not find a resource named \"%s\"!", name.c_str());
@@ -59,11 +68,71 @@ Scheduler::Scheduler() {
 	m_running = false;
 	m_nextWorkerOffset = 0;
 	m_maxWorkersPerProcess = -1;
+	m_workStealing = false;
 }
 
 Scheduler::~Scheduler() {
 	for (size_t i=0; i<m_workers.size(); ++i)
 		m_workers[i]->decRef();
+	for (size_t i=0; i<m_workQueues.size(); ++i)
+		delete m_workQueues[i];
+}
+
+void Scheduler::setWorkStealing(bool enabled) {
+	LockGuard lock(m_mutex);
+	if (m_running)
+		Log(EError, "setWorkStealing(): the scheduler must not be running!");
+	if (!enabled) {
+		for (size_t i=0; i<m_workQueues.size(); ++i) {
+			if (m_workQueues[i] && !m_workQueues[i]->units.empty())
+				Log(EError, "setWorkStealing(): there are pending work units!");
+			delete m_workQueues[i];
+		}
+		m_workQueues.clear();
+	}
+	m_workStealing = enabled;
+}
+
+std::vector<Scheduler::WorkerStatistics> Scheduler::getWorkerStatistics() const {
+	LockGuard lock(m_mutex);
+	std::vector<WorkerStatistics> result(m_workers.size());
+	for (size_t i=0; i<m_workers.size(); ++i) {
+		const Worker *worker = m_workers[i];
+		WorkerStatistics &stats = result[i];
+		stats.name = worker->getName();
+		stats.workUnits = worker->m_statsWorkUnits;
+		stats.steals = worker->m_statsSteals;
+		stats.idleTime = (Float) (worker->m_statsIdleTime * 1e-9);
+	}
+	return result;
+}
+
+std::string Scheduler::getWorkerStatisticsString() const {
+	std::vector<WorkerStatistics> stats = getWorkerStatistics();
+	std::ostringstream oss;
+	size_t totalUnits = 0, totalSteals = 0;
+	Float totalIdle = 0;
+	oss << "Worker statistics (" << (m_workStealing ? "work stealing" : "central queue") << "):" << endl;
+	for (size_t i=0; i<stats.size(); ++i) {
+		oss << formatString("  %-10s %8zu work units, %7zu stolen, idle for %s",
+			stats[i].name.c_str(), stats[i].workUnits, stats[i].steals,
+			timeString(stats[i].idleTime, true).c_str()) << endl;
+		totalUnits += stats[i].workUnits;
+		totalSteals += stats[i].steals;
+		totalIdle += stats[i].idleTime;
+	}
+	oss << formatString("  Total      %8zu work units, %7zu stolen, idle for %s",
+		totalUnits, totalSteals, timeString(totalIdle, true).c_str());
+	return oss.str();
+}
+
+void Scheduler::resetWorkerStatistics() {
+	LockGuard lock(m_mutex);
+	for (size_t i=0; i<m_workers.size(); ++i) {
+		m_workers[i]->m_statsWorkUnits = 0;
+		m_workers[i]->m_statsSteals = 0;
+		m_workers[i]->m_statsIdleTime = 0;
+	}
 }
 
 void Scheduler::registerWorker(Worker *worker) {
@@ -385,6 +454,9 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
 	for (size_t i=0; i<m_workers.size(); ++i)
 		m_workers[i]->signalProcessCancellation(rec->id);
 
+	/* Work units that were generated in advance are never started */
+	discardQueuedWork(rec);
+
 	/* Ensure that this process won't be scheduled again */
 	m_localQueue.erase(std::remove(m_localQueue.begin(), m_localQueue.end(), rec->id),
 		m_localQueue.end());
@@ -431,8 +503,21 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
 	return true;
 }
 
+bool Scheduler::isWorkerInRange(const ProcessRecord *rec, int workerIndex) const {
+	if (rec->workerCount <= 0)
+		return true;
+	bool workerInRange = rec->workerOffset <= workerIndex && workerIndex < rec->workerOffset + rec->workerCount;
+	int wrapAroundOffset = (rec->workerOffset + rec->workerCount) % (int) m_workers.size();
+	workerInRange |= wrapAroundOffset <= rec->workerOffset && workerIndex < wrapAroundOffset;
+	return workerInRange;
+}
+
 Scheduler::EStatus Scheduler::acquireWork(Item &item,
 		bool local, bool onlyTry, bool keepLock) {
+	if (local && m_workStealing && !onlyTry && !keepLock)
+		return acquireWorkStealing(item);
+
+	const int64_t start = schedClock();
 	UniqueLock lock(m_mutex);
 	std::deque<int> &queue = local ? m_localQueue : m_remoteQueue;
 	while (true) {
@@ -454,16 +539,8 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
 				int id = *it;
 				ParallelProcess *proc = m_idToProcess[id];
 				ProcessRecord* rec = m_processes[proc];
-
-				bool workerInRange = true;
-				if (rec->workerCount > 0) {
-					workerInRange = rec->workerOffset <= item.workerIndex && item.workerIndex < rec->workerOffset + rec->workerCount;
-					int wrapAroundOffset = (rec->workerOffset + rec->workerCount) % (int) m_workers.size();
-					workerInRange |= wrapAroundOffset <= rec->workerOffset && item.workerIndex < wrapAroundOffset;
-				}
-				if (!workerInRange) {
+				if (!isWorkerInRange(rec, item.workerIndex))
 					continue;
-				}
 
 				if (item.id != id) {
 					/* First work unit from this parallel process - establish
@@ -510,15 +587,221 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
 	item.rec->inflight++;
 	item.stop = false;
 
+	Worker *worker = m_workers[item.workerIndex];
 	if (!keepLock)
 		lock.unlock();
 	else
 		lock.release(); /* Avoid the automatic unlocking upon destruction */
 
+	++worker->m_statsWorkUnits;
+	worker->m_statsIdleTime += schedClock() - start;
+
 	std::this_thread::yield();
 	return EOK;
 }
 
+Scheduler::EStatus Scheduler::acquireWorkStealing(Item &item) {
+	const int64_t start = schedClock();
+	WorkQueue *own = m_workQueues[item.workerIndex];
+	Worker *worker = m_workers[item.workerIndex];
+	QueuedWorkUnit unit;
+
+	/* Next work unit from the own queue, which does not need the scheduler lock.
+	   The owner takes units in the order of generation, thieves take them from
+	   the other end */
+	{
+		std::lock_guard<std::mutex> guard(own->mutex);
+		if (!own->units.empty()) {
+			unit = own->units.back();
+			own->units.pop_back();
+		}
+	}
+
+	if (!unit.workUnit) {
+		UniqueLock lock(m_mutex);
+		bool stolen = false;
+		while (true) {
+			if (!m_running)
+				return EStop;
+
+			/* Generate several work units from the first process
+			   in the queue that this worker may contribute to */
+			ParallelProcess::EStatus wStatus = ParallelProcess::EUnknown;
+			int generated = 0;
+			try {
+				for (std::deque<int>::iterator it = m_localQueue.begin(); it != m_localQueue.end(); ++it) {
+					int id = *it;
+					ParallelProcess *proc = m_idToProcess[id];
+					ProcessRecord* rec = m_processes[proc];
+					if (!isWorkerInRange(rec, item.workerIndex))
+						continue;
+
+					if (item.id != id)
+						setProcessByID(item, id);
+
+					std::lock_guard<std::mutex> guard(own->mutex);
+					for (int i=0; i<MTS_SCHED_STEAL_BATCH; ++i) {
+						ref<WorkUnit> workUnit = item.wp->createWorkUnit();
+						wStatus = item.proc->generateWork(workUnit, item.workerIndex);
+						if (wStatus != ParallelProcess::ESuccess)
+							break;
+						QueuedWorkUnit entry;
+						entry.id = id;
+						entry.workUnit = workUnit;
+						own->units.push_front(entry);
+						item.rec->inflight++;
+						++generated;
+					}
+					break;
+				}
+			} catch (const std::exception &ex) {
+				Log(EWarn, "Caught an exception - canceling process %i: %s",
+					item.id, ex.what());
+				cancel(item.proc);
+				continue;
+			}
+
+			if (wStatus == ParallelProcess::EFailure || wStatus == ParallelProcess::EPause) {
+#if defined(DEBUG_SCHED)
+				Log(item.rec->logLevel, "Process %i has %s generating work", item.rec->id,
+					wStatus == ParallelProcess::EFailure ? "finished" : "paused");
+#endif
+				if (wStatus == ParallelProcess::EFailure)
+					item.rec->morework = false;
+				item.rec->active = false;
+				m_localQueue.erase(std::remove(m_localQueue.begin(), m_localQueue.end(), item.id),
+					m_localQueue.end());
+				if (item.rec->inflight == 0 && !item.rec->morework) {
+					signalProcessTermination(item.proc, item.rec);
+					continue;
+				}
+			}
+
+			if (generated > 0) {
+				/* Let idle workers steal the remaining units */
+				if (generated > 1)
+					m_workAvailable->broadcast();
+				std::lock_guard<std::mutex> guard(own->mutex);
+				unit = own->units.back();
+				own->units.pop_back();
+				break;
+			} else if (wStatus != ParallelProcess::EUnknown) {
+				continue;
+			}
+
+			/* No process has more work -- steal from another worker. The
+			   first victim rotates to spread the thieves over the queues */
+			const size_t count = m_workQueues.size();
+			const size_t offset = (size_t) item.workerIndex + worker->m_statsWorkUnits;
+			for (size_t i=0; i<count && !unit.workUnit; ++i) {
+				WorkQueue *victim = m_workQueues[(offset + i) % count];
+				if (!victim || victim == own)
+					continue;
+				std::lock_guard<std::mutex> guard(victim->mutex);
+				for (std::deque<QueuedWorkUnit>::iterator it = victim->units.begin(); it != victim->units.end(); ++it) {
+					if (isWorkerInRange(m_processes[m_idToProcess[it->id]], item.workerIndex)) {
+						unit = *it;
+						victim->units.erase(it);
+						break;
+					}
+				}
+			}
+			if (unit.workUnit) {
+				stolen = true;
+				break;
+			}
+
+			m_workAvailable->wait();
+		}
+		if (stolen)
+			++worker->m_statsSteals;
+	}
+
+	beginQueuedWork(item, unit);
+
+	++worker->m_statsWorkUnits;
+	worker->m_statsIdleTime += schedClock() - start;
+	return EOK;
+}
+
+void Scheduler::beginQueuedWork(Item &item, QueuedWorkUnit &unit) {
+	/* The process can't terminate meanwhile, since the unit is in flight */
+	if (item.id != unit.id)
+		setProcessByID(item, unit.id);
+	item.workUnit = unit.workUnit;
+	item.stop = false;
+	/* Cancellation has already been signaled if the process was
+	   cancelled after the unit was generated */
+	if (item.rec->cancelled)
+		item.stop = true;
+}
+
+void Scheduler::discardQueuedWork(ProcessRecord *rec) {
+	for (size_t i=0; i<m_workQueues.size(); ++i) {
+		WorkQueue *queue = m_workQueues[i];
+		if (!queue)
+			continue;
+		std::lock_guard<std::mutex> guard(queue->mutex);
+		for (std::deque<QueuedWorkUnit>::iterator it = queue->units.begin(); it != queue->units.end(); ) {
+			if (it->id == rec->id) {
+				it = queue->units.erase(it);
+				--rec->inflight;
+			} else {
+				++it;
+			}
+		}
+	}
+}
+
+void Scheduler::rebuildWorkQueues() {
+	LockGuard lock(m_mutex);
+	/* The set of workers may have changed during a pause. Give every local
+	   worker a new queue and hand over the work units that were generated
+	   before the pause, preferably to a worker that may process them */
+	std::vector<WorkQueue *> oldQueues;
+	oldQueues.swap(m_workQueues);
+	m_workQueues.assign(m_workers.size(), NULL);
+	std::vector<size_t> localWorkers;
+	for (size_t i=0; i<m_workers.size(); ++i) {
+		if (!m_workers[i]->isRemoteWorker()) {
+			m_workQueues[i] = new WorkQueue();
+			localWorkers.push_back(i);
+		}
+	}
+
+	size_t next = 0;
+	for (size_t i=0; i<oldQueues.size(); ++i) {
+		if (!oldQueues[i])
+			continue;
+		std::deque<QueuedWorkUnit> &units = oldQueues[i]->units;
+		for (std::deque<QueuedWorkUnit>::iterator it = units.begin(); it != units.end(); ++it) {
+			ParallelProcess *proc = m_idToProcess[it->id];
+			ProcessRecord *rec = m_processes[proc];
+			WorkQueue *target = NULL;
+			for (size_t j=0; j<localWorkers.size() && !target; ++j) {
+				size_t index = localWorkers[(next + j) % localWorkers.size()];
+				if (isWorkerInRange(rec, (int) index))
+					target = m_workQueues[index];
+			}
+			/* Better violate the worker range than lose the work unit */
+			if (!target && !localWorkers.empty())
+				target = m_workQueues[localWorkers[next % localWorkers.size()]];
+			++next;
+
+			if (target && !rec->cancelled) {
+				target->units.push_back(*it);
+			} else {
+				/* No local worker is left -- discard the unit like discardQueuedWork() */
+				--rec->inflight;
+				rec->cond->signal();
+				if (rec->inflight == 0 && !rec->morework)
+					signalProcessTermination(proc, rec);
+			}
+		}
+		delete oldQueues[i];
+	}
+}
+
 void Scheduler::signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec) {
 #if defined(DEBUG_SCHED)
 	Log(rec->logLevel, "Process %i is complete.", rec->id);
@@ -553,6 +836,9 @@ void Scheduler::start() {
 	if (m_workers.size() == 0)
 		Log(EError, "Cannot start the scheduler - there are no registered workers!");
 
+	if (m_workStealing)
+		rebuildWorkQueues();
+
 	int coreIndex = 0;
 	for (size_t i=0; i<m_workers.size(); ++i) {
 		m_workers[i]->start(this, (int) i, coreIndex);
@@ -595,6 +881,9 @@ void Scheduler::stop() {
 	m_idToProcess.clear();
 	m_localQueue.clear();
 	m_remoteQueue.clear();
+	for (size_t i=0; i<m_workQueues.size(); ++i)
+		delete m_workQueues[i];
+	m_workQueues.clear();
 	for (std::map<int, ResourceRecord *>::iterator
 		it = m_resources.begin(); it != m_resources.end(); ++it) {
 		ResourceRecord *rec = (*it).second;
@@ -638,7 +927,8 @@ void Scheduler::staticShutdown() {
 /*                         Worker implementations                       */
 /* ==================================================================== */
 
-Worker::Worker(const std::string &name) : Thread(name), m_coreCount(0), m_isRemote(false) {
+Worker::Worker(const std::string &name) : Thread(name), m_coreCount(0), m_isRemote(false),
+	m_statsWorkUnits(0), m_statsSteals(0), m_statsIdleTime(0) {
 }
 
 void Worker::clear() {
@@ -19,11 +19,19 @@
 #include <mitsuba/core/sched_remote.h>
 #include <mitsuba/core/sstream.h>
 #include <mitsuba/core/mstream.h>
+#include <mitsuba/core/zstream.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/version.h>
+#include <mutex>
 
 MTS_NAMESPACE_BEGIN
 
+/* Bounds and average size (2^MTS_CHUNK_HASH_BITS bytes past the minimum)
+   of the content-defined chunks that resources are split into */
+#define MTS_CHUNK_MIN_SIZE  (16 * 1024)
+#define MTS_CHUNK_MAX_SIZE  (256 * 1024)
+#define MTS_CHUNK_HASH_BITS 16
+
 class CancelThread : public Thread {
 public:
 	CancelThread(ParallelProcess *proc) : Thread("cthr"), m_proc(proc) { }
@@ -38,16 +46,29 @@ private:
 	ref<ParallelProcess> m_proc;
 };
 
-RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(name), m_stream(stream) {
-	const size_t dataLength = strlen(MTS_VERSION)+3;
-	char *data = (char *) alloca(dataLength);
+/* Handshake data, which must match exactly on both sides: the program version,
+   the configuration flags and the version of the wire protocol. The protocol
+   version shares a byte with the precision flag, which keeps the length
+   compatible with older nodes (these are then rejected as incompatible) */
+static size_t getHandshakeLength() {
+	return strlen(MTS_VERSION)+3;
+}
+
+static void writeHandshake(char *data) {
+	const size_t dataLength = getHandshakeLength();
 	strncpy(data, MTS_VERSION, strlen(MTS_VERSION)+1);
 	data[dataLength-2] = SPECTRUM_SAMPLES;
 #ifdef DOUBLE_PRECISION
-	data[dataLength-1] = 1;
+	data[dataLength-1] = (char) ((MTS_REMOTE_PROTOCOL_VERSION << 1) | 1);
 #else
-	data[dataLength-1] = 0;
+	data[dataLength-1] = (char) (MTS_REMOTE_PROTOCOL_VERSION << 1);
 #endif
+}
+
+RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(name), m_stream(stream) {
+	const size_t dataLength = getHandshakeLength();
+	char *data = (char *) alloca(dataLength);
+	writeHandshake(data);
 	m_stream->writeShort(StreamBackend::EHello);
 	m_stream->write(data, dataLength);
 	m_stream->flush();
@@ -61,6 +82,10 @@ RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(nam
 	m_nodeName = m_stream->readString();
 	m_mutex = new Mutex();
 	m_finishCond = new ConditionVariable(m_mutex);
+	m_chunkCond = new ConditionVariable(m_mutex);
+	m_chunkQueryPending = false;
+	m_pendingProcess = -1;
+	m_pendingCancelled = false;
 	m_memStream = new MemoryStream();
 	m_memStream->setByteOrder(Stream::ENetworkByteOrder);
 	m_reader = new RemoteWorkerReader(this);
@@ -109,7 +134,7 @@ void RemoteWorker::run() {
 				break;
 		}
 		/* Acquire the lock each iteration, release it at the end of each one */
-		LockGuard lock(m_mutex);
+		UniqueLock lock(m_mutex);
 
 		const int id = m_schedItem.rec->id;
 		if (m_processes.find(id) == m_processes.end()) {
@@ -118,6 +143,7 @@ void RemoteWorker::run() {
 			   units on the other side */
 			std::vector<std::pair<int, const MemoryStream *> > resources;
 			std::vector<std::pair<int, const SerializableObject *> > multiResources;
+			std::set<int> newResources;
 
 			/* First, look up all resources required by this process (the scheduler lock
 			   needs to be held for that, so do it quickly) */
@@ -126,7 +152,8 @@ void RemoteWorker::run() {
 				it != bindings.end(); ++it) {
 				int resID = (*it).second;
 
-				if (m_resources.find(resID) == m_resources.end()) {
+				if (m_resources.find(resID) == m_resources.end()
+						&& newResources.insert(resID).second) {
 					if (!m_scheduler->isMultiResource(resID)) {
 						resources.push_back(std::pair<int, const MemoryStream *>(resID,
 							m_scheduler->getResourceStream(resID)));
@@ -136,13 +163,57 @@ void RemoteWorker::run() {
 								m_scheduler->getResource(resID, (int) (m_schedItem.coreOffset + i))));
 					}
 				}
-				m_resources.insert(resID);
 			}
 			/* We can safely release the scheduler lock now. The local message buffer lock is still
-			   held and thus, there is no danger of sending a cancellation message for a process which
-			   the remote side has not even seen yet. */
+			   held, except while waiting for the chunk query result below. A cancellation that
+			   arrives in the meantime is recorded in m_pendingCancelled, since the remote side
+			   has not seen the process yet. */
 			releaseSchedulerLock();
 
+			/* Split the resources into chunks and ask the remote side which of them
+			   are not in its cache yet. This is done before writing anything else,
+			   since messages of other threads may be sent while waiting for the answer */
+			std::vector<std::vector<ResourceChunkCache::Chunk> > chunks(resources.size());
+			std::vector<uint8_t> missing;
+			if (!resources.empty()) {
+				size_t chunkCount = 0;
+				for (size_t i=0; i<resources.size(); ++i) {
+					const MemoryStream *resStream = resources[i].second;
+					ResourceChunkCache::split(resStream->getData(), resStream->getPos(), chunks[i]);
+					chunkCount += chunks[i].size();
+				}
+
+				m_memStream->writeShort(StreamBackend::EQueryChunks);
+				m_memStream->writeInt((int) chunkCount);
+				for (size_t i=0; i<chunks.size(); ++i) {
+					for (size_t j=0; j<chunks[i].size(); ++j) {
+						m_memStream->writeULong(chunks[i][j].key.h0);
+						m_memStream->writeULong(chunks[i][j].key.h1);
+					}
+				}
+				m_chunkQueryPending = true;
+				m_pendingProcess = id;
+				m_pendingCancelled = false;
+				flush();
+				while (m_chunkQueryPending)
+					m_chunkCond->wait();
+				m_pendingProcess = -1;
+				missing.swap(m_chunkQuery);
+				if (missing.size() != chunkCount)
+					Log(EError, "Received an invalid chunk query result!");
+
+				if (m_pendingCancelled) {
+					/* Don't send the process at all and return the
+					   work unit as cancelled (without holding the lock,
+					   since the scheduler lock is acquired next) */
+					m_pendingCancelled = false;
+					lock.unlock();
+					m_schedItem.stop = true;
+					releaseWork(m_schedItem);
+					continue;
+				}
+			}
+
 			std::vector<std::string> plugins = m_schedItem.proc->getRequiredPlugins();
 			for (size_t i=0; i<plugins.size(); ++i) {
 				if (m_plugins.find(plugins[i]) == m_plugins.end()) {
@@ -161,15 +232,43 @@ void RemoteWorker::run() {
 			manager->serialize(m_memStream, m_schedItem.wp);
 			m_processes.insert(id);
 
+			const uint8_t *missingPtr = missing.empty() ? NULL : &missing[0];
 			for (size_t i=0; i<resources.size(); ++i) {
 				int resID = resources[i].first;
 				const MemoryStream *resStream = resources[i].second;
-				Log(EDebug, "Sending resource %i to \"%s\" (%i KB)", resID, m_nodeName.c_str(),
-					resStream->getPos() / 1024);
-				m_memStream->writeShort(StreamBackend::ENewResource);
+				const std::vector<ResourceChunkCache::Chunk> &resChunks = chunks[i];
+
+				/* Compress the chunks that are missing on the remote side */
+				ref<MemoryStream> packed = new MemoryStream();
+				size_t missingCount = 0;
+				{
+					ref<ZStream> zstream = new ZStream(packed);
+					for (size_t j=0; j<resChunks.size(); ++j) {
+						if (!missingPtr[j])
+							continue;
+						zstream->write(resStream->getData() + resChunks[j].offset, resChunks[j].size);
+						++missingCount;
+					}
+				}
+
+				Log(EDebug, "Sending resource %i to \"%s\" (%i KB, %i/%i chunks "
+					"missing, %i KB compressed)", resID, m_nodeName.c_str(),
+					(int) (resStream->getPos() / 1024), (int) missingCount,
+					(int) resChunks.size(), (int) (packed->getPos() / 1024));
+
+				m_memStream->writeShort(StreamBackend::ENewChunkedResource);
 				m_memStream->writeInt(resID);
 				m_memStream->writeSize(resStream->getPos());
-				m_memStream->write(resStream->getData(), resStream->getPos());
+				m_memStream->writeSize(resChunks.size());
+				for (size_t j=0; j<resChunks.size(); ++j) {
+					m_memStream->writeULong(resChunks[j].key.h0);
+					m_memStream->writeULong(resChunks[j].key.h1);
+					m_memStream->writeUInt((uint32_t) resChunks[j].size);
+					m_memStream->writeBool(missingPtr[j] != 0);
+				}
+				m_memStream->writeSize(packed->getPos());
+				m_memStream->write(packed->getData(), packed->getPos());
+				missingPtr += resChunks.size();
 			}
 
 			for (size_t i=0; i<multiResources.size(); i += m_coreCount) {
@@ -187,6 +286,11 @@ void RemoteWorker::run() {
 				m_memStream->write(resStream->getData(), resStream->getPos());
 			}
 
+			/* Only mark the resources as sent now. Waiting for the chunk query
+			   result above temporarily releases the lock, and an expiration
+			   message must not overtake the resource itself */
+			m_resources.insert(newResources.begin(), newResources.end());
+
 			for (ParallelProcess::ResourceBindings::const_iterator it = bindings.begin();
 				it != bindings.end(); ++it) {
 				m_memStream->writeShort(StreamBackend::EBindResource);
@@ -229,6 +333,9 @@ void RemoteWorker::signalResourceExpiration(int id) {
 void RemoteWorker::signalProcessCancellation(int id) {
 	LockGuard lock(m_mutex);
 	if (m_processes.find(id) == m_processes.end()) {
+		/* The process may be about to be sent, see run() */
+		if (id == m_pendingProcess)
+			m_pendingCancelled = true;
 		return;
 	}
 	m_memStream->writeShort(StreamBackend::EProcessCancelled);
@@ -272,6 +379,15 @@ void RemoteWorkerReader::run() {
 			msg = m_stream->readShort();
 			id = m_stream->readInt();
 
+			if (msg == StreamBackend::EChunkQueryResult) {
+				/* Not associated with a process -- 'id' holds the chunk count */
+				std::vector<uint8_t> missing((size_t) id);
+				if (id > 0)
+					m_stream->read(&missing[0], missing.size());
+				m_parent->signalChunkQueryResult(missing);
+				continue;
+			}
+
 			if (id != m_currentID) {
 				m_parent->setProcessByID(m_schedItem, id);
 				m_currentID = id;
@@ -345,16 +461,10 @@ void StreamBackend::run() {
 		return;
 	}
 
-	const size_t dataLength = strlen(MTS_VERSION)+3;
+	const size_t dataLength = getHandshakeLength();
 	char *data    = (char *) alloca(dataLength),
 		 *refData = (char *) alloca(dataLength);
-	strncpy(refData, MTS_VERSION, strlen(MTS_VERSION)+1);
-	refData[dataLength-2] = SPECTRUM_SAMPLES;
-#ifdef DOUBLE_PRECISION
-	refData[dataLength-1] = 1;
-#else
-	refData[dataLength-1] = 0;
-#endif
+	writeHandshake(refData);
 	m_stream->read(data, dataLength);
 
 	if (memcmp(data, refData, dataLength) != 0) {
@@ -400,6 +510,76 @@ void StreamBackend::run() {
 						m_resources[id] = m_scheduler->registerResource(res);
 					}
 					break;
+				case EQueryChunks: {
+						int count = m_stream->readInt();
+						ResourceChunkCache *cache = ResourceChunkCache::getInstance();
+						std::vector<uint8_t> missing(count);
+						/* Keep references to the cached chunks, so that they
+						   can't be evicted before the resources arrive */
+						m_queriedChunks.clear();
+						for (int i=0; i<count; ++i) {
+							ResourceChunkCache::Key key;
+							key.h0 = m_stream->readULong();
+							key.h1 = m_stream->readULong();
+							ResourceChunkCache::ChunkPtr chunk = cache->get(key);
+							if (chunk)
+								m_queriedChunks[key] = chunk;
+							else
+								missing[i] = 1;
+						}
+						sendChunkQueryResult(missing);
+					}
+					break;
+				case ENewChunkedResource: {
+						int id = m_stream->readInt();
+						size_t size = m_stream->readSize();
+						size_t chunkCount = m_stream->readSize();
+						std::vector<ResourceChunkCache::Key> keys(chunkCount);
+						std::vector<size_t> sizes(chunkCount);
+						std::vector<bool> included(chunkCount);
+						for (size_t i=0; i<chunkCount; ++i) {
+							keys[i].h0 = m_stream->readULong();
+							keys[i].h1 = m_stream->readULong();
+							sizes[i] = m_stream->readUInt();
+							included[i] = m_stream->readBool();
+						}
+						size_t packedSize = m_stream->readSize();
+						ref<MemoryStream> packed = new MemoryStream(packedSize);
+						m_stream->copyTo(packed, packedSize);
+						packed->seek(0);
+
+						/* Reassemble the resource from the cache and the received chunks */
+						ResourceChunkCache *cache = ResourceChunkCache::getInstance();
+						ref<ZStream> zstream = new ZStream(packed);
+						ref<MemoryStream> mstream = new MemoryStream(size);
+						mstream->setByteOrder(Stream::ENetworkByteOrder);
+						for (size_t i=0; i<chunkCount; ++i) {
+							ResourceChunkCache::ChunkPtr chunk;
+							if (included[i]) {
+								std::vector<uint8_t> *data = new std::vector<uint8_t>(sizes[i]);
+								chunk.reset(data);
+								zstream->read(&(*data)[0], sizes[i]);
+								if (!(ResourceChunkCache::computeKey(&(*data)[0], sizes[i]) == keys[i]))
+									Log(EError, "Received a corrupted chunk of resource %i!", id);
+								cache->put(keys[i], chunk);
+							} else {
+								std::map<ResourceChunkCache::Key, ResourceChunkCache::ChunkPtr>::const_iterator
+									it = m_queriedChunks.find(keys[i]);
+								if (it == m_queriedChunks.end())
+									Log(EError, "Chunk %i of resource %i is not available!", (int) i, id);
+								chunk = it->second;
+							}
+							mstream->write(&(*chunk)[0], chunk->size());
+						}
+						if (mstream->getPos() != size)
+							Log(EError, "Resource %i has an unexpected size!", id);
+						mstream->seek(0);
+
+						ref<InstanceManager> manager = new InstanceManager();
+						ref<SerializableObject> res = static_cast<SerializableObject *>(manager->getInstance(mstream));
+						m_resources[id] = m_scheduler->registerResource(res);
+					}
+					break;
 				case ENewMultiResource: {
 						int id = m_stream->readInt();
 						size_t size = m_stream->readSize();
@@ -516,6 +696,24 @@ void StreamBackend::sendCancellation(int id, int numLost) {
 	}
 }
 
+void StreamBackend::sendChunkQueryResult(const std::vector<uint8_t> &missing) {
+	LockGuard lock(m_sendMutex);
+	m_memStream->reset();
+	m_memStream->writeShort(EChunkQueryResult);
+	m_memStream->writeInt((int) missing.size());
+	if (!missing.empty())
+		m_memStream->write(&missing[0], missing.size());
+	try {
+		m_memStream->seek(0);
+		m_memStream->copyTo(m_stream);
+		m_stream->flush();
+	} catch (std::exception &) {
+		Log(EWarn, "Connection error - could not submit the chunk query result");
+		/* A connection failure occurred - this will eventually be
+		   caught and handled in run() and is therefore ignored for now */
+	}
+}
+
 void StreamBackend::sendWorkResult(int id, const WorkResult *result, bool cancelled) {
 	LockGuard lock(m_sendMutex);
 	m_memStream->reset();
@@ -589,6 +787,133 @@ void RemoteProcess::handleCancellation() {
 	m_full.clear();
 }
 
+/* ==================================================================== */
+/*                         Resource chunk cache                         */
+/* ==================================================================== */
+
+/* Random values used by the rolling hash that determines the chunk boundaries */
+static struct ChunkGearTable {
+	uint64_t values[256];
+
+	ChunkGearTable() {
+		uint64_t state = 0x9E3779B97F4A7C15ULL;
+		for (int i=0; i<256; ++i) {
+			/* SplitMix64 */
+			uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			values[i] = z ^ (z >> 31);
+		}
+	}
+} __chunkGearTable;
+
+ResourceChunkCache *ResourceChunkCache::getInstance() {
+	/* Created on first use and intentionally never released, since
+	   server connections may still be active during the static shutdown */
+	static ResourceChunkCache *instance = NULL;
+	static std::once_flag flag;
+	std::call_once(flag, []() {
+		instance = new ResourceChunkCache((size_t) MTS_CHUNKCACHE_DEFAULT_BUDGET * 1024 * 1024);
+		instance->incRef();
+	});
+	return instance;
+}
+
+ResourceChunkCache::ResourceChunkCache(size_t budget)
+	: m_budget(budget), m_memoryUsage(0) {
+	m_mutex = new Mutex();
+}
+
+ResourceChunkCache::~ResourceChunkCache() { }
+
+ResourceChunkCache::Key ResourceChunkCache::computeKey(const uint8_t *data, size_t size) {
+	Key key;
+	key.h0 = hashBuffer(data, size);
+	key.h1 = hashBuffer(data, size, key.h0);
+	return key;
+}
+
+void ResourceChunkCache::split(const uint8_t *data, size_t size, std::vector<Chunk> &chunks) {
+	/* A boundary is placed where the upper bits of a rolling "gear"
+	   hash over the preceding 64 bytes are zero */
+	const uint64_t mask = ((1ULL << MTS_CHUNK_HASH_BITS) - 1) << (64 - MTS_CHUNK_HASH_BITS);
+	const uint64_t *gear = __chunkGearTable.values;
+	size_t start = 0;
+
+	chunks.clear();
+	while (start < size) {
+		size_t end = std::min(size, start + MTS_CHUNK_MAX_SIZE),
+			   pos = std::min(end, start + MTS_CHUNK_MIN_SIZE);
+		uint64_t hash = 0;
+
+		while (pos < end) {
+			hash = (hash << 1) + gear[data[pos++]];
+			if ((hash & mask) == 0)
+				break;
+		}
+
+		Chunk chunk;
+		chunk.offset = start;
+		chunk.size = pos - start;
+		chunk.key = computeKey(data + start, chunk.size);
+		chunks.push_back(chunk);
+		start = pos;
+	}
+}
+
+ResourceChunkCache::ChunkPtr ResourceChunkCache::get(const Key &key) {
+	LockGuard lock(m_mutex);
+	std::map<Key, ChunkList::iterator>::iterator it = m_index.find(key);
+	if (it == m_index.end())
+		return ChunkPtr();
+	/* Move to the front of the LRU list */
+	m_chunks.splice(m_chunks.begin(), m_chunks, it->second);
+	return it->second->second;
+}
+
+void ResourceChunkCache::put(const Key &key, const ChunkPtr &chunk) {
+	LockGuard lock(m_mutex);
+	if (m_index.find(key) != m_index.end())
+		return;
+	m_chunks.push_front(std::make_pair(key, chunk));
+	m_index[key] = m_chunks.begin();
+	m_memoryUsage += chunk->size();
+	evict();
+}
+
+void ResourceChunkCache::evict() {
+	while (m_memoryUsage > m_budget && !m_chunks.empty()) {
+		const std::pair<Key, ChunkPtr> &entry = m_chunks.back();
+		m_memoryUsage -= entry.second->size();
+		m_index.erase(entry.first);
+		m_chunks.pop_back();
+	}
+}
+
+void ResourceChunkCache::setMemoryBudget(size_t bytes) {
+	LockGuard lock(m_mutex);
+	m_budget = bytes;
+	evict();
+}
+
+void ResourceChunkCache::clear() {
+	LockGuard lock(m_mutex);
+	m_chunks.clear();
+	m_index.clear();
+	m_memoryUsage = 0;
+}
+
+std::string ResourceChunkCache::toString() const {
+	std::ostringstream oss;
+	oss << "ResourceChunkCache[" << endl
+		<< "  memoryBudget = " << memString(m_budget) << "," << endl
+		<< "  memoryUsage = " << memString(m_memoryUsage) << "," << endl
+		<< "  chunks = " << m_chunks.size() << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(ResourceChunkCache, false, Object)
 MTS_IMPLEMENT_CLASS(RemoteWorker, false, Worker)
 MTS_IMPLEMENT_CLASS(RemoteWorkerReader, false, Thread)
 MTS_IMPLEMENT_CLASS(StreamBackend, false, Thread)
@@ -19,6 +19,8 @@
 #include <mitsuba/mitsuba.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/lock.h>
+#include <mitsuba/core/fstream.h>
+#include <mutex>
 
 MTS_NAMESPACE_BEGIN
 
@@ -106,6 +108,59 @@ StatsCounter::~StatsCounter() {
 	freeAligned(m_base);
 }
 
+namespace {
+	/// Pool of the counter slots that are not owned by a running thread
+	struct SlotPool {
+		std::mutex mutex;
+		std::vector<int> free;
+
+		SlotPool() {
+			for (int i=MTS_STATS_SHARED_SLOT-1; i>=0; --i)
+				free.push_back(i);
+		}
+	};
+
+	/* Created on first use and never released, since
+	   threads may still exit during the static shutdown */
+	SlotPool &getSlotPool() {
+		static SlotPool *pool = new SlotPool();
+		return *pool;
+	}
+
+	/// Owns a counter slot for the lifetime of a thread
+	struct ThreadSlot {
+		int index;
+
+		ThreadSlot() : index(MTS_STATS_SHARED_SLOT) {
+			SlotPool &pool = getSlotPool();
+			std::lock_guard<std::mutex> lock(pool.mutex);
+			if (!pool.free.empty()) {
+				index = pool.free.back();
+				pool.free.pop_back();
+			}
+		}
+
+		~ThreadSlot() {
+			if (index == MTS_STATS_SHARED_SLOT)
+				return;
+			SlotPool &pool = getSlotPool();
+			std::lock_guard<std::mutex> lock(pool.mutex);
+			pool.free.push_back(index);
+		}
+	};
+}
+
+int StatsCounter::getSlot() {
+	static thread_local ThreadSlot slot;
+	return slot.index;
+}
+
+int StatsCounter::getSlotCount() {
+	SlotPool &pool = getSlotPool();
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	return MTS_STATS_SHARED_SLOT - (int) pool.free.size();
+}
+
 bool StatsCounter::operator<(const StatsCounter &v) const {
 	if (getCategory() == v.getCategory())
 		return getName() < v.getName();
@@ -119,11 +174,53 @@ void Statistics::staticInitialization() {
 }
 
 void Statistics::staticShutdown() {
+	m_instance->stopRecording();
 	m_instance = NULL;
 }
 
+/// Background thread that appends statistics snapshots to a file
+class StatsRecorder : public Thread {
+public:
+	StatsRecorder(const fs::pathstr &filename, int intervalMs)
+		: Thread("stats"), m_flag(new WaitFlag()), m_intervalMs(intervalMs) {
+		m_stream = new FileStream(filename, FileStream::EAppendWrite);
+		setCritical(false);
+	}
+
+	void run() {
+		do {
+			write();
+		} while (!m_flag->wait(m_intervalMs));
+		write();
+	}
+
+	void quit() {
+		m_flag->set(true);
+		join();
+	}
+
+protected:
+	virtual ~StatsRecorder() { }
+
+	void write() {
+		std::string json = Statistics::getInstance()->getStatsJSON() + "\n";
+		m_stream->write(json.c_str(), json.length());
+		m_stream->flush();
+	}
+
+private:
+	ref<FileStream> m_stream;
+	ref<WaitFlag> m_flag;
+	int m_intervalMs;
+};
+
 Statistics::Statistics() {
 	m_mutex = new Mutex();
+	m_timer = new Timer();
+}
+
+Statistics::~Statistics() {
+	stopRecording();
 }
 
 void Statistics::registerCounter(const StatsCounter *ctr) {
@@ -143,6 +240,92 @@ void Statistics::printStats() {
 	logger->setLogLevel(curLevel);
 }
 
+void Statistics::startRecording(const fs::pathstr &filename, int intervalMs) {
+	stopRecording();
+	if (intervalMs <= 0)
+		Log(EError, "The recording interval must be positive!");
+	ref<StatsRecorder> recorder = new StatsRecorder(filename, intervalMs);
+	recorder->start();
+	m_recorder = recorder;
+}
+
+void Statistics::stopRecording() {
+	if (!m_recorder)
+		return;
+	static_cast<StatsRecorder *>(m_recorder.get())->quit();
+	m_recorder = NULL;
+}
+
+static void appendJSONString(std::ostringstream &oss, const std::string &str) {
+	oss << '"';
+	for (size_t i=0; i<str.length(); ++i) {
+		char c = str[i];
+		switch (c) {
+			case '"': oss << "\\\""; break;
+			case '\\': oss << "\\\\"; break;
+			case '\n': oss << "\\n"; break;
+			case '\t': oss << "\\t"; break;
+			default:
+				if ((unsigned char) c < 0x20) {
+					char temp[8];
+					snprintf(temp, sizeof(temp), "\\u%04x", (int) c);
+					oss << temp;
+				} else {
+					oss << c;
+				}
+		}
+	}
+	oss << '"';
+}
+
+std::string Statistics::getStatsJSON() {
+	static const char *typeNames[] = {
+		"number", "bytes", "percentage", "minimum", "maximum", "average"
+	};
+
+	std::ostringstream oss;
+	LockGuard lock(m_mutex);
+	oss << "{\"time\": " << m_timer->getMilliseconds() / 1000.0 << ", \"plugins\": [";
+
+	std::sort(m_plugins.begin(), m_plugins.end());
+	for (size_t i=0; i<m_plugins.size(); ++i) {
+		if (i > 0)
+			oss << ", ";
+		oss << "{\"name\": ";
+		appendJSONString(oss, m_plugins[i].first);
+		oss << ", \"description\": ";
+		appendJSONString(oss, m_plugins[i].second);
+		oss << "}";
+	}
+	oss << "], \"counters\": [";
+
+	std::sort(m_counters.begin(), m_counters.end(), compareCategory());
+	for (size_t i=0; i<m_counters.size(); ++i) {
+		const StatsCounter *counter = m_counters[i];
+		EStatsType type = counter->getType();
+		uint64_t value;
+		if (type == EMinimumValue)
+			value = counter->getMinimum();
+		else if (type == EMaximumValue)
+			value = counter->getMaximum();
+		else
+			value = counter->getValue();
+
+		if (i > 0)
+			oss << ", ";
+		oss << "{\"category\": ";
+		appendJSONString(oss, counter->getCategory());
+		oss << ", \"name\": ";
+		appendJSONString(oss, counter->getName());
+		oss << ", \"type\": \"" << typeNames[type] << "\", \"value\": " << value;
+		if (type == EPercentage || type == EAverage)
+			oss << ", \"base\": " << counter->getBase();
+		oss << "}";
+	}
+	oss << "]}";
+	return oss.str();
+}
+
 void Statistics::resetAll() {
 	LockGuard lock(m_mutex);
 	for (size_t i=0; i<m_counters.size(); ++i)
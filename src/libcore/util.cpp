@@ -902,6 +902,72 @@ std::string memString(size_t size, bool precise) {
 	return os.str();
 }
 
+namespace {
+	/* Constants and mixing steps of xxHash64 */
+	const uint64_t HashPrime1 = 0x9E3779B185EBCA87ULL;
+	const uint64_t HashPrime2 = 0xC2B2AE3D27D4EB4FULL;
+	const uint64_t HashPrime3 = 0x165667B19E3779F9ULL;
+	const uint64_t HashPrime4 = 0x85EBCA77C2B2AE63ULL;
+	const uint64_t HashPrime5 = 0x27D4EB2F165667C5ULL;
+
+	inline uint64_t hashRotl(uint64_t x, int r) {
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline uint64_t hashRound(uint64_t acc, uint64_t value) {
+		acc += value * HashPrime2;
+		return hashRotl(acc, 31) * HashPrime1;
+	}
+
+	inline uint64_t hashMerge(uint64_t acc, uint64_t value) {
+		acc ^= hashRound(0, value);
+		return acc * HashPrime1 + HashPrime4;
+	}
+
+	inline uint64_t hashLoad64(const uint8_t *ptr) {
+		uint64_t value;
+		memcpy(&value, ptr, sizeof(uint64_t));
+		return value;
+	}
+}
+
+uint64_t hashBuffer(const void *_ptr, size_t size, uint64_t seed) {
+	const uint8_t *ptr = static_cast<const uint8_t *>(_ptr);
+	const uint8_t *end = ptr + size;
+	uint64_t h;
+
+	if (size >= 32) {
+		uint64_t v[4] = { seed + HashPrime1 + HashPrime2, seed + HashPrime2,
+			seed, seed - HashPrime1 };
+		for (; ptr + 32 <= end; ptr += 32) {
+			for (int i=0; i<4; ++i)
+				v[i] = hashRound(v[i], hashLoad64(ptr + 8*i));
+		}
+		h = hashRotl(v[0], 1) + hashRotl(v[1], 7) + hashRotl(v[2], 12) + hashRotl(v[3], 18);
+		for (int i=0; i<4; ++i)
+			h = hashMerge(h, v[i]);
+	} else {
+		h = seed + HashPrime5;
+	}
+
+	h += (uint64_t) size;
+	for (; ptr + 8 <= end; ptr += 8)
+		h = hashRotl(h ^ hashRound(0, hashLoad64(ptr)), 27) * HashPrime1 + HashPrime4;
+	if (ptr + 4 <= end) {
+		uint32_t value;
+		memcpy(&value, ptr, sizeof(uint32_t));
+		h = hashRotl(h ^ ((uint64_t) value * HashPrime1), 23) * HashPrime2 + HashPrime3;
+		ptr += 4;
+	}
+	for (; ptr < end; ++ptr)
+		h = hashRotl(h ^ (*ptr * HashPrime5), 11) * HashPrime1;
+
+	h ^= h >> 33; h *= HashPrime2;
+	h ^= h >> 29; h *= HashPrime3;
+	h ^= h >> 32;
+	return h;
+}
+
 bool starts_with(std::string const& s, char const* c) {
 	return 0 == strncmp(s.c_str(), c, std::strlen(c));
 }
@@ -0,0 +1,219 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/workerpool.h>
+#include <mitsuba/core/thread.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
+MTS_NAMESPACE_BEGIN
+
+typedef std::chrono::steady_clock PoolClock;
+
+static Float elapsedMilliseconds(PoolClock::time_point since) {
+	return (Float) std::chrono::duration<double, std::milli>(PoolClock::now() - since).count();
+}
+
+struct WorkerPool::WorkerPoolPrivate {
+	std::string name;
+	bool coreAffinity;
+
+	std::mutex mutex;
+	/// Signaled when a new generation starts or on shutdown
+	std::condition_variable wakeup;
+	/// Signaled when the last active worker finished
+	std::condition_variable done;
+
+	ref_vector<Thread> workers;
+	const Task *task;
+	uint64_t generation;
+	int activeWorkers;
+	int awakeWorkers;
+	int finishedWorkers;
+	bool shutdown;
+	std::exception_ptr error;
+
+	PoolClock::time_point restartTime;
+	std::atomic<bool> sampled;
+	Float wakeupLatency;
+	std::atomic<Float> firstSampleLatency;
+	Float maxFirstSampleLatency;
+
+	WorkerPoolPrivate(const std::string &name, bool coreAffinity)
+		: name(name), coreAffinity(coreAffinity), task(NULL), generation(0),
+		  activeWorkers(0), awakeWorkers(0), finishedWorkers(0), shutdown(false),
+		  sampled(false), wakeupLatency(0), firstSampleLatency(-1),
+		  maxFirstSampleLatency(0) { }
+};
+
+/**
+ * Persistent worker: parks on the pool's condition variable and executes
+ * the current task once per generation in which it is active.
+ */
+class WorkerPool::Worker : public Thread {
+public:
+	Worker(WorkerPoolPrivate *pool, int index)
+		: Thread(formatString("%s%i", pool->name.c_str(), index)),
+		  m_pool(pool), m_index(index) { }
+
+	void run() {
+		WorkerPoolPrivate *p = m_pool;
+		uint64_t seenGeneration = 0;
+		while (true) {
+			const Task *task;
+			{
+				std::unique_lock<std::mutex> lock(p->mutex);
+				p->wakeup.wait(lock, [&]() {
+					return p->shutdown || (p->generation != seenGeneration
+						&& m_index < p->activeWorkers);
+				});
+				if (p->shutdown)
+					break;
+				seenGeneration = p->generation;
+				task = p->task;
+				if (++p->awakeWorkers == p->activeWorkers)
+					p->wakeupLatency = elapsedMilliseconds(p->restartTime);
+			}
+
+			try {
+				(*task)(m_index);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(p->mutex);
+				if (!p->error)
+					p->error = std::current_exception();
+			}
+
+			std::lock_guard<std::mutex> lock(p->mutex);
+			if (++p->finishedWorkers == p->activeWorkers)
+				p->done.notify_all();
+		}
+	}
+
+protected:
+	virtual ~Worker() { }
+
+private:
+	WorkerPoolPrivate *m_pool;
+	int m_index;
+};
+
+WorkerPool::WorkerPool(const std::string &name, int maxWorkers, bool coreAffinity)
+	: d(new WorkerPoolPrivate(name, coreAffinity)), m_maxWorkers(maxWorkers) {
+	if (m_maxWorkers <= 0)
+		m_maxWorkers = getCoreCount();
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(d->mutex);
+		d->shutdown = true;
+	}
+	d->wakeup.notify_all();
+	for (size_t i = 0; i < d->workers.size(); ++i)
+		d->workers[i]->join();
+}
+
+void WorkerPool::run(const Task &task, int workerCount) {
+	if (workerCount < 0 || workerCount > m_maxWorkers)
+		workerCount = m_maxWorkers;
+	if (workerCount == 0)
+		return;
+
+	/* Lazily spawn missing workers, they park until the generation changes */
+	for (int i = (int) d->workers.size(); i < workerCount; ++i) {
+		ref<Thread> worker = new Worker(d.get(), i);
+		if (d->coreAffinity)
+			worker->setCoreAffinity(i);
+		worker->start();
+		d->workers.push_back(worker);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(d->mutex);
+		if (d->sampled)
+			d->maxFirstSampleLatency = std::max(d->maxFirstSampleLatency,
+				(Float) d->firstSampleLatency);
+		d->task = &task;
+		d->activeWorkers = workerCount;
+		d->awakeWorkers = 0;
+		d->finishedWorkers = 0;
+		d->error = std::exception_ptr();
+		d->firstSampleLatency = -1;
+		d->sampled = false;
+		d->restartTime = PoolClock::now();
+		++d->generation;
+	}
+	d->wakeup.notify_all();
+
+	std::exception_ptr error;
+	{
+		std::unique_lock<std::mutex> lock(d->mutex);
+		d->done.wait(lock, [&]() { return d->finishedWorkers == d->activeWorkers; });
+		d->task = NULL;
+		error = d->error;
+		d->error = std::exception_ptr();
+	}
+	if (error)
+		std::rethrow_exception(error);
+}
+
+bool WorkerPool::notifyFirstSample() {
+	if (d->sampled.load(std::memory_order_relaxed) || d->sampled.exchange(true))
+		return false;
+	d->firstSampleLatency = elapsedMilliseconds(d->restartTime);
+	return true;
+}
+
+int WorkerPool::getWorkerCount() const {
+	return (int) d->workers.size();
+}
+
+uint64_t WorkerPool::getGeneration() const {
+	return d->generation;
+}
+
+Float WorkerPool::getWakeupLatency() const {
+	return d->wakeupLatency;
+}
+
+Float WorkerPool::getFirstSampleLatency() const {
+	return d->firstSampleLatency;
+}
+
+Float WorkerPool::getMaxFirstSampleLatency() const {
+	return std::max(d->maxFirstSampleLatency, (Float) d->firstSampleLatency);
+}
+
+std::string WorkerPool::toString() const {
+	std::ostringstream oss;
+	oss << "WorkerPool[" << endl
+		<< "  name = \"" << d->name << "\"," << endl
+		<< "  maxWorkers = " << m_maxWorkers << "," << endl
+		<< "  workerCount = " << d->workers.size() << "," << endl
+		<< "  generation = " << d->generation << "," << endl
+		<< "  wakeupLatency = " << d->wakeupLatency << " ms," << endl
+		<< "  firstSampleLatency = " << (Float) d->firstSampleLatency << " ms" << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(WorkerPool, false, Object)
+MTS_NAMESPACE_END
@@ -1728,6 +1728,7 @@ void export_core() {
 
 	BP_CLASS(Statistics, Object, bp::no_init)
 		.def("getStats", &Statistics::getStats, BP_RETURN_VALUE)
+		.def("getStatsJSON", &Statistics::getStatsJSON, BP_RETURN_VALUE)
 		.def("resetAll", &Statistics::resetAll)
 		.def("printStats", &Statistics::printStats)
 		.def("getInstance", &Statistics::getInstance, BP_RETURN_VALUE)
@@ -1805,6 +1806,10 @@ void export_core() {
 		.def("getInstance", &Scheduler::getInstance, BP_RETURN_VALUE)
 		.def("isRunning", &Scheduler::isRunning)
 		.def("isBusy", &Scheduler::isBusy)
+		.def("setWorkStealing", &Scheduler::setWorkStealing)
+		.def("getWorkStealing", &Scheduler::getWorkStealing)
+		.def("getWorkerStatisticsString", &Scheduler::getWorkerStatisticsString)
+		.def("resetWorkerStatistics", &Scheduler::resetWorkerStatistics)
 		.staticmethod("getInstance");
 
 	BP_CLASS(AbstractAnimationTrack, Object, bp::no_init)
@@ -75,6 +75,35 @@ void BSDF::getFrameDerivative(const Intersection &its, Frame &du, Frame &dv) con
 	computeShadingFrameDerivative(its.shFrame.n, its.dpdu, dndu, dndv, du, dv);
 }
 
+void BSDF::evalBatch(const BSDFQueryBatch &batch, Spectrum *result, EMeasure measure) const {
+	for (size_t i=0; i<batch.size; ++i)
+		result[i] = eval(batch.getRecord(i), measure);
+}
+
+void BSDF::pdfBatch(const BSDFQueryBatch &batch, Float *result, EMeasure measure) const {
+	for (size_t i=0; i<batch.size; ++i)
+		result[i] = pdf(batch.getRecord(i), measure);
+}
+
+void BSDF::sampleBatch(const BSDFQueryBatch &batch, const Point2 *sample,
+		Spectrum *weight, Float *pdf) const {
+	for (size_t i=0; i<batch.size; ++i) {
+		BSDFSamplingRecord bRec(*batch.its[i], batch.sampler, batch.mode);
+		bRec.wi = Vector(batch.wiX[i], batch.wiY[i], batch.wiZ[i]);
+		bRec.wo = Vector(0.0f);
+		bRec.eta = 1.0f;
+		bRec.typeMask = batch.typeMask;
+		bRec.component = batch.component;
+		Float samplePdf = 0.0f;
+		weight[i] = this->sample(bRec, samplePdf, sample[i]);
+		if (weight[i].isZero())
+			samplePdf = 0.0f;
+		if (pdf)
+			pdf[i] = samplePdf;
+		batch.putRecord(i, bRec);
+	}
+}
+
 Float BSDF::getRoughness(const Intersection &its, int component) const {
 	NotImplementedError("getRoughness");
 }
@@ -192,5 +221,16 @@ std::string BSDFSamplingRecord::toString() const {
 	return oss.str();
 }
 
+std::string BSDFQueryBatch::toString() const {
+	std::ostringstream oss;
+	oss << "BSDFQueryBatch[" << endl
+		<< "  size = " << size << "," << endl
+		<< "  mode = " << mode << "," << endl
+		<< "  typeMask = " << typeMaskToString(typeMask) << "," << endl
+		<< "  component = " << component << endl
+		<< "]";
+	return oss.str();
+}
+
 MTS_IMPLEMENT_CLASS(BSDF, true, ConfigurableObject)
 MTS_NAMESPACE_END
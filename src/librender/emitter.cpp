@@ -60,6 +60,8 @@ ref<Shape> AbstractEmitter::createShape(const Scene *scene) {
 	return NULL;
 }
 
+void AbstractEmitter::updateShape() { }
+
 Spectrum AbstractEmitter::samplePosition(PositionSamplingRecord &pRec,
 		const Point2 &sample, const Point2 *extra) const {
 	NotImplementedError("samplePosition");
@@ -17,12 +17,14 @@
 */
 
 #include <mitsuba/render/imageblock.h>
+#include <mitsuba/render/splattiles.h>
 
 MTS_NAMESPACE_BEGIN
 
 ImageBlock::ImageBlock(Bitmap::EPixelFormat fmt, const Vector2i &size,
 		const ReconstructionFilter *filter, int channels, bool warn) : m_offset(0),
-		m_size(size), m_filter(filter), m_weightsX(NULL), m_weightsY(NULL), m_warn(warn) {
+		m_size(size), m_filter(filter), m_weightsX(NULL), m_weightsY(NULL), m_warn(warn),
+		m_splatSlot(-1) {
 	m_borderSize = filter ? filter->getBorderSize() : 0;
 
 	/* Allocate a small bitmap data structure for the block */
@@ -37,11 +39,33 @@ ImageBlock::ImageBlock(Bitmap::EPixelFormat fmt, const Vector2i &size,
 	}
 }
 
+ImageBlock::ImageBlock(ImageBlock *target, SplatTiles *tiles, int slot)
+		: m_bitmap(target->m_bitmap), m_offset(target->m_offset), m_size(target->m_size),
+		m_borderSize(target->m_borderSize), m_filter(target->m_filter),
+		m_weightsX(NULL), m_weightsY(NULL), m_warn(target->m_warn),
+		m_splatTiles(tiles), m_splatSlot(slot) {
+	if (m_filter) {
+		/* Temporary buffers used in put() */
+		int tempBufferSize = (int) std::ceil(2*m_filter->getRadius()) + 1;
+		m_weightsX = new Float[2*tempBufferSize];
+		m_weightsY = m_weightsX + tempBufferSize;
+	}
+}
+
 ImageBlock::~ImageBlock() {
 	if (m_weightsX)
 		delete[] m_weightsX;
 }
 
+bool ImageBlock::putDeferred(const Point2 &pos, const Float *value) {
+	return m_splatTiles->put(m_splatSlot, pos, value);
+}
+
+void ImageBlock::syncSplats() {
+	if (m_splatTiles)
+		m_splatTiles->sync(m_splatSlot);
+}
+
 void ImageBlock::load(Stream *stream) {
 	m_offset = Point2i(stream);
 	m_size = Vector2i(stream);
@@ -44,7 +44,13 @@ void Integrator::configureSampler(const Scene *scene, Sampler *sampler) {
 const Integrator *Integrator::getSubIntegrator(int idx) const { return NULL; }
 
 SamplingIntegrator::SamplingIntegrator(const Properties &props)
- : Integrator(props) { }
+ : Integrator(props) {
+	/* Read by the responsive wrapper (see \ref ImageOrderIntegrator) */
+	props.markQueried("adaptive");
+	props.markQueried("adaptiveThreshold");
+	props.markQueried("adaptiveErrorTarget");
+	props.markQueried("adaptiveMinSpp");
+}
 
 SamplingIntegrator::SamplingIntegrator(Stream *stream, InstanceManager *manager)
  : Integrator(stream, manager) { }
@@ -305,8 +311,34 @@ char const* ResponsiveIntegrator::getRealtimeStatistics() {
 	return nullptr;
 }
 
+bool ResponsiveIntegrator::isAdaptive() const {
+	return false;
+}
+
+void ResponsiveIntegrator::reset() { }
+
 ImageOrderIntegrator::ImageOrderIntegrator(const Properties &props)
-	: ResponsiveIntegrator(props) { }
+	: ResponsiveIntegrator(props), m_adaptiveActive(false), m_resolution(0)
+	, m_errorTargetReached(false), m_adaptiveError(0.0f), m_activeFraction(1.0f) {
+	m_adaptive = props.getBoolean("adaptive", false);
+	/* Relative standard error, below which a pixel receives no more samples */
+	m_adaptiveThreshold = props.getFloat("adaptiveThreshold", 0.05f);
+	/* Mean relative error over all pixels, at which rendering stops */
+	m_adaptiveErrorTarget = props.getFloat("adaptiveErrorTarget", m_adaptiveThreshold);
+	if (m_adaptiveErrorTarget < m_adaptiveThreshold) {
+		/* Converged pixels receive no more samples, hence the mean error
+		   would stay above the target forever */
+		Log(EWarn, "\"adaptiveErrorTarget\" (%f) is below \"adaptiveThreshold\" (%f) and can "
+			"never be reached -- clamping it to the threshold.",
+			(double) m_adaptiveErrorTarget, (double) m_adaptiveThreshold);
+		m_adaptiveErrorTarget = m_adaptiveThreshold;
+	}
+	/* Number of samples every pixel receives before it can be skipped */
+	m_adaptiveMinSpp = props.getInteger("adaptiveMinSpp", 16);
+	if (m_adaptiveMinSpp < 2)
+		Log(EError, "\"adaptiveMinSpp\" must be at least 2!");
+	m_statisticsBuffer[0] = '\0';
+}
 
 ImageOrderIntegrator::~ImageOrderIntegrator() { }
 
@@ -325,9 +357,93 @@ bool ImageOrderIntegrator::allocate(const Scene &scene, Sampler *const *samplers
 			std::shuffle(pixels, pixels + pixelCount, g);
 		}
 	}
+
+	m_adaptiveActive = false;
+	if (m_adaptive && !isAdaptive()) {
+		Log(EWarn, "This integrator does not support adaptive sampling, "
+			"ignoring the \"adaptive\" property.");
+	} else if (m_adaptive) {
+		if (targets[0]->getBitmap()->getPixelFormat() != Bitmap::ESpectrumAlphaWeight) {
+			Log(EWarn, "Adaptive sampling requires framebuffers with a weight channel, "
+				"sampling all pixels uniformly.");
+		} else {
+			m_adaptiveActive = true;
+			m_resolution = resolution;
+			m_moments.resize(pixelCount);
+			m_pixelErrors.resize(pixelCount);
+			m_converged.reset(new std::atomic<uint8_t>[pixelCount]);
+			reset();
+		}
+	}
 	return true;
 }
 
+void ImageOrderIntegrator::reset() {
+	if (!m_adaptiveActive)
+		return;
+	PixelMoments zero = { 0.0f, 0.0f, 0.0f };
+	std::fill(m_moments.begin(), m_moments.end(), zero);
+	for (size_t i = 0; i < m_moments.size(); ++i)
+		m_converged[i].store(0, std::memory_order_relaxed);
+	m_errorTargetReached = false;
+	m_adaptiveError = 0.0f;
+	m_activeFraction = 1.0f;
+}
+
+void ImageOrderIntegrator::updateAdaptiveState() {
+	/* Other threads keep adding samples meanwhile, the estimates are
+	   therefore slightly out of date, which is fine for this purpose */
+	const int width = m_resolution.x, height = m_resolution.y;
+	const size_t pixelCount = m_moments.size();
+	double errorSum = 0.0;
+	for (size_t i = 0; i < pixelCount; ++i) {
+		const PixelMoments &m = m_moments[i];
+		const Float n = m.count;
+		Float error = std::numeric_limits<Float>::infinity();
+		if (n >= 2) {
+			Float mean = m.sum / n;
+			Float variance = std::max((Float) 0, (m.sumSqr - m.sum * mean) / (n - 1));
+			/* The offset keeps dark pixels from dominating */
+			error = std::sqrt(variance / n) / (mean + 1e-2f);
+		}
+		m_pixelErrors[i] = error;
+		errorSum += std::min(error, (Float) 1);
+	}
+
+	/* A few samples can miss small features entirely, hence pixels only
+	   stop once the error in their 3x3 neighborhood is below the threshold */
+	size_t active = 0;
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			const size_t i = (size_t) y * width + x;
+			bool converged = m_moments[i].count >= m_adaptiveMinSpp;
+			for (int dy = std::max(y - 1, 0); converged && dy <= std::min(y + 1, height - 1); ++dy)
+				for (int dx = std::max(x - 1, 0); converged && dx <= std::min(x + 1, width - 1); ++dx)
+					converged = m_pixelErrors[(size_t) dy * width + dx] <= m_adaptiveThreshold;
+			m_converged[i].store(converged ? 1 : 0, std::memory_order_relaxed);
+			if (!converged)
+				++active;
+		}
+	}
+
+	m_adaptiveError = (Float) (errorSum / pixelCount);
+	m_activeFraction = (Float) active / (Float) pixelCount;
+	if (m_adaptiveError <= m_adaptiveErrorTarget && !m_errorTargetReached) {
+		m_errorTargetReached = true;
+		Log(EInfo, "Adaptive sampling reached a mean relative error of %.4f, halting",
+			(double) m_adaptiveError);
+	}
+}
+
+char const* ImageOrderIntegrator::getRealtimeStatistics() {
+	if (!m_adaptiveActive)
+		return nullptr;
+	snprintf(m_statisticsBuffer, sizeof(m_statisticsBuffer),
+		"rel. error %.4f (target %.4f), %.1f%% pixels active",
+		(double) m_adaptiveError, (double) m_adaptiveErrorTarget, 100.0 * m_activeFraction);
+	return m_statisticsBuffer;
+}
+
 int ImageOrderIntegrator::render(const Scene &scene, const Sensor &sensor, Sampler &sampler, ImageBlock& target
 	, Controls controls, int threadIdx, int threadCount) {
 	return this->render(scene, sensor, sampler, target, controls, threadIdx, threadCount, nullptr);
@@ -359,6 +475,15 @@ int ImageOrderIntegrator::render(const Scene &scene, const Sensor &sensor, Sampl
 					break;
 				sampler.advance();
 			}
+			// re-estimate the per-pixel errors once per round
+			if (m_adaptiveActive) {
+				if (threadIdx == 0 && completedBlocks >= m_adaptiveMinSpp)
+					updateAdaptiveState();
+				if (m_errorTargetReached) {
+					returnCode = EErrorTargetReached;
+					break;
+				}
+			}
 			workBegin = wid * blockSize + this->m_pxPermutation.data();
 			workEnd = std::min((wid+1) * blockSize, planeSamples) + this->m_pxPermutation.data();
 			work = workBegin;
@@ -382,12 +507,14 @@ int ImageOrderIntegrator::render(const Scene &scene, const Sensor &sensor, Sampl
 			}
 		}
 
-		// one sample
+		// one sample (converged pixels are skipped, but still count towards the round)
 		int j = *work++;
-		mitsuba::Point2i offset(j % resolution.x, j / resolution.x);
-		sampler.generate(offset, ~0);
+		if (!m_adaptiveActive || !m_converged[j].load(std::memory_order_relaxed)) {
+			mitsuba::Point2i offset(j % resolution.x, j / resolution.x);
+			sampler.generate(offset, ~0);
 
-		returnCode = this->render(scene, sensor, sampler, target, offset, threadIdx, threadCount, userData);
+			returnCode = this->render(scene, sensor, sampler, target, offset, threadIdx, threadCount, userData);
+		}
 
 		++currentSamples;
 		// precise sample tracking
@@ -447,6 +574,10 @@ ClassicSamplingIntegrator::ClassicSamplingIntegrator(SamplingIntegrator* classic
 ClassicSamplingIntegrator::~ClassicSamplingIntegrator() {
 }
 
+bool ClassicSamplingIntegrator::isAdaptive() const {
+	return m_adaptive;
+}
+
 bool ClassicSamplingIntegrator::allocate(const Scene &scene, Sampler *const *samplers, ImageBlock *const *targets, int threadCount) {
 	bool result = ImageOrderIntegrator::allocate(scene, samplers, targets, threadCount);
 
@@ -473,6 +604,7 @@ int  ClassicSamplingIntegrator::render(SamplingIntegrator& threadLocalIntegrator
 	RadianceQueryRecord rRec(&scene, &sampler);
 	rRec.newQuery(RadianceQueryRecord::ESensorRay, sensor.getMedium());
 	spec *= threadLocalIntegrator.Li(pxSample.ray, rRec);
+	recordSample(pixel, spec);
 
 	if (rRec.alpha >= 0.0f) {
 #ifndef MTS_NO_ATOMIC_SPLAT
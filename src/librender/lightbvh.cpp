@@ -0,0 +1,437 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/lightbvh.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Cosine of <tt>max(0, a - b)</tt> given the sines and cosines of two angles
+static inline Float cosSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+	if (cosA > cosB)
+		return 1.0f;
+	return cosA * cosB + sinA * sinB;
+}
+
+/// Sine of <tt>max(0, a - b)</tt> given the sines and cosines of two angles
+static inline Float sinSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+	if (cosA > cosB)
+		return 0.0f;
+	return sinA * cosB - cosA * sinB;
+}
+
+LightBVH::LightBVH(ref_vector<Emitter> &emitters) {
+	ref<Timer> timer = new Timer();
+	std::vector<BuildItem> items;
+	Float boundedPower = 0, infinitePower = 0;
+
+	for (size_t i=0; i<emitters.size(); ++i) {
+		Emitter *emitter = emitters[i].get();
+		Float power = emitter->getSamplingWeight();
+		AABB aabb = emitter->getAABB();
+
+		bool bounded = !emitter->isEnvironmentEmitter()
+			&& !(emitter->getType() & Emitter::EDeltaDirection)
+			&& aabb.isValid() && std::isfinite(aabb.getSurfaceArea());
+
+		if (bounded) {
+			BuildItem item;
+			item.aabb = aabb;
+			item.center = aabb.getCenter();
+			item.normals = computeNormalCone(emitter);
+			item.power = power;
+			item.object = emitter;
+			item.emitter = (uint32_t) i;
+			items.push_back(item);
+			boundedPower += power;
+		} else {
+			m_infiniteIndex[emitter] = (uint32_t) m_infinite.size();
+			m_infinite.push_back((uint32_t) i);
+			m_infinitePDF.append(power);
+			infinitePower += power;
+		}
+	}
+
+	if (!m_infinite.empty())
+		m_infinitePDF.normalize();
+
+	if (items.empty())
+		m_infiniteProb = 1.0f;
+	else if (infinitePower + boundedPower > 0)
+		m_infiniteProb = infinitePower / (infinitePower + boundedPower);
+	else
+		m_infiniteProb = 0.0f;
+
+	if (!items.empty()) {
+		m_nodes.reserve(2 * items.size() - 1);
+		build(items, 0, items.size(), 0, 0);
+	}
+
+	Log(EInfo, "Built a light BVH over " SIZE_T_FMT " emitters (" SIZE_T_FMT
+		" nodes, " SIZE_T_FMT " emitters outside of the tree) in %i ms",
+		items.size(), m_nodes.size(), m_infinite.size(), timer->getMilliseconds());
+}
+
+uint32_t LightBVH::build(std::vector<BuildItem> &items, size_t start,
+		size_t end, uint32_t parent, int depth) {
+	uint32_t index = (uint32_t) m_nodes.size();
+	m_nodes.push_back(Node());
+
+	AABB aabb, centroids;
+	DirectionCone normals = items[start].normals;
+	Float power = 0;
+	for (size_t i=start; i<end; ++i) {
+		aabb.expandBy(items[i].aabb);
+		centroids.expandBy(items[i].center);
+		normals = merge(normals, items[i].normals);
+		power += items[i].power;
+	}
+
+	Node &node = m_nodes[index];
+	node.aabb = aabb;
+	node.normals = normals;
+	node.cosThetaE = 0.0f; /* All emitters are assumed to emit into a hemisphere */
+	node.power = power;
+	node.parent = parent;
+
+	if (end - start == 1) {
+		node.leaf = true;
+		node.data = items[start].emitter;
+		m_leaves[items[start].object] = index;
+		return index;
+	}
+
+	/* Search for the split with the lowest surface area orientation cost */
+	const int binCount = 12;
+	Vector extents = aabb.getExtents();
+	Float maxExtent = std::max(std::max(extents.x, extents.y), extents.z);
+	Float bestCost = std::numeric_limits<Float>::infinity();
+	int bestAxis = -1, bestSplit = -1;
+
+	if (depth < MTS_LIGHTBVH_MAXDEPTH) {
+		for (int axis=0; axis<3; ++axis) {
+			Float min = centroids.min[axis], range = centroids.max[axis] - min;
+			if (!(range > 0))
+				continue;
+
+			AABB binAABB[binCount];
+			DirectionCone binNormals[binCount];
+			Float binPower[binCount];
+			size_t binSize[binCount];
+			for (int b=0; b<binCount; ++b) {
+				binPower[b] = 0;
+				binSize[b] = 0;
+			}
+
+			for (size_t i=start; i<end; ++i) {
+				int b = std::min(binCount - 1, (int) (binCount *
+					((items[i].center[axis] - min) / range)));
+				binNormals[b] = binSize[b] == 0 ? items[i].normals
+					: merge(binNormals[b], items[i].normals);
+				binAABB[b].expandBy(items[i].aabb);
+				binPower[b] += items[i].power;
+				binSize[b]++;
+			}
+
+			/* Elongated nodes should preferably be split along their long axis */
+			Float kr = extents[axis] > 0 ? maxExtent / extents[axis] : 1.0f;
+
+			for (int split=1; split<binCount; ++split) {
+				Float cost = 0;
+				bool empty = false;
+				for (int side=0; side<2; ++side) {
+					int first = side == 0 ? 0 : split, last = side == 0 ? split : binCount;
+					AABB sideAABB;
+					DirectionCone sideNormals;
+					Float sidePower = 0;
+					size_t sideSize = 0;
+					for (int b=first; b<last; ++b) {
+						if (binSize[b] == 0)
+							continue;
+						sideNormals = sideSize == 0 ? binNormals[b]
+							: merge(sideNormals, binNormals[b]);
+						sideAABB.expandBy(binAABB[b]);
+						sidePower += binPower[b];
+						sideSize += binSize[b];
+					}
+					if (sideSize == 0) {
+						empty = true;
+						break;
+					}
+					cost += sidePower * orientationMeasure(sideNormals, 0.0f)
+						* sideAABB.getSurfaceArea();
+				}
+				cost *= kr;
+
+				if (!empty && cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+	}
+
+	size_t mid;
+	if (bestAxis != -1) {
+		Float min = centroids.min[bestAxis],
+		      range = centroids.max[bestAxis] - min;
+		BuildItem *middle = std::partition(&items[start], &items[0] + end,
+			[&](const BuildItem &item) {
+				int b = std::min(binCount - 1, (int) (binCount *
+					((item.center[bestAxis] - min) / range)));
+				return b < bestSplit;
+			});
+		mid = middle - &items[0];
+	} else {
+		/* Coincident centroids or too deep: split at the median */
+		int axis = centroids.getLargestAxis();
+		mid = (start + end) / 2;
+		std::nth_element(items.begin() + start, items.begin() + mid, items.begin() + end,
+			[axis](const BuildItem &a, const BuildItem &b) {
+				return a.center[axis] < b.center[axis];
+			});
+	}
+
+	/* Note: 'node' may be invalidated by the recursion */
+	build(items, start, mid, index, depth + 1);
+	uint32_t right = build(items, mid, end, index, depth + 1);
+	m_nodes[index].leaf = false;
+	m_nodes[index].data = right;
+	return index;
+}
+
+LightBVH::DirectionCone LightBVH::computeNormalCone(Emitter *emitter) {
+	Shape *shape = emitter->getShape();
+	if (!emitter->isOnSurface() || !shape)
+		return DirectionCone::entireSphere();
+
+	ref<TriMesh> mesh;
+	if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+		mesh = static_cast<TriMesh *>(shape);
+	else
+		mesh = shape->createTriMesh();
+
+	if (!mesh || mesh->getTriangleCount() == 0)
+		return DirectionCone::entireSphere();
+
+	const Point *positions = mesh->getVertexPositions();
+	const Triangle *triangles = mesh->getTriangles();
+	const Normal *vertexNormals = mesh->getVertexNormals();
+	size_t triangleCount = mesh->getTriangleCount(),
+	       vertexCount = mesh->getVertexCount();
+
+	/* Area-weighted average normal */
+	Vector sum(0.0f);
+	for (size_t i=0; i<triangleCount; ++i) {
+		const Triangle &tri = triangles[i];
+		sum += cross(positions[tri.idx[1]] - positions[tri.idx[0]],
+			positions[tri.idx[2]] - positions[tri.idx[0]]);
+	}
+	if (vertexNormals) {
+		for (size_t i=0; i<vertexCount; ++i)
+			sum += Vector(vertexNormals[i]);
+	}
+
+	Float length = sum.length();
+	if (length == 0)
+		return DirectionCone::entireSphere();
+	Vector axis = sum / length;
+
+	/* Find the widest angle to any face or vertex normal */
+	Float cosTheta = 1.0f;
+	for (size_t i=0; i<triangleCount; ++i) {
+		const Triangle &tri = triangles[i];
+		Vector n = cross(positions[tri.idx[1]] - positions[tri.idx[0]],
+			positions[tri.idx[2]] - positions[tri.idx[0]]);
+		Float nLength = n.length();
+		if (nLength > 0)
+			cosTheta = std::min(cosTheta, dot(axis, n) / nLength);
+	}
+	if (vertexNormals) {
+		for (size_t i=0; i<vertexCount; ++i)
+			cosTheta = std::min(cosTheta, dot(axis, normalize(Vector(vertexNormals[i]))));
+	}
+
+	/* Leave some room for roundoff errors */
+	Float theta = std::min(math::safe_acos(cosTheta) + 1e-3f, (Float) M_PI);
+	if (theta >= M_PI)
+		return DirectionCone::entireSphere();
+	return DirectionCone(axis, std::cos(theta));
+}
+
+LightBVH::DirectionCone LightBVH::merge(const DirectionCone &a, const DirectionCone &b) {
+	if (a.cosTheta <= -1 || b.cosTheta <= -1)
+		return DirectionCone::entireSphere();
+
+	/* Check if one cone is contained in the other */
+	Float thetaA = math::safe_acos(a.cosTheta),
+	      thetaB = math::safe_acos(b.cosTheta),
+	      thetaD = unitAngle(a.axis, b.axis);
+	if (std::min(thetaD + thetaB, (Float) M_PI) <= thetaA)
+		return a;
+	if (std::min(thetaD + thetaA, (Float) M_PI) <= thetaB)
+		return b;
+
+	/* Otherwise, rotate the axis of 'a' towards 'b' */
+	Float theta = (thetaA + thetaD + thetaB) * 0.5f + 1e-4f;
+	if (theta >= M_PI)
+		return DirectionCone::entireSphere();
+	Vector rotationAxis = cross(a.axis, b.axis);
+	if (rotationAxis.lengthSquared() == 0)
+		return DirectionCone::entireSphere();
+
+	Vector axis = Transform::rotate(rotationAxis, radToDeg(theta - thetaA))(a.axis);
+	return DirectionCone(normalize(axis), std::cos(theta));
+}
+
+Float LightBVH::orientationMeasure(const DirectionCone &cone, Float cosThetaE) {
+	Float thetaO = math::safe_acos(cone.cosTheta),
+	      thetaE = math::safe_acos(cosThetaE),
+	      thetaW = std::min(thetaO + thetaE, (Float) M_PI),
+	      sinThetaO = math::safe_sqrt(1 - cone.cosTheta * cone.cosTheta);
+
+	return 2 * M_PI * (1 - cone.cosTheta) + M_PI * 0.5f * (2 * thetaW * sinThetaO
+		- std::cos(thetaO - 2 * thetaW) - 2 * thetaO * sinThetaO + cone.cosTheta);
+}
+
+Float LightBVH::importance(const Node &node, const Point &p, const Normal &n) const {
+	Vector d = p - node.aabb.getCenter();
+	Float distSquared = d.lengthSquared(),
+	      radiusSquared = 0.25f * node.aabb.getExtents().lengthSquared();
+
+	/* Half-angle of the cone of directions towards the node */
+	Float sinThetaB = 0.0f, cosThetaB = -1.0f;
+	if (distSquared > radiusSquared) {
+		Float sin2ThetaB = radiusSquared / distSquared;
+		sinThetaB = std::sqrt(sin2ThetaB);
+		cosThetaB = math::safe_sqrt(1 - sin2ThetaB);
+	}
+
+	Vector wi = distSquared > 0 ? d / std::sqrt(distSquared) : Vector(0.0f, 0.0f, 1.0f);
+	distSquared = std::max(distSquared, std::max(radiusSquared, (Float) (Epsilon * Epsilon)));
+
+	/* Smallest angle between an emitter normal and the direction to 'p' */
+	Float cosThetaW = dot(node.normals.axis, wi),
+	      sinThetaW = math::safe_sqrt(1 - cosThetaW * cosThetaW),
+	      cosThetaO = node.normals.cosTheta,
+	      sinThetaO = math::safe_sqrt(1 - cosThetaO * cosThetaO);
+	Float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO),
+	      sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO),
+	      cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+
+	if (cosThetaP <= node.cosThetaE)
+		return 0.0f;
+
+	Float result = node.power * cosThetaP / distSquared;
+
+	/* Bound the foreshortening at the reference point. This uses the absolute
+	   cosine, since transmissive BSDFs also receive light from behind */
+	if (!n.isZero()) {
+		Float cosThetaI = std::abs(dot(wi, n)),
+		      sinThetaI = math::safe_sqrt(1 - cosThetaI * cosThetaI);
+		result *= std::max((Float) 0,
+			cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB));
+	}
+
+	return result;
+}
+
+size_t LightBVH::sampleReuse(const Point &p, const Normal &n,
+		Float &sample, Float &pdf) const {
+	if (sample < m_infiniteProb || m_nodes.empty()) {
+		if (m_infinite.empty()) {
+			pdf = 0.0f;
+			return (size_t) -1;
+		}
+		sample = std::min(sample / m_infiniteProb, ONE_MINUS_EPS);
+		size_t index = m_infinitePDF.sampleReuse(sample, pdf);
+		pdf *= m_infiniteProb;
+		return m_infinite[index];
+	}
+
+	sample = std::min((sample - m_infiniteProb) / (1 - m_infiniteProb), ONE_MINUS_EPS);
+	Float prob = 1 - m_infiniteProb;
+	uint32_t index = 0;
+
+	while (!m_nodes[index].leaf) {
+		const Node &node = m_nodes[index];
+		Float left = importance(m_nodes[index + 1], p, n),
+		      right = importance(m_nodes[node.data], p, n);
+
+		if (left + right == 0) {
+			pdf = 0.0f;
+			return (size_t) -1;
+		}
+
+		Float probLeft = left / (left + right);
+		if (sample < probLeft) {
+			sample = std::min(sample / probLeft, ONE_MINUS_EPS);
+			prob *= probLeft;
+			index = index + 1;
+		} else {
+			sample = std::min((sample - probLeft) / (1 - probLeft), ONE_MINUS_EPS);
+			prob *= 1 - probLeft;
+			index = node.data;
+		}
+	}
+
+	pdf = prob;
+	return m_nodes[index].data;
+}
+
+Float LightBVH::pdf(const Point &p, const Normal &n, const Emitter *emitter) const {
+	std::unordered_map<const Emitter *, uint32_t>::const_iterator it = m_leaves.find(emitter);
+	if (it == m_leaves.end()) {
+		it = m_infiniteIndex.find(emitter);
+		if (it == m_infiniteIndex.end())
+			return 0.0f;
+		return m_infinitePDF[it->second] * m_infiniteProb;
+	}
+
+	/* Walk up to the root and accumulate the probabilities of the traversal */
+	Float prob = 1 - m_infiniteProb;
+	uint32_t index = it->second;
+	while (index != 0) {
+		uint32_t parent = m_nodes[index].parent;
+		Float left = importance(m_nodes[parent + 1], p, n),
+		      right = importance(m_nodes[m_nodes[parent].data], p, n);
+		if (left + right == 0)
+			return 0.0f;
+		Float probLeft = left / (left + right);
+		prob *= (index == parent + 1) ? probLeft : (1 - probLeft);
+		index = parent;
+	}
+
+	return prob;
+}
+
+std::string LightBVH::toString() const {
+	std::ostringstream oss;
+	oss << "LightBVH[" << endl
+		<< "  nodeCount = " << m_nodes.size() << "," << endl
+		<< "  emitterCount = " << m_leaves.size() << "," << endl
+		<< "  infiniteEmitterCount = " << m_infinite.size() << "," << endl
+		<< "  infiniteProb = " << m_infiniteProb << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(LightBVH, false, Object)
+MTS_NAMESPACE_END
@@ -19,19 +19,34 @@
 #include <mitsuba/render/photonmap.h>
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/phase.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
 #include <fstream>
+#include <atomic>
+
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
 
 MTS_NAMESPACE_BEGIN
 
+static StatsCounter statsGridBuilds("Photon hash grid", "Grid builds");
+static StatsCounter statsGridPhotons("Photon hash grid", "Binned photons");
+static StatsCounter statsGridBuildTime("Photon hash grid", "Average build time (ms)", EAverage);
+static StatsCounter statsGridQueries("Photon hash grid", "Gather queries");
+static StatsCounter statsGridFound("Photon hash grid", "Photons found per query", EAverage);
+
 PhotonMap::PhotonMap(size_t photonCount)
-		: m_kdtree(0, PhotonTree::ESlidingMidpoint), m_scale(1.0f) {
+		: m_kdtree(0, PhotonTree::ESlidingMidpoint), m_scale(1.0f),
+		  m_gridInvCellSize(0.0f), m_gridMask(0) {
 	m_kdtree.reserve(photonCount);
 	Assert(Photon::m_precompTableReady);
 }
 
 PhotonMap::PhotonMap(Stream *stream, InstanceManager *manager)
     : SerializableObject(stream, manager),
-	  m_kdtree(0, PhotonTree::ESlidingMidpoint) {
+	  m_kdtree(0, PhotonTree::ESlidingMidpoint),
+	  m_gridInvCellSize(0.0f), m_gridMask(0) {
 	Assert(Photon::m_precompTableReady);
 	m_scale = (Float) stream->readFloat();
 	m_kdtree.resize(stream->readSize());
@@ -187,10 +202,82 @@ struct RawRadianceQuery {
 size_t PhotonMap::estimateRadianceRaw(const Intersection &its,
 		Float searchRadius, Spectrum &result, int maxDepth) const {
 	RawRadianceQuery query(its, maxDepth);
-	size_t count = m_kdtree.executeQuery(its.p, searchRadius, query);
+	size_t count;
+	if (m_gridCells.empty()) {
+		count = m_kdtree.executeQuery(its.p, searchRadius, query);
+	} else {
+		count = executeGridQuery(its.p, searchRadius, query);
+		++statsGridQueries;
+		statsGridFound.incrementBase();
+		statsGridFound += count;
+	}
 	result = query.result;
 	return count;
 }
 
+void PhotonMap::buildHashGrid(Float cellSize) {
+	if (!(cellSize > 0))
+		Log(EError, "buildHashGrid(): the cell size must be positive!");
+	if (m_kdtree.size() >= (size_t) 0x80000000u)
+		Log(EError, "buildHashGrid(): too many photons!");
+
+	ref<Timer> timer = new Timer();
+	const int photonCount = (int) m_kdtree.size();
+	uint32_t tableSize = 1;
+	while (tableSize < (uint32_t) photonCount)
+		tableSize <<= 1;
+	m_gridMask = tableSize - 1;
+	m_gridInvCellSize = 1.0f / cellSize;
+
+	/* Count the photons per hash table slot */
+	std::vector<uint32_t> slots(photonCount);
+	std::unique_ptr<std::atomic<uint32_t>[]> counts(new std::atomic<uint32_t>[tableSize]);
+	#if defined(MTS_OPENMP)
+		#pragma omp parallel for
+	#endif
+	for (int i=0; i<(int) tableSize; ++i)
+		counts[i].store(0, std::memory_order_relaxed);
+
+	#if defined(MTS_OPENMP)
+		#pragma omp parallel for
+	#endif
+	for (int i=0; i<photonCount; ++i) {
+		slots[i] = getGridSlot(getGridCell(m_kdtree[i].getPosition()));
+		counts[slots[i]].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/* Turn the counts into offsets, which then serve as insertion cursors */
+	m_gridCells.resize(tableSize + 1);
+	uint32_t offset = 0;
+	for (uint32_t i=0; i<tableSize; ++i) {
+		m_gridCells[i] = offset;
+		offset += counts[i].load(std::memory_order_relaxed);
+		counts[i].store(m_gridCells[i], std::memory_order_relaxed);
+	}
+	m_gridCells[tableSize] = offset;
+
+	/* Scatter the photons, the order within a slot is arbitrary */
+	std::vector<Photon> sorted(photonCount);
+	#if defined(MTS_OPENMP)
+		#pragma omp parallel for
+	#endif
+	for (int i=0; i<photonCount; ++i)
+		sorted[counts[slots[i]].fetch_add(1, std::memory_order_relaxed)] = m_kdtree[i];
+
+	#if defined(MTS_OPENMP)
+		#pragma omp parallel for
+	#endif
+	for (int i=0; i<photonCount; ++i)
+		m_kdtree[i] = sorted[i];
+
+	++statsGridBuilds;
+	statsGridPhotons += photonCount;
+	statsGridBuildTime.incrementBase();
+	statsGridBuildTime += timer->getMilliseconds();
+
+	Log(EDebug, "Built a photon hash grid over %i photons (%s) in %i ms", photonCount,
+		memString(m_gridCells.size() * sizeof(uint32_t)).c_str(), timer->getMilliseconds());
+}
+
 MTS_IMPLEMENT_CLASS_S(PhotonMap, false, SerializableObject)
 MTS_NAMESPACE_END
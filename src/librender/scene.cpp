@@ -34,6 +34,7 @@ Scene::Scene()
 	m_kdtree = new ShapeKDTree();
 	m_sourceFile = new fs::pathstr();
 	m_destinationFile = new fs::pathstr();
+	m_useLightBVH = false;
 	m_scenePreprocessed = false;
 	m_integratorPreprocessed = false;
 }
@@ -78,6 +79,26 @@ Scene::Scene(const Properties &props)
 	   in succession before a leaf node will be created.*/
 	if (props.hasProperty("kdMaxBadRefines"))
 		m_kdtree->setMaxBadRefines(props.getInteger("kdMaxBadRefines"));
+	/* Acceleration data structure: "kdtree" (default), or a 4/8-wide
+	   BVH ("bvh4", "bvh8"), which builds faster and needs less memory */
+	if (props.hasProperty("accelerator"))
+		m_kdtree->setAccelerator(ShapeKDTree::getAccelerator(props.getString("accelerator")));
+	/* kd-tree construction: directory for caching built trees across runs
+	   (defaults to the environment variable MITSUBA_KDCACHE) */
+	if (props.hasProperty("kdCacheDirectory"))
+		m_kdtree->setCacheDirectory(fs::pathstr(props.getString("kdCacheDirectory")));
+	/* Emitter selection for direct illumination sampling: in proportion to
+	   their power ("power", default), or using a light BVH that also
+	   accounts for the position of the reference point ("lightbvh") */
+	std::string emitterSampling = to_lower_copy(
+		props.getString("emitterSampling", "power"));
+	if (emitterSampling == "power")
+		m_useLightBVH = false;
+	else if (emitterSampling == "lightbvh")
+		m_useLightBVH = true;
+	else
+		Log(EError, "Unknown emitter sampling strategy \"%s\" (must be "
+			"\"power\" or \"lightbvh\")", emitterSampling.c_str());
 	m_sourceFile = new fs::pathstr();
 	m_destinationFile = new fs::pathstr();
 	m_scenePreprocessed = false;
@@ -94,6 +115,8 @@ Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
 	m_sourceFile = new fs::pathstr(*scene->m_sourceFile);
 	m_destinationFile = new fs::pathstr(*scene->m_destinationFile);
 	m_emitterPDF = scene->m_emitterPDF;
+	m_lightBVH = scene->m_lightBVH;
+	m_useLightBVH = scene->m_useLightBVH;
 	m_shapes = scene->m_shapes;
 	m_sensors = scene->m_sensors;
 	m_meshes = scene->m_meshes;
@@ -122,6 +145,8 @@ Scene::Scene(Stream *stream, InstanceManager *manager)
 	m_kdtree->setParallelBuild(stream->readBool());
 	m_kdtree->setRetract(stream->readBool());
 	m_kdtree->setMaxBadRefines(stream->readUInt());
+	m_kdtree->setAccelerator((ShapeKDTree::EAccelerator) stream->readInt());
+	m_useLightBVH = stream->readBool();
 	m_blockSize = stream->readUInt();
 	m_degenerateSensor = stream->readBool();
 	m_degenerateEmitters = stream->readBool();
@@ -190,6 +215,8 @@ void Scene::serialize(Stream *stream, InstanceManager *manager) const {
 	stream->writeBool(m_kdtree->getParallelBuild());
 	stream->writeBool(m_kdtree->getRetract());
 	stream->writeUInt(m_kdtree->getMaxBadRefines());
+	stream->writeInt(m_kdtree->getAccelerator());
+	stream->writeBool(m_useLightBVH);
 	stream->writeUInt(m_blockSize);
 	stream->writeBool(m_degenerateSensor);
 	stream->writeBool(m_degenerateEmitters);
@@ -324,7 +351,11 @@ void Scene::configure() {
 }
 
 void Scene::invalidate() {
+	ShapeKDTree::EAccelerator accelerator = m_kdtree->getAccelerator();
+	fs::pathstr cacheDirectory = m_kdtree->getCacheDirectory();
 	m_kdtree = new ShapeKDTree();
+	m_kdtree->setAccelerator(accelerator);
+	m_kdtree->setCacheDirectory(cacheDirectory);
 }
 
 void Scene::initialize() {
@@ -380,12 +411,7 @@ void Scene::initialize() {
 			emitter->configure();
 		}
 
-		/* Calculate a discrete PDF to importance sample emitters */
-		for (ref_vector<Emitter>::iterator it = m_emitters.begin();
-				it != m_emitters.end(); ++it)
-			m_emitterPDF.append(it->get()->getSamplingWeight());
-
-		m_emitterPDF.normalize();
+		buildEmitterPDF();
 	}
 
 	initializeBidirectional();
@@ -421,6 +447,99 @@ void Scene::initializeBidirectional() {
 	m_aabb = aabb;
 }
 
+void Scene::updateGeometry() {
+	if (!m_kdtree->isBuilt())
+		return;
+	ref<Timer> timer = new Timer();
+	m_kdtree->update();
+
+	/* Area emitters may have moved along with their shapes: recompute
+	   their power (the surface area changes unless the transformation
+	   is rigid), then the emitter PDF and the light BVH bounds */
+	bool surfaceEmitters = false;
+	for (ref_vector<Emitter>::iterator it = m_emitters.begin();
+			it != m_emitters.end(); ++it) {
+		if ((*it)->getShape() != NULL) {
+			(*it)->updateShape();
+			surfaceEmitters = true;
+		}
+	}
+	if (surfaceEmitters)
+		buildEmitterPDF();
+
+	initializeBidirectional();
+	Log(EInfo, "Geometry update took %i ms", timer->getMilliseconds());
+}
+
+size_t Scene::replaceBSDF(const BSDF *oldBSDF, BSDF *newBSDF) {
+	ref<Timer> timer = new Timer();
+	size_t count = 0;
+	for (ref_vector<Shape>::iterator it = m_shapes.begin();
+			it != m_shapes.end(); ++it) {
+		if ((*it)->getBSDF() == oldBSDF) {
+			(*it)->setBSDF(newBSDF);
+			++count;
+		}
+	}
+	for (ref_vector<ConfigurableObject>::iterator it = m_objects.begin();
+			it != m_objects.end(); ++it) {
+		if (it->get() == oldBSDF)
+			*it = newBSDF;
+	}
+	Log(EInfo, "Material update of " SIZE_T_FMT " shapes took %i ms",
+		count, timer->getMilliseconds());
+	return count;
+}
+
+void Scene::replaceEmitter(Emitter *oldEmitter, Emitter *newEmitter) {
+	ref<Timer> timer = new Timer();
+	ref_vector<Emitter>::iterator it = std::find(m_emitters.begin(),
+		m_emitters.end(), oldEmitter);
+	if (it == m_emitters.end())
+		Log(EError, "replaceEmitter(): the emitter is not part of the scene!");
+
+	ref<Emitter> keepAlive = oldEmitter;
+	*it = newEmitter;
+	if (m_environmentEmitter.get() == oldEmitter)
+		m_environmentEmitter = newEmitter->isEnvironmentEmitter() ? newEmitter : NULL;
+	else if (newEmitter->isEnvironmentEmitter())
+		m_environmentEmitter = newEmitter;
+
+	if (Shape *shape = oldEmitter->getShape()) {
+		if (!newEmitter->isOnSurface())
+			Log(EError, "replaceEmitter(): tried to attach an incompatible emitter to a surface!");
+		if (shape->getExteriorMedium())
+			newEmitter->setMedium(shape->getExteriorMedium());
+		shape->setEmitter(newEmitter);
+		newEmitter->setParent(shape);
+	} else if (newEmitter->getMedium() == NULL) {
+		newEmitter->setMedium(oldEmitter->getMedium());
+	}
+
+	updateEmitters();
+	Log(EInfo, "Emitter update took %i ms", timer->getMilliseconds());
+}
+
+void Scene::buildEmitterPDF() {
+	/* Calculate a discrete PDF to importance sample emitters */
+	m_emitterPDF.clear();
+	for (ref_vector<Emitter>::iterator it = m_emitters.begin();
+			it != m_emitters.end(); ++it)
+		m_emitterPDF.append(it->get()->getSamplingWeight());
+	m_emitterPDF.normalize();
+
+	/* Optionally, also build a light BVH for direct illumination sampling */
+	m_lightBVH = m_useLightBVH ? new LightBVH(m_emitters) : NULL;
+}
+
+void Scene::updateEmitters() {
+	buildEmitterPDF();
+
+	/* The emitters may contribute special shapes and bounds */
+	if (m_kdtree->isBuilt())
+		initializeBidirectional();
+}
+
 bool Scene::preprocess(RenderQueue *queue, const RenderJob *job,
 		int sceneResID, int sensorResID, int samplerResID) {
 
@@ -857,14 +976,28 @@ Spectrum Scene::evalTransmittanceAll(const Point &p1, bool p1OnSurface, const Po
 //                Emission and direct illumination sampling
 // ===========================================================================
 
+const Emitter *Scene::chooseEmitterDirect(const DirectSamplingRecord &dRec,
+		Float &sample, Float &pdf) const {
+	if (m_lightBVH.get()) {
+		size_t index = m_lightBVH->sampleReuse(dRec.ref, dRec.refN, sample, pdf);
+		return index != (size_t) -1 ? m_emitters[index].get() : NULL;
+	}
+
+	size_t index = m_emitterPDF.sampleReuse(sample, pdf);
+	return m_emitters[index].get();
+}
+
 Spectrum Scene::sampleEmitterDirect(DirectSamplingRecord &dRec,
 		const Point2 &_sample, bool testVisibility) const {
 	Point2 sample(_sample);
 
 	/* Randomly pick an emitter */
 	Float emPdf;
-	size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-	const Emitter *emitter = m_emitters[index].get();
+	const Emitter *emitter = chooseEmitterDirect(dRec, sample.x, emPdf);
+	if (!emitter) {
+		dRec.pdf = 0.0f;
+		return Spectrum(0.0f);
+	}
 	Spectrum value = emitter->sampleDirect(dRec, sample);
 
 	if (dRec.pdf != 0) {
@@ -889,8 +1022,11 @@ Spectrum Scene::sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
 
 	/* Randomly pick an emitter */
 	Float emPdf;
-	size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-	const Emitter *emitter = m_emitters[index].get();
+	const Emitter *emitter = chooseEmitterDirect(dRec, sample.x, emPdf);
+	if (!emitter) {
+		dRec.pdf = 0.0f;
+		return Spectrum(0.0f);
+	}
 	Spectrum value = emitter->sampleDirect(dRec, sample);
 
 	if (dRec.pdf != 0) {
@@ -912,8 +1048,11 @@ Spectrum Scene::sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
 
 	/* Randomly pick an emitter */
 	Float emPdf;
-	size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-	const Emitter *emitter = m_emitters[index].get();
+	const Emitter *emitter = chooseEmitterDirect(dRec, sample.x, emPdf);
+	if (!emitter) {
+		dRec.pdf = 0.0f;
+		return Spectrum(0.0f);
+	}
 	Spectrum value = emitter->sampleDirect(dRec, sample);
 
 	if (dRec.pdf != 0) {
@@ -980,6 +1119,8 @@ Spectrum Scene::sampleAttenuatedSensorDirect(DirectSamplingRecord &dRec,
 
 Float Scene::pdfEmitterDirect(const DirectSamplingRecord &dRec) const {
 	const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
+	if (m_lightBVH.get())
+		return emitter->pdfDirect(dRec) * m_lightBVH->pdf(dRec.ref, dRec.refN, emitter);
 	return emitter->pdfDirect(dRec) * pdfEmitterDiscrete(emitter);
 }
 
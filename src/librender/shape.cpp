@@ -250,5 +250,9 @@ ref<TriMesh> Shape::createTriMesh() {
 	return NULL;
 }
 
+bool Shape::applyTransform(const Transform &trafo) {
+	return false;
+}
+
 MTS_IMPLEMENT_CLASS(Shape, true, ConfigurableObject)
 MTS_NAMESPACE_END
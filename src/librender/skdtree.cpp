@@ -18,6 +18,10 @@
 
 #include <mitsuba/render/skdtree.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/filesystem.h>
+#include <mitsuba/core/timer.h>
+#include <chrono>
 
 #if defined(MTS_SSE)
 #include <mitsuba/core/sse.h>
@@ -25,16 +29,56 @@
 #include <mitsuba/render/triaccel_sse.h>
 #endif
 
+/// Version of the kd-tree cache file format
+#define MTS_KD_CACHE_VERSION 1
+
+/// Alignment of the sections in a kd-tree cache file
+#define MTS_KD_CACHE_ALIGNMENT 64
+
 MTS_NAMESPACE_BEGIN
 
-ShapeKDTree::ShapeKDTree() {
+namespace {
+	/**
+	 * Header of a kd-tree cache file. It is followed by the node array
+	 * (including the dummy node preceding the root, see \ref
+	 * KDNode::getSibling()), the index list and the TriAccel records,
+	 * each starting at an offset aligned to \c MTS_KD_CACHE_ALIGNMENT.
+	 */
+	struct KDCacheHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t floatSize, nodeSize, triAccelSize;
+		uint64_t key;
+		uint64_t nodeCount, indexCount, primCount;
+		uint64_t nodeOffset, indexOffset, triAccelOffset, fileSize;
+		AABB aabb, tightAABB;
+	};
+
+	const char KDCacheMagic[8] = { 'M', 'T', 'S', 'K', 'D', 'C', '\0', '\0' };
+
+	inline uint64_t alignCacheOffset(uint64_t offset) {
+		return (offset + MTS_KD_CACHE_ALIGNMENT - 1) & ~((uint64_t) MTS_KD_CACHE_ALIGNMENT - 1);
+	}
+}
+
+ShapeKDTree::ShapeKDTree() : m_accelerator(EKDTree), m_built(false) {
 #if !defined(MTS_KD_CONSERVE_MEMORY)
 	m_triAccel = NULL;
 #endif
 	m_shapeMap.push_back(0);
+	if (const char *cacheDirectory = getenv("MITSUBA_KDCACHE"))
+		m_cacheDirectory = fs::pathstr(std::string(cacheDirectory));
 }
 
 ShapeKDTree::~ShapeKDTree() {
+	if (m_cacheFile) {
+		/* Nodes, indices and TriAccel records point into the mapped cache file */
+		m_nodes = NULL;
+		m_indices = NULL;
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+		m_triAccel = NULL;
+#endif
+	}
 #if !defined(MTS_KD_CONSERVE_MEMORY)
 	if (m_triAccel)
 		freeAligned(m_triAccel);
@@ -65,13 +109,160 @@ void ShapeKDTree::addShape(const Shape *shape) {
 	m_shapes.push_back(shape);
 }
 
+ShapeKDTree::EAccelerator ShapeKDTree::getAccelerator(const std::string &name) {
+	std::string lowercase = to_lower_copy(name);
+	if (lowercase == "kdtree")
+		return EKDTree;
+	else if (lowercase == "bvh4")
+		return EWideBVH4;
+	else if (lowercase == "bvh8")
+		return EWideBVH8;
+	SLog(EError, "Unknown accelerator \"%s\" (must be \"kdtree\", \"bvh4\" or \"bvh8\")", name.c_str());
+	return EKDTree;
+}
+
+std::string ShapeKDTree::getAcceleratorName(EAccelerator accel) {
+	switch (accel) {
+		case EKDTree: return "kdtree";
+		case EWideBVH4: return "bvh4";
+		case EWideBVH8: return "bvh8";
+		default: return "invalid";
+	}
+}
+
 void ShapeKDTree::build() {
 	for (size_t i=1; i<m_shapeMap.size(); ++i)
 		m_shapeMap[i] += m_shapeMap[i-1];
 
-	SAHKDTree3D<ShapeKDTree>::buildInternal();
+	fs::pathstr cachePath;
+	uint64_t cacheKey = 0;
+	if (m_accelerator == EKDTree && !m_cacheDirectory.s.empty() && getPrimitiveCount() > 0) {
+		cacheKey = computeCacheKey();
+		cachePath = fs::encode_pathstr(fs::decode_pathstr(m_cacheDirectory)
+			/ formatString("kdtree-%016llx.cache", (unsigned long long) cacheKey));
+		if (loadCache(cachePath, cacheKey))
+			return;
+		Log(m_logLevel, "kd-tree cache miss, the tree will be written to \"%s\"",
+			cachePath.s.c_str());
+	}
+
+	if (m_accelerator == EKDTree) {
+		SAHKDTree3D<ShapeKDTree>::buildInternal();
+	} else {
+		ref<Timer> timer = new Timer();
+		SizeType primCount = getPrimitiveCount();
+		int width = m_accelerator == EWideBVH4 ? 4 : 8;
+		Log(m_logLevel, "Building a %i-wide BVH over %u primitives ..", width, primCount);
+
+		AABB *bounds = new AABB[primCount];
+		for (IndexType i=0; i<primCount; ++i)
+			bounds[i] = getAABB(i);
+
+		if (m_accelerator == EWideBVH4) {
+			m_bvh4.setParallelBuild(m_parallelBuild);
+			m_bvh4.build(bounds, primCount);
+		} else {
+			m_bvh8.setParallelBuild(m_parallelBuild);
+			m_bvh8.build(bounds, primCount);
+		}
+		delete[] bounds;
+
+		updateBVHBounds();
+		m_built = true;
+
+		Log(m_logLevel, "Finished -- took %i ms (" SIZE_T_FMT " nodes, depth %i, %s).",
+			timer->getMilliseconds(),
+			m_accelerator == EWideBVH4 ? m_bvh4.getNodeCount() : m_bvh8.getNodeCount(),
+			m_accelerator == EWideBVH4 ? m_bvh4.getDepth() : m_bvh8.getDepth(),
+			memString(getMemoryUsage()).c_str());
+	}
+
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	buildTriAccel();
+#endif
+
+	if (!cachePath.s.empty())
+		saveCache(cachePath, cacheKey);
+}
+
+bool ShapeKDTree::update() {
+	if (!isBuilt())
+		Log(EError, "update(): the acceleration data structure has not been built yet!");
+
+	ref<Timer> timer = new Timer();
+
+	/* Release everything that depends on the primitive positions */
+	if (m_cacheFile) {
+		/* Nodes, indices and TriAccel records point into the mapped cache file */
+		m_nodes = NULL;
+		m_indices = NULL;
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+		m_triAccel = NULL;
+#endif
+		m_cacheFile = NULL;
+	}
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	if (m_triAccel) {
+		freeAligned(m_triAccel);
+		m_triAccel = NULL;
+	}
+#endif
+
+	bool refit = m_accelerator != EKDTree;
+	if (refit) {
+		SizeType primCount = getPrimitiveCount();
+		AABB *bounds = new AABB[primCount];
+		for (IndexType i=0; i<primCount; ++i)
+			bounds[i] = getAABB(i);
+		if (m_accelerator == EWideBVH4)
+			m_bvh4.refit(bounds);
+		else
+			m_bvh8.refit(bounds);
+		delete[] bounds;
+		updateBVHBounds();
+	} else {
+		/* kd-tree splits can't be refit -- rebuild the tree over the same
+		   shapes. Nested trees (e.g. of instanced shape groups) are kept. */
+		if (m_nodes) {
+			freeAligned(m_nodes-1); // undo alignment shift
+			m_nodes = NULL;
+		}
+		if (m_indices) {
+			delete[] m_indices;
+			m_indices = NULL;
+		}
+		SAHKDTree3D<ShapeKDTree>::buildInternal();
+	}
+
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	buildTriAccel();
+#endif
+
+	Log(m_logLevel, "%s the %s took %i ms.", refit ? "Refitting" : "Rebuilding",
+		getAcceleratorName(m_accelerator).c_str(), timer->getMilliseconds());
+	return refit;
+}
+
+void ShapeKDTree::updateBVHBounds() {
+	/* Same conventions as the kd-tree: slightly enlarged bounds */
+	AABB &aabb = m_aabb;
+	aabb = m_accelerator == EWideBVH4 ? m_bvh4.getAABB() : m_bvh8.getAABB();
+	#if defined(DOUBLE_PRECISION)
+		for (int i=0; i<3; ++i) {
+			aabb.min[i] = math::castflt_down(aabb.min[i]);
+			aabb.max[i] = math::castflt_up(aabb.max[i]);
+		}
+	#endif
+	m_tightAABB = aabb;
+	if (aabb.isValid()) {
+		const Float eps = MTS_KD_AABB_EPSILON;
+		aabb.min -= (aabb.max-aabb.min) * eps + Vector(eps);
+		aabb.max += (aabb.max-aabb.min) * eps + Vector(eps);
+	}
+}
 
 #if !defined(MTS_KD_CONSERVE_MEMORY)
+void ShapeKDTree::buildTriAccel() {
 	ref<Timer> timer = new Timer();
 	SizeType primCount = getPrimitiveCount();
 	Log(EDebug, "Precomputing triangle intersection information (%s)",
@@ -106,7 +297,201 @@ void ShapeKDTree::build() {
 	Log(EDebug, "Finished -- took %i ms.", timer->getMilliseconds());
 	Log(m_logLevel, "");
 	KDAssert(idx == primCount);
+}
 #endif
+
+uint64_t ShapeKDTree::computeCacheKey() const {
+	/* Build parameters and the layout of the cached data */
+	struct {
+		uint32_t version, floatSize, nodeSize, triAccelSize;
+		Float traversalCost, queryCost, emptySpaceBonus;
+		uint32_t clip, retract, maxDepth, stopPrims;
+		uint32_t maxBadRefines, exactPrimThreshold, minMaxBins;
+	} params;
+	memset(&params, 0, sizeof(params));
+	params.version = MTS_KD_CACHE_VERSION;
+	params.floatSize = (uint32_t) sizeof(Float);
+	params.nodeSize = (uint32_t) sizeof(KDNode);
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	params.triAccelSize = (uint32_t) sizeof(TriAccel);
+#endif
+	params.traversalCost = m_traversalCost;
+	params.queryCost = m_queryCost;
+	params.emptySpaceBonus = m_emptySpaceBonus;
+	params.clip = m_clip;
+	params.retract = m_retract;
+	params.maxDepth = m_maxDepth;
+	params.stopPrims = m_stopPrims;
+	params.maxBadRefines = m_maxBadRefines;
+	params.exactPrimThreshold = m_exactPrimThreshold;
+	params.minMaxBins = m_minMaxBins;
+	uint64_t key = hashBuffer(&params, sizeof(params));
+
+	/* Geometry: triangle meshes are hashed by content, other
+	   shapes by their description and bounds */
+	for (size_t i=0; i<m_shapes.size(); ++i) {
+		const Shape *shape = m_shapes[i];
+		const std::string &className = shape->getClass()->getName();
+		key = hashBuffer(className.c_str(), className.length(), key);
+
+		if (m_triangleFlag[i]) {
+			const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+			uint64_t counts[2] = { mesh->getTriangleCount(), mesh->getVertexCount() };
+			key = hashBuffer(counts, sizeof(counts), key);
+			key = hashBuffer(mesh->getVertexPositions(), sizeof(Point) * counts[1], key);
+			key = hashBuffer(mesh->getTriangles(), sizeof(Triangle) * counts[0], key);
+		} else {
+			std::string desc = shape->toString();
+			AABB aabb = shape->getAABB();
+			key = hashBuffer(desc.c_str(), desc.length(), key);
+			key = hashBuffer(&aabb, sizeof(AABB), key);
+		}
+	}
+
+	return key;
+}
+
+bool ShapeKDTree::loadCache(const fs::pathstr &path, uint64_t key) {
+	if (!fs::exists(path))
+		return false;
+
+	ref<Timer> timer = new Timer();
+	ref<MemoryMappedFile> file;
+	try {
+		file = new MemoryMappedFile(path);
+	} catch (const std::exception &e) {
+		Log(EWarn, "Unable to map the kd-tree cache \"%s\": %s", path.s.c_str(), e.what());
+		return false;
+	}
+
+	uint8_t *data = static_cast<uint8_t *>(file->getData());
+	const uint64_t size = file->getSize();
+	if (size < sizeof(KDCacheHeader)) {
+		Log(EWarn, "Ignoring truncated kd-tree cache \"%s\"", path.s.c_str());
+		return false;
+	}
+	/* The mapping is page-aligned, hence the header can be read in place */
+	const KDCacheHeader header = *reinterpret_cast<const KDCacheHeader *>(data);
+
+	bool valid = memcmp(header.magic, KDCacheMagic, sizeof(KDCacheMagic)) == 0
+		&& header.version == MTS_KD_CACHE_VERSION
+		&& header.floatSize == sizeof(Float)
+		&& header.nodeSize == sizeof(KDNode)
+		&& header.key == key
+		&& header.primCount == getPrimitiveCount()
+		&& header.fileSize == size
+		&& header.nodeCount > 0
+		&& header.nodeCount < size / sizeof(KDNode)
+		&& header.indexCount <= size / sizeof(IndexType)
+		&& header.nodeOffset % MTS_KD_CACHE_ALIGNMENT == 0
+		&& header.indexOffset % MTS_KD_CACHE_ALIGNMENT == 0
+		&& header.triAccelOffset % MTS_KD_CACHE_ALIGNMENT == 0
+		&& header.nodeOffset >= sizeof(KDCacheHeader)
+		&& header.nodeOffset + (header.nodeCount + 1) * sizeof(KDNode) <= header.indexOffset
+		&& header.indexOffset + header.indexCount * sizeof(IndexType) <= header.triAccelOffset;
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	valid = valid && header.triAccelSize == sizeof(TriAccel)
+		&& header.primCount <= size / sizeof(TriAccel)
+		&& header.triAccelOffset + header.primCount * sizeof(TriAccel) <= size;
+#else
+	valid = valid && header.triAccelSize == 0;
+#endif
+	if (!valid) {
+		Log(EWarn, "Ignoring incompatible or corrupt kd-tree cache \"%s\"", path.s.c_str());
+		return false;
+	}
+
+	/* +1 shift is for alignment purposes (see KDNode::getSibling) */
+	m_nodes = reinterpret_cast<KDNode *>(data + header.nodeOffset) + 1;
+	m_indices = reinterpret_cast<IndexType *>(data + header.indexOffset);
+	m_nodeCount = (SizeType) header.nodeCount;
+	m_indexCount = (SizeType) header.indexCount;
+	m_aabb = header.aabb;
+	m_tightAABB = header.tightAABB;
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	m_triAccel = reinterpret_cast<TriAccel *>(data + header.triAccelOffset);
+#endif
+	m_cacheFile = file;
+
+	Log(m_logLevel, "Mapped the kd-tree from cache \"%s\" (%i nodes, %s) in %i ms.",
+		path.s.c_str(), m_nodeCount, memString(size).c_str(), timer->getMilliseconds());
+	return true;
+}
+
+void ShapeKDTree::saveCache(const fs::pathstr &path, uint64_t key) const {
+	ref<Timer> timer = new Timer();
+
+	KDCacheHeader header = KDCacheHeader();
+	memcpy(header.magic, KDCacheMagic, sizeof(KDCacheMagic));
+	header.version = MTS_KD_CACHE_VERSION;
+	header.floatSize = (uint32_t) sizeof(Float);
+	header.nodeSize = (uint32_t) sizeof(KDNode);
+	header.key = key;
+	header.nodeCount = m_nodeCount;
+	header.indexCount = m_indexCount;
+	header.primCount = getPrimitiveCount();
+	header.nodeOffset = alignCacheOffset(sizeof(KDCacheHeader));
+	header.indexOffset = alignCacheOffset(header.nodeOffset + (header.nodeCount + 1) * sizeof(KDNode));
+	header.triAccelOffset = alignCacheOffset(header.indexOffset + header.indexCount * sizeof(IndexType));
+	header.fileSize = header.triAccelOffset;
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	header.triAccelSize = (uint32_t) sizeof(TriAccel);
+	header.fileSize += header.primCount * sizeof(TriAccel);
+#endif
+	header.aabb = m_aabb;
+	header.tightAABB = m_tightAABB;
+
+	/* Write to a temporary file first, so that concurrent
+	   runs never map a partially written cache */
+	uint64_t unique = (uint64_t) std::chrono::high_resolution_clock::now().time_since_epoch().count();
+	unique = hashBuffer(&unique, sizeof(uint64_t), (uint64_t) (uintptr_t) this);
+	fs::pathstr tempPath(formatString("%s.%016llx.tmp", path.s.c_str(), (unsigned long long) unique));
+
+	try {
+		std::error_code ec;
+		fs::create_directories(fs::decode_pathstr(m_cacheDirectory), ec);
+
+		ref<FileStream> stream = new FileStream(tempPath, FileStream::ETruncWrite);
+		const char padding[MTS_KD_CACHE_ALIGNMENT] = { 0 };
+		stream->write(&header, sizeof(KDCacheHeader));
+		stream->write(padding, (size_t) (header.nodeOffset - stream->getPos()));
+		stream->write(m_nodes - 1, (size_t) (header.nodeCount + 1) * sizeof(KDNode));
+		stream->write(padding, (size_t) (header.indexOffset - stream->getPos()));
+		stream->write(m_indices, (size_t) header.indexCount * sizeof(IndexType));
+		stream->write(padding, (size_t) (header.triAccelOffset - stream->getPos()));
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+		stream->write(m_triAccel, (size_t) header.primCount * sizeof(TriAccel));
+#endif
+		stream->close();
+	} catch (const std::exception &e) {
+		Log(EWarn, "Unable to write the kd-tree cache \"%s\": %s", path.s.c_str(), e.what());
+		fs::remove(tempPath);
+		return;
+	}
+
+	if (!fs::rename(tempPath, path)) {
+		Log(EWarn, "Unable to move the kd-tree cache to \"%s\"", path.s.c_str());
+		fs::remove(tempPath);
+		return;
+	}
+
+	Log(m_logLevel, "Wrote the kd-tree cache (%s) in %i ms.",
+		memString((size_t) header.fileSize).c_str(), timer->getMilliseconds());
+}
+
+size_t ShapeKDTree::getMemoryUsage() const {
+	size_t bytes = 0;
+	if (m_accelerator == EKDTree) {
+		if (m_nodes)
+			bytes += sizeof(KDNode) * m_nodeCount + sizeof(IndexType) * m_indexCount;
+	} else {
+		bytes += m_accelerator == EWideBVH4 ? m_bvh4.getMemoryUsage() : m_bvh8.getMemoryUsage();
+	}
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	if (m_triAccel)
+		bytes += sizeof(TriAccel) * getPrimitiveCount();
+#endif
+	return bytes;
 }
 
 bool ShapeKDTree::rayIntersect(const Ray &ray, Intersection &its) const {
@@ -132,7 +517,7 @@ bool ShapeKDTree::rayIntersect(const Ray &ray, Intersection &its) const {
 		if (ray.maxt < maxt) maxt = ray.maxt;
 
 		if (EXPECT_TAKEN(maxt > mint)) {
-			if (rayIntersectHavran<false>(ray, mint, maxt, its.t, temp)) {
+			if (rayIntersectAccel<false>(ray, mint, maxt, its.t, temp)) {
 				fillIntersectionRecord<true>(ray, temp, its);
 				return true;
 			}
@@ -160,7 +545,7 @@ bool ShapeKDTree::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
 		if (ray.maxt < maxt) maxt = ray.maxt;
 
 		if (EXPECT_TAKEN(maxt > mint)) {
-			if (rayIntersectHavran<false>(ray, mint, maxt, t, temp)) {
+			if (rayIntersectAccel<false>(ray, mint, maxt, t, temp)) {
 				const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
 				shape = m_shapes[cache->shapeIndex];
 
@@ -219,7 +604,7 @@ bool ShapeKDTree::rayIntersect(const Ray &ray) const {
 		if (ray.maxt < maxt) maxt = ray.maxt;
 
 		if (EXPECT_TAKEN(maxt > mint))
-			if (rayIntersectHavran<true>(ray, mint, maxt, t, NULL))
+			if (rayIntersectAccel<true>(ray, mint, maxt, t, NULL))
 				return true;
 	}
 	return false;
@@ -240,6 +625,12 @@ static StatsCounter incoherentPackets("General", "Incoherent ray packets");
 
 void ShapeKDTree::rayIntersectPacket(const RayPacket4 &packet,
 		const RayInterval4 &rayInterval, Intersection4 &its, void *temp) const {
+	if (m_accelerator != EKDTree) {
+		/* The BVH has no packet traversal, trace the rays one by one */
+		rayIntersectPacketIncoherent(packet, rayInterval, its, temp);
+		return;
+	}
+
 	CoherentKDStackEntry MM_ALIGN16 stack[MTS_KD_MAXDEPTH];
 	RayInterval4 MM_ALIGN16 interval;
 
@@ -370,7 +761,7 @@ void ShapeKDTree::rayIntersectPacketIncoherent(const RayPacket4 &packet,
 		ray.mint = rayInterval.mint.f[i];
 		ray.maxt = rayInterval.maxt.f[i];
 		uint8_t *rayTemp = reinterpret_cast<uint8_t *>(temp) + i * MTS_KD_INTERSECTION_TEMP;
-		if (ray.mint < ray.maxt && rayIntersectHavran<false>(ray, ray.mint, ray.maxt, t, rayTemp)) {
+		if (ray.mint < ray.maxt && rayIntersectAccel<false>(ray, ray.mint, ray.maxt, t, rayTemp)) {
 			const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(rayTemp);
 			its4.t.f[i] = t;
 			its4.shapeIndex.i[i] = cache->shapeIndex;
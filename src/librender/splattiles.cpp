@@ -0,0 +1,302 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/splattiles.h>
+#include <mitsuba/core/atomic.h>
+#include <mitsuba/core/statistics.h>
+#include <atomic>
+#include <thread>
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter statsFlushes("Splat tiles", "Slot merges");
+static StatsCounter statsTileMisses("Splat tiles", "Tile allocations");
+
+/**
+ * Per-thread tile set: a small open-addressing hash table maps image tile
+ * indices to tiles in a fixed-size storage array. Padded to keep the
+ * slots of different threads on separate cache lines. The spin lock is only
+ * contended while another thread merges all slots (see \ref flushAll()),
+ * since the owner cannot hand its tiles over without synchronizing.
+ */
+struct alignas(64) SplatTiles::Slot {
+	std::vector<int32_t> keys;    ///< Image tile index per hash entry, -1 if empty
+	std::vector<int32_t> values;  ///< Storage tile per hash entry
+	std::vector<int32_t> used;    ///< Image tile index of every storage tile in use
+	std::vector<Float> storage;   ///< Tile pixel data
+	std::vector<Float> weights;   ///< Temporary filter weights
+	uint32_t hashMask;
+	int epoch;
+	size_t flushes;
+	std::atomic<bool> locked;
+};
+
+/// Scoped lock of a slot
+struct SplatTiles::SlotLock {
+	Slot &slot;
+
+	inline SlotLock(Slot &slot) : slot(slot) {
+		while (slot.locked.exchange(true, std::memory_order_acquire))
+			std::this_thread::yield();
+	}
+
+	inline ~SlotLock() {
+		slot.locked.store(false, std::memory_order_release);
+	}
+};
+
+SplatTiles::SplatTiles(ImageBlock *target, int slotCount, int maxTilesPerSlot, int tileSize)
+		: m_target(target), m_tileSize(tileSize), m_maxTiles(maxTilesPerSlot), m_flushEpoch(0) {
+	if (m_tileSize <= 0 || m_maxTiles <= 0)
+		Log(EError, "Tile size and tile count must be positive!");
+	const Vector2i &size = target->getBitmap()->getSize();
+	m_tilesX = (size.x + m_tileSize - 1) / m_tileSize;
+
+	const ReconstructionFilter *filter = target->getFilter();
+	int weightCount = filter ? 2 * ((int) std::ceil(2*filter->getRadius()) + 1) : 2;
+	size_t tileFloats = (size_t) m_tileSize * m_tileSize * target->getChannelCount();
+
+	uint32_t hashSize = 1;
+	while (hashSize < 2 * (uint32_t) m_maxTiles)
+		hashSize <<= 1;
+
+	m_slots.resize(slotCount);
+	for (int i = 0; i < slotCount; ++i) {
+		Slot *slot = new Slot();
+		slot->keys.resize(hashSize, -1);
+		slot->values.resize(hashSize);
+		slot->used.reserve(m_maxTiles);
+		slot->storage.resize(tileFloats * m_maxTiles, 0.0f);
+		slot->weights.resize(weightCount);
+		slot->hashMask = hashSize - 1;
+		slot->epoch = 0;
+		slot->flushes = 0;
+		slot->locked = false;
+		m_slots[i] = slot;
+	}
+}
+
+SplatTiles::~SplatTiles() {
+	for (size_t i = 0; i < m_slots.size(); ++i)
+		delete m_slots[i];
+}
+
+bool SplatTiles::put(int slotIdx, const Point2 &_pos, const Float *value) {
+	Slot &slot = *m_slots[slotIdx];
+	SlotLock lock(slot);
+	if (EXPECT_NOT_TAKEN(slot.epoch != m_flushEpoch))
+		flushLocked(slot);
+
+	Bitmap *bitmap = m_target->getBitmap();
+	const int channels = bitmap->getChannelCount();
+
+	/* Check if all sample values are valid */
+	for (int i=0; i<channels; ++i) {
+		if (EXPECT_NOT_TAKEN((!std::isfinite(value[i]) || value[i] < 0) && m_target->getWarn())) {
+			std::ostringstream oss;
+			oss << "Invalid sample value : [";
+			for (int j=0; j<channels; ++j) {
+				oss << value[j];
+				if (j+1 < channels)
+					oss << ", ";
+			}
+			oss << "]";
+			Log(EWarn, "%s", oss.str().c_str());
+			return false;
+		}
+	}
+
+	const ReconstructionFilter *filter = m_target->getFilter();
+	const Float filterRadius = filter->getRadius();
+	const Vector2i &size = bitmap->getSize();
+	const Point2i &offset = m_target->getOffset();
+	const int borderSize = m_target->getBorderSize();
+
+	/* Convert to pixel coordinates within the image block */
+	const Point2 pos(
+		_pos.x - 0.5f - (offset.x - borderSize),
+		_pos.y - 0.5f - (offset.y - borderSize));
+
+	/* Determine the affected range of pixels */
+	const Point2i min(std::max((int) std::ceil (pos.x - filterRadius), 0),
+	                  std::max((int) std::ceil (pos.y - filterRadius), 0)),
+	              max(std::min((int) std::floor(pos.x + filterRadius), size.x - 1),
+	                  std::min((int) std::floor(pos.y + filterRadius), size.y - 1));
+
+	/* Lookup values from the pre-rasterized filter */
+	Float *weightsX = &slot.weights[0];
+	Float *weightsY = weightsX + slot.weights.size() / 2;
+	for (int x=min.x, idx = 0; x<=max.x; ++x)
+		weightsX[idx++] = filter->evalDiscretized(x-pos.x);
+	for (int y=min.y, idx = 0; y<=max.y; ++y)
+		weightsY[idx++] = filter->evalDiscretized(y-pos.y);
+
+	const int tileSize = m_tileSize;
+	const size_t tileFloats = (size_t) tileSize * tileSize * channels;
+
+	/* Rasterize the filtered sample into the (thread-private) tiles */
+	for (int y=min.y, yr=0; y<=max.y; ++y, ++yr) {
+		const Float weightY = weightsY[yr];
+		const int tileY = y / tileSize, localY = y - tileY * tileSize;
+
+		for (int x=min.x, xr=0; x<=max.x; ) {
+			const int tileX = x / tileSize;
+			const int32_t key = tileY * m_tilesX + tileX;
+
+			/* Find or allocate the tile */
+			uint32_t h = ((uint32_t) key * 2654435761U) & slot.hashMask;
+			while (slot.keys[h] != key && slot.keys[h] != -1)
+				h = (h + 1) & slot.hashMask;
+			if (slot.keys[h] == -1) {
+				if ((int) slot.used.size() == m_maxTiles) {
+					flushLocked(slot);
+					h = ((uint32_t) key * 2654435761U) & slot.hashMask;
+				}
+				slot.keys[h] = key;
+				slot.values[h] = (int32_t) slot.used.size();
+				slot.used.push_back(key);
+				++statsTileMisses;
+			}
+
+			const int localX0 = x - tileX * tileSize;
+			const int span = std::min(max.x - x + 1, tileSize - localX0);
+			Float *dest = &slot.storage[slot.values[h] * tileFloats]
+				+ ((size_t) localY * tileSize + localX0) * channels;
+
+			for (int i = 0; i < span; ++i, ++xr) {
+				const Float weight = weightsX[xr] * weightY;
+				for (int k=0; k<channels; ++k)
+					*dest++ += weight * value[k];
+			}
+			x += span;
+		}
+	}
+
+	return true;
+}
+
+void SplatTiles::flush(int slotIdx) {
+	Slot &slot = *m_slots[slotIdx];
+	SlotLock lock(slot);
+	flushLocked(slot);
+}
+
+void SplatTiles::flushLocked(Slot &slot) {
+	slot.epoch = m_flushEpoch;
+	if (slot.used.empty())
+		return;
+
+	Bitmap *bitmap = m_target->getBitmap();
+	const int channels = bitmap->getChannelCount();
+	const Vector2i &size = bitmap->getSize();
+	const int tileSize = m_tileSize;
+	const size_t tileFloats = (size_t) tileSize * tileSize * channels;
+
+	for (size_t t = 0; t < slot.used.size(); ++t) {
+		const int32_t key = slot.used[t];
+		const int x0 = (key % m_tilesX) * tileSize, y0 = (key / m_tilesX) * tileSize;
+		const int w = std::min(tileSize, size.x - x0), h = std::min(tileSize, size.y - y0);
+		Float *src = &slot.storage[t * tileFloats];
+
+		for (int y = 0; y < h; ++y) {
+			Float *row = src + (size_t) y * tileSize * channels;
+			Float volatile *dest = bitmap->getFloatData()
+				+ ((y0 + y) * (size_t) size.x + x0) * channels;
+
+			/* Merge with atomic additions, skipping pixels that were never touched */
+			for (int x = 0; x < w; ++x, dest += channels) {
+				Float *px = row + (size_t) x * channels;
+				bool touched = false;
+				for (int k = 0; k < channels; ++k)
+					touched |= (px[k] != 0);
+				if (!touched)
+					continue;
+				for (int k = 0; k < channels; ++k) {
+					atomicAdd(dest + k, px[k]);
+					px[k] = 0;
+				}
+			}
+		}
+	}
+
+	std::fill(slot.keys.begin(), slot.keys.end(), -1);
+	slot.used.clear();
+	++slot.flushes;
+	++statsFlushes;
+}
+
+void SplatTiles::sync(int slotIdx) {
+	Slot &slot = *m_slots[slotIdx];
+	if (slot.epoch != m_flushEpoch) {
+		SlotLock lock(slot);
+		flushLocked(slot);
+	}
+}
+
+void SplatTiles::requestFlush() {
+	atomicAdd(&m_flushEpoch, 1);
+}
+
+void SplatTiles::flushAll() {
+	for (size_t i = 0; i < m_slots.size(); ++i)
+		flush((int) i);
+}
+
+void SplatTiles::clear() {
+	const size_t tileFloats = (size_t) m_tileSize * m_tileSize * m_target->getChannelCount();
+	for (size_t i = 0; i < m_slots.size(); ++i) {
+		Slot &slot = *m_slots[i];
+		std::fill(slot.storage.begin(), slot.storage.begin() + slot.used.size() * tileFloats, 0.0f);
+		std::fill(slot.keys.begin(), slot.keys.end(), -1);
+		slot.used.clear();
+		slot.epoch = m_flushEpoch;
+	}
+}
+
+size_t SplatTiles::getFlushCount() const {
+	size_t count = 0;
+	for (size_t i = 0; i < m_slots.size(); ++i)
+		count += m_slots[i]->flushes;
+	return count;
+}
+
+size_t SplatTiles::getMemoryUsage() const {
+	size_t bytes = 0;
+	for (size_t i = 0; i < m_slots.size(); ++i) {
+		const Slot &slot = *m_slots[i];
+		bytes += sizeof(Slot)
+			+ slot.storage.capacity() * sizeof(Float)
+			+ (slot.keys.capacity() + slot.values.capacity() + slot.used.capacity()) * sizeof(int32_t)
+			+ slot.weights.capacity() * sizeof(Float);
+	}
+	return bytes;
+}
+
+std::string SplatTiles::toString() const {
+	std::ostringstream oss;
+	oss << "SplatTiles[" << endl
+		<< "  slotCount = " << m_slots.size() << "," << endl
+		<< "  tileSize = " << m_tileSize << "," << endl
+		<< "  maxTilesPerSlot = " << m_maxTiles << "," << endl
+		<< "  memoryUsage = " << memString(getMemoryUsage()) << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(SplatTiles, false, Object)
+MTS_NAMESPACE_END
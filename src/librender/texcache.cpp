@@ -0,0 +1,191 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/texcache.h>
+#include <mitsuba/core/statistics.h>
+#include <cstdlib>
+#include <mutex>
+
+MTS_NAMESPACE_BEGIN
+
+namespace stats {
+	StatsCounter texCacheHits("Texture cache", "Tile hits", EPercentage);
+}
+
+static StatsCounter statsLoads("Texture cache", "Tiles loaded");
+static StatsCounter statsEvictions("Texture cache", "Tiles evicted");
+static StatsCounter statsBytesRead("Texture cache", "Tile data read", EByteCount);
+
+static std::atomic<uint32_t> __nextFileID(1);
+
+TiledTextureFile::TiledTextureFile(const fs::pathstr &filename, size_t dataOffset, size_t tileSize)
+		: m_filename(filename), m_dataOffset(dataOffset), m_tileSize(tileSize) {
+	if (tileSize == 0)
+		Log(EError, "The tile size must be positive!");
+	m_stream = new FileStream(filename, FileStream::EReadOnly);
+	m_mutex = new Mutex();
+	size_t fileSize = m_stream->getSize();
+	if (fileSize < dataOffset)
+		Log(EError, "\"%s\": the file is truncated!", filename.s.c_str());
+	m_tileCount = (uint32_t) ((fileSize - dataOffset) / tileSize);
+	m_id = __nextFileID++;
+	TextureCache::getInstance()->registerTileSize(tileSize);
+}
+
+TiledTextureFile::~TiledTextureFile() { }
+
+void TiledTextureFile::readTile(uint32_t index, uint8_t *target) const {
+	if (index >= m_tileCount)
+		Log(EError, "\"%s\": tile index %u is out of range (file has %u tiles)!",
+			m_filename.s.c_str(), index, m_tileCount);
+	LockGuard lock(m_mutex);
+	m_stream->seek(m_dataOffset + (size_t) index * m_tileSize);
+	m_stream->read(target, m_tileSize);
+}
+
+std::string TiledTextureFile::toString() const {
+	std::ostringstream oss;
+	oss << "TiledTextureFile[" << endl
+		<< "  filename = \"" << m_filename.s << "\"," << endl
+		<< "  tileSize = " << memString(m_tileSize) << "," << endl
+		<< "  tileCount = " << m_tileCount << endl
+		<< "]";
+	return oss.str();
+}
+
+TextureCache::LocalTiles::LocalTiles() {
+	for (int i=0; i<MTS_TEXCACHE_LOCAL_TILES; ++i)
+		keys[i] = (uint64_t) -1;
+}
+
+TextureCache::LocalTiles &TextureCache::getLocalTiles() {
+	static thread_local LocalTiles localTiles;
+	return localTiles;
+}
+
+TextureCache *TextureCache::getInstance() {
+	/* Created on first use and intentionally never released, since
+	   textures may still be destroyed during the static shutdown */
+	static TextureCache *instance = NULL;
+	static std::once_flag flag;
+	std::call_once(flag, []() {
+		size_t budget = (size_t) MTS_TEXCACHE_DEFAULT_BUDGET;
+		const char *env = getenv("MITSUBA_TEXCACHE_SIZE");
+		if (env) {
+			char *end_ptr = NULL;
+			long long value = strtoll(env, &end_ptr, 10);
+			if (*end_ptr == '\0' && value > 0)
+				budget = (size_t) value;
+		}
+		instance = new TextureCache(budget * 1024 * 1024);
+		instance->incRef();
+	});
+	return instance;
+}
+
+TextureCache::TextureCache(size_t budget)
+	: m_budget(budget), m_maxTileSize(0), m_memoryUsage(0) {
+	m_mutex = new Mutex();
+	for (int i=0; i<MTS_TEXCACHE_SHARDS; ++i)
+		m_shards[i].mutex = new Mutex();
+}
+
+TextureCache::~TextureCache() { }
+
+void TextureCache::reset() {
+	size_t capacity = 1;
+	if (m_maxTileSize > 0)
+		capacity = std::max((size_t) 1, m_budget / (MTS_TEXCACHE_SHARDS * m_maxTileSize));
+
+	for (int i=0; i<MTS_TEXCACHE_SHARDS; ++i) {
+		Shard &shard = m_shards[i];
+		LockGuard lock(shard.mutex);
+		shard.cache = new TileLRUCache(capacity,
+			[](const uint64_t &) { return TilePtr(); },
+			[this](const TilePtr &tile) {
+				m_memoryUsage -= tile->size;
+				++statsEvictions;
+			}
+		);
+	}
+}
+
+void TextureCache::registerTileSize(size_t tileSize) {
+	LockGuard lock(m_mutex);
+	if (tileSize <= m_maxTileSize)
+		return;
+	/* The capacity of the shards is measured in tiles */
+	m_maxTileSize = tileSize;
+	reset();
+}
+
+void TextureCache::setMemoryBudget(size_t bytes) {
+	LockGuard lock(m_mutex);
+	m_budget = bytes;
+	reset();
+}
+
+void TextureCache::flush() {
+	LockGuard lock(m_mutex);
+	reset();
+}
+
+TextureCache::TilePtr TextureCache::lookupShared(const TiledTextureFile *file, uint32_t index, uint64_t key) {
+	Shard &shard = m_shards[hashKey(key) % MTS_TEXCACHE_SHARDS];
+
+	/* The lookup was already counted by lookup(), which only
+	   calls this function after a miss in the thread-local tiles */
+	bool hit;
+	{
+		LockGuard lock(shard.mutex);
+		if (shard.cache->has(key)) {
+			++stats::texCacheHits;
+			return shard.cache->get(key, hit);
+		}
+	}
+
+	/* Load the tile without holding the lock. If another thread
+	   loads the same tile concurrently, only one copy is kept */
+	std::shared_ptr<Tile> tile = std::make_shared<Tile>();
+	tile->size = file->getTileSize();
+	tile->data.reset(new uint8_t[tile->size]);
+	file->readTile(index, tile->data.get());
+	++statsLoads;
+	statsBytesRead += tile->size;
+
+	LockGuard lock(shard.mutex);
+	if (shard.cache->has(key))
+		return shard.cache->get(key, hit);
+	m_memoryUsage += tile->size;
+	shard.cache->set(key, tile);
+	return tile;
+}
+
+std::string TextureCache::toString() const {
+	std::ostringstream oss;
+	oss << "TextureCache[" << endl
+		<< "  memoryBudget = " << memString(m_budget) << "," << endl
+		<< "  memoryUsage = " << memString(m_memoryUsage) << "," << endl
+		<< "  shards = " << MTS_TEXCACHE_SHARDS << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(TextureCache, false, Object)
+MTS_IMPLEMENT_CLASS(TiledTextureFile, false, Object)
+MTS_NAMESPACE_END
@@ -21,6 +21,8 @@
 #include <mitsuba/core/random.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/zstream.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/lock.h>
 #include <mitsuba/core/properties.h>
@@ -35,6 +37,10 @@
 #define MTS_FILEFORMAT_HEADER     0x041C
 #define MTS_FILEFORMAT_VERSION_V3 0x0003
 #define MTS_FILEFORMAT_VERSION_V4 0x0004
+#define MTS_FILEFORMAT_VERSION_V5 0x0005
+
+/// Alignment of the mesh arrays in the (uncompressed) version 5 format
+#define MTS_FILEFORMAT_ALIGNMENT  64
 
 MTS_NAMESPACE_BEGIN
 
@@ -173,6 +179,20 @@ static void readHelper(Stream *stream, bool fileDoublePrecision,
 	}
 }
 
+/// Skip the zero padding in front of an array of the aligned format
+static void skipPadding(Stream *stream) {
+	size_t pos = stream->getPos();
+	stream->seek((pos + MTS_FILEFORMAT_ALIGNMENT - 1) & ~((size_t) MTS_FILEFORMAT_ALIGNMENT - 1));
+}
+
+/// Write zero padding up to the next aligned file offset
+static void writePadding(Stream *stream) {
+	const uint8_t zeros[MTS_FILEFORMAT_ALIGNMENT] = { 0 };
+	size_t pos = stream->getPos();
+	size_t padding = ((pos + MTS_FILEFORMAT_ALIGNMENT - 1) & ~((size_t) MTS_FILEFORMAT_ALIGNMENT - 1)) - pos;
+	stream->write(zeros, padding);
+}
+
 void TriMesh::loadCompressed(Stream *_stream, int index) {
 	ref<Stream> stream = _stream;
 
@@ -188,11 +208,15 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
 		stream->skip(sizeof(short) * 2); // Skip the header
 	}
 
-	stream = new ZStream(stream);
-	stream->setByteOrder(Stream::ELittleEndian);
+	/* Version 5 stores uncompressed arrays at aligned file offsets */
+	const bool aligned = isAlignedVersion(version);
+	if (!aligned) {
+		stream = new ZStream(stream);
+		stream->setByteOrder(Stream::ELittleEndian);
+	}
 
 	uint32_t flags = stream->readUInt();
-	if (version == MTS_FILEFORMAT_VERSION_V4)
+	if (version >= MTS_FILEFORMAT_VERSION_V4)
 		m_name = stream->readString();
 	m_vertexCount = stream->readSize();
 	m_triangleCount = stream->readSize();
@@ -200,51 +224,48 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
 	bool fileDoublePrecision = flags & EDoublePrecision;
 	m_faceNormals = flags & EFaceNormals;
 
-	if (m_positions)
-		delete[] m_positions;
-
+	freeArray(m_positions);
 	m_positions = new Point[m_vertexCount];
+	if (aligned)
+		skipPadding(stream);
 	readHelper(stream, fileDoublePrecision,
 			reinterpret_cast<Float *>(m_positions),
 			m_vertexCount, sizeof(Point)/sizeof(Float));
 
-	if (m_normals)
-		delete[] m_normals;
-
+	freeArray(m_normals);
 	if (flags & EHasNormals) {
 		m_normals = new Normal[m_vertexCount];
+		if (aligned)
+			skipPadding(stream);
 		readHelper(stream, fileDoublePrecision,
 				reinterpret_cast<Float *>(m_normals),
 				m_vertexCount, sizeof(Normal)/sizeof(Float));
-	} else {
-		m_normals = NULL;
 	}
 
-	if (m_texcoords)
-		delete[] m_texcoords;
-
+	freeArray(m_texcoords);
 	if (flags & EHasTexcoords) {
 		m_texcoords = new Point2[m_vertexCount];
+		if (aligned)
+			skipPadding(stream);
 		readHelper(stream, fileDoublePrecision,
 				reinterpret_cast<Float *>(m_texcoords),
 				m_vertexCount, sizeof(Point2)/sizeof(Float));
-	} else {
-		m_texcoords = NULL;
 	}
 
-	if (m_colors)
-		delete[] m_colors;
-
+	freeArray(m_colors);
 	if (flags & EHasColors) {
 		m_colors = new Color3[m_vertexCount];
+		if (aligned)
+			skipPadding(stream);
 		readHelper(stream, fileDoublePrecision,
 				reinterpret_cast<Float *>(m_colors),
 				m_vertexCount, sizeof(Color3)/sizeof(Float));
-	} else {
-		m_colors = NULL;
 	}
 
+	freeArray(m_triangles);
 	m_triangles = new Triangle[m_triangleCount];
+	if (aligned)
+		skipPadding(stream);
 	stream->readUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
 		m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
 
@@ -252,6 +273,80 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
 	m_flipNormals = false;
 }
 
+void TriMesh::loadMapped(MemoryMappedFile *file, size_t offset) {
+	uint8_t *data = static_cast<uint8_t *>(file->getData());
+	const size_t size = file->getSize();
+	if (offset >= size)
+		Log(EError, "Unable to unserialize mesh, the offset " SIZE_T_FMT
+			" lies outside of the file!", offset);
+
+	ref<MemoryStream> stream = new MemoryStream(data, size);
+	stream->setByteOrder(Stream::ELittleEndian);
+	stream->seek(offset);
+	const short version = readHeader(stream);
+	uint32_t flags = stream->readUInt();
+
+#if defined(SINGLE_PRECISION)
+	const bool precisionMatches = flags & ESinglePrecision;
+#else
+	const bool precisionMatches = flags & EDoublePrecision;
+#endif
+	if (!isAlignedVersion(version) || !precisionMatches ||
+			Stream::getHostByteOrder() != Stream::ELittleEndian) {
+		/* The data cannot be used in place -- load a copy */
+		stream->seek(offset);
+		loadCompressed(stream);
+		return;
+	}
+
+	m_name = stream->readString();
+	m_vertexCount = stream->readSize();
+	m_triangleCount = stream->readSize();
+	m_faceNormals = flags & EFaceNormals;
+
+	/* Locate the next array and check that it lies within the file */
+	auto mapArray = [&](size_t count, size_t elementSize) -> uint8_t * {
+		size_t pos = stream->getPos();
+		pos = (pos + MTS_FILEFORMAT_ALIGNMENT - 1) & ~((size_t) MTS_FILEFORMAT_ALIGNMENT - 1);
+		if (pos > size || count > (size - pos) / elementSize)
+			Log(EError, "Unable to unserialize mesh \"%s\": the file is truncated!",
+				m_name.c_str());
+		stream->seek(pos + count * elementSize);
+		return data + pos;
+	};
+
+	freeArray(m_positions);
+	freeArray(m_normals);
+	freeArray(m_texcoords);
+	freeArray(m_colors);
+	freeArray(m_triangles);
+
+	m_positions = reinterpret_cast<Point *>(mapArray(m_vertexCount, sizeof(Point)));
+	if (flags & EHasNormals)
+		m_normals = reinterpret_cast<Normal *>(mapArray(m_vertexCount, sizeof(Normal)));
+	if (flags & EHasTexcoords)
+		m_texcoords = reinterpret_cast<Point2 *>(mapArray(m_vertexCount, sizeof(Point2)));
+	if (flags & EHasColors)
+		m_colors = reinterpret_cast<Color3 *>(mapArray(m_vertexCount, sizeof(Color3)));
+	m_triangles = reinterpret_cast<Triangle *>(mapArray(m_triangleCount, sizeof(Triangle)));
+	m_mapping = file;
+
+	m_surfaceArea = m_invSurfaceArea = -1;
+	m_flipNormals = false;
+}
+
+bool TriMesh::isAlignedVersion(short version) {
+	return version == MTS_FILEFORMAT_VERSION_V5;
+}
+
+bool TriMesh::isMapped(const void *ptr) const {
+	if (!m_mapping)
+		return false;
+	const uint8_t *start = static_cast<const uint8_t *>(m_mapping->getData());
+	const uint8_t *p = static_cast<const uint8_t *>(ptr);
+	return p >= start && p < start + m_mapping->getSize();
+}
+
 short TriMesh::readHeader(Stream *stream) {
 	short format = stream->readShort();
 	if (format == 0x1C04) {
@@ -264,7 +359,8 @@ short TriMesh::readHeader(Stream *stream) {
 	}
 	short version = stream->readShort();
 	if (version != MTS_FILEFORMAT_VERSION_V3 &&
-	    version != MTS_FILEFORMAT_VERSION_V4) {
+	    version != MTS_FILEFORMAT_VERSION_V4 &&
+	    version != MTS_FILEFORMAT_VERSION_V5) {
 		Log(EError, "Encountered an incompatible file version!");
 	}
 	return version;
@@ -284,7 +380,7 @@ size_t TriMesh::readOffset(Stream *stream, short version, int idx) {
 	}
 
 	// Seek to the correct position
-	if (version == MTS_FILEFORMAT_VERSION_V4) {
+	if (version >= MTS_FILEFORMAT_VERSION_V4) {
 		stream->seek(stream->getSize() - sizeof(uint64_t) * (count-idx) - sizeof(uint32_t));
 		return stream->readSize();
 	} else {
@@ -311,7 +407,7 @@ int TriMesh::readOffsetDictionary(Stream *stream, short version,
 
 	if (streamSize >= minSize) {
 		outOffsets.resize(count);
-		if (version == MTS_FILEFORMAT_VERSION_V4) {
+		if (version >= MTS_FILEFORMAT_VERSION_V4) {
 			stream->seek(stream->getSize() - sizeof(uint64_t) * count - sizeof(uint32_t));
 			if (typeid(size_t) == typeid(uint64_t)) {
 				stream->readArray(&outOffsets[0], count);
@@ -338,18 +434,12 @@ int TriMesh::readOffsetDictionary(Stream *stream, short version,
 }
 
 TriMesh::~TriMesh() {
-	if (m_positions)
-		delete[] m_positions;
-	if (m_normals)
-		delete[] m_normals;
-	if (m_texcoords)
-		delete[] m_texcoords;
-	if (m_tangents)
-		delete[] m_tangents;
-	if (m_colors)
-		delete[] m_colors;
-	if (m_triangles)
-		delete[] m_triangles;
+	freeArray(m_positions);
+	freeArray(m_normals);
+	freeArray(m_texcoords);
+	freeArray(m_tangents);
+	freeArray(m_colors);
+	freeArray(m_triangles);
 }
 
 AABB TriMesh::getAABB() const {
@@ -471,15 +561,8 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 	const Float dpThresh = std::cos(degToRad(maxAngle));
 	size_t degenerateTriangles = 0;
 
-	if (m_normals) {
-		delete[] m_normals;
-		m_normals = NULL;
-	}
-
-	if (m_tangents) {
-		delete[] m_tangents;
-		m_tangents = NULL;
-	}
+	freeArray(m_normals);
+	freeArray(m_tangents);
 
 	Log(EInfo, "Rebuilding the topology of \"%s\" (" SIZE_T_FMT
 			" triangles, " SIZE_T_FMT " vertices, max. angle = %f)",
@@ -575,21 +658,21 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 		for (int j=0; j<3; ++j)
 			Assert(newTriangles[i].idx[j] != 0xFFFFFFFFU);
 
-	delete[] m_triangles;
+	freeArray(m_triangles);
 	m_triangles = newTriangles;
 
-	delete[] m_positions;
+	freeArray(m_positions);
 	m_positions = new Point[newPositions.size()];
 	memcpy(m_positions, &newPositions[0], sizeof(Point) * newPositions.size());
 
 	if (m_texcoords) {
-		delete[] m_texcoords;
+		freeArray(m_texcoords);
 		m_texcoords = new Point2[newTexcoords.size()];
 		memcpy(m_texcoords, &newTexcoords[0], sizeof(Point2) * newTexcoords.size());
 	}
 
 	if (m_colors) {
-		delete[] m_colors;
+		freeArray(m_colors);
 		m_colors = new Color3[newColors.size()];
 		memcpy(m_colors, &newColors[0], sizeof(Color3) * newColors.size());
 	}
@@ -608,10 +691,7 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 void TriMesh::computeNormals(bool force) {
 	int invalidNormals = 0;
 	if (m_faceNormals) {
-		if (m_normals) {
-			delete[] m_normals;
-			m_normals = NULL;
-		}
+		freeArray(m_normals);
 
 		if (m_flipNormals) {
 			/* Change the winding order */
@@ -826,6 +906,40 @@ ref<TriMesh> TriMesh::createTriMesh() {
 	return this;
 }
 
+bool TriMesh::applyTransform(const Transform &trafo) {
+	m_aabb.reset();
+	for (size_t i=0; i<m_vertexCount; i++) {
+		m_positions[i] = trafo(m_positions[i]);
+		m_aabb.expandBy(m_positions[i]);
+	}
+
+	if (m_normals) {
+		for (size_t i=0; i<m_vertexCount; i++) {
+			Normal n = trafo(m_normals[i]);
+			Float length = n.length();
+			if (length != 0)
+				m_normals[i] = n / length;
+		}
+	}
+
+	if (m_tangents) {
+		for (size_t i=0; i<m_triangleCount; i++) {
+			m_tangents[i].dpdu = trafo(m_tangents[i].dpdu);
+			m_tangents[i].dpdv = trafo(m_tangents[i].dpdv);
+		}
+	}
+
+	/* Recreate the sampling table if it was in use, since the
+	   surface area changes unless the transformation is rigid */
+	LockGuard guard(m_mutex);
+	bool hadSamplingTable = m_surfaceArea >= 0;
+	m_areaDistr.clear();
+	m_surfaceArea = m_invSurfaceArea = -1;
+	if (hadSamplingTable)
+		prepareSamplingTable();
+	return true;
+}
+
 void TriMesh::serialize(Stream *stream, InstanceManager *manager) const {
 	Shape::serialize(stream, manager);
 	uint32_t flags = 0;
@@ -1174,6 +1288,57 @@ void TriMesh::serialize(Stream *_stream) const {
 		m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
 }
 
+void TriMesh::serializeAligned(Stream *stream) const {
+	if (stream->getByteOrder() != Stream::ELittleEndian)
+		Log(EError, "Tried to unserialize a shape from a stream, "
+			"which was not previously set to little endian byte order!");
+
+	stream->writeShort(MTS_FILEFORMAT_HEADER);
+	stream->writeShort(MTS_FILEFORMAT_VERSION_V5);
+
+#if defined(SINGLE_PRECISION)
+	uint32_t flags = ESinglePrecision;
+#else
+	uint32_t flags = EDoublePrecision;
+#endif
+
+	if (m_normals)
+		flags |= EHasNormals;
+	if (m_texcoords)
+		flags |= EHasTexcoords;
+	if (m_colors)
+		flags |= EHasColors;
+	if (m_faceNormals)
+		flags |= EFaceNormals;
+
+	stream->writeUInt(flags);
+	stream->writeString(m_name);
+	stream->writeSize(m_vertexCount);
+	stream->writeSize(m_triangleCount);
+
+	writePadding(stream);
+	stream->writeFloatArray(reinterpret_cast<Float *>(m_positions),
+		m_vertexCount * sizeof(Point)/sizeof(Float));
+	if (m_normals) {
+		writePadding(stream);
+		stream->writeFloatArray(reinterpret_cast<Float *>(m_normals),
+			m_vertexCount * sizeof(Normal)/sizeof(Float));
+	}
+	if (m_texcoords) {
+		writePadding(stream);
+		stream->writeFloatArray(reinterpret_cast<Float *>(m_texcoords),
+			m_vertexCount * sizeof(Point2)/sizeof(Float));
+	}
+	if (m_colors) {
+		writePadding(stream);
+		stream->writeFloatArray(reinterpret_cast<Float *>(m_colors),
+			m_vertexCount * sizeof(Color3)/sizeof(Float));
+	}
+	writePadding(stream);
+	stream->writeUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
+		m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+}
+
 size_t TriMesh::getPrimitiveCount() const {
 	return m_triangleCount;
 }
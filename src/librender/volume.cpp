@@ -54,6 +54,10 @@ Vector VolumeDataSource::lookupVector(const Point &p) const {
 	return Vector();
 }
 
+Float VolumeDataSource::getLocalMaximumFloatValue(const AABB &aabb) const {
+	return getMaximumFloatValue();
+}
+
 bool VolumeDataSource::supportsFloatLookups() const {
 	return false;
 }
@@ -0,0 +1,379 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/wbvh.h>
+#include <atomic>
+#include <thread>
+
+/// Number of bins used by the SAH split search
+#define MTS_WBVH_BINS 32
+
+/// Subtrees with at least this many primitives are built on a separate thread
+#define MTS_WBVH_PARALLEL_THRESHOLD 65536
+
+MTS_NAMESPACE_BEGIN
+
+namespace {
+	/// Range of the index list covered by a (future) node
+	struct BuildRange {
+		uint32_t begin, end;
+		AABB bounds, centroidBounds;
+
+		inline uint32_t size() const { return end - begin; }
+	};
+
+	void computeBounds(const AABB *bounds, const uint32_t *indices, BuildRange &range) {
+		range.bounds.reset();
+		range.centroidBounds.reset();
+		for (uint32_t i=range.begin; i<range.end; ++i) {
+			const AABB &aabb = bounds[indices[i]];
+			range.bounds.expandBy(aabb);
+			range.centroidBounds.expandBy(aabb.getCenter());
+		}
+	}
+
+	/**
+	 * Split a range using binned SAH, or at the centroid median if
+	 * \c median is set or binning cannot separate the primitives.
+	 * Returns the SAH cost of the split relative to the range's area.
+	 */
+	Float splitRange(const AABB *bounds, uint32_t *indices, const BuildRange &range,
+			bool median, BuildRange &left, BuildRange &right) {
+		struct Bin {
+			AABB aabb;
+			uint32_t count;
+		};
+
+		const AABB &cb = range.centroidBounds;
+		int bestAxis = -1, bestBin = -1;
+		Float bestCost = std::numeric_limits<Float>::infinity();
+		uint32_t *first = indices + range.begin, *last = indices + range.end, *mid = first;
+
+		if (!median) {
+			Bin bins[MTS_WBVH_BINS];
+			Float rightArea[MTS_WBVH_BINS];
+			uint32_t rightCount[MTS_WBVH_BINS];
+
+			for (int axis=0; axis<3; ++axis) {
+				Float extent = cb.max[axis] - cb.min[axis];
+				if (!(extent > 0))
+					continue;
+				Float binScale = MTS_WBVH_BINS * (1 - Epsilon) / extent;
+
+				for (int b=0; b<MTS_WBVH_BINS; ++b) {
+					bins[b].aabb.reset();
+					bins[b].count = 0;
+				}
+				for (uint32_t *it = first; it != last; ++it) {
+					const AABB &aabb = bounds[*it];
+					int b = std::min((int) ((aabb.getCenter()[axis] - cb.min[axis]) * binScale), MTS_WBVH_BINS - 1);
+					bins[b].aabb.expandBy(aabb);
+					bins[b].count++;
+				}
+
+				/* Sweep from the right, then evaluate the splits from the left */
+				AABB accum;
+				accum.reset();
+				uint32_t count = 0;
+				for (int b=MTS_WBVH_BINS-1; b>0; --b) {
+					accum.expandBy(bins[b].aabb);
+					count += bins[b].count;
+					rightArea[b] = count ? accum.getSurfaceArea() : 0;
+					rightCount[b] = count;
+				}
+
+				accum.reset();
+				count = 0;
+				for (int b=0; b<MTS_WBVH_BINS-1; ++b) {
+					accum.expandBy(bins[b].aabb);
+					count += bins[b].count;
+					if (count == 0 || rightCount[b+1] == 0)
+						continue;
+					Float cost = count * accum.getSurfaceArea() + rightCount[b+1] * rightArea[b+1];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = b;
+					}
+				}
+			}
+
+			if (bestAxis >= 0) {
+				const int axis = bestAxis, split = bestBin;
+				const Float minValue = cb.min[axis];
+				const Float binScale = MTS_WBVH_BINS * (1 - Epsilon) / (cb.max[axis] - cb.min[axis]);
+				mid = std::partition(first, last, [&](uint32_t idx) {
+					return std::min((int) ((bounds[idx].getCenter()[axis] - minValue) * binScale),
+						MTS_WBVH_BINS - 1) <= split;
+				});
+			}
+		}
+
+		if (mid == first || mid == last) {
+			/* Fall back to a median split along the largest centroid extent */
+			int axis = cb.isValid() ? cb.getLargestAxis() : 0;
+			mid = first + range.size() / 2;
+			std::nth_element(first, mid, last, [&](uint32_t a, uint32_t b) {
+				return bounds[a].getCenter()[axis] < bounds[b].getCenter()[axis];
+			});
+			bestCost = std::numeric_limits<Float>::infinity();
+		}
+
+		left.begin = range.begin;
+		left.end = right.begin = (uint32_t) (mid - indices);
+		right.end = range.end;
+		computeBounds(bounds, indices, left);
+		computeBounds(bounds, indices, right);
+
+		Float area = range.bounds.getSurfaceArea();
+		if (std::isfinite(bestCost) && area > 0)
+			return bestCost / area;
+		return std::numeric_limits<Float>::infinity();
+	}
+
+	/// Quantize the child bounds relative to the node bounds (conservatively)
+	template <typename NodeType, int Width> void encodeNode(NodeType &node,
+			const BuildRange *children, int childCount) {
+		AABB bounds;
+		bounds.reset();
+		for (int i=0; i<childCount; ++i)
+			bounds.expandBy(children[i].bounds);
+
+		memset(node.lower, 0xFF, sizeof(node.lower));
+		memset(node.upper, 0, sizeof(node.upper));
+		for (int axis=0; axis<3; ++axis) {
+			const float origin = math::castflt_down(bounds.min[axis]);
+			const double extent = (double) bounds.max[axis] - (double) origin;
+			float scale = 1.0f;
+			if (extent > 0) {
+				int exponent;
+				std::frexp(extent / 255.0, &exponent);
+				scale = std::ldexp(1.0f, exponent);
+			}
+			node.origin[axis] = origin;
+			node.scale[axis] = scale;
+
+			for (int i=0; i<childCount; ++i) {
+				const Float cmin = children[i].bounds.min[axis], cmax = children[i].bounds.max[axis];
+				int lo = std::max(0, std::min(255, (int) std::floor((cmin - origin) / scale)));
+				while (lo > 0 && lo * scale + origin > cmin)
+					--lo;
+				int hi = std::max(0, std::min(255, (int) std::ceil((cmax - origin) / scale)));
+				while (hi < 255 && hi * scale + origin < cmax)
+					++hi;
+				node.lower[axis][i] = (uint8_t) lo;
+				node.upper[axis][i] = (uint8_t) hi;
+			}
+		}
+		node.validMask = (1u << childCount) - 1;
+	}
+}
+
+template <int Width> struct WideBVH<Width>::BuildContext {
+	const AABB *bounds;
+	uint32_t *indices;
+	int maxLeafSize;
+	bool parallel;
+	int maxThreads;
+	std::atomic<int> threads;
+
+	/// Reserve one of the worker threads, if available
+	inline bool acquireThread() {
+		if (threads.fetch_add(1) < maxThreads)
+			return true;
+		--threads;
+		return false;
+	}
+
+	/**
+	 * Build the node covering \c range into \c nodes (the node is
+	 * appended, its children follow) and return the subtree depth
+	 */
+	int buildNode(std::vector<Node> &nodes, const BuildRange &range, int depth) {
+		const uint32_t nodeIndex = (uint32_t) nodes.size();
+		nodes.push_back(Node());
+		memset(&nodes[nodeIndex], 0, sizeof(Node));
+
+		/* Deep subtrees only arise from degenerate input, bound
+		   their depth by splitting at the median (halving per level) */
+		const bool median = depth >= MTS_WBVH_MAXDEPTH - 32;
+
+		/* Repeatedly split the child with the largest surface area */
+		BuildRange children[Width];
+		bool isLeaf[Width];
+		int childCount = 1;
+		children[0] = range;
+		isLeaf[0] = range.size() <= 1;
+
+		while (childCount < Width) {
+			int best = -1;
+			Float bestArea = -1;
+			for (int i=0; i<childCount; ++i) {
+				if (isLeaf[i])
+					continue;
+				Float area = children[i].bounds.getSurfaceArea();
+				if (area > bestArea) {
+					bestArea = area;
+					best = i;
+				}
+			}
+			if (best < 0)
+				break;
+
+			BuildRange left, right;
+			Float cost = splitRange(bounds, indices, children[best], median, left, right);
+			const uint32_t size = children[best].size();
+
+			/* Keep small ranges together if the SAH prefers a leaf */
+			if (size <= (uint32_t) maxLeafSize && 1 + cost >= (Float) size) {
+				/* Undo is unnecessary: the partition of a leaf does not matter */
+				isLeaf[best] = true;
+				continue;
+			}
+
+			children[best] = left;
+			isLeaf[best] = left.size() <= 1;
+			children[childCount] = right;
+			isLeaf[childCount] = right.size() <= 1;
+			++childCount;
+		}
+
+		encodeNode<Node, Width>(nodes[nodeIndex], children, childCount);
+
+		/* Create leaves and recurse into the inner children */
+		int subtreeDepth = 0;
+		std::vector<Node> subtrees[Width];
+		std::thread workers[Width];
+		int workerDepth[Width];
+
+		for (int i=0; i<childCount; ++i) {
+			const BuildRange &child = children[i];
+			if (child.size() <= (uint32_t) maxLeafSize) {
+				nodes[nodeIndex].child[i] = child.begin;
+				nodes[nodeIndex].count[i] = (uint8_t) child.size();
+				continue;
+			}
+
+			if (parallel && child.size() >= MTS_WBVH_PARALLEL_THRESHOLD && acquireThread()) {
+				workers[i] = std::thread([this, &subtrees, &workerDepth, child, depth, i]() {
+					workerDepth[i] = buildNode(subtrees[i], child, depth + 1);
+				});
+			} else {
+				uint32_t childIndex = (uint32_t) nodes.size();
+				subtreeDepth = std::max(subtreeDepth, buildNode(nodes, child, depth + 1));
+				nodes[nodeIndex].child[i] = childIndex;
+			}
+		}
+
+		/* Append the subtrees built in parallel, relocating their node references */
+		for (int i=0; i<childCount; ++i) {
+			if (!workers[i].joinable())
+				continue;
+			workers[i].join();
+			--threads;
+
+			const uint32_t base = (uint32_t) nodes.size();
+			for (size_t j=0; j<subtrees[i].size(); ++j) {
+				Node &node = subtrees[i][j];
+				for (int k=0; k<Width; ++k) {
+					if ((node.validMask & (1u << k)) && node.count[k] == 0)
+						node.child[k] += base;
+				}
+			}
+			nodes.insert(nodes.end(), subtrees[i].begin(), subtrees[i].end());
+			nodes[nodeIndex].child[i] = base;
+			subtreeDepth = std::max(subtreeDepth, workerDepth[i]);
+		}
+
+		return subtreeDepth + 1;
+	}
+};
+
+template <int Width> void WideBVH<Width>::build(const AABB *bounds, uint32_t primCount) {
+	m_nodes.clear();
+	if (primCount == 0) {
+		/* A single node without children */
+		m_nodes.resize(1);
+		memset(&m_nodes[0], 0, sizeof(Node));
+		m_indices.clear();
+		m_aabb.reset();
+		m_depth = 1;
+		return;
+	}
+
+	m_indices.resize(primCount);
+	for (uint32_t i=0; i<primCount; ++i)
+		m_indices[i] = i;
+
+	BuildRange range;
+	range.begin = 0;
+	range.end = primCount;
+	computeBounds(bounds, m_indices.data(), range);
+	m_aabb = range.bounds;
+
+	BuildContext ctx;
+	ctx.bounds = bounds;
+	ctx.indices = m_indices.data();
+	ctx.maxLeafSize = m_maxLeafSize;
+	ctx.parallel = m_parallelBuild;
+	ctx.maxThreads = std::max(0, getCoreCount() - 1);
+	ctx.threads = 0;
+
+	m_depth = ctx.buildNode(m_nodes, range, 0);
+	std::vector<Node>(m_nodes).swap(m_nodes);
+}
+
+template <int Width> AABB WideBVH<Width>::refitNode(const AABB *bounds, uint32_t nodeIndex) {
+	BuildRange children[Width];
+	int childCount = 0;
+
+	/* Children are stored contiguously, see encodeNode() */
+	while (childCount < Width && (m_nodes[nodeIndex].validMask & (1u << childCount))) {
+		const uint32_t child = m_nodes[nodeIndex].child[childCount];
+		const uint32_t count = m_nodes[nodeIndex].count[childCount];
+		AABB &childBounds = children[childCount].bounds;
+		if (count > 0) {
+			childBounds.reset();
+			for (uint32_t i=0; i<count; ++i)
+				childBounds.expandBy(bounds[m_indices[child + i]]);
+		} else {
+			childBounds = refitNode(bounds, child);
+		}
+		++childCount;
+	}
+
+	Node &node = m_nodes[nodeIndex];
+	encodeNode<Node, Width>(node, children, childCount);
+
+	AABB result;
+	result.reset();
+	for (int i=0; i<childCount; ++i)
+		result.expandBy(children[i].bounds);
+	return result;
+}
+
+template <int Width> void WideBVH<Width>::refit(const AABB *bounds) {
+	if (m_indices.empty())
+		return;
+	m_aabb = refitNode(bounds, 0);
+}
+
+template class MTS_EXPORT_RENDER WideBVH<4>;
+template class MTS_EXPORT_RENDER WideBVH<8>;
+
+MTS_NAMESPACE_END
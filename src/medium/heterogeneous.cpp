@@ -42,6 +42,8 @@ static StatsCounter avgRayMarchingStepsSampling("Heterogeneous volume",
 		"Avg. # of ray marching steps (sampling)", EAverage);
 static StatsCounter earlyExits("Heterogeneous volume",
 		"Number of early exits", EPercentage);
+static StatsCounter avgTentativeCollisions("Heterogeneous volume",
+		"Avg. # of tentative collisions (Woodcock tracking)", EAverage);
 #endif
 
 /*!\plugin{heterogeneous}{Heterogeneous participating medium}
@@ -81,6 +83,11 @@ static StatsCounter earlyExits("Heterogeneous volume",
  *         Provided for convenience when accomodating data based on different units,
  *         or to simply tweak the density of the medium. \default{1}
  *     }
+ *     \parameter{majorantResolution}{\Integer}{
+ *         Resolution of the coarse grid of local density maxima used by
+ *         Woodcock tracking along the longest axis of the medium. A value
+ *         of \code{1} uses a single global maximum. \default{16}
+ *     }
  *     \parameter{\Unnamed}{\Phase}{
  *          A nested phase function that describes the directional
  *          scattering properties of the medium. When none is specified,
@@ -184,6 +191,9 @@ public:
 		: Medium(props) {
 		m_stepSize = props.getFloat("stepSize", 0);
 		m_scale = props.getFloat("scale", 1);
+		m_majorantResolution = props.getInteger("majorantResolution", 16);
+		if (m_majorantResolution < 1)
+			Log(EError, "The majorant grid resolution must be at least 1!");
 		if (props.hasProperty("sigmaS") || props.hasProperty("sigmaA"))
 			Log(EError, "The 'sigmaS' and 'sigmaA' properties are only supported by "
 				"homogeneous media. Please use nested volume instances to supply "
@@ -210,6 +220,7 @@ public:
 		m_albedo = static_cast<VolumeDataSource *>(manager->getInstance(stream));
 		m_orientation = static_cast<VolumeDataSource *>(manager->getInstance(stream));
 		m_stepSize = stream->readFloat();
+		m_majorantResolution = stream->readInt();
 		configure();
 	}
 
@@ -222,6 +233,7 @@ public:
 		manager->serialize(stream, m_albedo.get());
 		manager->serialize(stream, m_orientation.get());
 		stream->writeFloat(m_stepSize);
+		stream->writeInt(m_majorantResolution);
 	}
 
 	void configure() {
@@ -234,12 +246,7 @@ public:
 		m_anisotropicMedium =
 			m_phaseFunction->needsDirectionallyVaryingCoefficients();
 
-		/* Assumes that the density medium does not
-		   contain values greater than one! */
-		m_maxDensity = m_scale * m_density->getMaximumFloatValue();
-		if (m_anisotropicMedium)
-			m_maxDensity *= m_phaseFunction->sigmaDirMax();
-		m_invMaxDensity = 1.0f/m_maxDensity;
+		buildMajorantGrid();
 
 		if (m_stepSize == 0) {
 			m_stepSize = std::min(
@@ -259,6 +266,160 @@ public:
 				"did not specify a particle orientation field!");
 	}
 
+	/**
+	 * Build a coarse grid of local density maxima over the bounds of the
+	 * density volume. Woodcock tracking uses these local majorants instead
+	 * of a single global one, so that it only needs a few tentative
+	 * collisions to cross thin parts of the medium.
+	 */
+	void buildMajorantGrid() {
+		Float factor = m_scale;
+		if (m_anisotropicMedium)
+			factor *= m_phaseFunction->sigmaDirMax();
+
+		const Vector extents = m_densityAABB.getExtents();
+		const Float maxExtent = std::max(std::max(extents.x, extents.y), extents.z);
+		if (!m_densityAABB.isValid() || !std::isfinite(maxExtent) || maxExtent == 0) {
+			m_majorantRes = Vector3i(1);
+			m_majorantCellSize = m_invMajorantCellSize = Vector(0.0f);
+			m_majorants.assign(1, factor * m_density->getMaximumFloatValue());
+			return;
+		}
+
+		for (int i=0; i<3; ++i) {
+			m_majorantRes[i] = std::max(1, (int) std::ceil(
+				m_majorantResolution * extents[i] / maxExtent - Epsilon));
+			m_majorantCellSize[i] = extents[i] / m_majorantRes[i];
+			m_invMajorantCellSize[i] = extents[i] > 0 ? m_majorantRes[i] / extents[i] : 0;
+		}
+
+		m_majorants.resize((size_t) m_majorantRes.x * m_majorantRes.y * m_majorantRes.z);
+		Float maxMajorant = 0, avgMajorant = 0;
+		for (int z=0, index=0; z<m_majorantRes.z; ++z) {
+			for (int y=0; y<m_majorantRes.y; ++y) {
+				for (int x=0; x<m_majorantRes.x; ++x, ++index) {
+					const Point min = m_densityAABB.min + Vector(
+						x * m_majorantCellSize.x, y * m_majorantCellSize.y,
+						z * m_majorantCellSize.z);
+					const AABB cell(min, min + m_majorantCellSize);
+					const Float majorant = factor * m_density->getLocalMaximumFloatValue(cell);
+					m_majorants[index] = majorant;
+					maxMajorant = std::max(maxMajorant, majorant);
+					avgMajorant += majorant;
+				}
+			}
+		}
+		avgMajorant /= m_majorants.size();
+
+		Log(EDebug, "Built a %ix%ix%i majorant grid (max. density = %f, average majorant = %f)",
+			m_majorantRes.x, m_majorantRes.y, m_majorantRes.z, maxMajorant, avgMajorant);
+	}
+
+	/**
+	 * Walk the cells of the majorant grid along the segment
+	 * [mint, maxt] of a ray using a 3D-DDA. The functor is invoked
+	 * as <tt>functor(t0, t1, majorant)</tt> for every cell that is
+	 * pierced by the segment, until it returns \c false.
+	 */
+	template <typename Functor> void traverseMajorants(const Ray &ray,
+			Float mint, Float maxt, Functor &functor) const {
+		if (m_majorants.size() == 1) {
+			functor(mint, maxt, m_majorants[0]);
+			return;
+		}
+
+		const Point p = ray(mint);
+		int cell[3], step[3], limit[3];
+		Float tNext[3], tDelta[3];
+		for (int i=0; i<3; ++i) {
+			cell[i] = math::clamp(math::floorToInt((p[i] - m_densityAABB.min[i])
+				* m_invMajorantCellSize[i]), 0, m_majorantRes[i] - 1);
+			if (ray.d[i] > 0) {
+				step[i] = 1; limit[i] = m_majorantRes[i];
+				tNext[i] = mint + (m_densityAABB.min[i] + (cell[i] + 1)
+					* m_majorantCellSize[i] - p[i]) * ray.dRcp[i];
+				tDelta[i] = m_majorantCellSize[i] * ray.dRcp[i];
+			} else if (ray.d[i] < 0) {
+				step[i] = -1; limit[i] = -1;
+				tNext[i] = mint + (m_densityAABB.min[i] + cell[i]
+					* m_majorantCellSize[i] - p[i]) * ray.dRcp[i];
+				tDelta[i] = -m_majorantCellSize[i] * ray.dRcp[i];
+			} else {
+				step[i] = 0; limit[i] = -1;
+				tNext[i] = tDelta[i] = std::numeric_limits<Float>::infinity();
+			}
+		}
+
+		Float t = mint;
+		while (true) {
+			int axis = (tNext[0] < tNext[1])
+				? (tNext[0] < tNext[2] ? 0 : 2)
+				: (tNext[1] < tNext[2] ? 1 : 2);
+			const Float t1 = std::min(std::max(tNext[axis], t), maxt);
+			const Float majorant = m_majorants[
+				(cell[2] * m_majorantRes.y + cell[1]) * m_majorantRes.x + cell[0]];
+			if (!functor(t, t1, majorant) || t1 >= maxt)
+				return;
+			t = t1;
+			cell[axis] += step[axis];
+			if (cell[axis] == limit[axis])
+				return;
+			tNext[axis] += tDelta[axis];
+		}
+	}
+
+	/**
+	 * Woodcock tracking through the majorant grid: returns \c true and
+	 * the position of the first real collision along [mint, maxt], or
+	 * \c false if the segment is crossed without a collision. The
+	 * \c sampling flag only selects the statistics counter for the
+	 * visited majorant cells (distance sampling vs. transmittance).
+	 */
+	bool trackCollision(const Ray &ray, Float mint, Float maxt,
+			Sampler *sampler, Float &t, Float &densityAtT, bool sampling) const {
+		Float tau = -math::fastlog(1-sampler->next1D());
+		bool collided = false;
+		size_t cells = 0;
+
+		auto functor = [&](Float t0, Float t1, Float majorant) -> bool {
+			Float tCur = t0;
+			++cells;
+			while (true) {
+				/* Skip the remainder of the cell if the next tentative
+				   collision lies beyond it */
+				const Float cellDensity = majorant * (t1 - tCur);
+				if (tau >= cellDensity) {
+					tau -= cellDensity;
+					return true;
+				}
+				tCur += tau / majorant;
+				const Float density = lookupDensity(ray(tCur), ray.d) * m_scale;
+				#if defined(HETVOL_STATISTICS)
+					++avgTentativeCollisions;
+				#endif
+				if (density > majorant * sampler->next1D()) {
+					t = tCur;
+					densityAtT = density;
+					collided = true;
+					return false;
+				}
+				tau = -math::fastlog(1-sampler->next1D());
+			}
+		};
+
+		traverseMajorants(ray, mint, maxt, functor);
+
+		#if defined(HETVOL_STATISTICS)
+			avgTentativeCollisions.incrementBase();
+			/* Each visited majorant cell is one step of the traversal */
+			StatsCounter &steps = sampling ? avgRayMarchingStepsSampling
+				: avgRayMarchingStepsTransmittance;
+			steps.incrementBase();
+			steps += cells;
+		#endif
+		return collided;
+	}
+
 	void addChild(const std::string &name, ConfigurableObject *child) {
 		if (child->getClass()->derivesFrom(MTS_CLASS(VolumeDataSource))) {
 			VolumeDataSource *volume = static_cast<VolumeDataSource *>(child);
@@ -556,31 +717,13 @@ public:
 			mint = std::max(mint, ray.mint);
 			maxt = std::min(maxt, ray.maxt);
 
-			#if defined(HETVOL_STATISTICS)
-				avgRayMarchingStepsTransmittance.incrementBase();
-			#endif
 			int nSamples = 2; /// XXX make configurable
 			Float result = 0;
 
 			for (int i=0; i<nSamples; ++i) {
-				Float t = mint;
-				while (true) {
-					t -= math::fastlog(1-sampler->next1D()) * m_invMaxDensity;
-					if (t >= maxt) {
-						result += 1;
-						break;
-					}
-
-					Point p = ray(t);
-					Float density = lookupDensity(p, ray.d) * m_scale;
-
-					#if defined(HETVOL_STATISTICS)
-						++avgRayMarchingStepsTransmittance;
-					#endif
-
-					if (density * m_invMaxDensity > sampler->next1D())
-						break;
-				}
+				Float t, density;
+				if (!trackCollision(ray, mint, maxt, sampler, t, density, false))
+					result += 1;
 			}
 			return Spectrum(result/nSamples);
 		}
@@ -619,42 +762,27 @@ public:
 			mRec.transmittance = Spectrum(1.0f);
 			mRec.time = ray.time;
 
-			#if defined(HETVOL_STATISTICS)
-				avgRayMarchingStepsSampling.incrementBase();
-			#endif
-
 			Float mint, maxt;
 			if (!m_densityAABB.rayIntersect(ray, mint, maxt))
 				return false;
 			mint = std::max(mint, ray.mint);
 			maxt = std::min(maxt, ray.maxt);
 
-			Float t = mint, densityAtT = 0;
-			while (true) {
-				t -= math::fastlog(1-sampler->next1D()) * m_invMaxDensity;
-				if (t >= maxt)
-					break;
-
+			Float t, densityAtT;
+			if (mint < maxt && trackCollision(ray, mint, maxt, sampler, t, densityAtT, true)) {
 				Point p = ray(t);
-				densityAtT = lookupDensity(p, ray.d) * m_scale;
-				#if defined(HETVOL_STATISTICS)
-					++avgRayMarchingStepsSampling;
-				#endif
-				if (densityAtT * m_invMaxDensity > sampler->next1D()) {
-					mRec.t = t;
-					mRec.p = p;
-					Spectrum albedo = m_albedo->lookupSpectrum(p);
-					mRec.sigmaS = albedo * densityAtT;
-					mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
-					mRec.transmittance = Spectrum(densityAtT != 0.0f ? 1.0f / densityAtT : 0);
-					if (!std::isfinite(mRec.transmittance[0])) // prevent rare overflow warnings
-						mRec.transmittance = Spectrum(0.0f);
-					mRec.orientation = m_orientation != NULL
-						? m_orientation->lookupVector(p) : Vector(0.0f);
-					mRec.medium = this;
-					success = true;
-					break;
-				}
+				mRec.t = t;
+				mRec.p = p;
+				Spectrum albedo = m_albedo->lookupSpectrum(p);
+				mRec.sigmaS = albedo * densityAtT;
+				mRec.sigmaA = Spectrum(densityAtT) - mRec.sigmaS;
+				mRec.transmittance = Spectrum(densityAtT != 0.0f ? 1.0f / densityAtT : 0);
+				if (!std::isfinite(mRec.transmittance[0])) // prevent rare overflow warnings
+					mRec.transmittance = Spectrum(0.0f);
+				mRec.orientation = m_orientation != NULL
+					? m_orientation->lookupVector(p) : Vector(0.0f);
+				mRec.medium = this;
+				success = true;
 			}
 		}
 		mRec.medium = this;
@@ -701,7 +829,8 @@ public:
 			<< "  albedo = " << indent(m_albedo.toString()) << "," << endl
 			<< "  orientation = " << indent(m_orientation.toString()) << "," << endl
 			<< "  stepSize = " << m_stepSize << "," << endl
-			<< "  scale = " << m_scale << endl
+			<< "  scale = " << m_scale << "," << endl
+			<< "  majorantResolution = " << m_majorantResolution << endl
 			<< "]";
 		return oss.str();
 	}
@@ -728,8 +857,11 @@ protected:
 	bool m_anisotropicMedium;
 	Float m_stepSize;
 	AABB m_densityAABB;
-	Float m_maxDensity;
-	Float m_invMaxDensity;
+	int m_majorantResolution;
+	Vector3i m_majorantRes;
+	Vector m_majorantCellSize;
+	Vector m_invMajorantCellSize;
+	std::vector<Float> m_majorants;
 };
 
 MTS_IMPLEMENT_CLASS_S(HeterogeneousMedium, false, Medium)
@@ -3,12 +3,15 @@
 #include <mitsuba/render/integrator2.h>
 #include <mitsuba/render/sampler.h>
 #include <mitsuba/render/imageblock.h>
+#include <mitsuba/render/splattiles.h>
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/thread.h>
+#include <mitsuba/core/workerpool.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/sse.h>
 #include <cstdlib>
 
 int ProcessConfig::recommendedThreads() {
@@ -32,6 +35,8 @@ void register_mitsuba_thread(mitsuba::Thread* parent, char const* name = "im-mts
 #include <random>
 #include <algorithm>
 #include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #define ATOMIC_SPLAT
 #define CORES_PER_FRAMEBUFFER 8
@@ -45,8 +50,11 @@ namespace impl {
 		mitsuba::ref_vector<mitsuba::Sampler> samplers;
 		mitsuba::ref_vector<mitsuba::ImageBlock> framebuffers;
 		std::vector<float volatile*> frambufferData;
+		// deferred splatting: framebuffers are per-thread views of one shared block
+		mitsuba::ref<mitsuba::SplatTiles> splatTiles;
 
-		mitsuba::ref_vector<mitsuba::Thread> workers;
+		// persistent workers, parked between renders
+		mitsuba::ref<mitsuba::WorkerPool> workers;
 
 		double lastWriteSpp = 0.0f;
 
@@ -69,15 +77,29 @@ namespace impl {
 
 			this->samplerPrototype = sampler;
 			this->samplers.resize(maxThreads);
+			this->workers = new mitsuba::WorkerPool("interactive", maxThreads, true);
 
 			mitsuba::Vector2i filmSize = scene->getFilm()->getSize();
-			{
+			// adaptive sampling: varying sample counts per pixel, normalized by the weight channel
+			// (note: loses the 4-channel fast path of atomic splatting)
+			mitsuba::Bitmap::EPixelFormat pixelFormat = integrator->isAdaptive()
+				? mitsuba::Bitmap::ESpectrumAlphaWeight : mitsuba::Bitmap::ESpectrumAlpha;
+			if (config.splatTiles > 0) {
+				mitsuba::ref<mitsuba::ImageBlock> shared = new mitsuba::ImageBlock(pixelFormat, filmSize, scene->getFilm()->getReconstructionFilter());
+				this->splatTiles = new mitsuba::SplatTiles(shared, maxThreads, config.splatTiles);
+				this->framebuffers.resize(maxThreads);
+				for (int i = 0; i < maxThreads; ++i)
+					framebuffers[i] = new mitsuba::ImageBlock(shared, splatTiles, i);
+				this->uniqueTargets = 1;
+				SLog(mitsuba::EInfo, "Deferred splatting through %s of tile storage", mitsuba::memString(splatTiles->getMemoryUsage()).c_str());
+			}
+			else {
 				this->framebuffers.resize(maxThreads);
 #ifdef ATOMIC_SPLAT
 				this->uniqueTargets = 0;
 				for (int i = 0; i < maxThreads; ++i) {
 					if (i % CORES_PER_FRAMEBUFFER == 0) {
-						framebuffers[i] = new mitsuba::ImageBlock(mitsuba::Bitmap::ESpectrumAlpha, filmSize, scene->getFilm()->getReconstructionFilter());
+						framebuffers[i] = new mitsuba::ImageBlock(pixelFormat, filmSize, scene->getFilm()->getReconstructionFilter());
 						++this->uniqueTargets;
 					}
 					else
@@ -85,7 +107,7 @@ namespace impl {
 				}
 #else
 				for (int i = 0; i < maxThreads; ++i)
-					framebuffers[i] = new mitsuba::ImageBlock(mitsuba::Bitmap::ESpectrumAlpha, filmSize, scene->getFilm()->getReconstructionFilter());
+					framebuffers[i] = new mitsuba::ImageBlock(pixelFormat, filmSize, scene->getFilm()->getReconstructionFilter());
 				this->uniqueTargets = maxThreads;
 #endif
 			}
@@ -107,12 +129,19 @@ namespace impl {
 			this->numActiveThreads = numThreads;
 			this->lastWriteSpp = 0.0f;
 			
+			if (splatTiles) {
+				splatTiles->clear();
+				splatTiles->getTarget()->clear();
+			}
 #ifdef ATOMIC_SPLAT
-			for (int i = 0; i < numThreads; ++i)
-				if (i % CORES_PER_FRAMEBUFFER == 0)
-					framebuffers[i]->clear();
+			else {
+				for (int i = 0; i < numThreads; ++i)
+					if (i % CORES_PER_FRAMEBUFFER == 0)
+						framebuffers[i]->clear();
+			}
 #endif
 
+			integrator->reset();
 			mitsuba::Statistics::getInstance()->resetAll();
 
 			volatile int returnCode = 0;
@@ -123,7 +152,7 @@ namespace impl {
 				mitsuba::ImageBlock* block = this->framebuffers[tid];
 				double volatile& spp = imageSamples[tid];
 
-				if (initialRun) {
+				if (initialRun && !this->splatTiles) {
 #ifndef ATOMIC_SPLAT
 					block->clear();
 #endif
@@ -147,9 +176,13 @@ namespace impl {
 
 					int progress(mitsuba::ResponsiveIntegrator* integrator, const mitsuba::Scene &scene, const mitsuba::Sensor &sensor, mitsuba::Sampler &sampler, mitsuba::ImageBlock& target, double spp
 						, mitsuba::ResponsiveIntegrator::Controls controls, int threadIdx, int threadCount) override {
+						// keep deferred splats in step with the published sample count
+						target.syncSplats();
 						if (spp) {
 							m.imageDataTarget = m.imageData;
 							m.sppTarget = spp;
+							if (m.proc->workers->notifyFirstSample())
+								m.proc->restartLatency = m.proc->workers->getFirstSampleLatency();
 						}
 						// max spp reached
 						if (spp * threadCount >= (double) m.maxSpp) {
@@ -165,6 +198,9 @@ namespace impl {
 							}
 							// intermediate output
 							else if (threadIdx == 0 && timer->getSecondsSinceStart() >= m.flushTimer) {
+								// merge the splats of all threads, not only our own slot
+								if (mitsuba::SplatTiles* tiles = target.getSplatTiles())
+									tiles->flushAll();
 								timer->stop();
 								m.proc->develop(&m.sppTarget, threadCount, totalTime, true);
 								timer->start();
@@ -191,60 +227,101 @@ namespace impl {
 				// end of parallel execution
 			};
 
+			if (backgroundDevelop && flushTimer > 0 && !developThread.joinable())
+				developThread = std::thread(runDeveloper, this, mitsuba::Thread::getThread());
+
 			// build on mitsuba infrastructure instead of OpenMP b/c for classic mitsuba thread-local support etc.
-			if (numThreads > (int) workers.size())
-				workers.resize(numThreads);
-			for (int i = 0; i < numThreads; ++i) {
-				typedef decltype(parallel_execution) par_exe;
-				struct Thread : mitsuba::Thread {
-					int tid;
-					par_exe* parallel_execution;
-					Thread(int tid, par_exe* parallel_execution)
-						: mitsuba::Thread("interactive")
-						, tid(tid)
-						, parallel_execution(parallel_execution) { setCoreAffinity(tid); }
-					void run() override {
-						(*parallel_execution)(tid);
-					}
-				};
-				if (auto* w = workers[i].get())
-					((Thread*) w)->parallel_execution = &parallel_execution;
-				else
-					workers[i] = new Thread(i, &parallel_execution);
-			}
+			this->restartLatency = -1.0;
+			workers->run(parallel_execution, numThreads);
+			waitForDevelop();
+			if (splatTiles)
+				splatTiles->flushAll();
+			SLog(mitsuba::EDebug, "Workers awake after %.3f ms, first sample after %.3f ms"
+				, (double) workers->getWakeupLatency(), (double) workers->getFirstSampleLatency());
+		}
 
+		// develop: reused, double-buffered merge targets; index of the buffer
+		// being written by / pending for the background developer, or -1
+		mitsuba::ref<mitsuba::Bitmap> developBuffers[2];
+		int developIndex = -1, pendingIndex = -1;
+		double pendingSpp = 0.0;
+		long long pendingMilliseconds = 0;
+		bool developShutdown = false;
+		std::mutex developMutex;
+		std::condition_variable developCondition;
+		std::thread developThread;
+
+		~InteractiveSceneProcess() {
+			if (developThread.joinable()) {
+				{
+					std::lock_guard<std::mutex> lock(developMutex);
+					developShutdown = true;
+				}
+				developCondition.notify_all();
+				developThread.join();
+			}
+		}
 
-			for (int i = 0; i < numThreads; ++i) {
-				workers[i]->start();
+		// dest[i] = scale * sum_k sources[k][i]
+		static void mergeScaled(float* dest, float volatile const* const* sources, int sourceCount, size_t count, float scale) {
+			size_t i = 0;
+#ifdef MTS_SSE
+			__m128 s = _mm_set1_ps(scale);
+			for (; i + 8 <= count; i += 8) {
+				__m128 a = _mm_loadu_ps((float const*) sources[0] + i);
+				__m128 b = _mm_loadu_ps((float const*) sources[0] + i + 4);
+				for (int k = 1; k < sourceCount; ++k) {
+					a = _mm_add_ps(a, _mm_loadu_ps((float const*) sources[k] + i));
+					b = _mm_add_ps(b, _mm_loadu_ps((float const*) sources[k] + i + 4));
+				}
+				_mm_storeu_ps(dest + i, _mm_mul_ps(a, s));
+				_mm_storeu_ps(dest + i + 4, _mm_mul_ps(b, s));
 			}
-			for (int i = numThreads; i-- > 0; ) {
-				workers[i]->join();
+#endif
+			for (; i < count; ++i) {
+				float sum = sources[0][i];
+				for (int k = 1; k < sourceCount; ++k)
+					sum += sources[k][i];
+				dest[i] = sum * scale;
 			}
 		}
 
-		void develop(const volatile double* spps, int numThreads, long long milliseconds = 0, bool flush = false) {
-			double spp = 0.0f;
-			for (int i = 0; i < numThreads; ++i)
-				spp += spps[i];
-			SLog(mitsuba::EInfo, "SPP: %lf", spp);
-			if (milliseconds)
-				SLog(mitsuba::EInfo, "Milliseconds: %lld", milliseconds);
-
-//			if (intermediate && !(spp > 512.0f && spp > lastWriteSpp * 1.5f))
-//				return;
+		// merge all framebuffers into the given develop buffer, normalized by spp
+		mitsuba::Bitmap* mergeFramebuffers(int bufferIdx, double spp, int numThreads) {
+			mitsuba::ImageBlock* first = splatTiles ? splatTiles->getTarget() : framebuffers[0].get();
+			mitsuba::Bitmap* source = first->getBitmap();
+			mitsuba::Vector2i size = scene->getFilm()->getCropSize();
+			mitsuba::ref<mitsuba::Bitmap>& dest = developBuffers[bufferIdx];
+			if (!dest || dest->getSize() != size)
+				dest = new mitsuba::Bitmap(source->getPixelFormat(), mitsuba::Bitmap::EFloat, size, source->getChannelCount());
+
+			std::vector<float volatile const*> sources;
+			if (splatTiles)
+				sources.push_back(source->getFloatData());
+			else {
+				for (int i = 0; i < numThreads; ++i)
+					if (i == 0 || framebuffers[i].get() != framebuffers[i - 1].get())
+						sources.push_back(framebuffers[i]->getBitmap()->getFloatData());
+			}
 
-			mitsuba::ref<mitsuba::ImageBlock> developBuffer = new mitsuba::ImageBlock(
-				  mitsuba::Bitmap::ESpectrumAlpha, scene->getFilm()->getCropSize());
-			developBuffer->clear();
-			for (int i = 0; i < numThreads; ++i)
-				if (i % CORES_PER_FRAMEBUFFER == 0)
-					developBuffer->put(framebuffers[i]);
-			float* data = developBuffer->getBitmap()->getFloatData();
-			for (size_t i = 0, ie = developBuffer->getBitmap()->getPixelCount() * developBuffer->getBitmap()->getChannelCount(); i < ie; ++i) {
-				*data = float(*data / spp);
-				++data;
+			// skip the filter border of the framebuffers
+			int channels = source->getChannelCount(), border = first->getBorderSize();
+			size_t sourceStride = (size_t) source->getWidth() * channels;
+			size_t rowOffset = (size_t) border * sourceStride + (size_t) border * channels;
+			size_t rowCount = (size_t) std::min(size.x, source->getWidth() - 2 * border) * channels;
+			std::vector<float volatile const*> rows(sources.size());
+			float scale = spp > 0.0 ? float(1.0 / spp) : 0.0f;
+			for (int y = 0, ye = std::min(size.y, source->getHeight() - 2 * border); y < ye; ++y) {
+				for (size_t k = 0; k < sources.size(); ++k)
+					rows[k] = sources[k] + rowOffset + y * sourceStride;
+				mergeScaled(dest->getFloatData() + (size_t) y * size.x * channels, rows.data(), (int) rows.size(), rowCount, scale);
 			}
-			scene->getFilm()->setBitmap(developBuffer->getBitmap());
+			return dest;
+		}
+
+		// hand the merged buffer to the film and optionally write it out
+		void developBitmap(mitsuba::Bitmap* bitmap, double spp, long long milliseconds, bool flush) {
+			scene->getFilm()->setBitmap(bitmap);
 
 			if (flush) {
 				fs::pathstr destFile;
@@ -266,6 +343,77 @@ namespace impl {
 			}
 		}
 
+		static void runDeveloper(InteractiveSceneProcess* proc, mitsuba::Thread* parentThread) {
+			register_mitsuba_thread(parentThread, "im-develop");
+			std::unique_lock<std::mutex> lock(proc->developMutex);
+			while (true) {
+				proc->developCondition.wait(lock, [proc]() { return proc->developShutdown || proc->pendingIndex >= 0; });
+				if (proc->developShutdown)
+					break;
+				proc->developIndex = proc->pendingIndex;
+				proc->pendingIndex = -1;
+				double spp = proc->pendingSpp;
+				long long milliseconds = proc->pendingMilliseconds;
+				lock.unlock();
+
+				try {
+					proc->developBitmap(proc->developBuffers[proc->developIndex], spp, milliseconds, true);
+				} catch (const std::exception& e) {
+					SLog(mitsuba::EWarn, "Background develop failed: %s", e.what());
+				}
+
+				lock.lock();
+				proc->developIndex = -1;
+				proc->developCondition.notify_all();
+			}
+		}
+
+		// wait until all queued intermediate output has been written
+		void waitForDevelop() {
+			std::unique_lock<std::mutex> lock(developMutex);
+			developCondition.wait(lock, [this]() { return pendingIndex < 0 && developIndex < 0; });
+		}
+
+		void develop(const volatile double* spps, int numThreads, long long milliseconds = 0, bool flush = false) {
+			double spp = 0.0f;
+			for (int i = 0; i < numThreads; ++i)
+				spp += spps[i];
+			SLog(mitsuba::EInfo, "SPP: %lf", spp);
+			if (milliseconds)
+				SLog(mitsuba::EInfo, "Milliseconds: %lld", milliseconds);
+
+//			if (intermediate && !(spp > 512.0f && spp > lastWriteSpp * 1.5f))
+//				return;
+
+			mitsuba::ref<mitsuba::Timer> timer = new mitsuba::Timer();
+			if (flush && developThread.joinable()) {
+				// snapshot into the buffer not currently written by the developer,
+				// replacing any request it has not picked up yet
+				int bufferIdx;
+				{
+					std::lock_guard<std::mutex> lock(developMutex);
+					pendingIndex = -1;
+					bufferIdx = developIndex == 0 ? 1 : 0;
+				}
+				mergeFramebuffers(bufferIdx, spp, numThreads);
+				{
+					std::lock_guard<std::mutex> lock(developMutex);
+					pendingIndex = bufferIdx;
+					pendingSpp = spp;
+					pendingMilliseconds = milliseconds;
+				}
+				developCondition.notify_all();
+				SLog(mitsuba::EDebug, "Queued intermediate output after %u ms of merging", timer->getMilliseconds());
+				return;
+			}
+
+			waitForDevelop();
+			mitsuba::Bitmap* bitmap = mergeFramebuffers(0, spp, numThreads);
+			unsigned mergeTime = timer->getMilliseconds();
+			developBitmap(bitmap, spp, milliseconds, flush);
+			SLog(mitsuba::EDebug, "Developed in %u ms (merge: %u ms)", timer->getMilliseconds(), mergeTime);
+		}
+
 		void render(int numThreads) override {
 			scene->getFilm()->setDestinationFile(scene->getDestinationFile(), scene->getBlockSize());
 			scene->preprocess(nullptr, nullptr, -1, -1, -1); // todo: this might crash for more advanced subsurf integrators ...?
@@ -3,6 +3,8 @@
 struct ProcessConfig {
 	int concurrentAtomic = 32;
 	int maxThreads = -1;
+	/// Tiles per thread for contention-free deferred splatting, 0 splats atomically into shared framebuffers
+	int splatTiles = 0;
 
 	static int recommendedThreads();
 	static ProcessConfig resolveDefaults(ProcessConfig const& cfg);
@@ -17,10 +19,14 @@ struct InteractiveSceneProcess {
 
 	float volatile *volatile *imageData;
 	int numActiveThreads;
+	/// Milliseconds from the last (re)start until the first sample arrived, negative while pending
+	double volatile restartLatency = -1.0;
 
 	int timeout = -1;
 	int flushTimer = -1;
 	int writeProgression = false;
+	/// Write intermediate output on a background thread instead of stalling worker 0
+	bool backgroundDevelop = false;
 
 	static InteractiveSceneProcess* create(mitsuba::Scene* scene, mitsuba::Sampler* sampler, mitsuba::ResponsiveIntegrator* integrator, ProcessConfig const& config);
 	static InteractiveSceneProcess* create(mitsuba::Scene* scene, mitsuba::Sampler* sampler, mitsuba::Integrator* integrator, ProcessConfig const& config);
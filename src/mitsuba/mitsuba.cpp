@@ -78,6 +78,11 @@ void help() {
 	cout <<  "   -r sec      Write (partial) output images every 'sec' seconds" << endl << endl;
 	cout <<  "   -C          Force classic mitsuba render job scheduling / code paths" << endl << endl;
 	cout <<  "   -S          Write progressive sequence of images to separate files" << endl << endl;
+	cout <<  "   -W          Let local workers generate work in batches and steal work from" << endl;
+	cout <<  "               each other instead of sharing one queue (reduces contention on" << endl;
+	cout <<  "               machines with many cores)" << endl << endl;
+	cout <<  "   -T fname    Append a JSON snapshot of the statistics to \"fname\" every" << endl;
+	cout <<  "               second while rendering (one object per line)" << endl << endl;
 	cout <<  "   -b res      Specify the block resolution used to split images into parallel" << endl;
 	cout <<  "               workloads (default: 32). Only applies to some integrators." << endl << endl;
 	cout <<  "   -v          Be more verbose (can be specified twice)" << endl << endl;
@@ -146,6 +151,8 @@ int mitsuba_app(int argc, char*const* argv) {
 		int flushTimer = -1;
 		bool classicRendering = false;
 		bool saveProgression = false;
+		bool workStealing = false;
+		std::string statsFile = "";
 
 		if (argc < 2) {
 			help();
@@ -154,7 +161,7 @@ int mitsuba_app(int argc, char*const* argv) {
 
 		optind = 1;
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:p:L:qhzvtwxCS")) != -1) {
+		while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:p:L:T:qhzvtwxCSW")) != -1) {
 			switch (optchar) {
 				case 'a': {
 						std::vector<std::string> paths = tokenize(optarg, ";");
@@ -194,6 +201,12 @@ int mitsuba_app(int argc, char*const* argv) {
 					saveProgression = true;
 					break;
 				}
+				case 'T':
+					statsFile = optarg;
+					break;
+				case 'W':
+					workStealing = true;
+					break;
 				case 'n':
 					nodeName = optarg;
 					break;
@@ -336,6 +349,7 @@ int mitsuba_app(int argc, char*const* argv) {
 			}
 		}
 
+		scheduler->setWorkStealing(workStealing);
 		scheduler->start();
 
 #if !defined(__WINDOWS__)
@@ -362,6 +376,9 @@ int mitsuba_app(int argc, char*const* argv) {
 			flushThread->start();
 		}
 
+		if (!statsFile.empty())
+			Statistics::getInstance()->startRecording(fs::pathstr(statsFile));
+
 		int jobIdx = 0;
 		for (int i=optind; i<argc; ++i) {
 			fs::path
@@ -384,9 +401,17 @@ int mitsuba_app(int argc, char*const* argv) {
 			if (scene->destinationExists() && skipExisting)
 				continue;
 
+			ProcessConfig processConfig;
+			{
+				const Properties &iprops = scene->getIntegrator()->getProperties();
+				if (iprops.hasProperty("splatTiles") && !iprops.wasQueried("splatTiles")) {
+					processConfig.splatTiles = iprops.getInteger("splatTiles");
+					SLog(EInfo, "Deferring splats through %i tiles per thread from unused integrator property", processConfig.splatTiles);
+				}
+			}
 			std::unique_ptr<InteractiveSceneProcess> ithr(
 				classicRendering ? nullptr :
-				InteractiveSceneProcess::create(scene, scene->getSampler(), scene->getIntegrator(), ProcessConfig())
+				InteractiveSceneProcess::create(scene, scene->getSampler(), scene->getIntegrator(), processConfig)
 			);
 			if (ithr) {
 				SLog(EInfo, "Using responsive integrator interface");
@@ -396,6 +421,10 @@ int mitsuba_app(int argc, char*const* argv) {
 					SLog(EInfo, "Setting timeout of %i s from unused integrator property", ithr->timeout);
 				}
 				ithr->flushTimer = flushTimer;
+				if (iprops.hasProperty("backgroundDevelop") && !iprops.wasQueried("backgroundDevelop")) {
+					ithr->backgroundDevelop = iprops.getBoolean("backgroundDevelop");
+					SLog(EInfo, "Setting background develop to %s from unused integrator property", ithr->backgroundDevelop ? "on" : "off");
+				}
 				ithr->writeProgression = saveProgression;
 				ithr->render();
 			}
@@ -417,7 +446,9 @@ int mitsuba_app(int argc, char*const* argv) {
 			flushThread->quit();
 		renderQueue = NULL;
 
+		Statistics::getInstance()->stopRecording();
 		Statistics::getInstance()->printStats();
+		SLog(workStealing ? EInfo : EDebug, "%s", scheduler->getWorkerStatisticsString().c_str());
 	} catch (const std::exception &e) {
 		std::cerr << "Caught a critical exception: " << e.what() << endl;
 		return -1;
@@ -110,7 +110,7 @@ int mtssrv(int argc, char **argv) {
 
 		optind = 1;
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "a:c:s:n:p:i:l:L:qhv")) != -1) {
+		while ((optchar = getopt(argc, argv, "a:c:C:s:n:p:i:l:L:qhv")) != -1) {
 			switch (optchar) {
 				case 'a': {
 						std::vector<std::string> paths = tokenize(optarg, ";");
@@ -121,6 +121,13 @@ int mtssrv(int argc, char **argv) {
 				case 'c':
 					networkHosts = networkHosts + std::string(";") + std::string(optarg);
 					break;
+				case 'C': {
+						long long budget = strtoll(optarg, &end_ptr, 10);
+						if (*end_ptr != '\0' || budget < 0)
+							SLog(EError, "Could not parse the chunk cache size!");
+						ResourceChunkCache::getInstance()->setMemoryBudget((size_t) budget * 1024 * 1024);
+					}
+					break;
 				case 'i':
 					hostName = optarg;
 					hostNameSet = true;
@@ -198,6 +205,8 @@ int mtssrv(int argc, char **argv) {
 					cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
 					cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
 					cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+					cout <<  "   -C size     Memory budget of the cache that keeps scene data received from" << endl;
+					cout <<  "               clients between jobs, in MiB (Default: " << MTS_CHUNKCACHE_DEFAULT_BUDGET << ")" << endl << endl;
 					cout <<  "   -i name     IP address / host name on which to listen for connections" << endl << endl;
 					cout <<  "   -l port     Listen for connections on a certain port (Default: " << MTS_DEFAULT_PORT << ")." << endl;
 					cout <<  "               To listen on stdin, specify \"-ls\" (implies -q)" << endl << endl;
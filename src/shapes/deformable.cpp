@@ -23,16 +23,65 @@
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/mstream.h>
 #include <mitsuba/core/mmap.h>
+#include <mitsuba/core/timer.h>
+#include <thread>
 
 #define SHAPE_PER_SEGMENT 1
 #define NO_CLIPPING_SUPPORT 1
 
+/// Number of bins per axis used by the SAH of the motion BVH
+#define MTS_DEFORMABLE_BVH_BINS 16
+/// Maximum number of triangles in a leaf that has no cheaper split
+#define MTS_DEFORMABLE_BVH_MAX_LEAF 4
+/// Cost of a node traversal step relative to the SAH query cost
+#define MTS_DEFORMABLE_BVH_TRAVERSAL_COST 1.0f
+/// Cost of an intersection test against an interpolated triangle
+#define MTS_DEFORMABLE_BVH_QUERY_COST 2.0f
+/// Maximum depth of the motion BVH
+#define MTS_DEFORMABLE_BVH_MAXDEPTH 64
+/// Size of the traversal stack (only spatial splits push entries)
+#define MTS_DEFORMABLE_BVH_STACK_SIZE 128
+/// Subtrees with at least this many triangle references are built by a separate thread
+#define MTS_DEFORMABLE_BVH_PARALLEL_THRESHOLD 16384
+/// Relative amount by which the bounds of nodes are enlarged
+#define MTS_DEFORMABLE_BVH_PADDING 1e-5f
+
 MTS_NAMESPACE_BEGIN
 
-class SpaceTimeKDTree : public SAHKDTree4D<SpaceTimeKDTree> {
-	friend class GenericKDTree<AABB4, SurfaceAreaHeuristic4, SpaceTimeKDTree>;
-	friend class SAHKDTree4D<SpaceTimeKDTree>;
+/*!\plugin{deformable}{Deformable triangle mesh}
+ * \order{12}
+ * \parameters{
+ *     \parameter{times}{\String}{
+ *       Comma-separated list of increasing keyframe times. Every keyframe
+ *       must be provided as a nested triangle mesh (or compound shape of
+ *       triangle meshes) with the same topology.
+ *     }
+ *     \parameter{accel}{\String}{
+ *       Acceleration data structure used to intersect the animated triangles:
+ *       \begin{enumerate}[(i)]
+ *           \item \code{bvh}: A bounding volume hierarchy with bounds that are
+ *           linearly interpolated between keyframes and which is only split
+ *           in time where the motion is large.
+ *           \item \code{kdtree}: A kd-tree over four-dimensional (space-time) boxes
+ *           enclosing the triangles over all keyframes.
+ *       \end{enumerate}
+ *       \default{\code{bvh}}
+ *     }
+ * }
+ *
+ * This plugin linearly interpolates the vertex attributes of a sequence of
+ * keyframe meshes to the time value of the rays, which makes it possible
+ * to render motion blur of deforming objects (e.g. animated characters).
+ */
+
+/**
+ * \brief Keyframes of a deforming set of triangle meshes. This is shared by
+ * the acceleration data structures supported by the \c deformable shape.
+ */
+class DeformableGeometry {
 public:
+	typedef uint32_t IndexType;
+
 	/// Temporarily holds some intersection information
 	struct IntersectionCache {
 		IndexType frameIndex;
@@ -41,9 +90,9 @@ public:
 		Float u, v;
 	};
 
-	SpaceTimeKDTree(const std::vector<Float> &times) : m_times(times) { }
+	DeformableGeometry(const std::vector<Float> &times) : m_times(times) { }
 
-	SpaceTimeKDTree(Stream *stream, InstanceManager *manager) {
+	DeformableGeometry(Stream *stream, InstanceManager *manager) {
 		size_t times = (size_t) stream->readUInt();
 		m_times.resize(times);
 		m_meshes.resize(times);
@@ -57,7 +106,7 @@ public:
 		}
 	}
 
-	~SpaceTimeKDTree() {
+	~DeformableGeometry() {
 		for (size_t i=0; i<m_meshes.size(); ++i)
 			for (size_t j=0; j<m_meshes[i].size(); ++j)
 				m_meshes[i][j]->decRef();
@@ -87,25 +136,25 @@ public:
 				if (element == NULL)
 					break;
 				if (!element->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
-					Log(EError, "Can only add triangle meshes to the 'deformable' plugin");
+					SLog(EError, "Can only add triangle meshes to the 'deformable' plugin");
 				element->incRef();
 				vec.push_back(static_cast<TriMesh *>(element.get()));
 			} while (true);
 		}
 
 		if (vec.empty())
-			Log(EError, "Can only add triangle meshes to the 'deformable' plugin");
+			SLog(EError, "Can only add triangle meshes to the 'deformable' plugin");
 		else
 			m_meshes.push_back(vec);
 	}
 
-
-	void build() {
+	/// Check the keyframes for consistency and compute the spatial bounds
+	void prepare() {
 		if (m_meshes.size() < 2)
-			Log(EError, "The deformable shape requires at least two sub-shapes!");
+			SLog(EError, "The deformable shape requires at least two sub-shapes!");
 
 		if (m_meshes.size() != m_times.size()) {
-			Log(EError, "The number of arguments to the 'times' parameter (%u) must "
+			SLog(EError, "The number of arguments to the 'times' parameter (%u) must "
 				"match the number of sub-shapes (%u).", m_times.size(), m_meshes.size());
 		}
 
@@ -113,29 +162,135 @@ public:
 			const std::vector<const TriMesh *> &meshes = m_meshes[i];
 
 			if (m_times[i] <= m_times[i-1])
-				Log(EError, "Frame times must be increasing!");
+				SLog(EError, "Frame times must be increasing!");
 
 			if (meshes.size() != m_meshes[0].size())
-				Log(EError, "The number of compound shapes for each time value must be identical!");
+				SLog(EError, "The number of compound shapes for each time value must be identical!");
 
 			for (size_t j=0;j<m_meshes[0].size(); ++j) {
 				const TriMesh *mesh0 = m_meshes[0][j];
 				const TriMesh *mesh1 = m_meshes[i][j];
 
 				if (mesh0->getTriangleCount() != mesh1->getTriangleCount())
-					Log(EError, "All sub-meshes must have the exact same number of triangles");
+					SLog(EError, "All sub-meshes must have the exact same number of triangles");
 				if (mesh0->getVertexCount() != mesh1->getVertexCount())
-					Log(EError, "All sub-meshes must have the exact same number of triangles");
+					SLog(EError, "All sub-meshes must have the exact same number of triangles");
 				if (memcmp(mesh0->getTriangles(), mesh1->getTriangles(), sizeof(Triangle) * mesh0->getTriangleCount()) != 0)
-					Log(EError, "All sub-meshes must have the exact same face topology");
+					SLog(EError, "All sub-meshes must have the exact same face topology");
 			}
 		}
 
-
 		m_shapeMap.resize(m_meshes[0].size()+1);
 		m_shapeMap[0] = 0;
 		for (size_t i=0; i<m_meshes[0].size(); ++i)
-			m_shapeMap[i+1] = m_shapeMap[i] + (SizeType) m_meshes[0][i]->getTriangleCount();
+			m_shapeMap[i+1] = m_shapeMap[i] + (IndexType) m_meshes[0][i]->getTriangleCount();
+
+		m_spatialAABB.reset();
+		for (size_t i=0; i<m_meshes.size(); ++i)
+			for (size_t j=0; j<m_meshes[i].size(); ++j)
+				m_spatialAABB.expandBy(m_meshes[i][j]->getAABB());
+	}
+
+	inline IndexType findShape(IndexType &index) const {
+		std::vector<IndexType>::const_iterator it = std::lower_bound(
+				m_shapeMap.begin(), m_shapeMap.end(), index + 1) - 1;
+		index -= *it;
+		return (IndexType) (it - m_shapeMap.begin());
+	}
+
+	/// Return the index of the sub-mesh that is referenced by \ref Intersection::shape
+	inline IndexType findMesh(const Shape *shape) const {
+		const std::vector<const TriMesh *> &meshes = m_meshes[0];
+		return (IndexType) (std::find(meshes.begin(), meshes.end(), shape) - meshes.begin());
+	}
+
+	/// Return the index of the keyframe interval containing \c time
+	inline IndexType findFrame(Float time) const {
+		return (IndexType) std::min(std::max((int) (std::lower_bound(
+			m_times.begin(), m_times.end(), time) - m_times.begin()) - 1, 0), (int) m_times.size()-2);
+	}
+
+	/// Return the interpolation weight of \c time within a keyframe interval
+	inline Float getAlpha(IndexType frameIndex, Float time) const {
+		return std::max((Float) 0.0f, std::min((Float) 1.0f,
+			(time - m_times[frameIndex])
+			/ (m_times[frameIndex + 1] - m_times[frameIndex])));
+	}
+
+	/**
+	 * \brief Intersect a ray with a triangle, whose vertices are interpolated
+	 * between the keyframes \c frameIndex and \c frameIndex+1
+	 */
+	inline bool intersectTriangle(const Ray &ray, IndexType shapeIndex,
+			IndexType primIndex, IndexType frameIndex, Float alpha,
+			Float mint, Float maxt, Float &u, Float &v, Float &t) const {
+		const Triangle &tri = m_meshes[0][shapeIndex]->getTriangles()[primIndex];
+
+		const Point *pos0 = m_meshes[frameIndex  ][shapeIndex]->getVertexPositions();
+		const Point *pos1 = m_meshes[frameIndex+1][shapeIndex]->getVertexPositions();
+
+		/* Compute interpolated positions */
+		Point p[3];
+		for (int i=0; i<3; ++i)
+			p[i] = (1 - alpha) * pos0[tri.idx[i]] + alpha * pos1[tri.idx[i]];
+
+		if (!Triangle::rayIntersect(p[0], p[1], p[2], ray, u, v, t))
+			return false;
+
+		return t >= mint && t <= maxt;
+	}
+
+	/// Return the total number of triangles
+	inline IndexType getTriangleCount() const {
+		return m_shapeMap[m_shapeMap.size()-1];
+	}
+
+	/// Return an AABB with the spatial extents
+	inline const AABB &getSpatialAABB() const {
+		return m_spatialAABB;
+	}
+
+	/// Return the number of key-framed time values
+	inline size_t getTimeCount() const {
+		return m_times.size();
+	}
+
+	inline const std::vector<Float> &getTimes() const {
+		return m_times;
+	}
+
+	inline const TriMesh *getMesh(IndexType frameIndex, IndexType shapeIndex) const {
+		return m_meshes[frameIndex][shapeIndex];
+	}
+
+	inline Triangle getTriangle(IndexType shapeIndex, IndexType primIndex) const {
+		return m_meshes[0][shapeIndex]->getTriangles()[primIndex];
+	}
+
+	inline const std::vector<std::vector<const TriMesh *> > &getMeshes() const {
+		return m_meshes;
+	}
+
+protected:
+	std::vector<Float> m_times;
+	std::vector<std::vector<const TriMesh *> > m_meshes;
+	std::vector<IndexType> m_shapeMap;
+	AABB m_spatialAABB;
+};
+
+class SpaceTimeKDTree : public SAHKDTree4D<SpaceTimeKDTree>, public DeformableGeometry {
+	friend class GenericKDTree<AABB4, SurfaceAreaHeuristic4, SpaceTimeKDTree>;
+	friend class SAHKDTree4D<SpaceTimeKDTree>;
+public:
+	typedef DeformableGeometry::IndexType IndexType;
+
+	SpaceTimeKDTree(const std::vector<Float> &times) : DeformableGeometry(times) { }
+
+	SpaceTimeKDTree(Stream *stream, InstanceManager *manager)
+		: DeformableGeometry(stream, manager) { }
+
+	void build() {
+		prepare();
 
 		this->setClip(false);
 		buildInternal();
@@ -164,23 +319,6 @@ public:
 		KDLog(EInfo, "  Spatial splits = " SIZE_T_FMT, spatialSplits);
 		KDLog(EInfo, "  Time splits    = " SIZE_T_FMT, timeSplits);
 		KDLog(EInfo, "");
-
-		m_spatialAABB = AABB(
-			Point(m_aabb.min.x, m_aabb.min.y, m_aabb.min.z),
-			Point(m_aabb.max.x, m_aabb.max.y, m_aabb.max.z)
-		);
-	}
-
-	inline IndexType findShape(IndexType &index) const {
-		std::vector<IndexType>::const_iterator it = std::lower_bound(
-				m_shapeMap.begin(), m_shapeMap.end(), index + 1) - 1;
-		index -= *it;
-		return (IndexType) (it - m_shapeMap.begin());
-	}
-
-	inline IndexType findFrame(Float time) const {
-		return (IndexType) std::min(std::max((int) (std::lower_bound(
-			m_times.begin(), m_times.end(), time) - m_times.begin()) - 1, 0), (int) m_times.size()-1);
 	}
 
 	// ========================================================================
@@ -189,7 +327,7 @@ public:
 
 	/// Return the total number of primitives that are organized in the tree
 	inline SizeType getPrimitiveCount() const {
-		return m_shapeMap[m_shapeMap.size()-1];
+		return getTriangleCount();
 	}
 
 	/// Return the 4D extents for one of the primitives contained in the tree
@@ -245,25 +383,11 @@ public:
 		IntersectionCache *cache = static_cast<IntersectionCache *>(tmp);
 		IndexType shapeIndex = findShape(index);
 		IndexType frameIndex = findFrame(ray.time);
-		Float alpha = std::max((Float) 0.0f, std::min((Float) 1.0f,
-			(ray.time - m_times[frameIndex])
-			/ (m_times[frameIndex + 1] - m_times[frameIndex])));
-
-		const Triangle &tri = m_meshes[0][shapeIndex]->getTriangles()[index];
-
-		const Point *pos0 = m_meshes[frameIndex  ][shapeIndex]->getVertexPositions();
-		const Point *pos1 = m_meshes[frameIndex+1][shapeIndex]->getVertexPositions();
-
-		/* Compute interpolated positions */
-		Point p[3];
-		for (int i=0; i<3; ++i)
-			p[i] = (1 - alpha) * pos0[tri.idx[i]] + alpha * pos1[tri.idx[i]];
+		Float alpha = getAlpha(frameIndex, ray.time);
 
 		Float tempU, tempV, tempT;
-		if (!Triangle::rayIntersect(p[0], p[1], p[2], ray, tempU, tempV, tempT))
-			return false;
-
-		if (tempT < mint || tempT > maxt)
+		if (!intersectTriangle(ray, shapeIndex, index, frameIndex,
+				alpha, mint, maxt, tempU, tempV, tempT))
 			return false;
 
 		t = tempT;
@@ -279,29 +403,12 @@ public:
 	/// Cast a shadow ray against a specific triangle
 	inline bool intersect(const Ray &ray, IndexType index, Float mint, Float maxt) const {
 		IndexType shapeIndex = findShape(index);
-		const Triangle &tri = m_meshes[0][shapeIndex]->getTriangles()[index];
-
 		IndexType frameIndex = findFrame(ray.time);
-		Float alpha = std::max((Float) 0.0f, std::min((Float) 1.0f,
-			(ray.time - m_times[frameIndex])
-			/ (m_times[frameIndex + 1] - m_times[frameIndex])));
-
-		const Point *pos0 = m_meshes[frameIndex  ][shapeIndex]->getVertexPositions();
-		const Point *pos1 = m_meshes[frameIndex+1][shapeIndex]->getVertexPositions();
-
-		/* Compute interpolated positions */
-		Point p[3];
-		for (int i=0; i<3; ++i)
-			p[i] = (1 - alpha) * pos0[tri.idx[i]] + alpha * pos1[tri.idx[i]];
+		Float alpha = getAlpha(frameIndex, ray.time);
 
 		Float tempU, tempV, tempT;
-		if (!Triangle::rayIntersect(p[0], p[1], p[2], ray, tempU, tempV, tempT))
-			return false;
-
-		if (tempT < mint || tempT > maxt)
-			return false;
-
-		return true;
+		return intersectTriangle(ray, shapeIndex, index, frameIndex,
+			alpha, mint, maxt, tempU, tempV, tempT);
 	}
 
 	// ========================================================================
@@ -350,39 +457,533 @@ public:
 		return false;
 	}
 
-	/// Return an AABB with the spatial extents
-	inline const AABB &getSpatialAABB() const {
-		return m_spatialAABB;
-	}
+	MTS_DECLARE_CLASS()
+};
 
-	/// Return the number of key-framed time values
-	inline size_t getTimeCount() const {
-		return m_times.size();
-	}
+/**
+ * \brief Bounding volume hierarchy over deforming triangles
+ *
+ * Every node covers an interval of keyframes and stores the bounds of its
+ * triangles at both ends of it, which are linearly interpolated to the time
+ * of a ray. Since vertices move linearly between adjacent keyframes, this is
+ * conservative (bounds are enlarged where they would not contain an
+ * intermediate keyframe) and tight for linear motion, unlike bounds over the
+ * whole animation. Nodes are split in half in time only when the surface
+ * area heuristic favors this over a spatial split, i.e. where the motion is
+ * large or non-linear. Rays then only visit the half containing their time.
+ */
+class MotionBVH : public Object, public DeformableGeometry {
+public:
+	MotionBVH(const std::vector<Float> &times) : DeformableGeometry(times) { }
 
-	inline const std::vector<Float> getTimes() const {
-		return m_times;
+	MotionBVH(Stream *stream, InstanceManager *manager)
+		: DeformableGeometry(stream, manager) { }
+
+	void build() {
+		prepare();
+		ref<Timer> timer = new Timer();
+		uint32_t lastFrame = (uint32_t) m_times.size() - 1;
+
+		std::vector<BuildItem> items(getTriangleCount());
+		size_t index = 0;
+		for (size_t i=0; i<m_meshes[0].size(); ++i) {
+			for (size_t j=0; j<m_meshes[0][i]->getTriangleCount(); ++j) {
+				items[index].ref.shapeIndex = (IndexType) i;
+				items[index].ref.primIndex = (IndexType) j;
+				++index;
+			}
+		}
+
+		/* The bounds over the whole animation are computed by several threads */
+		size_t threadCount = std::max((size_t) 1, std::min((size_t) getCoreCount(),
+			items.size() / MTS_DEFORMABLE_BVH_PARALLEL_THRESHOLD));
+		size_t chunkSize = (items.size() + threadCount - 1) / threadCount;
+		std::vector<std::thread> workers;
+		for (size_t start=chunkSize; start<items.size(); start += chunkSize) {
+			workers.push_back(std::thread([&, start] {
+				computeBounds(&items[start], std::min(chunkSize, items.size() - start), 0, lastFrame);
+			}));
+		}
+		if (!items.empty())
+			computeBounds(&items[0], std::min(chunkSize, items.size()), 0, lastFrame);
+		for (size_t i=0; i<workers.size(); ++i)
+			workers[i].join();
+
+		/* Bounds are padded to account for roundoff errors
+		   when interpolating them and the vertex positions */
+		m_padding = 0;
+		if (m_spatialAABB.isValid()) {
+			for (int i=0; i<3; ++i)
+				m_padding = std::max(m_padding, std::max(
+					std::abs(m_spatialAABB.min[i]), std::abs(m_spatialAABB.max[i])));
+			m_padding *= MTS_DEFORMABLE_BVH_PADDING;
+		}
+
+		Subtree tree;
+		tree.nodes.resize(1);
+		tree.timeSplits = 0;
+		if (!items.empty())
+			build(tree, &items[0], items.size(), 0, lastFrame, 0, 0);
+		else
+			tree.nodes.clear();
+		m_nodes.swap(tree.nodes);
+		m_refs.swap(tree.refs);
+		m_timeSplits = tree.timeSplits;
+
+		Log(EInfo, "Motion BVH statistics");
+		Log(EInfo, "  Time interval  = [%f, %f]", m_times[0], m_times[lastFrame]);
+		Log(EInfo, "  Keyframes      = " SIZE_T_FMT, m_times.size());
+		Log(EInfo, "  Nodes          = " SIZE_T_FMT, m_nodes.size());
+		Log(EInfo, "  Time splits    = " SIZE_T_FMT, m_timeSplits);
+		Log(EInfo, "  References     = " SIZE_T_FMT " (%.2f per triangle)", m_refs.size(),
+			items.empty() ? 0.0f : (Float) m_refs.size() / items.size());
+		Log(EInfo, "  Memory         = %s", memString(getMemoryUsage()).c_str());
+		Log(EInfo, "  Build time     = %i ms", timer->getMilliseconds());
+		Log(EInfo, "");
 	}
 
-	inline const TriMesh *getMesh(IndexType frameIndex, IndexType shapeIndex) const {
-		return m_meshes[frameIndex][shapeIndex];
+	/// Return the memory used by the nodes and triangle references
+	inline size_t getMemoryUsage() const {
+		return m_nodes.size() * sizeof(Node) + m_refs.size() * sizeof(PrimRef);
 	}
 
-	inline Triangle getTriangle(IndexType shapeIndex, IndexType primIndex) const {
-		return m_meshes[0][shapeIndex]->getTriangles()[primIndex];
+	/// Intersect a ray with all triangles stored in the BVH
+	inline bool rayIntersect(const Ray &ray, Float mint, Float maxt,
+			Float &t, void *temp) const {
+		return rayIntersectInternal<false>(ray, mint, maxt, t, temp);
 	}
 
-	inline const std::vector<std::vector<const TriMesh *> > &getMeshes() const {
-		return m_meshes;
+	/**
+	 * \brief Intersect a ray with all triangles stored in the BVH
+	 * (Visiblity query version)
+	 */
+	inline bool rayIntersect(const Ray &ray, Float mint, Float maxt) const {
+		Float t;
+		return rayIntersectInternal<true>(ray, mint, maxt, t, NULL);
 	}
 
 	MTS_DECLARE_CLASS()
 protected:
-	std::vector<Float> m_times;
-	std::vector<std::vector<const TriMesh *> > m_meshes;
-	std::vector<IndexType> m_shapeMap;
-	AABB m_spatialAABB;
-	Float m_traceTime;
+	enum ENodeType {
+		ELeaf = 0,
+		/// Both children cover the time interval of the node
+		ESpatialSplit = 1,
+		/// The children cover the two halves of the time interval of the node
+		ETimeSplit = 2
+	};
+
+	struct Node {
+		/// Bounds at the start of the time interval
+		Point min0, max0;
+		/// Bounds at the end of the time interval
+		Point min1, max1;
+		/// Start of the time interval
+		Float time;
+		/// Reciprocal length of the time interval
+		Float invDuration;
+		/// Index of the first child (inner nodes) or of the first triangle reference (leaves)
+		uint32_t data;
+		/// Node type (see \ref ENodeType)
+		uint32_t type : 2;
+		/// Number of triangle references (zero for inner nodes)
+		uint32_t primCount : 30;
+	};
+
+	struct PrimRef {
+		IndexType shapeIndex, primIndex;
+	};
+
+	/// Pair of bounds which are linearly interpolated over a time interval
+	struct LinearBounds {
+		AABB start, end;
+
+		inline void expandBy(const LinearBounds &bounds) {
+			start.expandBy(bounds.start);
+			end.expandBy(bounds.end);
+		}
+
+		/// Return the surface area averaged over the time interval
+		inline Float getSurfaceArea() const {
+			/* The area is quadratic in time, hence Simpson's rule is exact */
+			AABB mid(start.min + (end.min - start.min) * 0.5f,
+			         start.max + (end.max - start.max) * 0.5f);
+			return (start.getSurfaceArea() + 4 * mid.getSurfaceArea()
+				+ end.getSurfaceArea()) * (1.0f / 6.0f);
+		}
+
+		/// Return the center in the middle of the time interval
+		inline Point getCenter() const {
+			Point a = start.getCenter(), b = end.getCenter();
+			return a + (b - a) * 0.5f;
+		}
+	};
+
+	/// Per-triangle information used during the build
+	struct BuildItem {
+		LinearBounds bounds;
+		PrimRef ref;
+	};
+
+	/// Nodes and references of a subtree, which may be built by a separate thread
+	struct Subtree {
+		std::vector<Node> nodes;
+		std::vector<PrimRef> refs;
+		size_t timeSplits;
+	};
+
+	struct Bin {
+		LinearBounds bounds;
+		size_t count;
+	};
+
+	/// Return the bounds of a triangle at a keyframe
+	inline AABB getFrameBounds(const PrimRef &ref, uint32_t frame) const {
+		const Triangle &tri = m_meshes[0][ref.shapeIndex]->getTriangles()[ref.primIndex];
+		const Point *pos = m_meshes[frame][ref.shapeIndex]->getVertexPositions();
+		AABB aabb = AABB(pos[tri.idx[0]]);
+		aabb.expandBy(pos[tri.idx[1]]);
+		aabb.expandBy(pos[tri.idx[2]]);
+		return aabb;
+	}
+
+	/// Compute interpolated bounds of triangles over the keyframes <tt>[frame0, frame1]</tt>
+	void computeBounds(BuildItem *items, size_t count, uint32_t frame0, uint32_t frame1) const {
+		Float invDuration = 1 / (m_times[frame1] - m_times[frame0]);
+		for (size_t i=0; i<count; ++i) {
+			LinearBounds &bounds = items[i].bounds;
+			bounds.start = getFrameBounds(items[i].ref, frame0);
+			bounds.end = getFrameBounds(items[i].ref, frame1);
+
+			/* Enlarge both ends until the intermediate keyframes are contained */
+			for (uint32_t frame=frame0+1; frame<frame1; ++frame) {
+				AABB aabb = getFrameBounds(items[i].ref, frame);
+				Float s = (m_times[frame] - m_times[frame0]) * invDuration;
+				for (int k=0; k<3; ++k) {
+					Float lower = (1 - s) * bounds.start.min[k] + s * bounds.end.min[k] - aabb.min[k],
+					      upper = aabb.max[k] - ((1 - s) * bounds.start.max[k] + s * bounds.end.max[k]);
+					if (lower > 0) {
+						bounds.start.min[k] -= lower;
+						bounds.end.min[k] -= lower;
+					}
+					if (upper > 0) {
+						bounds.start.max[k] += upper;
+						bounds.end.max[k] += upper;
+					}
+				}
+			}
+		}
+	}
+
+	/**
+	 * \brief Estimate the SAH cost of splitting the time interval of a node
+	 * at the keyframe \c frameMid. The bounds of the halves are approximated
+	 * using the keyframes at their ends.
+	 */
+	Float evalTimeSplit(const BuildItem *items, size_t count, uint32_t frame0,
+			uint32_t frameMid, uint32_t frame1, Float invArea) const {
+		LinearBounds first, second;
+		for (size_t i=0; i<count; ++i) {
+			AABB aabbMid = getFrameBounds(items[i].ref, frameMid);
+			first.start.expandBy(getFrameBounds(items[i].ref, frame0));
+			first.end.expandBy(aabbMid);
+			second.start.expandBy(aabbMid);
+			second.end.expandBy(getFrameBounds(items[i].ref, frame1));
+		}
+
+		/* Rays only visit one of the halves */
+		Float weight = (m_times[frameMid] - m_times[frame0])
+			/ (m_times[frame1] - m_times[frame0]);
+		return MTS_DEFORMABLE_BVH_TRAVERSAL_COST + MTS_DEFORMABLE_BVH_QUERY_COST * count
+			* (weight * first.getSurfaceArea() + (1 - weight) * second.getSurfaceArea()) * invArea;
+	}
+
+	/**
+	 * \brief Find the best spatial split of <tt>items[0..count)</tt> using the
+	 * binned SAH. Returns its cost (infinity if the triangles cannot be split).
+	 */
+	Float findSpatialSplit(const BuildItem *items, size_t count,
+			const AABB &centroidBounds, Float invArea, int &bestAxis,
+			int &bestSplit, Float *scale) const {
+		Float bestCost = std::numeric_limits<Float>::infinity();
+		bestAxis = bestSplit = -1;
+		if (count == 1)
+			return bestCost;
+
+		Bin bins[3][MTS_DEFORMABLE_BVH_BINS];
+		for (int k=0; k<3; ++k) {
+			Float range = centroidBounds.max[k] - centroidBounds.min[k];
+			scale[k] = range > 0 ? MTS_DEFORMABLE_BVH_BINS / range : 0;
+			for (int j=0; j<MTS_DEFORMABLE_BVH_BINS; ++j) {
+				bins[k][j].bounds.start.reset();
+				bins[k][j].bounds.end.reset();
+				bins[k][j].count = 0;
+			}
+		}
+
+		for (size_t i=0; i<count; ++i) {
+			Point centroid = items[i].bounds.getCenter();
+			for (int k=0; k<3; ++k) {
+				if (scale[k] == 0)
+					continue;
+				int index = std::min(MTS_DEFORMABLE_BVH_BINS - 1,
+					(int) ((centroid[k] - centroidBounds.min[k]) * scale[k]));
+				bins[k][index].bounds.expandBy(items[i].bounds);
+				bins[k][index].count++;
+			}
+		}
+
+		/* Sweep over all bin boundaries */
+		for (int k=0; k<3; ++k) {
+			if (scale[k] == 0)
+				continue;
+			Float rightCost[MTS_DEFORMABLE_BVH_BINS];
+			LinearBounds bounds;
+			size_t binCount = 0;
+			for (int j=MTS_DEFORMABLE_BVH_BINS-1; j>0; --j) {
+				bounds.expandBy(bins[k][j].bounds);
+				binCount += bins[k][j].count;
+				rightCost[j] = binCount > 0 ? bounds.getSurfaceArea() * binCount : 0;
+			}
+			bounds.start.reset();
+			bounds.end.reset();
+			binCount = 0;
+			for (int j=0; j<MTS_DEFORMABLE_BVH_BINS-1; ++j) {
+				bounds.expandBy(bins[k][j].bounds);
+				binCount += bins[k][j].count;
+				if (binCount == 0 || binCount == count)
+					continue;
+				Float cost = MTS_DEFORMABLE_BVH_TRAVERSAL_COST + MTS_DEFORMABLE_BVH_QUERY_COST
+					* (bounds.getSurfaceArea() * binCount + rightCost[j+1]) * invArea;
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = k;
+					bestSplit = j;
+				}
+			}
+		}
+
+		return bestCost;
+	}
+
+	/// Recursively build the subtree over <tt>items[0..count)</tt> and the keyframes <tt>[frame0, frame1]</tt>
+	void build(Subtree &tree, BuildItem *items, size_t count, uint32_t frame0,
+			uint32_t frame1, int depth, size_t nodeIndex) const {
+		LinearBounds bounds = items[0].bounds;
+		AABB centroidBounds;
+		for (size_t i=0; i<count; ++i) {
+			bounds.expandBy(items[i].bounds);
+			centroidBounds.expandBy(items[i].bounds.getCenter());
+		}
+
+		Node node;
+		node.min0 = bounds.start.min - Vector(m_padding);
+		node.max0 = bounds.start.max + Vector(m_padding);
+		node.min1 = bounds.end.min - Vector(m_padding);
+		node.max1 = bounds.end.max + Vector(m_padding);
+		node.time = m_times[frame0];
+		node.invDuration = 1 / (m_times[frame1] - m_times[frame0]);
+
+		/* Compare the best spatial split against splitting the time interval in half */
+		Float invArea = 1 / bounds.getSurfaceArea(), scale[3];
+		int axis, bin;
+		Float spatialCost = findSpatialSplit(items, count, centroidBounds, invArea, axis, bin, scale);
+		uint32_t frameMid = (frame0 + frame1) / 2;
+		Float timeCost = std::numeric_limits<Float>::infinity();
+		if (frame1 - frame0 >= 2)
+			timeCost = evalTimeSplit(items, count, frame0, frameMid, frame1, invArea);
+		bool timeSplit = timeCost < spatialCost;
+		Float bestCost = std::min(spatialCost, timeCost);
+
+		if (depth >= MTS_DEFORMABLE_BVH_MAXDEPTH || !(bestCost < std::numeric_limits<Float>::infinity())
+				|| (count <= MTS_DEFORMABLE_BVH_MAX_LEAF && count * MTS_DEFORMABLE_BVH_QUERY_COST <= bestCost)) {
+			node.type = ELeaf;
+			node.data = (uint32_t) tree.refs.size();
+			node.primCount = (uint32_t) count;
+			for (size_t i=0; i<count; ++i)
+				tree.refs.push_back(items[i].ref);
+			tree.nodes[nodeIndex] = node;
+			return;
+		}
+
+		size_t mid = 0;
+		if (!timeSplit) {
+			mid = std::partition(items, items + count,
+				[&](const BuildItem &item) {
+					int index = std::min(MTS_DEFORMABLE_BVH_BINS - 1,
+						(int) ((item.bounds.getCenter()[axis] - centroidBounds.min[axis]) * scale[axis]));
+					return index <= bin;
+				}) - items;
+		} else {
+			tree.timeSplits++;
+		}
+
+		/* The children are stored next to each other */
+		size_t children = tree.nodes.size();
+		node.type = timeSplit ? ETimeSplit : ESpatialSplit;
+		node.data = (uint32_t) children;
+		node.primCount = 0;
+		tree.nodes[nodeIndex] = node;
+		tree.nodes.resize(children + 2);
+
+		auto buildChild = [&](Subtree &target, int child, size_t slot) {
+			if (timeSplit) {
+				/* Both halves reference all triangles, with tighter bounds */
+				uint32_t start = child == 0 ? frame0 : frameMid,
+				         end = child == 0 ? frameMid : frame1;
+				std::vector<BuildItem> childItems(items, items + count);
+				computeBounds(&childItems[0], count, start, end);
+				build(target, &childItems[0], count, start, end, depth + 1, slot);
+			} else if (child == 0) {
+				build(target, items, mid, frame0, frame1, depth + 1, slot);
+			} else {
+				build(target, items + mid, count - mid, frame0, frame1, depth + 1, slot);
+			}
+		};
+
+		if (count >= MTS_DEFORMABLE_BVH_PARALLEL_THRESHOLD && depth < 16 && (1 << depth) < getCoreCount()) {
+			/* Build the second child in parallel and append it afterwards */
+			Subtree right;
+			right.nodes.resize(1);
+			right.timeSplits = 0;
+			std::thread worker([&] { buildChild(right, 1, 0); });
+			buildChild(tree, 0, children);
+			worker.join();
+
+			/* The root of the subtree goes into the reserved slot */
+			uint32_t nodeOffset = (uint32_t) tree.nodes.size() - 1,
+			         refOffset = (uint32_t) tree.refs.size();
+			for (size_t i=0; i<right.nodes.size(); ++i) {
+				Node child = right.nodes[i];
+				child.data += child.type == ELeaf ? refOffset : nodeOffset;
+				if (i == 0)
+					tree.nodes[children + 1] = child;
+				else
+					tree.nodes.push_back(child);
+			}
+			tree.refs.insert(tree.refs.end(), right.refs.begin(), right.refs.end());
+			tree.timeSplits += right.timeSplits;
+		} else {
+			buildChild(tree, 0, children);
+			buildChild(tree, 1, children + 1);
+		}
+	}
+
+	/**
+	 * \brief Clip a ray segment against the bounds of a node, which are
+	 * interpolated to the time of the ray. NaNs due to zero direction
+	 * components are discarded by the comparisons.
+	 */
+	static inline bool intersectNode(const Node &node, const Ray &ray,
+			Float mint, Float maxt, Float &nearT) {
+		Float s = std::max((Float) 0, std::min((Float) 1,
+			(ray.time - node.time) * node.invDuration));
+		for (int i=0; i<3; ++i) {
+			Float min = node.min0[i] + (node.min1[i] - node.min0[i]) * s,
+			      max = node.max0[i] + (node.max1[i] - node.max0[i]) * s;
+			Float t1 = (min - ray.o[i]) * ray.dRcp[i],
+			      t2 = (max - ray.o[i]) * ray.dRcp[i];
+			mint = std::max(mint, std::min(t1, t2));
+			maxt = std::min(maxt, std::max(t1, t2));
+		}
+		nearT = mint;
+		return mint <= maxt;
+	}
+
+	template <bool shadowRay> bool rayIntersectInternal(const Ray &ray, Float mint,
+			Float maxt, Float &t, void *temp) const {
+		struct StackEntry {
+			uint32_t node;
+			Float nearT;
+		} stack[MTS_DEFORMABLE_BVH_STACK_SIZE];
+		int stackSize = 0;
+		bool found = false;
+		Float nearT;
+
+		if (m_nodes.empty() || !intersectNode(m_nodes[0], ray, mint, maxt, nearT))
+			return false;
+
+		/* All triangles are interpolated between the same keyframes */
+		IndexType frameIndex = findFrame(ray.time);
+		Float alpha = getAlpha(frameIndex, ray.time);
+
+		uint32_t index = 0;
+		while (true) {
+			const Node &node = m_nodes[index];
+			if (node.type == ESpatialSplit) {
+				Float nearLeft, nearRight;
+				bool hitLeft = intersectNode(m_nodes[node.data], ray, mint, maxt, nearLeft);
+				bool hitRight = intersectNode(m_nodes[node.data+1], ray, mint, maxt, nearRight);
+
+				if (hitLeft && hitRight) {
+					/* Visit the closer child first */
+					StackEntry &entry = stack[stackSize++];
+					if (nearLeft <= nearRight) {
+						entry.node = node.data + 1;
+						entry.nearT = nearRight;
+						index = node.data;
+					} else {
+						entry.node = node.data;
+						entry.nearT = nearLeft;
+						index = node.data + 1;
+					}
+					continue;
+				} else if (hitLeft) {
+					index = node.data;
+					continue;
+				} else if (hitRight) {
+					index = node.data + 1;
+					continue;
+				}
+			} else if (node.type == ETimeSplit) {
+				/* Only visit the half that contains the time of the ray */
+				index = ray.time < m_nodes[node.data+1].time ? node.data : node.data + 1;
+				if (intersectNode(m_nodes[index], ray, mint, maxt, nearT))
+					continue;
+			} else {
+				for (uint32_t i=0; i<node.primCount; ++i) {
+					const PrimRef &ref = m_refs[node.data + i];
+					Float u, v, tempT;
+					if (!intersectTriangle(ray, ref.shapeIndex, ref.primIndex,
+							frameIndex, alpha, mint, maxt, u, v, tempT))
+						continue;
+					if (shadowRay)
+						return true;
+					IntersectionCache *cache = static_cast<IntersectionCache *>(temp);
+					cache->frameIndex = frameIndex;
+					cache->alpha = alpha;
+					cache->shapeIndex = ref.shapeIndex;
+					cache->primIndex = ref.primIndex;
+					cache->u = u;
+					cache->v = v;
+					maxt = tempT;
+					found = true;
+				}
+			}
+
+			/* Continue with the next node that may contain a closer intersection */
+			bool next = false;
+			while (stackSize > 0 && !next) {
+				const StackEntry &entry = stack[--stackSize];
+				if (entry.nearT <= maxt) {
+					index = entry.node;
+					next = true;
+				}
+			}
+			if (!next)
+				break;
+		}
+
+		if (found)
+			t = maxt;
+		return found;
+	}
+
+	virtual ~MotionBVH() { }
+private:
+	std::vector<Node> m_nodes;
+	std::vector<PrimRef> m_refs;
+	size_t m_timeSplits;
+	Float m_padding;
 };
 
 class Deformable : public Shape {
@@ -399,40 +1000,66 @@ public:
 				SLog(EError, "Could not parse the times parameter!");
 			times[i] = value;
 		}
-		m_kdtree = new SpaceTimeKDTree(times);
+
+		std::string accel = props.getString("accel", "bvh");
+		if (accel == "bvh") {
+			m_bvh = new MotionBVH(times);
+			m_geometry = m_bvh;
+		} else if (accel == "kdtree") {
+			m_kdtree = new SpaceTimeKDTree(times);
+			m_geometry = m_kdtree;
+		} else {
+			Log(EError, "The 'accel' parameter must be either \"bvh\" or \"kdtree\"!");
+		}
 	}
 
 	Deformable(Stream *stream, InstanceManager *manager)
 		: Shape(stream, manager) {
-		m_kdtree = new SpaceTimeKDTree(stream, manager);
+		if (stream->readBool()) {
+			m_bvh = new MotionBVH(stream, manager);
+			m_geometry = m_bvh;
+		} else {
+			m_kdtree = new SpaceTimeKDTree(stream, manager);
+			m_geometry = m_kdtree;
+		}
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
 		Shape::serialize(stream, manager);
-		m_kdtree->serialize(stream, manager);
+		stream->writeBool(m_bvh.get() != NULL);
+		m_geometry->serialize(stream, manager);
 	}
 
 	void configure() {
-		m_kdtree->build();
+		if (m_bvh.get())
+			m_bvh->build();
+		else
+			m_kdtree->build();
 	}
 
 	bool rayIntersect(const Ray &ray, Float mint,
 			Float maxt, Float &t, void *temp) const {
-		return m_kdtree->rayIntersect(ray, mint, maxt, t, temp);
+		if (m_bvh.get())
+			return m_bvh->rayIntersect(ray, mint, maxt, t, temp);
+		else
+			return m_kdtree->rayIntersect(ray, mint, maxt, t, temp);
 	}
 
 	bool rayIntersect(const Ray &ray, Float mint, Float maxt) const {
-		return m_kdtree->rayIntersect(ray, mint, maxt);
+		if (m_bvh.get())
+			return m_bvh->rayIntersect(ray, mint, maxt);
+		else
+			return m_kdtree->rayIntersect(ray, mint, maxt);
 	}
 
 	void fillIntersectionRecord(const Ray &ray,
 			const void *temp, Intersection &its) const {
-		const SpaceTimeKDTree::IntersectionCache *cache
-			= static_cast<const SpaceTimeKDTree::IntersectionCache *>(temp);
-		const TriMesh *trimesh0 = m_kdtree->getMesh(cache->frameIndex,   cache->shapeIndex);
-		const TriMesh *trimesh1 = m_kdtree->getMesh(cache->frameIndex+1, cache->shapeIndex);
+		const DeformableGeometry::IntersectionCache *cache
+			= static_cast<const DeformableGeometry::IntersectionCache *>(temp);
+		const TriMesh *trimesh0 = m_geometry->getMesh(cache->frameIndex,   cache->shapeIndex);
+		const TriMesh *trimesh1 = m_geometry->getMesh(cache->frameIndex+1, cache->shapeIndex);
 		const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
-		const Triangle tri = m_kdtree->getTriangle(cache->shapeIndex, cache->primIndex);
+		const Triangle tri = m_geometry->getTriangle(cache->shapeIndex, cache->primIndex);
 		const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
 		const Float alpha = cache->alpha;
 
@@ -505,10 +1132,9 @@ public:
 				result[2], Spectrum::EReflectance);
 		}
 
-		its.shape = m_kdtree->getMesh(0, cache->shapeIndex);
+		its.shape = m_geometry->getMesh(0, cache->shapeIndex);
 		its.hasUVPartials = false;
 		its.primIndex = cache->primIndex;
-		its.other = cache->shapeIndex;
 		its.instance = this;
 		its.time = ray.time;
 	}
@@ -516,15 +1142,12 @@ public:
 	void getNormalDerivative(const Intersection &its,
 			Vector &dndu, Vector &dndv, bool shadingFrame) const {
 
-		const std::vector<Float> &times = m_kdtree->getTimes();
-		int frameIndex = m_kdtree->findFrame(its.time);
-		Float alpha = std::max((Float) 0.0f, std::min((Float) 1.0f,
-			(its.time - times[frameIndex])
-			/ (times[frameIndex + 1] - times[frameIndex])));
+		int frameIndex = m_geometry->findFrame(its.time);
+		Float alpha = m_geometry->getAlpha(frameIndex, its.time);
 
-		uint32_t primIndex = its.primIndex, shapeIndex = its.other;
-		const TriMesh *trimesh0 = m_kdtree->getMesh(frameIndex,   shapeIndex);
-		const TriMesh *trimesh1 = m_kdtree->getMesh(frameIndex+1, shapeIndex);
+		uint32_t primIndex = its.primIndex, shapeIndex = m_geometry->findMesh(its.shape);
+		const TriMesh *trimesh0 = m_geometry->getMesh(frameIndex,   shapeIndex);
+		const TriMesh *trimesh1 = m_geometry->getMesh(frameIndex+1, shapeIndex);
 		const Point *vertexPositions0 = trimesh0->getVertexPositions();
 		const Point *vertexPositions1 = trimesh1->getVertexPositions();
 		const Point2 *vertexTexcoords0 = trimesh0->getVertexTexcoords();
@@ -609,23 +1232,19 @@ public:
 
 
 	void adjustTime(Intersection &its, Float time) const {
-		SpaceTimeKDTree::IntersectionCache cache;
-
-		const std::vector<Float> &times = m_kdtree->getTimes();
+		DeformableGeometry::IntersectionCache cache;
 
 		cache.primIndex = its.primIndex;
-		cache.shapeIndex = its.other;
-		cache.frameIndex = m_kdtree->findFrame(its.time);
-		cache.alpha = std::max((Float) 0.0f, std::min((Float) 1.0f,
-			(its.time - times[cache.frameIndex])
-			/ (times[cache.frameIndex + 1] - times[cache.frameIndex])));
-
-		const TriMesh *trimesh0 = m_kdtree->getMesh(cache.frameIndex,   cache.shapeIndex);
-		const TriMesh *trimesh1 = m_kdtree->getMesh(cache.frameIndex+1, cache.shapeIndex);
+		cache.shapeIndex = m_geometry->findMesh(its.shape);
+		cache.frameIndex = m_geometry->findFrame(its.time);
+		cache.alpha = m_geometry->getAlpha(cache.frameIndex, its.time);
+
+		const TriMesh *trimesh0 = m_geometry->getMesh(cache.frameIndex,   cache.shapeIndex);
+		const TriMesh *trimesh1 = m_geometry->getMesh(cache.frameIndex+1, cache.shapeIndex);
 		const Point *vertexPositions0 = trimesh0->getVertexPositions();
 		const Point *vertexPositions1 = trimesh1->getVertexPositions();
 
-		const Triangle tri = m_kdtree->getTriangle(cache.shapeIndex, cache.primIndex);
+		const Triangle tri = m_geometry->getTriangle(cache.shapeIndex, cache.primIndex);
 		const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
 		const Point p0 = vertexPositions0[idx0] * (1-cache.alpha) + vertexPositions1[idx0] * cache.alpha;
 		const Point p1 = vertexPositions0[idx1] * (1-cache.alpha) + vertexPositions1[idx1] * cache.alpha;
@@ -641,44 +1260,43 @@ public:
 		cache.u = ( a22 * b1 - a12 * b2) * invDet,
 		cache.v = (-a12 * b1 + a11 * b2) * invDet;
 
-		cache.frameIndex = m_kdtree->findFrame(time);
-		cache.alpha = std::max((Float) 0.0f, std::min((Float) 1.0f,
-			(time - times[cache.frameIndex])
-			/ (times[cache.frameIndex + 1] - times[cache.frameIndex])));
+		cache.frameIndex = m_geometry->findFrame(time);
+		cache.alpha = m_geometry->getAlpha(cache.frameIndex, time);
 
 		fillIntersectionRecord(Ray(Point(0.0f), its.toWorld(-its.wi), time), &cache, its);
 	}
 
 
 	AABB getAABB() const {
-		return m_kdtree->getSpatialAABB();
+		return m_geometry->getSpatialAABB();
 	}
 
 	size_t getPrimitiveCount() const {
-		return m_kdtree->getPrimitiveCount();
+		return m_geometry->getTriangleCount();
 	}
 
 	size_t getEffectivePrimitiveCount() const {
-		return m_kdtree->getPrimitiveCount();
+		return m_geometry->getTriangleCount();
 	}
 
 	void addChild(const std::string &name, ConfigurableObject *child) {
 		if (child->getClass()->derivesFrom(MTS_CLASS(Shape)))
-			m_kdtree->addShape(static_cast<Shape *>(child));
+			m_geometry->addShape(static_cast<Shape *>(child));
 		else
 			Shape::addChild(name, child);
 	}
 
 	ref<TriMesh> createTriMesh() {
-		return const_cast<TriMesh *>(m_kdtree->getMesh(0, 0));
+		return const_cast<TriMesh *>(m_geometry->getMesh(0, 0));
 	}
 
 	std::string toString() const {
 		std::ostringstream oss;
 		oss << "Deformable[" << endl
-			<< "   primitiveCount = " << m_kdtree->getPrimitiveCount() << "," << endl
-			<< "   timeCount = " << m_kdtree->getTimeCount() << "," << endl
-			<< "   aabb = " << indent(m_kdtree->getSpatialAABB().toString()) << endl
+			<< "   primitiveCount = " << m_geometry->getTriangleCount() << "," << endl
+			<< "   timeCount = " << m_geometry->getTimeCount() << "," << endl
+			<< "   accel = " << (m_bvh.get() ? "bvh" : "kdtree") << "," << endl
+			<< "   aabb = " << indent(m_geometry->getSpatialAABB().toString()) << endl
 			<< "]";
 		return oss.str();
 	}
@@ -686,9 +1304,12 @@ public:
 	MTS_DECLARE_CLASS()
 private:
 	ref<SpaceTimeKDTree> m_kdtree;
+	ref<MotionBVH> m_bvh;
+	DeformableGeometry *m_geometry;
 };
 
 MTS_IMPLEMENT_CLASS_S(SpaceTimeKDTree, false, KDTreeBase)
+MTS_IMPLEMENT_CLASS(MotionBVH, false, Object)
 MTS_IMPLEMENT_CLASS_S(Deformable, false, Shape)
 MTS_EXPORT_PLUGIN(Deformable, "Deformable shape");
 MTS_NAMESPACE_END
@@ -26,10 +26,37 @@
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/filesystem.h>
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
 #include <fstream>
+#include <thread>
 
 #define MTS_HAIR_USE_FANCY_CLIPPING 1
 
+/// Identifier, version, strand and vertex count of the indexed format
+#define MTS_HAIR_INDEXED_HEADER_SIZE 32
+#define MTS_HAIR_INDEXED_VERSION 1
+/// Minimum number of strands processed by a thread when loading indexed files
+#define MTS_HAIR_PARALLEL_GRAINSIZE 4096
+
+/// Number of bins per axis used to evaluate the SAH when building a \ref HairBVH
+#define MTS_HAIR_BVH_BINS 16
+/// Maximum number of segments stored in a leaf (unless they can't be separated)
+#define MTS_HAIR_BVH_MAX_LEAF 8
+/// Relative costs of visiting a node and of a segment intersection test
+#define MTS_HAIR_BVH_TRAVERSAL_COST 1.0f
+#define MTS_HAIR_BVH_QUERY_COST 2.0f
+/// Use oriented bounds when their surface area is below this fraction of the axis-aligned ones
+#define MTS_HAIR_BVH_ORIENTED_RATIO 0.8f
+/// Subtrees below this depth are split at the median
+#define MTS_HAIR_BVH_MAXDEPTH 64
+#define MTS_HAIR_BVH_STACK_SIZE 128
+/// Minimum number of segments for building the subtrees of a node in parallel
+#define MTS_HAIR_BVH_PARALLEL_THRESHOLD 65536
+/// Padding of the node bounds relative to the magnitude of the scene coordinates
+#define MTS_HAIR_BVH_PADDING 1e-5f
+
 MTS_NAMESPACE_BEGIN
 
 /*!\plugin{hair}{Hair intersection shape}
@@ -61,6 +88,19 @@ MTS_NAMESPACE_BEGIN
  *        Note that non-uniform scales are not permitted!
  *        \default{none, i.e. object space $=$ world space}
  *     }
+ *     \parameter{accel}{\String}{
+ *       Acceleration data structure used to intersect the hair segments:
+ *       \begin{enumerate}[(i)]
+ *           \item \code{kdtree}: A kd-tree over (clipped) axis-aligned boxes,
+ *           which is loose for diagonal strands.
+ *           \item \code{bvh}: A bounding volume hierarchy, whose nodes are
+ *           bounded by boxes aligned with the dominant direction of the
+ *           strands below them where this pays off. It is currently slower
+ *           to traverse than the kd-tree, and the kd-tree visualization of
+ *           the interactive walkthrough is not available with it.
+ *       \end{enumerate}
+ *       \default{\code{kdtree}}
+ *     }
  * }
  * \renderings{
  *     \centering
@@ -98,32 +138,239 @@ MTS_NAMESPACE_BEGIN
  * single-precision XYZ coordinates (again in little-endian byte ordering).
  * To mark the beginning of a new hair strand, a single $+\infty$ floating
  * point value can be inserted between the vertex data.
+ *
+ * Large hair assets are best stored in the indexed binary format, which
+ * is mapped into memory and decoded using several threads. It starts with
+ * the identifier ``\texttt{INDEXED\_HAIR}'' (12 bytes), followed by the
+ * format version (currently 1) as a 32-bit integer, and by the number
+ * of strands $n$ and the total number of vertices as 64-bit integers.
+ * This header is followed by $n+1$ 64-bit offsets, where the vertices of
+ * the $i$-th strand are those with indices between the $i$-th (inclusive)
+ * and the $(i+1)$-th offset (exclusive). The first offset must be zero and
+ * the last one must equal the number of vertices. The remainder of the file
+ * contains the vertex positions as single-precision XYZ coordinates. All
+ * values use little-endian byte ordering. The \code{hairconv} utility
+ * (``\code{mtsutil hairconv input output}'') converts the other two formats
+ * into this one.
  */
 
-class HairKDTree : public SAHKDTree3D<HairKDTree> {
-	friend class GenericKDTree<AABB, SurfaceAreaHeuristic3, HairKDTree>;
-	friend class SAHKDTree3D<HairKDTree>;
+static StatsCounter segmentTests("Hair", "Segment intersection tests per ray", EAverage);
+
+/**
+ * \brief Vertex data of a hair shape along with the geometric queries
+ * involving its cylindrical segments. This is shared by the acceleration
+ * data structures below.
+ */
+class HairGeometry {
 public:
-	using SAHKDTree3D<HairKDTree>::IndexType;
-	using SAHKDTree3D<HairKDTree>::SizeType;
+	typedef uint32_t IndexType;
 
-	HairKDTree(std::vector<Point> &vertices,
+	struct IntersectionStorage {
+		IndexType iv;
+		Point p;
+	};
+
+	HairGeometry(std::vector<Point> &vertices,
 			std::vector<bool> &vertexStartsFiber, Float radius)
-			: m_radius(radius) {
+			: m_segmentCount(0), m_hairCount(0), m_radius(radius) {
 		/* Take the supplied vertex & start fiber arrays (without copying) */
 		m_vertices.swap(vertices);
 		m_vertexStartsFiber.swap(vertexStartsFiber);
-		m_hairCount = 0;
 
-		/* Compute the index of the first vertex in each segment. */
-		m_segIndex.reserve(m_vertices.size());
-		for (size_t i=0; i<m_vertices.size()-1; i++) {
+		for (size_t i=0; i+1<m_vertices.size(); i++) {
 			if (m_vertexStartsFiber[i])
 				m_hairCount++;
+			if (!m_vertexStartsFiber[i+1])
+				m_segmentCount++;
+		}
+	}
+
+	/// Return the list of vertices underlying the hair geometry
+	inline const std::vector<Point> &getVertices() const {
+		return m_vertices;
+	}
+
+	/**
+	 * Return a boolean list specifying whether a vertex
+	 * marks the beginning of a new fiber
+	 */
+	inline const std::vector<bool> &getStartFiber() const {
+		return m_vertexStartsFiber;
+	}
+
+	/// Return the radius of the hairs
+	inline Float getRadius() const {
+		return m_radius;
+	}
+
+	/// Return the total number of segments
+	inline size_t getSegmentCount() const {
+		return m_segmentCount;
+	}
+
+	/// Return the total number of hairs
+	inline size_t getHairCount() const {
+		return m_hairCount;
+	}
+
+	/// Return the total number of vertices
+	inline size_t getVertexCount() const {
+		return m_vertices.size();
+	}
+
+	/**
+	 * \brief Return the distance by which the end points of a segment must be
+	 * expanded along every axis so that the resulting box contains the segment
+	 */
+	inline Float getSegmentExtent(IndexType iv) const {
+		// cosine of steepest miter angle
+		const Float cos0 = dot(firstMiterNormal(iv), tangent(iv));
+		const Float cos1 = dot(secondMiterNormal(iv), tangent(iv));
+		return m_radius / std::min(cos0, cos1);
+	}
+
+	inline bool intersect(const Ray &ray, IndexType iv,
+		Float mint, Float maxt, Float &t, void *tmp) const {
+		++segmentTests;
+
+		/* First compute the intersection with the infinite cylinder */
+		Vector3d axis = tangentDouble(iv);
+
+		// Projection of ray onto subspace normal to axis
+		Point3d rayO(ray.o);
+		Vector3d rayD(ray.d);
+		Point3d v1 = firstVertexDouble(iv);
+
+		Vector3d relOrigin = rayO - v1;
+		Vector3d projOrigin = relOrigin - dot(axis, relOrigin) * axis;
+		Vector3d projDirection = rayD - dot(axis, rayD) * axis;
+
+		// Quadratic to intersect circle in projection
+		const double A = projDirection.lengthSquared();
+		const double B = 2 * dot(projOrigin, projDirection);
+		const double C = projOrigin.lengthSquared() - m_radius*m_radius;
+
+		double nearT, farT;
+		if (!solveQuadraticDouble(A, B, C, nearT, farT))
+			return false;
+
+		if (!(nearT <= maxt && farT >= mint)) /* NaN-aware conditionals */
+			return false;
+
+		/* Next check the intersection points against the miter planes */
+		Point3d pointNear = rayO + rayD * nearT;
+		Point3d pointFar = rayO + rayD * farT;
+
+		Vector3d n1 = firstMiterNormalDouble(iv);
+		Vector3d n2 = secondMiterNormalDouble(iv);
+		Point3d v2 = secondVertexDouble(iv);
+		IntersectionStorage *storage = static_cast<IntersectionStorage *>(tmp);
+		Point p;
+
+		if (dot(pointNear - v1, n1) >= 0 &&
+			dot(pointNear - v2, n2) <= 0 &&
+			nearT >= mint) {
+			p = Point(rayO + rayD * nearT);
+			t = (Float) nearT;
+		} else if (dot(pointFar - v1, n1) >= 0 &&
+		           dot(pointFar - v2, n2) <= 0) {
+			if (farT > maxt)
+				return false;
+			p = Point(rayO + rayD * farT);
+			t = (Float) farT;
+		} else {
+			return false;
+		}
+
+		if (storage) {
+			storage->iv = iv;
+			storage-> p = p;
+		}
+
+		return true;
+	}
+
+	inline bool intersect(const Ray &ray, IndexType iv,
+		Float mint, Float maxt) const {
+		Float tempT;
+		return intersect(ray, iv, mint, maxt, tempT, NULL);
+	}
+
+	/* Some utility functions */
+	inline Point firstVertex(IndexType iv) const { return m_vertices[iv]; }
+	inline Point3d firstVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv]); }
+	inline Point secondVertex(IndexType iv) const { return m_vertices[iv+1]; }
+	inline Point3d secondVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv+1]); }
+	inline Point prevVertex(IndexType iv) const { return m_vertices[iv-1]; }
+	inline Point3d prevVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv-1]); }
+	inline Point nextVertex(IndexType iv) const { return m_vertices[iv+2]; }
+	inline Point3d nextVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv+2]); }
+
+	inline bool prevSegmentExists(IndexType iv) const { return !m_vertexStartsFiber[iv]; }
+	inline bool nextSegmentExists(IndexType iv) const { return !m_vertexStartsFiber[iv+2]; }
+
+	inline Vector tangent(IndexType iv) const { return normalize(secondVertex(iv) - firstVertex(iv)); }
+	inline Vector3d tangentDouble(IndexType iv) const { return normalize(Vector3d(secondVertex(iv)) - Vector3d(firstVertex(iv))); }
+	inline Vector prevTangent(IndexType iv) const { return normalize(firstVertex(iv) - prevVertex(iv)); }
+	inline Vector3d prevTangentDouble(IndexType iv) const { return normalize(firstVertexDouble(iv) - prevVertexDouble(iv)); }
+	inline Vector nextTangent(IndexType iv) const { return normalize(nextVertex(iv) - secondVertex(iv)); }
+	inline Vector3d nextTangentDouble(IndexType iv) const { return normalize(nextVertexDouble(iv) - secondVertexDouble(iv)); }
+
+	inline Vector firstMiterNormal(IndexType iv) const {
+		if (prevSegmentExists(iv))
+			return normalize(prevTangent(iv) + tangent(iv));
+		else
+			return tangent(iv);
+	}
+
+	inline Vector secondMiterNormal(IndexType iv) const {
+		if (nextSegmentExists(iv))
+			return normalize(tangent(iv) + nextTangent(iv));
+		else
+			return tangent(iv);
+	}
+
+	inline Vector3d firstMiterNormalDouble(IndexType iv) const {
+		if (prevSegmentExists(iv))
+			return normalize(prevTangentDouble(iv) + tangentDouble(iv));
+		else
+			return tangentDouble(iv);
+	}
+
+	inline Vector3d secondMiterNormalDouble(IndexType iv) const {
+		if (nextSegmentExists(iv))
+			return normalize(tangentDouble(iv) + nextTangentDouble(iv));
+		else
+			return tangentDouble(iv);
+	}
+protected:
+	std::vector<Point> m_vertices;
+	std::vector<bool> m_vertexStartsFiber;
+	size_t m_segmentCount;
+	size_t m_hairCount;
+	Float m_radius;
+};
+
+/**
+ * \brief SAH kd-tree over hair segments, which are bounded using
+ * (clipped) axis-aligned boxes
+ */
+class HairKDTree : public SAHKDTree3D<HairKDTree>, public HairGeometry {
+	friend class GenericKDTree<AABB, SurfaceAreaHeuristic3, HairKDTree>;
+	friend class SAHKDTree3D<HairKDTree>;
+public:
+	using SAHKDTree3D<HairKDTree>::IndexType;
+	using SAHKDTree3D<HairKDTree>::SizeType;
+
+	HairKDTree(std::vector<Point> &vertices,
+			std::vector<bool> &vertexStartsFiber, Float radius)
+			: HairGeometry(vertices, vertexStartsFiber, radius) {
+		/* Compute the index of the first vertex in each segment. */
+		m_segIndex.reserve(m_segmentCount);
+		for (size_t i=0; i+1<m_vertices.size(); i++) {
 			if (!m_vertexStartsFiber[i+1])
 				m_segIndex.push_back((IndexType) i);
 		}
-		m_segmentCount = m_segIndex.size();
 
 		Log(EDebug, "Building a kd-tree for " SIZE_T_FMT " hair vertices, "
 			SIZE_T_FMT " segments, " SIZE_T_FMT " hairs",
@@ -147,8 +394,8 @@ public:
 		Log(EDebug, "Total amount of storage (kd-tree & vertex data): %s",
 			memString(m_nodeCount * sizeof(KDNode)
 			+ m_indexCount * sizeof(IndexType)
-			+ vertices.size() * sizeof(Point)
-			+ vertexStartsFiber.size() / 8).c_str());
+			+ m_vertices.size() * sizeof(Point)
+			+ m_vertexStartsFiber.size() / 8).c_str());
 
 		/* Optimization: replace all primitive indices by the
 		   associated vertex indices (this avoids an extra
@@ -165,39 +412,6 @@ public:
 		return m_aabb;
 	}
 
-	/// Return the list of vertices underlying the hair kd-tree
-	inline const std::vector<Point> &getVertices() const {
-		return m_vertices;
-	}
-
-	/**
-	 * Return a boolean list specifying whether a vertex
-	 * marks the beginning of a new fiber
-	 */
-	inline const std::vector<bool> &getStartFiber() const {
-		return m_vertexStartsFiber;
-	}
-
-	/// Return the radius of the hairs stored in the kd-tree
-	inline Float getRadius() const {
-		return m_radius;
-	}
-
-	/// Return the total number of segments
-	inline size_t getSegmentCount() const {
-		return m_segmentCount;
-	}
-
-	/// Return the total number of hairs
-	inline size_t getHairCount() const {
-		return m_hairCount;
-	}
-
-	/// Return the total number of vertices
-	inline size_t getVertexCount() const {
-		return m_vertices.size();
-	}
-
 	/// Intersect a ray with all segments stored in the kd-tree
 	inline bool rayIntersect(const Ray &ray, Float _mint, Float _maxt,
 			Float &t, void *temp) const {
@@ -448,12 +662,7 @@ public:
 	/// Compute the AABB of a segment (only used during tree construction)
 	AABB getAABB(IndexType index) const {
 		IndexType iv = m_segIndex[index];
-
-		// cosine of steepest miter angle
-		const Float cos0 = dot(firstMiterNormal(iv), tangent(iv));
-		const Float cos1 = dot(secondMiterNormal(iv), tangent(iv));
-		const Float maxInvCos = 1.0 / std::min(cos0, cos1);
-		const Vector expandVec(m_radius * maxInvCos);
+		const Vector expandVec(getSegmentExtent(iv));
 
 		const Point a = firstVertex(iv);
 		const Point b = secondVertex(iv);
@@ -479,133 +688,516 @@ public:
 		return (SizeType) m_segIndex.size();
 	}
 
-	struct IntersectionStorage {
+	MTS_DECLARE_CLASS()
+protected:
+	std::vector<IndexType> m_segIndex;
+};
+
+/**
+ * \brief Bounding volume hierarchy over hair segments with oriented bounds
+ *
+ * The axis-aligned boxes used by \ref HairKDTree are mostly empty for long
+ * diagonal segments, which causes many unnecessary segment intersection
+ * tests. The nodes of this hierarchy are instead bounded by boxes that are
+ * aligned with the dominant direction of the segments below them, whenever
+ * this noticeably reduces their surface area (similar to "Exploiting Local
+ * Orientation Similarity for Efficient Ray Traversal of Hair and Fur" by
+ * Woop et al.). Splits are chosen using a binned surface area heuristic in
+ * the coordinate system of the node, which tends to group neighboring
+ * segments of similarly oriented strands.
+ */
+class HairBVH : public Object, public HairGeometry {
+public:
+	HairBVH(std::vector<Point> &vertices,
+			std::vector<bool> &vertexStartsFiber, Float radius)
+			: HairGeometry(vertices, vertexStartsFiber, radius) {
+		Log(EDebug, "Building a BVH for " SIZE_T_FMT " hair vertices, "
+			SIZE_T_FMT " segments, " SIZE_T_FMT " hairs",
+			m_vertices.size(), m_segmentCount, m_hairCount);
+		ref<Timer> timer = new Timer();
+
+		std::vector<BuildItem> items;
+		items.reserve(m_segmentCount);
+		for (size_t i=0; i+1<m_vertices.size(); i++) {
+			if (m_vertexStartsFiber[i+1])
+				continue;
+			BuildItem item;
+			item.iv = (IndexType) i;
+			item.extent = getSegmentExtent(item.iv);
+			m_aabb.expandBy(getBounds(item, NULL));
+			items.push_back(item);
+		}
+
+		/* Bounds are padded to account for roundoff errors when
+		   transforming rays into the coordinate system of a node */
+		m_padding = 0;
+		if (m_aabb.isValid()) {
+			for (int i=0; i<3; ++i)
+				m_padding = std::max(m_padding, std::max(
+					std::abs(m_aabb.min[i]), std::abs(m_aabb.max[i])));
+			m_padding *= MTS_HAIR_BVH_PADDING;
+		}
+
+		if (!items.empty()) {
+			Subtree tree;
+			tree.nodes.resize(1);
+			build(tree, &items[0], 0, items.size(), 0, 0);
+			m_nodes.swap(tree.nodes);
+			m_frames.swap(tree.frames);
+		}
+
+		m_indices.resize(items.size());
+		for (size_t i=0; i<items.size(); ++i)
+			m_indices[i] = items[i].iv;
+
+		Log(EDebug, "Created " SIZE_T_FMT " nodes (" SIZE_T_FMT " oriented) in %i ms",
+			m_nodes.size(), m_frames.size(), timer->getMilliseconds());
+		Log(EDebug, "Total amount of storage (BVH & vertex data): %s",
+			memString(m_nodes.size() * sizeof(Node)
+			+ m_frames.size() * sizeof(Frame)
+			+ m_indices.size() * sizeof(IndexType)
+			+ m_vertices.size() * sizeof(Point)
+			+ m_vertexStartsFiber.size() / 8).c_str());
+	}
+
+	/// Return the AABB of all segments
+	inline const AABB &getAABB() const {
+		return m_aabb;
+	}
+
+	/// Return the number of nodes
+	inline size_t getNodeCount() const {
+		return m_nodes.size();
+	}
+
+	/// Return the number of nodes with oriented bounds
+	inline size_t getOrientedNodeCount() const {
+		return m_frames.size();
+	}
+
+	/// Intersect a ray with all segments stored in the BVH
+	inline bool rayIntersect(const Ray &ray, Float mint, Float maxt,
+			Float &t, void *temp) const {
+		return rayIntersectInternal<false>(ray, mint, maxt, t, temp);
+	}
+
+	/**
+	 * \brief Intersect a ray with all segments stored in the BVH
+	 * (Visiblity query version)
+	 */
+	inline bool rayIntersect(const Ray &ray, Float mint, Float maxt) const {
+		Float t;
+		return rayIntersectInternal<true>(ray, mint, maxt, t, NULL);
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	enum {
+		/// Frame index of nodes with axis-aligned bounds
+		EAxisAligned = 0xFFFFFFFFu
+	};
+
+	struct Node {
+		/// Bounds of the segments in the coordinate system of the node
+		Point min, max;
+		/// Index of the node's frame, or \c EAxisAligned
+		uint32_t frame;
+		/// Index of the first child (inner nodes) or of the first segment (leaves)
+		uint32_t data;
+		/// Number of segments (zero for inner nodes)
+		uint32_t primCount;
+	};
+
+	/// Per-segment information used during the build
+	struct BuildItem {
 		IndexType iv;
-		Point p;
+		/// See \ref getSegmentExtent()
+		Float extent;
 	};
 
-	inline bool intersect(const Ray &ray, IndexType iv,
-		Float mint, Float maxt, Float &t, void *tmp) const {
-		/* First compute the intersection with the infinite cylinder */
-		Vector3d axis = tangentDouble(iv);
+	/// Nodes and frames of a subtree, which may be built by a separate thread
+	struct Subtree {
+		std::vector<Node> nodes;
+		std::vector<Frame> frames;
+	};
 
-		// Projection of ray onto subspace normal to axis
-		Point3d rayO(ray.o);
-		Vector3d rayD(ray.d);
-		Point3d v1 = firstVertexDouble(iv);
+	struct Bin {
+		AABB aabb;
+		size_t count;
+	};
 
-		Vector3d relOrigin = rayO - v1;
-		Vector3d projOrigin = relOrigin - dot(axis, relOrigin) * axis;
-		Vector3d projDirection = rayD - dot(axis, rayD) * axis;
+	/// Return the bounds of a segment in the coordinate system of \c frame (world space if \c NULL)
+	inline AABB getBounds(const BuildItem &item, const Frame *frame) const {
+		Vector a(m_vertices[item.iv]), b(m_vertices[item.iv+1]);
+		if (frame) {
+			a = frame->toLocal(a);
+			b = frame->toLocal(b);
+		}
+		AABB aabb = AABB(Point(a));
+		aabb.expandBy(Point(b));
+		aabb.min -= Vector(item.extent);
+		aabb.max += Vector(item.extent);
+		return aabb;
+	}
 
-		// Quadratic to intersect circle in projection
-		const double A = projDirection.lengthSquared();
-		const double B = 2 * dot(projOrigin, projDirection);
-		const double C = projOrigin.lengthSquared() - m_radius*m_radius;
+	/// Return the center of a segment in the coordinate system of \c frame (world space if \c NULL)
+	inline Point getCentroid(const BuildItem &item, const Frame *frame) const {
+		Vector center = (Vector(m_vertices[item.iv]) + Vector(m_vertices[item.iv+1])) * 0.5f;
+		return Point(frame ? frame->toLocal(center) : center);
+	}
 
-		double nearT, farT;
-		if (!solveQuadraticDouble(A, B, C, nearT, farT))
-			return false;
+	/// Recursively build the subtree over <tt>items[start..end)</tt> into the given node
+	void build(Subtree &tree, BuildItem *items, size_t start,
+			size_t end, int depth, size_t nodeIndex) const {
+		/* Bound the segments using an axis-aligned box and a box
+		   aligned with their dominant direction */
+		AABB aabb, centroidAABB;
+		Vector dir(0.0f);
+		for (size_t i=start; i<end; ++i) {
+			const BuildItem &item = items[i];
+			aabb.expandBy(getBounds(item, NULL));
+			centroidAABB.expandBy(getCentroid(item, NULL));
+			Vector d = m_vertices[item.iv+1] - m_vertices[item.iv];
+			dir += dot(d, dir) < 0 ? -d : d;
+		}
 
-		if (!(nearT <= maxt && farT >= mint)) /* NaN-aware conditionals */
-			return false;
+		Frame frame;
+		AABB obb, centroidOBB;
+		bool oriented = false;
+		if (!dir.isZero()) {
+			frame = Frame(normalize(dir));
+			for (size_t i=start; i<end; ++i) {
+				obb.expandBy(getBounds(items[i], &frame));
+				centroidOBB.expandBy(getCentroid(items[i], &frame));
+			}
+			oriented = obb.getSurfaceArea() <
+				MTS_HAIR_BVH_ORIENTED_RATIO * aabb.getSurfaceArea();
+		}
 
-		/* Next check the intersection points against the miter planes */
-		Point3d pointNear = rayO + rayD * nearT;
-		Point3d pointFar = rayO + rayD * farT;
+		const Frame *space = oriented ? &frame : NULL;
+		const AABB &bounds = oriented ? obb : aabb;
+		const AABB &centroidBounds = oriented ? centroidOBB : centroidAABB;
+
+		size_t mid = 0;
+		Node node;
+		node.min = bounds.min - Vector(m_padding);
+		node.max = bounds.max + Vector(m_padding);
+		node.frame = EAxisAligned;
+		if (oriented) {
+			node.frame = (uint32_t) tree.frames.size();
+			tree.frames.push_back(frame);
+		}
 
-		Vector3d n1 = firstMiterNormalDouble(iv);
-		Vector3d n2 = secondMiterNormalDouble(iv);
-		Point3d v2 = secondVertexDouble(iv);
-		IntersectionStorage *storage = static_cast<IntersectionStorage *>(tmp);
-		Point p;
+		if (!split(items, start, end, depth, space, bounds, centroidBounds, mid)) {
+			node.data = (uint32_t) start;
+			node.primCount = (uint32_t) (end - start);
+			tree.nodes[nodeIndex] = node;
+			return;
+		}
 
-		if (dot(pointNear - v1, n1) >= 0 &&
-			dot(pointNear - v2, n2) <= 0 &&
-			nearT >= mint) {
-			p = Point(rayO + rayD * nearT);
-			t = (Float) nearT;
-		} else if (dot(pointFar - v1, n1) >= 0 &&
-		           dot(pointFar - v2, n2) <= 0) {
-			if (farT > maxt)
-				return false;
-			p = Point(rayO + rayD * farT);
-			t = (Float) farT;
+		/* The children are stored next to each other */
+		size_t children = tree.nodes.size();
+		node.data = (uint32_t) children;
+		node.primCount = 0;
+		tree.nodes[nodeIndex] = node;
+		tree.nodes.resize(children + 2);
+
+		if (end - start >= MTS_HAIR_BVH_PARALLEL_THRESHOLD && depth < 16 && (1 << depth) < getCoreCount()) {
+			/* Build the right subtree in parallel and append it afterwards */
+			Subtree right;
+			right.nodes.resize(1);
+			std::thread worker([&] { build(right, items, mid, end, depth+1, 0); });
+			build(tree, items, start, mid, depth+1, children);
+			worker.join();
+
+			/* The root of the right subtree goes into the reserved slot */
+			uint32_t nodeOffset = (uint32_t) tree.nodes.size() - 1,
+			         frameOffset = (uint32_t) tree.frames.size();
+			for (size_t i=0; i<right.nodes.size(); ++i) {
+				Node child = right.nodes[i];
+				if (child.primCount == 0)
+					child.data += nodeOffset;
+				if (child.frame != EAxisAligned)
+					child.frame += frameOffset;
+				if (i == 0)
+					tree.nodes[children + 1] = child;
+				else
+					tree.nodes.push_back(child);
+			}
+			tree.frames.insert(tree.frames.end(), right.frames.begin(), right.frames.end());
 		} else {
+			build(tree, items, start, mid, depth+1, children);
+			build(tree, items, mid, end, depth+1, children + 1);
+		}
+	}
+
+	/**
+	 * \brief Partition <tt>items[start..end)</tt> using the binned SAH in the
+	 * given coordinate system. Returns \c false if a leaf should be created.
+	 */
+	bool split(BuildItem *items, size_t start, size_t end, int depth,
+			const Frame *space, const AABB &bounds, const AABB &centroidBounds,
+			size_t &mid) const {
+		size_t count = end - start;
+		int axis = centroidBounds.getLargestAxis();
+		Float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		if (count == 1 || !(extent > 0))
 			return false;
+
+		if (depth >= MTS_HAIR_BVH_MAXDEPTH) {
+			/* Degenerate input -- split at the median to bound the depth */
+			if (count <= MTS_HAIR_BVH_MAX_LEAF)
+				return false;
+			mid = start + count / 2;
+			std::nth_element(items + start, items + mid, items + end,
+				[&](const BuildItem &a, const BuildItem &b) {
+					return getCentroid(a, space)[axis] < getCentroid(b, space)[axis];
+				});
+			return true;
 		}
 
-		if (storage) {
-			storage->iv = iv;
-			storage-> p = p;
+		Bin bins[3][MTS_HAIR_BVH_BINS];
+		Float scale[3];
+		for (int k=0; k<3; ++k) {
+			Float range = centroidBounds.max[k] - centroidBounds.min[k];
+			scale[k] = range > 0 ? MTS_HAIR_BVH_BINS / range : 0;
+			for (int j=0; j<MTS_HAIR_BVH_BINS; ++j) {
+				bins[k][j].aabb.reset();
+				bins[k][j].count = 0;
+			}
 		}
 
-		return true;
+		for (size_t i=start; i<end; ++i) {
+			AABB aabb = getBounds(items[i], space);
+			Point centroid = getCentroid(items[i], space);
+			for (int k=0; k<3; ++k) {
+				if (scale[k] == 0)
+					continue;
+				int index = std::min(MTS_HAIR_BVH_BINS - 1,
+					(int) ((centroid[k] - centroidBounds.min[k]) * scale[k]));
+				bins[k][index].aabb.expandBy(aabb);
+				bins[k][index].count++;
+			}
+		}
+
+		/* Sweep over all bin boundaries */
+		Float bestCost = std::numeric_limits<Float>::infinity(),
+		      invArea = 1 / bounds.getSurfaceArea();
+		int bestAxis = -1, bestSplit = -1;
+		for (int k=0; k<3; ++k) {
+			if (scale[k] == 0)
+				continue;
+			Float rightCost[MTS_HAIR_BVH_BINS];
+			AABB aabb;
+			size_t binCount = 0;
+			for (int j=MTS_HAIR_BVH_BINS-1; j>0; --j) {
+				aabb.expandBy(bins[k][j].aabb);
+				binCount += bins[k][j].count;
+				rightCost[j] = binCount > 0 ? aabb.getSurfaceArea() * binCount : 0;
+			}
+			aabb.reset();
+			binCount = 0;
+			for (int j=0; j<MTS_HAIR_BVH_BINS-1; ++j) {
+				aabb.expandBy(bins[k][j].aabb);
+				binCount += bins[k][j].count;
+				if (binCount == 0 || binCount == count)
+					continue;
+				Float cost = MTS_HAIR_BVH_TRAVERSAL_COST + MTS_HAIR_BVH_QUERY_COST
+					* (aabb.getSurfaceArea() * binCount + rightCost[j+1]) * invArea;
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = k;
+					bestSplit = j;
+				}
+			}
+		}
+
+		if (bestAxis == -1 || (count <= MTS_HAIR_BVH_MAX_LEAF
+				&& count * MTS_HAIR_BVH_QUERY_COST <= bestCost))
+			return false;
+
+		BuildItem *midPtr = std::partition(items + start, items + end,
+			[&](const BuildItem &item) {
+				Float value = getCentroid(item, space)[bestAxis];
+				int index = std::min(MTS_HAIR_BVH_BINS - 1,
+					(int) ((value - centroidBounds.min[bestAxis]) * scale[bestAxis]));
+				return index <= bestSplit;
+			});
+		mid = midPtr - items;
+		return mid != start && mid != end;
 	}
 
-	inline bool intersect(const Ray &ray, IndexType iv,
-		Float mint, Float maxt) const {
-		Float tempT;
-		return intersect(ray, iv, mint, maxt, tempT, NULL);
+	/**
+	 * \brief Clip a ray segment against the bounds of a node (given in the
+	 * node's coordinate system). NaNs due to zero direction components are
+	 * discarded by the comparisons, in which case the slab does not clip.
+	 */
+	static inline bool intersectBounds(const Node &node, const Vector &o,
+			const Vector &dRcp, Float mint, Float maxt, Float &nearT) {
+		for (int i=0; i<3; ++i) {
+			Float t1 = (node.min[i] - o[i]) * dRcp[i],
+			      t2 = (node.max[i] - o[i]) * dRcp[i];
+			mint = std::max(mint, std::min(t1, t2));
+			maxt = std::min(maxt, std::max(t1, t2));
+		}
+		nearT = mint;
+		return mint <= maxt;
 	}
 
-	/* Some utility functions */
-	inline Point firstVertex(IndexType iv) const { return m_vertices[iv]; }
-	inline Point3d firstVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv]); }
-	inline Point secondVertex(IndexType iv) const { return m_vertices[iv+1]; }
-	inline Point3d secondVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv+1]); }
-	inline Point prevVertex(IndexType iv) const { return m_vertices[iv-1]; }
-	inline Point3d prevVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv-1]); }
-	inline Point nextVertex(IndexType iv) const { return m_vertices[iv+2]; }
-	inline Point3d nextVertexDouble(IndexType iv) const { return Point3d(m_vertices[iv+2]); }
+	/// Intersect a ray with the bounds of a node
+	inline bool intersectNode(const Node &node, const Ray &ray,
+			Float mint, Float maxt, Float &nearT) const {
+		if (node.frame == EAxisAligned)
+			return intersectBounds(node, Vector(ray.o), ray.dRcp, mint, maxt, nearT);
 
-	inline bool prevSegmentExists(IndexType iv) const { return !m_vertexStartsFiber[iv]; }
-	inline bool nextSegmentExists(IndexType iv) const { return !m_vertexStartsFiber[iv+2]; }
+		const Frame &frame = m_frames[node.frame];
+		Vector o = frame.toLocal(Vector(ray.o)), d = frame.toLocal(ray.d);
+		Vector dRcp(1 / d.x, 1 / d.y, 1 / d.z);
+		return intersectBounds(node, o, dRcp, mint, maxt, nearT);
+	}
 
-	inline Vector tangent(IndexType iv) const { return normalize(secondVertex(iv) - firstVertex(iv)); }
-	inline Vector3d tangentDouble(IndexType iv) const { return normalize(Vector3d(secondVertex(iv)) - Vector3d(firstVertex(iv))); }
-	inline Vector prevTangent(IndexType iv) const { return normalize(firstVertex(iv) - prevVertex(iv)); }
-	inline Vector3d prevTangentDouble(IndexType iv) const { return normalize(firstVertexDouble(iv) - prevVertexDouble(iv)); }
-	inline Vector nextTangent(IndexType iv) const { return normalize(nextVertex(iv) - secondVertex(iv)); }
-	inline Vector3d nextTangentDouble(IndexType iv) const { return normalize(nextVertexDouble(iv) - secondVertexDouble(iv)); }
+	template <bool shadowRay> bool rayIntersectInternal(const Ray &ray, Float mint,
+			Float maxt, Float &t, void *temp) const {
+		struct StackEntry {
+			uint32_t node;
+			Float nearT;
+		} stack[MTS_HAIR_BVH_STACK_SIZE];
+		int stackSize = 0;
+		bool found = false;
+		Float nearT;
+
+		if (m_nodes.empty() || !intersectNode(m_nodes[0], ray, mint, maxt, nearT))
+			return false;
 
-	inline Vector firstMiterNormal(IndexType iv) const {
-		if (prevSegmentExists(iv))
-			return normalize(prevTangent(iv) + tangent(iv));
-		else
-			return tangent(iv);
-	}
+		uint32_t index = 0;
+		while (true) {
+			const Node &node = m_nodes[index];
+			if (node.primCount == 0) {
+				Float nearLeft, nearRight;
+				bool hitLeft = intersectNode(m_nodes[node.data], ray, mint, maxt, nearLeft);
+				bool hitRight = intersectNode(m_nodes[node.data+1], ray, mint, maxt, nearRight);
+
+				if (hitLeft && hitRight) {
+					/* Visit the closer child first */
+					StackEntry &entry = stack[stackSize++];
+					if (nearLeft <= nearRight) {
+						entry.node = node.data + 1;
+						entry.nearT = nearRight;
+						index = node.data;
+					} else {
+						entry.node = node.data;
+						entry.nearT = nearLeft;
+						index = node.data + 1;
+					}
+					continue;
+				} else if (hitLeft) {
+					index = node.data;
+					continue;
+				} else if (hitRight) {
+					index = node.data + 1;
+					continue;
+				}
+			} else {
+				for (uint32_t i=0; i<node.primCount; ++i) {
+					Float tempT;
+					if (intersect(ray, m_indices[node.data + i], mint, maxt, tempT, temp)) {
+						if (shadowRay)
+							return true;
+						maxt = tempT;
+						found = true;
+					}
+				}
+			}
 
-	inline Vector secondMiterNormal(IndexType iv) const {
-		if (nextSegmentExists(iv))
-			return normalize(tangent(iv) + nextTangent(iv));
-		else
-			return tangent(iv);
+			/* Continue with the next node that may contain a closer intersection */
+			bool next = false;
+			while (stackSize > 0 && !next) {
+				const StackEntry &entry = stack[--stackSize];
+				if (entry.nearT <= maxt) {
+					index = entry.node;
+					next = true;
+				}
+			}
+			if (!next)
+				break;
+		}
+
+		if (found)
+			t = maxt;
+		return found;
 	}
 
-	inline Vector3d firstMiterNormalDouble(IndexType iv) const {
-		if (prevSegmentExists(iv))
-			return normalize(prevTangentDouble(iv) + tangentDouble(iv));
-		else
-			return tangentDouble(iv);
+	virtual ~HairBVH() { }
+private:
+	std::vector<Node> m_nodes;
+	std::vector<Frame> m_frames;
+	std::vector<IndexType> m_indices;
+	AABB m_aabb;
+	Float m_padding;
+};
+
+/// Appends hair vertices while merging segments with nearly identical tangents
+class HairStrandBuilder {
+public:
+	HairStrandBuilder(std::vector<Point> &vertices,
+		std::vector<bool> &vertexStartsFiber, Float dpThresh)
+		: nDegenerate(0), nSkipped(0), m_vertices(vertices),
+		  m_vertexStartsFiber(vertexStartsFiber), m_dpThresh(dpThresh),
+		  m_newFiber(true), m_lastP(0.0f), m_tangent(0.0f) { }
+
+	/// Mark the beginning of a new fiber
+	inline void startFiber() {
+		m_newFiber = true;
 	}
 
-	inline Vector3d secondMiterNormalDouble(IndexType iv) const {
-		if (nextSegmentExists(iv))
-			return normalize(tangentDouble(iv) + nextTangentDouble(iv));
-		else
-			return tangentDouble(iv);
+	/// Skip a vertex of a fiber that was culled
+	inline void skip() {
+		++nSkipped;
+		m_newFiber = false;
 	}
 
+	/// Append a vertex to the current fiber
+	void append(const Point &p) {
+		if (m_newFiber) {
+			m_vertices.push_back(p);
+			m_vertexStartsFiber.push_back(true);
+			m_lastP = p;
+			m_tangent = Vector(0.0f);
+		} else if (p != m_lastP) {
+			if (m_tangent.isZero()) {
+				m_vertices.push_back(p);
+				m_vertexStartsFiber.push_back(false);
+				m_tangent = normalize(p - m_lastP);
+				m_lastP = p;
+			} else {
+				Vector nextTangent = normalize(p - m_lastP);
+				if (dot(nextTangent, m_tangent) > m_dpThresh) {
+					/* Too small of a difference in the tangent value,
+					   just overwrite the previous vertex by the current one */
+					m_tangent = normalize(p - m_vertices[m_vertices.size()-2]);
+					m_vertices[m_vertices.size()-1] = p;
+					++nSkipped;
+				} else {
+					m_vertices.push_back(p);
+					m_vertexStartsFiber.push_back(false);
+					m_tangent = nextTangent;
+				}
+				m_lastP = p;
+			}
+		} else {
+			nDegenerate++;
+		}
+		m_newFiber = false;
+	}
 
-	MTS_DECLARE_CLASS()
-protected:
-	std::vector<Point> m_vertices;
-	std::vector<bool> m_vertexStartsFiber;
-	std::vector<IndexType> m_segIndex;
-	size_t m_segmentCount;
-	size_t m_hairCount;
-	Float m_radius;
+	size_t nDegenerate, nSkipped;
+private:
+	std::vector<Point> &m_vertices;
+	std::vector<bool> &m_vertexStartsFiber;
+	Float m_dpThresh;
+	bool m_newFiber;
+	Point m_lastP;
+	Vector m_tangent;
 };
 
 HairShape::HairShape(const Properties &props) : Shape(props) {
@@ -617,6 +1209,11 @@ HairShape::HairShape(const Properties &props) : Shape(props) {
 	Float angleThreshold = degToRad(props.getFloat("angleThreshold", 1.0f));
 	Float dpThresh = std::cos(angleThreshold);
 
+	/* Acceleration data structure used for ray intersections */
+	std::string accel = props.getString("accel", "kdtree");
+	if (accel != "bvh" && accel != "kdtree")
+		Log(EError, "The 'accel' parameter must be either \"bvh\" or \"kdtree\"!");
+
 	/* When set to a value n>1, the hair shape object will reduce
 	   the input by only loading every n-th hair */
 	Float reduction = props.getFloat("reduction", 0);
@@ -640,28 +1237,31 @@ HairShape::HairShape(const Properties &props) : Shape(props) {
 	ref<FileStream> binaryStream = new FileStream(path, FileStream::EReadOnly);
 	binaryStream->setByteOrder(Stream::ELittleEndian);
 
-	const char *binaryHeader = "BINARY_HAIR";
-	char temp[11];
-
-	bool binaryFormat = true;
-	binaryStream->read(temp, 11);
-	if (memcmp(temp, binaryHeader, 11) != 0)
-		binaryFormat = false;
+	char temp[12];
+	bool binaryFormat = false, indexedFormat = false;
+	if (binaryStream->getSize() >= 12) {
+		binaryStream->read(temp, 12);
+		indexedFormat = memcmp(temp, "INDEXED_HAIR", 12) == 0;
+		binaryFormat = memcmp(temp, "BINARY_HAIR", 11) == 0;
+		binaryStream->seek(11);
+	}
 
 	std::vector<Point> vertices;
 	std::vector<bool> vertexStartsFiber;
-	Vector tangent(0.0f);
-	size_t nDegenerate = 0, nSkipped = 0;
-	Point p, lastP(0.0f);
+	HairStrandBuilder builder(vertices, vertexStartsFiber, dpThresh);
+	Point p;
 	bool ignore = false;
 
-	if (binaryFormat) {
+	if (indexedFormat) {
+		binaryStream->close();
+		loadIndexed(path, objectToWorld, dpThresh, reduction, random,
+			vertices, vertexStartsFiber, builder.nDegenerate, builder.nSkipped);
+	} else if (binaryFormat) {
 		size_t vertexCount = binaryStream->readUInt();
 		Log(EInfo, "Loading " SIZE_T_FMT " hair vertices ..", vertexCount);
 		vertices.reserve(vertexCount);
 		vertexStartsFiber.reserve(vertexCount);
 
-		bool newFiber = true;
 		size_t verticesRead = 0;
 
 		while (verticesRead != vertexCount) {
@@ -670,7 +1270,7 @@ HairShape::HairShape(const Properties &props) : Shape(props) {
 				p.x = binaryStream->readSingle();
 				p.y = binaryStream->readSingle();
 				p.z = binaryStream->readSingle();
-				newFiber = true;
+				builder.startFiber();
 				if (reduction > 0)
 					ignore = random->nextFloat() < reduction;
 			} else {
@@ -678,47 +1278,16 @@ HairShape::HairShape(const Properties &props) : Shape(props) {
 				p.y = binaryStream->readSingle();
 				p.z = binaryStream->readSingle();
 			}
-			//cout << "Read " << verticesRead << " vertices (vs goal " << vertexCount << ") .." << endl;
 			p = objectToWorld(p);
 			verticesRead++;
 
-			if (ignore) {
-				// Do nothing
-				++nSkipped;
-			} else if (newFiber) {
-				vertices.push_back(p);
-				vertexStartsFiber.push_back(newFiber);
-				lastP = p;
-				tangent = Vector(0.0f);
-			} else if (p != lastP) {
-				if (tangent.isZero()) {
-					vertices.push_back(p);
-					vertexStartsFiber.push_back(newFiber);
-					tangent = normalize(p - lastP);
-					lastP = p;
-				} else {
-					Vector nextTangent = normalize(p - lastP);
-					if (dot(nextTangent, tangent) > dpThresh) {
-						/* Too small of a difference in the tangent value,
-						   just overwrite the previous vertex by the current one */
-						tangent = normalize(p - vertices[vertices.size()-2]);
-						vertices[vertices.size()-1] = p;
-						++nSkipped;
-					} else {
-						vertices.push_back(p);
-						vertexStartsFiber.push_back(newFiber);
-						tangent = nextTangent;
-					}
-					lastP = p;
-				}
-			} else {
-				nDegenerate++;
-			}
-			newFiber = false;
+			if (ignore)
+				builder.skip();
+			else
+				builder.append(p);
 		}
 	} else {
 		std::string line;
-		bool newFiber = true;
 
 		std::ifstream is(decode_pathstr(path).string().c_str());
 		if (is.fail())
@@ -726,64 +1295,142 @@ HairShape::HairShape(const Properties &props) : Shape(props) {
 		while (is.good()) {
 			std::getline(is, line);
 			if (line.length() > 0 && line[0] == '#') {
-				newFiber = true;
+				builder.startFiber();
 				continue;
 			}
 			std::istringstream iss(line);
 			iss >> p.x >> p.y >> p.z;
 			if (!iss.fail()) {
 				p = objectToWorld(p);
-				if (ignore) {
-					// Do nothing
-					++nSkipped;
-				} else if (newFiber) {
-					vertices.push_back(p);
-					vertexStartsFiber.push_back(newFiber);
-					lastP = p;
-					tangent = Vector(0.0f);
-				} else if (p != lastP) {
-					if (tangent.isZero()) {
-						vertices.push_back(p);
-						vertexStartsFiber.push_back(newFiber);
-						tangent = normalize(p - lastP);
-						lastP = p;
-					} else {
-						Vector nextTangent = normalize(p - lastP);
-						if (dot(nextTangent, tangent) > dpThresh) {
-							/* Too small of a difference in the tangent value,
-							   just overwrite the previous vertex by the current one */
-							tangent = normalize(p - vertices[vertices.size()-2]);
-							vertices[vertices.size()-1] = p;
-							++nSkipped;
-						} else {
-							vertices.push_back(p);
-							vertexStartsFiber.push_back(newFiber);
-							tangent = nextTangent;
-						}
-						lastP = p;
-					}
-				} else {
-					nDegenerate++;
-				}
-				newFiber = false;
+				if (ignore)
+					builder.skip();
+				else
+					builder.append(p);
 			} else {
-				newFiber = true;
+				builder.startFiber();
 				if (reduction > 0)
 					ignore = random->nextFloat() < reduction;
 			}
 		}
 	}
 
-	if (nDegenerate > 0)
+	if (builder.nDegenerate > 0)
 		Log(EInfo, "Encountered " SIZE_T_FMT
-			" degenerate segments!", nDegenerate);
-	if (nSkipped > 0)
-		Log(EInfo, "Skipped " SIZE_T_FMT " segments.", nSkipped);
+			" degenerate segments!", builder.nDegenerate);
+	if (builder.nSkipped > 0)
+		Log(EInfo, "Skipped " SIZE_T_FMT " segments.", builder.nSkipped);
 	Log(EInfo, "Done (took %i ms)", timer->getMilliseconds());
 
 	vertexStartsFiber.push_back(true);
 
-	m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius);
+	if (accel == "kdtree") {
+		m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius);
+		m_geometry = m_kdtree.get();
+	} else {
+		m_bvh = new HairBVH(vertices, vertexStartsFiber, radius);
+		m_geometry = m_bvh.get();
+	}
+}
+
+void HairShape::loadIndexed(const fs::pathstr &path, const Transform &objectToWorld,
+		Float dpThresh, Float reduction, Random *random, std::vector<Point> &vertices,
+		std::vector<bool> &vertexStartsFiber, size_t &nDegenerate, size_t &nSkipped) {
+	if (Stream::getHostByteOrder() != Stream::ELittleEndian)
+		Log(EError, "Indexed hair files can only be loaded on little endian machines!");
+
+	ref<MemoryMappedFile> mmap = new MemoryMappedFile(path);
+	const uint8_t *data = static_cast<const uint8_t *>(mmap->getData());
+	size_t size = mmap->getSize();
+
+	if (size < MTS_HAIR_INDEXED_HEADER_SIZE)
+		Log(EError, "\"%s\": truncated header!", path.s.c_str());
+
+	uint32_t version;
+	uint64_t strandCount, vertexCount;
+	memcpy(&version, data + 12, sizeof(uint32_t));
+	memcpy(&strandCount, data + 16, sizeof(uint64_t));
+	memcpy(&vertexCount, data + 24, sizeof(uint64_t));
+
+	if (version != MTS_HAIR_INDEXED_VERSION)
+		Log(EError, "\"%s\": unsupported version %i of the indexed hair "
+			"format!", path.s.c_str(), version);
+
+	/* Check the sizes before computing the expected file size to avoid overflows */
+	size_t dataSize = size - MTS_HAIR_INDEXED_HEADER_SIZE;
+	if (strandCount >= dataSize / sizeof(uint64_t) || vertexCount > dataSize / (3 * sizeof(float)) ||
+		size < MTS_HAIR_INDEXED_HEADER_SIZE + (strandCount + 1) * sizeof(uint64_t)
+			+ vertexCount * 3 * sizeof(float))
+		Log(EError, "\"%s\": the file is truncated!", path.s.c_str());
+
+	const uint64_t *offsets = reinterpret_cast<const uint64_t *>(data + MTS_HAIR_INDEXED_HEADER_SIZE);
+	const float *positions = reinterpret_cast<const float *>(offsets + strandCount + 1);
+
+	if (offsets[0] != 0 || offsets[strandCount] != vertexCount)
+		Log(EError, "\"%s\": invalid strand offsets!", path.s.c_str());
+	for (size_t i=0; i<strandCount; ++i) {
+		if (offsets[i] > offsets[i+1])
+			Log(EError, "\"%s\": invalid strand offsets!", path.s.c_str());
+	}
+
+	Log(EInfo, "Loading " SIZE_T_FMT " hair strands with " SIZE_T_FMT " vertices ..",
+		(size_t) strandCount, (size_t) vertexCount);
+
+	/* Decide which strands are culled (sequentially, to stay deterministic) */
+	std::vector<bool> culled(strandCount, false);
+	if (reduction > 0) {
+		for (size_t i=0; i<strandCount; ++i)
+			culled[i] = random->nextFloat() < reduction;
+	}
+
+	/* Each thread processes a contiguous range of strands into separate arrays */
+	size_t chunks = std::min((size_t) std::max(1, getCoreCount()),
+		std::max((size_t) 1, (size_t) strandCount / MTS_HAIR_PARALLEL_GRAINSIZE));
+	std::vector<std::vector<Point> > chunkVertices(chunks);
+	std::vector<std::vector<bool> > chunkStartsFiber(chunks);
+	std::vector<size_t> chunkDegenerate(chunks), chunkSkipped(chunks);
+
+	auto process = [&](size_t chunk) {
+		size_t start = strandCount * chunk / chunks,
+		       end = strandCount * (chunk + 1) / chunks;
+		chunkVertices[chunk].reserve(offsets[end] - offsets[start]);
+		chunkStartsFiber[chunk].reserve(offsets[end] - offsets[start]);
+		HairStrandBuilder builder(chunkVertices[chunk], chunkStartsFiber[chunk], dpThresh);
+
+		for (size_t i=start; i<end; ++i) {
+			builder.startFiber();
+			for (uint64_t j=offsets[i]; j<offsets[i+1]; ++j) {
+				if (culled[i]) {
+					builder.skip();
+				} else {
+					const float *pos = positions + 3 * j;
+					builder.append(objectToWorld(Point((Float) pos[0], (Float) pos[1], (Float) pos[2])));
+				}
+			}
+		}
+		chunkDegenerate[chunk] = builder.nDegenerate;
+		chunkSkipped[chunk] = builder.nSkipped;
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t i=1; i<chunks; ++i)
+		workers.push_back(std::thread(process, i));
+	process(0);
+	for (size_t i=0; i<workers.size(); ++i)
+		workers[i].join();
+
+	size_t total = 0;
+	for (size_t i=0; i<chunks; ++i)
+		total += chunkVertices[i].size();
+	vertices.reserve(total + 1);
+	vertexStartsFiber.reserve(total + 1);
+	for (size_t i=0; i<chunks; ++i) {
+		vertices.insert(vertices.end(), chunkVertices[i].begin(), chunkVertices[i].end());
+		vertexStartsFiber.insert(vertexStartsFiber.end(),
+			chunkStartsFiber[i].begin(), chunkStartsFiber[i].end());
+		std::vector<Point>().swap(chunkVertices[i]);
+		nDegenerate += chunkDegenerate[i];
+		nSkipped += chunkSkipped[i];
+	}
 }
 
 HairShape::HairShape(Stream *stream, InstanceManager *manager)
@@ -799,29 +1446,44 @@ HairShape::HairShape(Stream *stream, InstanceManager *manager)
 		vertexStartsFiber[i] = stream->readBool();
 	vertexStartsFiber[vertexCount] = true;
 
-	m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius);
+	if (stream->readBool()) {
+		m_bvh = new HairBVH(vertices, vertexStartsFiber, radius);
+		m_geometry = m_bvh.get();
+	} else {
+		m_kdtree = new HairKDTree(vertices, vertexStartsFiber, radius);
+		m_geometry = m_kdtree.get();
+	}
 }
 
 void HairShape::serialize(Stream *stream, InstanceManager *manager) const {
 	Shape::serialize(stream, manager);
 
-	const std::vector<Point> &vertices = m_kdtree->getVertices();
-	const std::vector<bool> &vertexStartsFiber = m_kdtree->getStartFiber();
+	const std::vector<Point> &vertices = m_geometry->getVertices();
+	const std::vector<bool> &vertexStartsFiber = m_geometry->getStartFiber();
 
-	stream->writeFloat(m_kdtree->getRadius());
+	stream->writeFloat(m_geometry->getRadius());
 	stream->writeSize(vertices.size());
 	stream->writeFloatArray((Float *) &vertices[0], vertices.size() * 3);
 	for (size_t i=0; i<vertices.size(); ++i)
 		stream->writeBool(vertexStartsFiber[i]);
+	stream->writeBool(m_bvh.get() != NULL);
 }
 
 bool HairShape::rayIntersect(const Ray &ray, Float mint,
 		Float maxt, Float &t, void *temp) const {
-	return m_kdtree->rayIntersect(ray, mint, maxt, t, temp);
+	segmentTests.incrementBase();
+	if (m_bvh.get())
+		return m_bvh->rayIntersect(ray, mint, maxt, t, temp);
+	else
+		return m_kdtree->rayIntersect(ray, mint, maxt, t, temp);
 }
 
 bool HairShape::rayIntersect(const Ray &ray, Float mint, Float maxt) const {
-	return m_kdtree->rayIntersect(ray, mint, maxt);
+	segmentTests.incrementBase();
+	if (m_bvh.get())
+		return m_bvh->rayIntersect(ray, mint, maxt);
+	else
+		return m_kdtree->rayIntersect(ray, mint, maxt);
 }
 
 void HairShape::fillIntersectionRecord(const Ray &ray,
@@ -831,21 +1493,21 @@ void HairShape::fillIntersectionRecord(const Ray &ray,
 	its.dpdu = Vector(0,0,0);
 	its.dpdv = Vector(0,0,0);
 
-	const HairKDTree::IntersectionStorage *storage =
-		static_cast<const HairKDTree::IntersectionStorage *>(temp);
-	HairKDTree::IndexType iv = storage->iv;
+	const HairGeometry::IntersectionStorage *storage =
+		static_cast<const HairGeometry::IntersectionStorage *>(temp);
+	HairGeometry::IndexType iv = storage->iv;
 	its.p = storage->p;
 
-	const Vector axis = m_kdtree->tangent(iv);
+	const Vector axis = m_geometry->tangent(iv);
 	its.shape = this;
 	its.geoFrame.s = axis;
-	const Vector relHitPoint = its.p - m_kdtree->firstVertex(iv);
+	const Vector relHitPoint = its.p - m_geometry->firstVertex(iv);
 	its.geoFrame.n = Normal(normalize(relHitPoint - dot(axis, relHitPoint) * axis));
 	its.geoFrame.t = cross(its.geoFrame.n, its.geoFrame.s);
 
 	/* Migitate roundoff error issues by a normal shift of the computed intersection point */
 	const Vector local = its.geoFrame.toLocal(relHitPoint);
-	its.p += its.geoFrame.n * (m_kdtree->getRadius() - std::sqrt(local.y*local.y+local.z*local.z));
+	its.p += its.geoFrame.n * (m_geometry->getRadius() - std::sqrt(local.y*local.y+local.z*local.z));
 
 	its.shFrame.n = its.geoFrame.n;
 	coordinateSystem(its.shFrame.n, its.dpdu, its.dpdv);
@@ -855,7 +1517,7 @@ void HairShape::fillIntersectionRecord(const Ray &ray,
 }
 
 ref<TriMesh> HairShape::createTriMesh() {
-	size_t nSegments = m_kdtree->getSegmentCount();
+	size_t nSegments = m_geometry->getSegmentCount();
 	/// Use very approximate geometry for large hair meshes
 	const uint32_t phiSteps = (nSegments > 100000) ? 4 : 10;
 	const Float dPhi   = (2*M_PI) / phiSteps;
@@ -868,9 +1530,9 @@ ref<TriMesh> HairShape::createTriMesh() {
 	Triangle *triangles = mesh->getTriangles();
 	size_t triangleIdx = 0, vertexIdx = 0;
 
-	const std::vector<Point> &hairVertices = m_kdtree->getVertices();
-	const std::vector<bool> &vertexStartsFiber = m_kdtree->getStartFiber();
-	const Float radius = m_kdtree->getRadius();
+	const std::vector<Point> &hairVertices = m_geometry->getVertices();
+	const std::vector<bool> &vertexStartsFiber = m_geometry->getStartFiber();
+	const Float radius = m_geometry->getRadius();
 	Float *cosPhi = new Float[phiSteps];
 	Float *sinPhi = new Float[phiSteps];
 	for (size_t i=0; i<phiSteps; ++i) {
@@ -879,22 +1541,22 @@ ref<TriMesh> HairShape::createTriMesh() {
 	}
 
 	uint32_t hairIdx = 0;
-	for (HairKDTree::IndexType iv=0; iv<(HairKDTree::IndexType) hairVertices.size()-1; iv++) {
+	for (HairGeometry::IndexType iv=0; iv<(HairGeometry::IndexType) hairVertices.size()-1; iv++) {
 		if (!vertexStartsFiber[iv+1]) {
 			for (uint32_t phi=0; phi<phiSteps; ++phi) {
-				Vector tangent = m_kdtree->tangent(iv);
+				Vector tangent = m_geometry->tangent(iv);
 				Vector dir = Frame(tangent).toWorld(
 						Vector(cosPhi[phi], sinPhi[phi], 0));
-				Normal miterNormal1 = m_kdtree->firstMiterNormal(iv);
-				Normal miterNormal2 = m_kdtree->secondMiterNormal(iv);
+				Normal miterNormal1 = m_geometry->firstMiterNormal(iv);
+				Normal miterNormal2 = m_geometry->secondMiterNormal(iv);
 				Float t1 = dot(miterNormal1, radius*dir) / dot(miterNormal1, tangent);
 				Float t2 = dot(miterNormal2, radius*dir) / dot(miterNormal2, tangent);
 
 				Normal normal(normalize(dir));
 				normals[vertexIdx] = normal;
-				vertices[vertexIdx++] = m_kdtree->firstVertex(iv) + radius*dir - tangent*t1;
+				vertices[vertexIdx++] = m_geometry->firstVertex(iv) + radius*dir - tangent*t1;
 				normals[vertexIdx] = normal;
-				vertices[vertexIdx++] = m_kdtree->secondVertex(iv) + radius*dir - tangent*t2;
+				vertices[vertexIdx++] = m_geometry->secondVertex(iv) + radius*dir - tangent*t2;
 
 				uint32_t idx0 = 2*(phi + hairIdx*phiSteps), idx1 = idx0+1;
 				uint32_t idx2 = (2*phi+2) % (2*phiSteps) + 2*hairIdx*phiSteps, idx3 = idx2+1;
@@ -923,27 +1585,30 @@ ref<TriMesh> HairShape::createTriMesh() {
 }
 
 const KDTreeBase<AABB> *HairShape::getKDTree() const {
+	if (!m_kdtree)
+		Log(EError, "getKDTree(): the hair shape was built with accel=\"bvh\", "
+			"which does not provide a kd-tree!");
 	return m_kdtree.get();
 }
 
 const std::vector<Point> &HairShape::getVertices() const {
-	return m_kdtree->getVertices();
+	return m_geometry->getVertices();
 }
 
 const std::vector<bool> &HairShape::getStartFiber() const {
-	return m_kdtree->getStartFiber();
+	return m_geometry->getStartFiber();
 }
 
 AABB HairShape::getAABB() const {
-	return m_kdtree->getAABB();
+	return m_bvh.get() ? m_bvh->getAABB() : m_kdtree->getAABB();
 }
 
 size_t HairShape::getPrimitiveCount() const {
-	return m_kdtree->getHairCount();
+	return m_geometry->getHairCount();
 }
 
 size_t HairShape::getEffectivePrimitiveCount() const {
-	return m_kdtree->getHairCount();
+	return m_geometry->getHairCount();
 }
 
 Float HairShape::getSurfaceArea() const {
@@ -954,15 +1619,17 @@ Float HairShape::getSurfaceArea() const {
 std::string HairShape::toString() const {
 	std::ostringstream oss;
 	oss << "Hair[" << endl
-		<< "   numVertices = " << m_kdtree->getVertexCount() << ","
-		<< "   numSegments = " << m_kdtree->getSegmentCount() << ","
-		<< "   numHairs = " << m_kdtree->getHairCount() << ","
-		<< "   radius = " << m_kdtree->getRadius()
+		<< "   numVertices = " << m_geometry->getVertexCount() << ","
+		<< "   numSegments = " << m_geometry->getSegmentCount() << ","
+		<< "   numHairs = " << m_geometry->getHairCount() << ","
+		<< "   radius = " << m_geometry->getRadius() << ","
+		<< "   accel = " << (m_bvh.get() ? "bvh" : "kdtree")
 		<< "]";
 	return oss.str();
 }
 
 MTS_IMPLEMENT_CLASS(HairKDTree, false, KDTreeBase)
+MTS_IMPLEMENT_CLASS(HairBVH, false, Object)
 MTS_IMPLEMENT_CLASS_S(HairShape, false, Shape)
 MTS_EXPORT_PLUGIN(HairShape, "Hair intersection shape");
 MTS_NAMESPACE_END
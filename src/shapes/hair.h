@@ -23,14 +23,17 @@
 
 MTS_NAMESPACE_BEGIN
 
+class HairGeometry;
 class HairKDTree;
+class HairBVH;
 
 /**
  * \brief Intersection shape structure for cylindrical hair
  * segments with miter joints. This class expects an ASCII file containing
  * a list of hairs made from segments. Each line should contain an X,
  * Y and Z coordinate separated by a space. An empty line indicates
- * the start of a new hair.
+ * the start of a new hair. Two binary formats are supported as well
+ * (see the plugin documentation).
  */
 class HairShape : public Shape {
 public:
@@ -73,6 +76,7 @@ public:
 
 	ref<TriMesh> createTriMesh();
 
+	/// Return the kd-tree (throws an exception when \c accel="bvh" was used)
 	const KDTreeBase<AABB> *getKDTree() const;
 
 	AABB getAABB() const;
@@ -91,7 +95,15 @@ public:
 
 	MTS_DECLARE_CLASS()
 private:
+	/// Load a file in the indexed binary format using several threads
+	void loadIndexed(const fs::pathstr &path, const Transform &objectToWorld,
+		Float dpThresh, Float reduction, Random *random, std::vector<Point> &vertices,
+		std::vector<bool> &vertexStartsFiber, size_t &nDegenerate, size_t &nSkipped);
+
 	ref<HairKDTree> m_kdtree;
+	ref<HairBVH> m_bvh;
+	/// Vertex data of whichever acceleration data structure is used
+	const HairGeometry *m_geometry;
 };
 
 MTS_NAMESPACE_END
@@ -104,6 +104,17 @@ void Instance::addChild(const std::string &name, ConfigurableObject *child) {
 	}
 }
 
+bool Instance::applyTransform(const Transform &trafo) {
+	/* Only the transformation changes -- the kd-tree of
+	   the referenced shape group is left untouched */
+	if (!m_transform->isStatic()) {
+		Log(EWarn, "applyTransform(): animated instances are not supported!");
+		return false;
+	}
+	m_transform = new AnimatedTransform(trafo * m_transform->eval(0));
+	return true;
+}
+
 size_t Instance::getPrimitiveCount() const {
 	return 0;
 }
@@ -60,6 +60,8 @@ public:
 
 	AABB getAABB() const;
 
+	bool applyTransform(const Transform &trafo);
+
 	bool rayIntersect(const Ray &_ray, Float mint,
 			Float maxt, Float &t, void *temp) const;
 
@@ -0,0 +1,282 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "instancearray.h"
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/fstream.h>
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{instancearray}{Geometry instance array}
+ * \order{10}
+ * \parameters{
+ *     \parameter{\Unnamed}{\ShapeGroup}{A reference to a
+ *     shape group that should be instantiated}
+ *     \parameter{filename}{\String}{
+ *       Binary file with the instance-to-world transformation of every
+ *       instance, stored as the upper 3x4 block of the matrix in row-major
+ *       order (12 little endian single precision values per instance)
+ *     }
+ *     \parameter{toWorld}{\Transform}{
+ *	      Specifies an optional linear transformation that is
+ *        applied to all instances.
+ *        \default{none}
+ *     }
+ * }
+ *
+ * This plugin replicates a shape group a large number of times, e.g. to
+ * render forests or crowds with millions of instances. In contrast to
+ * the \pluginref{instance} plugin, the instances are not separate shapes
+ * that are stored in the scene-wide kd-tree. Instead, only a compact
+ * transformation (48 bytes) is stored per instance, and the instances are
+ * organized in a dedicated 8-wide BVH. Together, this amounts to roughly
+ * 70 bytes per instance, and building the data structure is considerably
+ * faster than the construction of a kd-tree over separate instances.
+ * The following snippet instantiates a tree model:
+ * \begin{xml}
+ * <shape type="shapegroup" id="tree">
+ *     <shape type="serialized">
+ *         <string name="filename" value="tree.serialized"/>
+ *     </shape>
+ * </shape>
+ *
+ * <shape type="instancearray">
+ *     <ref id="tree"/>
+ *     <string name="filename" value="forest.bin"/>
+ * </shape>
+ * \end{xml}
+ * \remarks{
+ *   \item The same restrictions as for the \pluginref{instance} plugin apply.
+ *   \item Animated transformations are not supported.
+ * }
+ */
+
+InstanceArray::InstanceArray(const Properties &props) : Shape(props) {
+	fs::pathstr path = Thread::getThread()->getFileResolver()->resolve(
+		fs::pathstr(props.getString("filename")));
+	Transform toWorld = props.getTransform("toWorld", Transform());
+
+	ref<FileStream> stream = new FileStream(path, FileStream::EReadOnly);
+	stream->setByteOrder(Stream::ELittleEndian);
+	size_t size = stream->getSize();
+	if (size % (12 * sizeof(float)) != 0)
+		Log(EError, "The size of the instance file \"%s\" is not a multiple of "
+			"12 floats!", path.s.c_str());
+
+	/* Read all instance-to-world transformations at once and invert them in place */
+	m_toLocal.resize(size / (12 * sizeof(float)));
+	if (!m_toLocal.empty())
+		stream->readSingleArray(&m_toLocal[0].m[0][0], m_toLocal.size() * 12);
+
+	for (size_t i=0; i<m_toLocal.size(); ++i) {
+		AffineMatrix instanceToWorld = m_toLocal[i];
+		if (!toWorld.isIdentity())
+			instanceToWorld = toAffine(toWorld.getMatrix() * toMatrix4x4(instanceToWorld));
+		if (!invertAffine(instanceToWorld, m_toLocal[i]))
+			Log(EError, "The transformation of instance " SIZE_T_FMT " in \"%s\" "
+				"is singular!", i, path.s.c_str());
+	}
+}
+
+InstanceArray::InstanceArray(Stream *stream, InstanceManager *manager)
+	: Shape(stream, manager) {
+	m_shapeGroup = static_cast<ShapeGroup *>(manager->getInstance(stream));
+	m_toLocal.resize(stream->readSize());
+	if (!m_toLocal.empty())
+		stream->readSingleArray(&m_toLocal[0].m[0][0], m_toLocal.size() * 12);
+	configure();
+}
+
+void InstanceArray::serialize(Stream *stream, InstanceManager *manager) const {
+	Shape::serialize(stream, manager);
+	manager->serialize(stream, m_shapeGroup.get());
+	stream->writeSize(m_toLocal.size());
+	if (!m_toLocal.empty())
+		stream->writeSingleArray(&m_toLocal[0].m[0][0], m_toLocal.size() * 12);
+}
+
+void InstanceArray::configure() {
+	if (!m_shapeGroup)
+		Log(EError, "A reference to a 'shapegroup' must be specified!");
+	if (m_bvh.isBuilt())
+		return;
+
+	ref<Timer> timer = new Timer();
+	update(true);
+	size_t count = m_toLocal.size();
+	Log(EInfo, "Created " SIZE_T_FMT " instances of a shape group with " SIZE_T_FMT
+		" primitives (%i ms, " SIZE_T_FMT " BVH nodes, %s, %s per instance)", count,
+		m_shapeGroup->getPrimitiveCount(), timer->getMilliseconds(), m_bvh.getNodeCount(),
+		memString(getMemoryUsage()).c_str(),
+		memString(getMemoryUsage() / std::max((size_t) 1, count)).c_str());
+}
+
+void InstanceArray::addChild(const std::string &name, ConfigurableObject *child) {
+	const Class *cClass = child->getClass();
+	if (cClass->getName() == "ShapeGroup") {
+		m_shapeGroup = static_cast<ShapeGroup *>(child);
+	} else {
+		Shape::addChild(name, child);
+	}
+}
+
+AABB InstanceArray::getAABB() const {
+	return m_bvh.getAABB();
+}
+
+bool InstanceArray::applyTransform(const Transform &trafo) {
+	/* Only the transformations change -- the kd-tree of
+	   the referenced shape group is left untouched */
+	const Matrix4x4 &inverse = trafo.getInverseMatrix();
+	for (size_t i=0; i<m_toLocal.size(); ++i)
+		m_toLocal[i] = toAffine(toMatrix4x4(m_toLocal[i]) * inverse);
+	update();
+	return true;
+}
+
+size_t InstanceArray::getPrimitiveCount() const {
+	return 0;
+}
+
+size_t InstanceArray::getEffectivePrimitiveCount() const {
+	return m_toLocal.size() * m_shapeGroup->getPrimitiveCount();
+}
+
+bool InstanceArray::rayIntersect(const Ray &ray, Float mint,
+		Float maxt, Float &t, void *temp) const {
+	const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
+	/* The index of the hit instance is stored in front of the
+	   intersection cache of the shape group */
+	uint8_t *cache = reinterpret_cast<uint8_t *>(temp) + sizeof(uint64_t);
+
+	auto intersectInstance = [&](uint32_t index, Float instMint, Float instMaxt, Float &instT) {
+		Ray localRay;
+		transformRay(m_toLocal[index], ray, localRay);
+		if (!kdtree->rayIntersect(localRay, instMint, instMaxt, instT, cache))
+			return false;
+		*reinterpret_cast<uint32_t *>(temp) = index;
+		return true;
+	};
+
+	if (m_bvh.rayIntersect<false>(ray, mint, maxt, intersectInstance)) {
+		t = maxt;
+		return true;
+	}
+	return false;
+}
+
+bool InstanceArray::rayIntersect(const Ray &ray, Float mint, Float maxt) const {
+	const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
+
+	auto intersectInstance = [&](uint32_t index, Float instMint, Float instMaxt, Float &instT) {
+		Ray localRay;
+		transformRay(m_toLocal[index], ray, localRay);
+		return kdtree->rayIntersect(localRay, instMint, instMaxt);
+	};
+
+	return m_bvh.rayIntersect<true>(ray, mint, maxt, intersectInstance);
+}
+
+void InstanceArray::fillIntersectionRecord(const Ray &_ray,
+	const void *temp, Intersection &its) const {
+	const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
+	uint32_t index = *reinterpret_cast<const uint32_t *>(temp);
+	const Transform trafo = getTransform(index);
+
+	Ray ray;
+	transformRay(m_toLocal[index], _ray, ray);
+	kdtree->fillIntersectionRecord<false>(ray,
+		reinterpret_cast<const uint8_t *>(temp) + sizeof(uint64_t), its);
+
+	its.shFrame.n = normalize(trafo(its.shFrame.n));
+	its.geoFrame = Frame(normalize(trafo(its.geoFrame.n)));
+	its.dpdu = trafo(its.dpdu);
+	its.dpdv = trafo(its.dpdv);
+	its.p = trafo(its.p);
+	its.instance = this;
+}
+
+int64_t InstanceArray::findInstance(const Intersection &its) const {
+	/* The intersection record has no room for the instance index.
+	   Recover it by tracing a short ray towards the surface point */
+	const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
+	uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+	const Float delta = ShadowEpsilon * (1 + std::max(std::max(
+		std::abs(its.p.x), std::abs(its.p.y)), std::abs(its.p.z)));
+	Ray ray(its.p + its.geoFrame.n * delta, -its.geoFrame.n, its.time);
+	int64_t result = -1;
+
+	auto intersectInstance = [&](uint32_t index, Float instMint, Float instMaxt, Float &instT) {
+		Ray localRay;
+		transformRay(m_toLocal[index], ray, localRay);
+		if (!kdtree->rayIntersect(localRay, instMint, instMaxt, instT, temp))
+			return false;
+		result = index;
+		return true;
+	};
+
+	Float maxt = 2 * delta;
+	m_bvh.rayIntersect<false>(ray, 0, maxt, intersectInstance);
+	return result;
+}
+
+void InstanceArray::getNormalDerivative(const Intersection &its,
+		Vector &dndu, Vector &dndv, bool shadingFrame) const {
+	int64_t index = findInstance(its);
+	if (index < 0) {
+		dndu = dndv = Vector(0.0f);
+		return;
+	}
+
+	const Transform trafo = getTransform((size_t) index);
+	const Transform invTrafo = trafo.inverse();
+
+	Intersection temp(its);
+	temp.p = invTrafo(its.p);
+	temp.dpdu = invTrafo(its.dpdu);
+	temp.dpdv = invTrafo(its.dpdv);
+
+	/* Determine the length of the transformed normal
+	   *before* it was re-normalized */
+	Normal tn = trafo(normalize(invTrafo(its.shFrame.n)));
+	Float invLen = 1 / tn.length();
+	tn *= invLen;
+
+	its.shape->getNormalDerivative(temp, dndu, dndv, shadingFrame);
+
+	dndu = trafo(Normal(dndu)) * invLen;
+	dndv = trafo(Normal(dndv)) * invLen;
+
+	dndu -= tn * dot(tn, dndu);
+	dndv -= tn * dot(tn, dndv);
+}
+
+std::string InstanceArray::toString() const {
+	std::ostringstream oss;
+	oss << "InstanceArray[" << endl
+		<< "  instanceCount = " << m_toLocal.size() << "," << endl
+		<< "  shapeGroup = " << indent(m_shapeGroup->toString()) << "," << endl
+		<< "  bvhNodes = " << m_bvh.getNodeCount() << "," << endl
+		<< "  memoryUsage = " << memString(getMemoryUsage()) << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS_S(InstanceArray, false, Shape)
+MTS_EXPORT_PLUGIN(InstanceArray, "Instance array");
+MTS_NAMESPACE_END
@@ -0,0 +1,251 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__INSTANCEARRAY_H)
+#define __INSTANCEARRAY_H
+
+#include <mitsuba/render/wbvh.h>
+#include <mitsuba/core/timer.h>
+#include "shapegroup.h"
+
+/// Maximum number of instances in a leaf of the top-level BVH
+#define MTS_INSTANCEARRAY_MAX_LEAF 2
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Compact geometry instancing for very large instance counts
+ * (to be used in conjunction with the \c shapegroup plugin)
+ *
+ * In contrast to \ref Instance, the instances are not separate shapes.
+ * Only the world-to-instance transformation of each instance is stored
+ * (a 3x4 single precision matrix, i.e. 48 bytes), in one flat array.
+ * The instances are organized in a dedicated top-level BVH, which can be
+ * refit or rebuilt quickly when only the transformations change.
+ */
+class InstanceArray : public Shape {
+public:
+	/// Affine world-to-instance transformation (upper 3x4 block of a 4x4 matrix)
+	typedef Matrix<3, 4, float> AffineMatrix;
+
+	/// Create a new instance array based on properties from an XML file
+	InstanceArray(const Properties &props);
+
+	/// Unserialize from a binary data stream
+	InstanceArray(Stream *stream, InstanceManager *manager);
+
+	/// Serialize to a binary data stream
+	void serialize(Stream *stream, InstanceManager *manager) const;
+
+	/** \brief Configure this object (called \a once after construction
+	   and addition of all child \ref ConfigurableObject instances).) */
+	void configure();
+
+	/// Add a child ConfigurableObject
+	void addChild(const std::string &name, ConfigurableObject *child);
+
+	/// Return a pointer to the associated \ref ShapeGroup (const version)
+	inline const ShapeGroup* getShapeGroup() const { return m_shapeGroup.get(); }
+
+	/// Return the number of instances
+	inline size_t getInstanceCount() const { return m_toLocal.size(); }
+
+	/// Return the instance-to-world transformation of the given instance
+	inline Transform getTransform(size_t index) const {
+		AffineMatrix toWorld;
+		invertAffine(m_toLocal[index], toWorld);
+		return Transform(toMatrix4x4(toWorld), toMatrix4x4(m_toLocal[index]));
+	}
+
+	/**
+	 * \brief Set the instance-to-world transformation of the given instance
+	 *
+	 * \ref update() must be called after changing transformations
+	 */
+	inline void setTransform(size_t index, const Transform &trafo) {
+		m_toLocal[index] = toAffine(trafo.getInverseMatrix());
+	}
+
+	/**
+	 * \brief Update the top-level BVH after the transformations have changed
+	 *
+	 * \param rebuild
+	 *    When set to \c false, the hierarchy is only refit to the new
+	 *    instance bounds. This takes a fraction of the time of a rebuild,
+	 *    but the traversal performance degrades when the instances
+	 *    were moved over large distances relative to each other.
+	 */
+	inline void update(bool rebuild = false) {
+		ref<Timer> timer = new Timer();
+		std::vector<AABB> bounds(m_toLocal.size());
+		AABB aabb = m_shapeGroup->getKDTree()->getAABB();
+		if (!aabb.isValid()) // the geometry group is empty
+			aabb = AABB(Point(0.0f));
+		for (size_t i=0; i<m_toLocal.size(); ++i)
+			bounds[i] = getInstanceAABB(m_toLocal[i], aabb);
+
+		if (rebuild || !m_bvh.isBuilt() || bounds.empty()) {
+			m_bvh = WideBVH<8>();
+			m_bvh.setMaxLeafSize(MTS_INSTANCEARRAY_MAX_LEAF);
+			m_bvh.build(bounds.empty() ? NULL : &bounds[0], (uint32_t) bounds.size());
+			SLog(EDebug, "Built the BVH over " SIZE_T_FMT " instances (%i ms, "
+				SIZE_T_FMT " nodes, %s per instance)", m_toLocal.size(),
+				timer->getMilliseconds(), m_bvh.getNodeCount(),
+				memString(getMemoryUsage() / std::max((size_t) 1, m_toLocal.size())).c_str());
+		} else {
+			m_bvh.refit(&bounds[0]);
+			SLog(EDebug, "Refit the BVH over " SIZE_T_FMT " instances (%i ms)",
+				m_toLocal.size(), timer->getMilliseconds());
+		}
+	}
+
+	/// Return the memory used by the transformations and the top-level BVH in bytes
+	inline size_t getMemoryUsage() const {
+		return m_toLocal.capacity() * sizeof(AffineMatrix) + m_bvh.getMemoryUsage();
+	}
+
+	// =============================================================
+	//! @{ \name Implementation of the Shape interface
+	// =============================================================
+
+	AABB getAABB() const;
+
+	bool applyTransform(const Transform &trafo);
+
+	bool rayIntersect(const Ray &_ray, Float mint,
+			Float maxt, Float &t, void *temp) const;
+
+	bool rayIntersect(const Ray &_ray, Float mint, Float maxt) const;
+
+	void fillIntersectionRecord(const Ray &ray,
+		const void *temp, Intersection &its) const;
+
+	void getNormalDerivative(const Intersection &its,
+		Vector &dndu, Vector &dndv, bool shadingFrame) const;
+
+	size_t getPrimitiveCount() const;
+
+	size_t getEffectivePrimitiveCount() const;
+
+	std::string toString() const;
+
+	//! @}
+	// =============================================================
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Convert an affine 4x4 matrix into the compact representation
+	static inline AffineMatrix toAffine(const Matrix4x4 &matrix) {
+		AffineMatrix result;
+		for (int i=0; i<3; ++i)
+			for (int j=0; j<4; ++j)
+				result.m[i][j] = (float) matrix.m[i][j];
+		return result;
+	}
+
+	/// Expand the compact representation into a 4x4 matrix
+	static inline Matrix4x4 toMatrix4x4(const AffineMatrix &matrix) {
+		Matrix4x4 result;
+		for (int i=0; i<3; ++i)
+			for (int j=0; j<4; ++j)
+				result.m[i][j] = matrix.m[i][j];
+		result.m[3][0] = result.m[3][1] = result.m[3][2] = 0.0f;
+		result.m[3][3] = 1.0f;
+		return result;
+	}
+
+	/**
+	 * \brief Invert an affine transformation
+	 *
+	 * Uses cofactors in double precision, which is both faster
+	 * and more accurate than a general 4x4 matrix inverse.
+	 *
+	 * \return \c false if the transformation is singular
+	 */
+	static inline bool invertAffine(const AffineMatrix &matrix, AffineMatrix &result) {
+		const float (&m)[3][4] = matrix.m;
+		double inv[3][3];
+		for (int i=0; i<3; ++i) {
+			int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+			for (int j=0; j<3; ++j) {
+				int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+				inv[j][i] = (double) m[i1][j1] * m[i2][j2] - (double) m[i1][j2] * m[i2][j1];
+			}
+		}
+		double det = m[0][0] * inv[0][0] + m[0][1] * inv[1][0] + m[0][2] * inv[2][0];
+		if (det == 0)
+			return false;
+		double invDet = 1.0 / det;
+		for (int i=0; i<3; ++i) {
+			double translation = 0;
+			for (int j=0; j<3; ++j) {
+				inv[i][j] *= invDet;
+				translation -= inv[i][j] * m[j][3];
+				result.m[i][j] = (float) inv[i][j];
+			}
+			result.m[i][3] = (float) translation;
+		}
+		return true;
+	}
+
+	/// Compute the world space bounds of an instance of geometry with bounds \c aabb
+	static inline AABB getInstanceAABB(const AffineMatrix &toLocal, const AABB &aabb) {
+		AffineMatrix toWorld;
+		invertAffine(toLocal, toWorld);
+
+		/* Transform the center, and use the absolute values of the matrix for the extents */
+		Point center = aabb.getCenter();
+		Vector extents = aabb.getExtents() * 0.5f;
+		AABB result;
+		for (int i=0; i<3; ++i) {
+			Float c = toWorld.m[i][3], e = 0;
+			for (int j=0; j<3; ++j) {
+				c += toWorld.m[i][j] * center[j];
+				e += std::abs(toWorld.m[i][j]) * extents[j];
+			}
+			result.min[i] = c - e;
+			result.max[i] = c + e;
+		}
+		return result;
+	}
+
+	/// Transform a ray into the local coordinate system of an instance
+	static FINLINE void transformRay(const AffineMatrix &m, const Ray &ray, Ray &result) {
+		for (int i=0; i<3; ++i)
+			result.o[i] = m.m[i][0] * ray.o.x + m.m[i][1] * ray.o.y + m.m[i][2] * ray.o.z + m.m[i][3];
+		result.setDirection(Vector(
+			m.m[0][0] * ray.d.x + m.m[0][1] * ray.d.y + m.m[0][2] * ray.d.z,
+			m.m[1][0] * ray.d.x + m.m[1][1] * ray.d.y + m.m[1][2] * ray.d.z,
+			m.m[2][0] * ray.d.x + m.m[2][1] * ray.d.y + m.m[2][2] * ray.d.z));
+		result.mint = ray.mint;
+		result.maxt = ray.maxt;
+		result.time = ray.time;
+	}
+
+	/// Find the instance containing the given surface point (or return -1)
+	int64_t findInstance(const Intersection &its) const;
+
+private:
+	ref<ShapeGroup> m_shapeGroup;
+	std::vector<AffineMatrix> m_toLocal;
+	WideBVH<8> m_bvh;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __INSTANCEARRAY_H */
@@ -27,8 +27,22 @@
 #include <mitsuba/render/sensor.h>
 #include <mitsuba/core/filesystem.h>
 #include <mitsuba/hw/basicshader.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/mstream.h>
 #include <fstream>
 #include <set>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+/// OBJ files are split into chunks of at least this size (in bytes), which are parsed in parallel
+#define MTS_OBJ_CHUNK_SIZE (4*1024*1024)
+
+/// By default, cache files are created for OBJ files larger than this (in bytes)
+#define MTS_OBJ_CACHE_THRESHOLD (64*1024*1024)
+
+/// Identifier at the beginning of OBJ cache files (includes the format version)
+#define MTS_OBJ_CACHE_IDENTIFIER "MTS_OBJCACHE_V1"
 
 MTS_NAMESPACE_BEGIN
 
@@ -70,6 +84,12 @@ MTS_NAMESPACE_BEGIN
  *	   \parameter{loadMaterials}{\Boolean}{
  *	     \mbox{Import materials from a \code{mtl} file, if it exists?\default{\code{true}}}
  *	   }
+ *     \parameter{cache}{\Boolean}{
+ *        Store the parsed geometry in a binary cache file named
+ *        \emph{filename}\code{.objcache}, which is loaded instead of the OBJ
+ *        file by subsequent runs.
+ *        \default{automatic---use caching for files larger than 64 MiB}
+ *     }
  * }
  * \renderings{
  *     \label{fig:rungholt}
@@ -141,6 +161,15 @@ MTS_NAMESPACE_BEGIN
  * actually needed (i.e. when the mesh contains creases or edges and does not come with
  * valid vertex normals).
  *
+ * \paragraph{Loading large files:}
+ * The OBJ file is memory-mapped, split into chunks of complete lines and parsed
+ * using all available cores. Since this is still much slower than reading
+ * binary data, the resulting meshes can be stored in a cache file (see the
+ * \code{cache} parameter). The cache is automatically regenerated when the
+ * size or modification time of the OBJ file changes, or when any of the
+ * parameters \code{toWorld}, \code{flipTexCoords}, \code{collapse} or
+ * \code{shapeIndex} are modified. Material libraries are not cached.
+ *
  * \remarks{
  * \item Importing geometry via OBJ files should only be used as an absolutely
  * last resort. Due to inherent limitations of this format, the files tend to be unreasonably
@@ -158,12 +187,47 @@ public:
 		int p[3];
 		int n[3];
 		int uv[3];
+		/// Bit <tt>3*i+k</tt> marks a position (k=0), texture coordinate (k=1)
+		/// or normal (k=2) index of corner \c i that is relative to the chunk
+		uint16_t relative;
 
 		inline OBJTriangle() {
 			memset(this, 0, sizeof(OBJTriangle));
 		}
 	};
 
+	/// Statement that determines how the triangles are grouped into meshes
+	struct OBJDirective {
+		enum EType {
+			EGroup,
+			EUseMaterial,
+			EMaterialLibrary
+		};
+
+		EType type;
+		std::string argument;
+		/// Number of triangles of the chunk that precede the statement
+		size_t triangleCount;
+	};
+
+	/// Contents of a range of lines of an OBJ file, which are parsed independently
+	struct OBJChunk {
+		std::vector<Point> vertices;
+		std::vector<Normal> normals;
+		std::vector<Point2> texcoords;
+		std::vector<OBJTriangle> triangles;
+		std::vector<OBJDirective> directives;
+		std::string error;
+
+		inline void addDirective(OBJDirective::EType type, const std::string &argument) {
+			OBJDirective directive;
+			directive.type = type;
+			directive.argument = argument;
+			directive.triangleCount = triangles.size();
+			directives.push_back(directive);
+		}
+	};
+
 	bool fetch_line(std::istream &is, std::string &line) {
 		/// Fetch a line from the stream, while handling line breaks with backslashes
 		if (!std::getline(is, line))
@@ -223,131 +287,585 @@ public:
 
 		/* Load the geometry */
 		Log(EInfo, "Loading geometry from \"%s\" ..", path.filename().string().c_str());
-		std::ifstream is(path);
-		if (is.bad() || is.fail())
+		if (!fs::exists(path))
 			Log(EError, "Wavefront OBJ file '%s' not found!", path.string().c_str());
 
+		std::error_code ec;
+		uint64_t fileSize = (uint64_t) fs::file_size(path, ec);
+		if (ec.value())
+			Log(EError, "Could not determine the size of \"%s\"!", path.string().c_str());
+		uint64_t timestamp = (uint64_t) fs::last_write_time(path, ec).time_since_epoch().count();
+		if (ec.value())
+			Log(EError, "Could not determine modification time of \"%s\"!", path.string().c_str());
+
+		/* Everything that affects the generated meshes is part of the cache key */
+		ref<MemoryStream> cacheKey = new MemoryStream();
+		cacheKey->setByteOrder(Stream::ELittleEndian);
+		cacheKey->writeULong(fileSize);
+		cacheKey->writeULong(timestamp);
+		cacheKey->writeUChar((uint8_t) sizeof(Float));
+		cacheKey->writeBool(flipTexCoords);
+		cacheKey->writeBool(m_collapse);
+		cacheKey->writeInt(shapeIndex);
+		objectToWorld.serialize(cacheKey);
+
+		fs::path cacheFile = path;
+		cacheFile.replace_extension(".objcache");
+		bool createCache = props.getBoolean("cache", fileSize > MTS_OBJ_CACHE_THRESHOLD);
+
 		fileResolver->prependPath(fs::encode_pathstr(fs::absolute(path).parent_path()));
 
 		ref<Timer> timer = new Timer();
-		std::string buf;
+		fs::path materialLibrary;
+		if (createCache && readCache(cacheFile, cacheKey, materialLibrary)) {
+			Log(EInfo, "Loaded " SIZE_T_FMT " meshes from the cache file \"%s\"",
+				m_meshes.size(), cacheFile.filename().string().c_str());
+		} else {
+			ref<MemoryMappedFile> mmap;
+			const char *data = NULL;
+			if (fileSize > 0) {
+				mmap = new MemoryMappedFile(fs::encode_pathstr(path));
+				data = (const char *) mmap->getData();
+			}
+			parseOBJ(data, (size_t) fileSize, flipTexCoords, shapeIndex,
+				objectToWorld, fileResolver, materialLibrary);
+			if (createCache)
+				writeCache(cacheFile, cacheKey, materialLibrary);
+		}
+
+		if (props.hasProperty("maxSmoothAngle")) {
+			if (m_faceNormals)
+				Log(EError, "The properties 'maxSmoothAngle' and 'faceNormals' "
+				"can't be specified at the same time!");
+			Float maxSmoothAngle = props.getFloat("maxSmoothAngle");
+			for (size_t i=0; i<m_meshes.size(); ++i)
+				m_meshes[i]->rebuildTopology(maxSmoothAngle);
+		}
+
+		if (!materialLibrary.empty() && loadMaterials)
+			loadMaterialLibrary(fileResolver, materialLibrary);
+
+		Log(EInfo, "Done with \"%s\" (took %i ms)", path.filename().string().c_str(), timer->getMilliseconds());
+	}
+
+	/**
+	 * \brief Parse the contents of an OBJ file and create the meshes
+	 *
+	 * The file is split into chunks of complete lines, which are parsed
+	 * in parallel. Afterwards, the group and material statements of all
+	 * chunks are processed in order to assemble the meshes.
+	 */
+	void parseOBJ(const char *data, size_t size, bool flipTexCoords, int shapeIndex,
+			const Transform &objectToWorld, const FileResolver *fileResolver,
+			fs::path &materialLibrary) {
+		ref<Timer> timer = new Timer();
+
+		/* Split the file into chunks that start at the beginning of a line */
+		int threadCount = std::max(1, getCoreCount());
+		size_t chunkCount = std::max((size_t) 1, std::min((size_t) threadCount * 4,
+			size / MTS_OBJ_CHUNK_SIZE));
+		std::vector<const char *> bounds(chunkCount + 1);
+		bounds[0] = data;
+		for (size_t i=1; i<chunkCount; ++i) {
+			/* Lines longer than a chunk may extend past the next split position */
+			const char *pos = std::max(bounds[i-1], data + (size / chunkCount) * i);
+			bounds[i] = findLineStart(bounds[i-1], pos, data + size);
+		}
+		bounds[chunkCount] = data + size;
+
+		std::vector<OBJChunk> chunks(chunkCount);
+		std::atomic<size_t> nextChunk(0);
+		auto worker = [&]() {
+			size_t i;
+			while ((i = nextChunk++) < chunkCount)
+				parseChunk(bounds[i], bounds[i+1], chunks[i], flipTexCoords);
+		};
+
+		threadCount = (int) std::min((size_t) threadCount, chunkCount);
+		std::vector<std::thread> workers;
+		for (int i=1; i<threadCount; ++i)
+			workers.push_back(std::thread(worker));
+		worker();
+		for (size_t i=0; i<workers.size(); ++i)
+			workers[i].join();
+
+		size_t vertexCount = 0, normalCount = 0, texcoordCount = 0;
+		for (size_t i=0; i<chunkCount; ++i) {
+			if (!chunks[i].error.empty())
+				Log(EError, "%s", chunks[i].error.c_str());
+			vertexCount += chunks[i].vertices.size();
+			normalCount += chunks[i].normals.size();
+			texcoordCount += chunks[i].texcoords.size();
+		}
+		Log(EDebug, "Parsed " SIZE_T_FMT " chunks using %i threads (took %i ms)",
+			chunkCount, threadCount, timer->getMilliseconds());
+
+		/* Concatenate the vertex attributes of all chunks */
 		std::vector<Point> vertices;
 		std::vector<Normal> normals;
 		std::vector<Point2> texcoords;
+		vertices.reserve(vertexCount);
+		normals.reserve(normalCount);
+		texcoords.reserve(texcoordCount);
+
 		std::vector<OBJTriangle> triangles;
-		std::string name = m_name, line;
+		std::string name = m_name;
 		std::set<std::string> geomNames;
 		std::vector<Vertex> vertexBuffer;
-		fs::path materialLibrary;
 		int geomIndex = 0;
 		bool nameBeforeGeometry = false;
 		std::string materialName;
 
-		while (is.good() && !is.eof() && fetch_line(is, line)) {
-			std::istringstream iss(line);
-			if (!(iss >> buf))
-				continue;
+		for (size_t c=0; c<chunkCount; ++c) {
+			OBJChunk &chunk = chunks[c];
+
+			/* Indices that were relative to the end of the chunk's
+			   attribute lists now become absolute ones */
+			int offset[3] = { (int) vertices.size(),
+				(int) texcoords.size(), (int) normals.size() };
+			for (size_t i=0; i<chunk.triangles.size(); ++i) {
+				OBJTriangle &t = chunk.triangles[i];
+				if (!t.relative)
+					continue;
+				for (int j=0; j<3; ++j) {
+					if (t.relative & (1 << (3*j)))
+						t.p[j] += offset[0];
+					if (t.relative & (1 << (3*j+1)))
+						t.uv[j] += offset[1];
+					if (t.relative & (1 << (3*j+2)))
+						t.n[j] += offset[2];
+				}
+			}
 
-			if (buf == "v") {
-				/* Parse + transform vertices */
-				Point p;
-				iss >> p.x >> p.y >> p.z;
-				vertices.push_back(p);
-			} else if (buf == "vn") {
-				Normal n;
-				iss >> n.x >> n.y >> n.z;
-				normals.push_back(n);
-			} else if (buf == "g" && !m_collapse) {
-				std::string targetName;
-				std::string newName = trim(line.substr(1, line.length()-1));
-
-				/* There appear to be two different conventions
-				   for specifying object names in OBJ file -- try
-				   to detect which one is being used */
-				if (nameBeforeGeometry)
-					// Save geometry under the previously specified name
-					targetName = name;
-				else
-					targetName = newName;
-
-				if (triangles.size() > 0) {
-					/// make sure that we have unique names
-					if (geomNames.find(targetName) != geomNames.end())
-						targetName = formatString("%s_%i", targetName.c_str(), geomIndex);
-					geomIndex += 1;
-					geomNames.insert(targetName);
-					if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
-						createMesh(targetName, vertices, normals, texcoords,
-							triangles, materialName, objectToWorld, vertexBuffer);
-					triangles.clear();
+			vertices.insert(vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+			normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+			texcoords.insert(texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+			std::vector<Point>().swap(chunk.vertices);
+			std::vector<Normal>().swap(chunk.normals);
+			std::vector<Point2>().swap(chunk.texcoords);
+
+			size_t pos = 0;
+			for (size_t d=0; d<chunk.directives.size(); ++d) {
+				const OBJDirective &directive = chunk.directives[d];
+				triangles.insert(triangles.end(), chunk.triangles.begin() + pos,
+					chunk.triangles.begin() + directive.triangleCount);
+				pos = directive.triangleCount;
+
+				if (directive.type == OBJDirective::EGroup) {
+					std::string targetName;
+					const std::string &newName = directive.argument;
+
+					/* There appear to be two different conventions
+					   for specifying object names in OBJ file -- try
+					   to detect which one is being used */
+					if (nameBeforeGeometry)
+						// Save geometry under the previously specified name
+						targetName = name;
+					else
+						targetName = newName;
+
+					if (triangles.size() > 0) {
+						/// make sure that we have unique names
+						if (geomNames.find(targetName) != geomNames.end())
+							targetName = formatString("%s_%i", targetName.c_str(), geomIndex);
+						geomIndex += 1;
+						geomNames.insert(targetName);
+						if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
+							createMesh(targetName, vertices, normals, texcoords,
+								triangles, materialName, objectToWorld, vertexBuffer);
+						triangles.clear();
+					} else {
+						nameBeforeGeometry = true;
+					}
+					name = newName;
+				} else if (directive.type == OBJDirective::EUseMaterial) {
+					/* Flush if necessary */
+					if (triangles.size() > 0 && !m_collapse) {
+						/// make sure that we have unique names
+						if (geomNames.find(name) != geomNames.end())
+							name = formatString("%s_%i", name.c_str(), geomIndex);
+						geomIndex += 1;
+						geomNames.insert(name);
+						if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
+							createMesh(name, vertices, normals, texcoords,
+								triangles, materialName, objectToWorld, vertexBuffer);
+						triangles.clear();
+						name = m_name;
+					}
+
+					materialName = directive.argument;
 				} else {
-					nameBeforeGeometry = true;
+					materialLibrary = fs::decode_pathstr(fileResolver->resolve(fs::pathstr(directive.argument)));
 				}
-				name = newName;
-			} else if (buf == "usemtl") {
-				/* Flush if necessary */
-				if (triangles.size() > 0 && !m_collapse) {
-					/// make sure that we have unique names
-					if (geomNames.find(name) != geomNames.end())
-						name = formatString("%s_%i", name.c_str(), geomIndex);
-					geomIndex += 1;
-					geomNames.insert(name);
-					if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
-						createMesh(name, vertices, normals, texcoords,
-							triangles, materialName, objectToWorld, vertexBuffer);
-					triangles.clear();
-					name = m_name;
+			}
+			triangles.insert(triangles.end(), chunk.triangles.begin() + pos,
+				chunk.triangles.end());
+			std::vector<OBJTriangle>().swap(chunk.triangles);
+		}
+
+		if (geomNames.find(name) != geomNames.end())
+			/// make sure that we have unique names
+			name = formatString("%s_%i", m_name.c_str(), geomIndex);
+
+		if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
+			createMesh(name, vertices, normals, texcoords,
+				triangles, materialName, objectToWorld, vertexBuffer);
+	}
+
+	/**
+	 * \brief Return the start of the first line that begins at or after \c pos
+	 * and does not continue a previous line (i.e. one ending with a backslash)
+	 */
+	static const char *findLineStart(const char *begin, const char *pos, const char *end) {
+		while (pos < end) {
+			const char *newline = (const char *) memchr(pos, '\n', end - pos);
+			if (!newline)
+				return end;
+			const char *last = newline;
+			while (last > begin && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+				--last;
+			pos = newline + 1;
+			if (last == begin || last[-1] != '\\')
+				return pos;
+		}
+		return end;
+	}
+
+	/// Parse all lines in the range <tt>[ptr, end)</tt>
+	void parseChunk(const char *ptr, const char *end, OBJChunk &chunk, bool flipTexCoords) {
+		std::string joined;
+		while (ptr < end && chunk.error.empty()) {
+			const char *lineEnd = (const char *) memchr(ptr, '\n', end - ptr);
+			if (!lineEnd)
+				lineEnd = end;
+			const char *last = lineEnd;
+			while (last > ptr && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+				--last;
+
+			if (last > ptr && last[-1] == '\\') {
+				/* Handle line breaks with backslashes */
+				joined.clear();
+				while (true) {
+					bool continued = last > ptr && last[-1] == '\\';
+					joined.append(ptr, continued ? last - 1 : last);
+					ptr = lineEnd < end ? lineEnd + 1 : end;
+					if (!continued || ptr == end)
+						break;
+					lineEnd = (const char *) memchr(ptr, '\n', end - ptr);
+					if (!lineEnd)
+						lineEnd = end;
+					last = lineEnd;
+					while (last > ptr && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+						--last;
 				}
+				parseLine(joined.data(), joined.data() + joined.size(), chunk, flipTexCoords);
+			} else {
+				parseLine(ptr, last, chunk, flipTexCoords);
+				ptr = lineEnd < end ? lineEnd + 1 : end;
+			}
+		}
+	}
 
-				materialName = trim(line.substr(6, line.length()-1));
-			} else if (buf == "mtllib") {
-				materialLibrary = fs::decode_pathstr(fileResolver->resolve(fs::pathstr(trim(line.substr(6, line.length()-1)))));
-			} else if (buf == "vt") {
-				Float u, v;
-				iss >> u >> v;
-				if (flipTexCoords)
-					v = 1-v;
-				texcoords.push_back(Point2(u, v));
-			} else if (buf == "f") {
-				std::string  tmp;
-				OBJTriangle t;
-				iss >> tmp; parse(t, 0, tmp);
-				iss >> tmp; parse(t, 1, tmp);
-				iss >> tmp; parse(t, 2, tmp);
-				triangles.push_back(t);
-				/* Handle n-gons assuming a convex shape */
-				while (iss >> tmp) {
+	/// Parse a single line (without its line break)
+	void parseLine(const char *ptr, const char *end, OBJChunk &chunk, bool flipTexCoords) {
+		ptr = skipSpace(ptr, end);
+		const char *keyword = ptr;
+		while (ptr < end && *ptr != ' ' && *ptr != '\t')
+			++ptr;
+		size_t length = ptr - keyword;
+
+		if (length == 1 && keyword[0] == 'v') {
+			/* Parse + transform vertices */
+			Point p(0.0f);
+			ptr = parseFloat(ptr, end, p.x);
+			ptr = parseFloat(ptr, end, p.y);
+			parseFloat(ptr, end, p.z);
+			chunk.vertices.push_back(p);
+		} else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n') {
+			Normal n(0.0f);
+			ptr = parseFloat(ptr, end, n.x);
+			ptr = parseFloat(ptr, end, n.y);
+			parseFloat(ptr, end, n.z);
+			chunk.normals.push_back(n);
+		} else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't') {
+			Float u = 0, v = 0;
+			ptr = parseFloat(ptr, end, u);
+			parseFloat(ptr, end, v);
+			if (flipTexCoords)
+				v = 1-v;
+			chunk.texcoords.push_back(Point2(u, v));
+		} else if (length == 1 && keyword[0] == 'f') {
+			OBJTriangle t;
+			int corners = 0;
+			while ((ptr = skipSpace(ptr, end)) < end) {
+				if (corners >= 3) {
+					/* Handle n-gons assuming a convex shape */
 					t.p[1] = t.p[2];
 					t.uv[1] = t.uv[2];
 					t.n[1] = t.n[2];
-					parse(t, 2, tmp);
-					triangles.push_back(t);
+					t.relative = (uint16_t) ((t.relative & 0x7)
+						| ((t.relative >> 3) & 0x38));
 				}
+				ptr = parseFaceVertex(ptr, end, t, std::min(corners, 2), chunk);
+				if (!ptr) {
+					chunk.error = "Invalid OBJ face format!";
+					return;
+				}
+				if (++corners >= 3)
+					chunk.triangles.push_back(t);
+			}
+		} else if (length == 1 && keyword[0] == 'g') {
+			if (!m_collapse)
+				chunk.addDirective(OBJDirective::EGroup, trim(std::string(ptr, end)));
+		} else if (length == 6 && memcmp(keyword, "usemtl", 6) == 0) {
+			chunk.addDirective(OBJDirective::EUseMaterial, trim(std::string(ptr, end)));
+		} else if (length == 6 && memcmp(keyword, "mtllib", 6) == 0) {
+			chunk.addDirective(OBJDirective::EMaterialLibrary, trim(std::string(ptr, end)));
+		} else {
+			/* Ignore */
+		}
+	}
+
+	static inline const char *skipSpace(const char *ptr, const char *end) {
+		while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\r'))
+			++ptr;
+		return ptr;
+	}
+
+	static inline const char *parseInt(const char *ptr, const char *end, int &value) {
+		bool negative = false;
+		if (ptr < end && (*ptr == '-' || *ptr == '+'))
+			negative = *ptr++ == '-';
+		int result = 0;
+		while (ptr < end && *ptr >= '0' && *ptr <= '9')
+			result = result * 10 + (*ptr++ - '0');
+		value = negative ? -result : result;
+		return ptr;
+	}
+
+	/**
+	 * \brief Parse a floating point value without going through
+	 * the C++ streams library
+	 *
+	 * Numbers with up to 19 significant digits and a decimal exponent
+	 * in <tt>[-22, 22]</tt> are converted using a single rounding
+	 * step in double precision. Anything else (including "nan" and
+	 * "inf") is passed on to \c strtod().
+	 */
+	static const char *parseFloat(const char *ptr, const char *end, Float &value) {
+		static const double powersOf10[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+
+		ptr = skipSpace(ptr, end);
+		const char *start = ptr;
+		bool negative = false, valid = false;
+		if (ptr < end && (*ptr == '-' || *ptr == '+'))
+			negative = *ptr++ == '-';
+
+		uint64_t mantissa = 0;
+		int digits = 0, exponent = 0;
+		for (; ptr < end && *ptr >= '0' && *ptr <= '9'; ++ptr) {
+			valid = true;
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (uint64_t) (*ptr - '0');
+				digits += mantissa != 0 ? 1 : 0;
 			} else {
-				/* Ignore */
+				++exponent;
+			}
+		}
+		if (ptr < end && *ptr == '.') {
+			for (++ptr; ptr < end && *ptr >= '0' && *ptr <= '9'; ++ptr) {
+				valid = true;
+				if (digits < 19) {
+					mantissa = mantissa * 10 + (uint64_t) (*ptr - '0');
+					digits += mantissa != 0 ? 1 : 0;
+					--exponent;
+				}
+			}
+		}
+		if (valid && ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+			const char *exponentStart = ptr++;
+			bool negativeExponent = false;
+			if (ptr < end && (*ptr == '-' || *ptr == '+'))
+				negativeExponent = *ptr++ == '-';
+			if (ptr < end && *ptr >= '0' && *ptr <= '9') {
+				int value = 0;
+				for (; ptr < end && *ptr >= '0' && *ptr <= '9'; ++ptr)
+					value = std::min(value * 10 + (*ptr - '0'), 100000);
+				exponent += negativeExponent ? -value : value;
+			} else {
+				ptr = exponentStart;
 			}
 		}
-		if (geomNames.find(name) != geomNames.end())
-			/// make sure that we have unique names
-			name = formatString("%s_%i", m_name.c_str(), geomIndex);
 
-		if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
-			createMesh(name, vertices, normals, texcoords,
-				triangles, materialName, objectToWorld, vertexBuffer);
+		if (!valid || exponent < -22 || exponent > 22) {
+			char buf[64];
+			size_t length = std::min((size_t) (end - start), sizeof(buf) - 1);
+			memcpy(buf, start, length);
+			buf[length] = '\0';
+			char *endptr = NULL;
+			value = (Float) strtod(buf, &endptr);
+			return start + (endptr - buf);
+		}
 
-		if (props.hasProperty("maxSmoothAngle")) {
-			if (m_faceNormals)
-				Log(EError, "The properties 'maxSmoothAngle' and 'faceNormals' "
-				"can't be specified at the same time!");
-			Float maxSmoothAngle = props.getFloat("maxSmoothAngle");
-			for (size_t i=0; i<m_meshes.size(); ++i)
-				m_meshes[i]->rebuildTopology(maxSmoothAngle);
+		double result = (double) mantissa;
+		if (exponent < 0)
+			result /= powersOf10[-exponent];
+		else
+			result *= powersOf10[exponent];
+		value = (Float) (negative ? -result : result);
+		return ptr;
+	}
+
+	/**
+	 * \brief Parse a face vertex (<tt>p</tt>, <tt>p/uv</tt>, <tt>p//n</tt>
+	 * or <tt>p/uv/n</tt>) and store it as corner \c i of \c t
+	 *
+	 * Negative indices refer to the end of the attribute lists parsed so far.
+	 * They are stored relative to the start of the chunk and marked in
+	 * \ref OBJTriangle::relative. Returns \c NULL when the format is invalid.
+	 */
+	static inline const char *parseFaceVertex(const char *ptr, const char *end,
+			OBJTriangle &t, int i, const OBJChunk &chunk) {
+		int p = 0, uv = 0, n = 0;
+		ptr = parseInt(ptr, end, p);
+		if (ptr < end && *ptr == '/') {
+			++ptr;
+			if (ptr < end && *ptr != '/')
+				ptr = parseInt(ptr, end, uv);
+			if (ptr < end && *ptr == '/')
+				ptr = parseInt(ptr + 1, end, n);
 		}
+		if (ptr < end && *ptr != ' ' && *ptr != '\t' && *ptr != '\r')
+			return NULL;
 
-		if (!materialLibrary.empty() && loadMaterials)
-			loadMaterialLibrary(fileResolver, materialLibrary);
+		t.relative &= (uint16_t) ~(0x7 << (3*i));
+		if (p < 0) {
+			p += (int) chunk.vertices.size() + 1;
+			t.relative |= (uint16_t) (1 << (3*i));
+		}
+		if (uv < 0) {
+			uv += (int) chunk.texcoords.size() + 1;
+			t.relative |= (uint16_t) (1 << (3*i+1));
+		}
+		if (n < 0) {
+			n += (int) chunk.normals.size() + 1;
+			t.relative |= (uint16_t) (1 << (3*i+2));
+		}
+		t.p[i] = p; t.uv[i] = uv; t.n[i] = n;
+		return ptr;
+	}
 
-		Log(EInfo, "Done with \"%s\" (took %i ms)", path.filename().string().c_str(), timer->getMilliseconds());
+	/// Try to load the meshes from a cache file created by \ref writeCache()
+	bool readCache(const fs::path &cacheFile, const MemoryStream *cacheKey,
+			fs::path &materialLibrary) {
+		if (!fs::exists(cacheFile))
+			return false;
+
+		std::vector<TriMesh *> meshes;
+		std::vector<std::string> materialAssignment;
+		try {
+			ref<FileStream> stream = new FileStream(fs::encode_pathstr(cacheFile), FileStream::EReadOnly);
+			stream->setByteOrder(Stream::ELittleEndian);
+
+			char identifier[sizeof(MTS_OBJ_CACHE_IDENTIFIER)];
+			std::vector<uint8_t> key(cacheKey->getSize());
+			if (stream->getSize() < sizeof(identifier) + key.size())
+				return false;
+			stream->read(identifier, sizeof(identifier));
+			stream->read(&key[0], key.size());
+			if (memcmp(identifier, MTS_OBJ_CACHE_IDENTIFIER, sizeof(identifier)) != 0 ||
+				memcmp(&key[0], cacheKey->getData(), key.size()) != 0) {
+				Log(EInfo, "The cache file \"%s\" is outdated and will be recreated",
+					cacheFile.filename().string().c_str());
+				return false;
+			}
+
+			std::string library = stream->readString();
+			size_t meshCount = stream->readSize();
+			for (size_t i=0; i<meshCount; ++i) {
+				std::string name = stream->readString();
+				std::string materialName = stream->readString();
+				size_t triangleCount = stream->readSize();
+				size_t vertexCount = stream->readSize();
+				bool hasNormals = stream->readBool();
+				bool hasTexcoords = stream->readBool();
+
+				ref<TriMesh> mesh = new TriMesh(name, triangleCount, vertexCount,
+					hasNormals, hasTexcoords, false, m_flipNormals, m_faceNormals);
+				mesh->getAABB() = AABB(stream);
+				stream->readUIntArray((unsigned int *) mesh->getTriangles(), triangleCount * 3);
+				stream->readFloatArray((Float *) mesh->getVertexPositions(), vertexCount * 3);
+				if (hasNormals)
+					stream->readFloatArray((Float *) mesh->getVertexNormals(), vertexCount * 3);
+				if (hasTexcoords)
+					stream->readFloatArray((Float *) mesh->getVertexTexcoords(), vertexCount * 2);
+
+				mesh->incRef();
+				meshes.push_back(mesh);
+				materialAssignment.push_back(materialName);
+			}
+			materialLibrary = library.empty() ? fs::path() : fs::path(library);
+		} catch (const std::exception &e) {
+			Log(EWarn, "Could not read the cache file \"%s\": %s",
+				cacheFile.string().c_str(), e.what());
+			for (size_t i=0; i<meshes.size(); ++i)
+				meshes[i]->decRef();
+			return false;
+		}
+
+		m_meshes.insert(m_meshes.end(), meshes.begin(), meshes.end());
+		m_materialAssignment.insert(m_materialAssignment.end(),
+			materialAssignment.begin(), materialAssignment.end());
+		return true;
+	}
+
+	/// Store the meshes in a cache file that is used by subsequent loads
+	void writeCache(const fs::path &cacheFile, const MemoryStream *cacheKey,
+			const fs::path &materialLibrary) {
+		/* Write to a temporary file first so that concurrent
+		   loads never observe an incomplete cache */
+		fs::path tempFile = cacheFile;
+		tempFile += ".tmp";
+		ref<Timer> timer = new Timer();
+
+		try {
+			ref<FileStream> stream = new FileStream(fs::encode_pathstr(tempFile), FileStream::ETruncWrite);
+			stream->setByteOrder(Stream::ELittleEndian);
+			stream->write(MTS_OBJ_CACHE_IDENTIFIER, sizeof(MTS_OBJ_CACHE_IDENTIFIER));
+			stream->write(cacheKey->getData(), cacheKey->getSize());
+			stream->writeString(materialLibrary.string());
+			stream->writeSize(m_meshes.size());
+			for (size_t i=0; i<m_meshes.size(); ++i) {
+				const TriMesh *mesh = m_meshes[i];
+				size_t triangleCount = mesh->getTriangleCount(),
+				       vertexCount = mesh->getVertexCount();
+				stream->writeString(mesh->getName());
+				stream->writeString(m_materialAssignment[i]);
+				stream->writeSize(triangleCount);
+				stream->writeSize(vertexCount);
+				stream->writeBool(mesh->hasVertexNormals());
+				stream->writeBool(mesh->hasVertexTexcoords());
+				mesh->getAABB().serialize(stream);
+				stream->writeUIntArray((const unsigned int *) mesh->getTriangles(), triangleCount * 3);
+				stream->writeFloatArray((const Float *) mesh->getVertexPositions(), vertexCount * 3);
+				if (mesh->hasVertexNormals())
+					stream->writeFloatArray((const Float *) mesh->getVertexNormals(), vertexCount * 3);
+				if (mesh->hasVertexTexcoords())
+					stream->writeFloatArray((const Float *) mesh->getVertexTexcoords(), vertexCount * 2);
+			}
+			stream->close();
+			if (!fs::rename(fs::encode_pathstr(tempFile), fs::encode_pathstr(cacheFile)))
+				Log(EError, "Could not rename \"%s\"", tempFile.string().c_str());
+			Log(EDebug, "Wrote the cache file \"%s\" (took %i ms)",
+				cacheFile.filename().string().c_str(), timer->getMilliseconds());
+		} catch (const std::exception &e) {
+			Log(EWarn, "Could not write the cache file \"%s\": %s",
+				cacheFile.string().c_str(), e.what());
+			fs::remove(fs::encode_pathstr(tempFile));
+		}
 	}
 
 	WavefrontOBJ(Stream *stream, InstanceManager *manager) : Shape(stream, manager) {
@@ -370,27 +888,6 @@ public:
 			manager->serialize(stream, m_meshes[i]);
 	}
 
-	void parse(OBJTriangle &t, int i, const std::string &str) {
-		std::vector<std::string> tokens = tokenize(str, "/");
-		if (tokens.size() == 1) {
-			t.p[i] = atoi(tokens[0].c_str());
-		} else if (tokens.size() == 2) {
-			if (str.find("//") == std::string::npos) {
-				t.p[i]  = atoi(tokens[0].c_str());
-				t.uv[i] = atoi(tokens[1].c_str());
-			} else {
-				t.p[i] = atoi(tokens[0].c_str());
-				t.n[i] = atoi(tokens[1].c_str());
-			}
-		} else if (tokens.size() == 3) {
-			t.p[i] = atoi(tokens[0].c_str());
-			t.uv[i] = atoi(tokens[1].c_str());
-			t.n[i] = atoi(tokens[2].c_str());
-		} else {
-			Log(EError, "Invalid OBJ face format!");
-		}
-	}
-
 	Texture *loadTexture(const FileResolver *fileResolver,
 			std::map<std::string, Texture *> &cache,
 			const fs::path &mtlPath, std::string filename,
@@ -583,27 +1080,30 @@ public:
 		Point2 uv;
 	};
 
-	/// For using vertices as keys in an associative structure
-	struct vertex_key_order {
+	/// For using vertices as keys in a hash table
+	struct vertex_key_hash {
+	public:
+		inline static void combine(size_t &hash, Float value) {
+			/* Adding zero maps -0 to +0, which compare as being equal */
+			value += 0.0f;
+			size_t h = 0;
+			memcpy(&h, &value, sizeof(Float));
+			hash ^= h + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+		}
+
+		size_t operator()(const Vertex &v) const {
+			size_t hash = 0;
+			combine(hash, v.p.x); combine(hash, v.p.y); combine(hash, v.p.z);
+			combine(hash, v.n.x); combine(hash, v.n.y); combine(hash, v.n.z);
+			combine(hash, v.uv.x); combine(hash, v.uv.y);
+			return hash;
+		}
+	};
+
+	struct vertex_key_equal {
 	public:
 		bool operator()(const Vertex &v1, const Vertex &v2) const {
-			if (v1.p.x < v2.p.x) return true;
-			else if (v1.p.x > v2.p.x) return false;
-			if (v1.p.y < v2.p.y) return true;
-			else if (v1.p.y > v2.p.y) return false;
-			if (v1.p.z < v2.p.z) return true;
-			else if (v1.p.z > v2.p.z) return false;
-			if (v1.n.x < v2.n.x) return true;
-			else if (v1.n.x > v2.n.x) return false;
-			if (v1.n.y < v2.n.y) return true;
-			else if (v1.n.y > v2.n.y) return false;
-			if (v1.n.z < v2.n.z) return true;
-			else if (v1.n.z > v2.n.z) return false;
-			if (v1.uv.x < v2.uv.x) return true;
-			else if (v1.uv.x > v2.uv.x) return false;
-			if (v1.uv.y < v2.uv.y) return true;
-			else if (v1.uv.y > v2.uv.y) return false;
-			return false;
+			return v1.p == v2.p && v1.n == v2.n && v1.uv == v2.uv;
 		}
 	};
 
@@ -617,8 +1117,9 @@ public:
 			std::vector<Vertex> &vertexBuffer) {
 		if (triangles.size() == 0)
 			return;
-		typedef std::map<Vertex, uint32_t, vertex_key_order> VertexMapType;
+		typedef std::unordered_map<Vertex, uint32_t, vertex_key_hash, vertex_key_equal> VertexMapType;
 		VertexMapType vertexMap;
+		vertexMap.reserve(std::min(vertices.size(), triangles.size()));
 
 		vertexBuffer.reserve(vertices.size());
 		size_t numMerged = 0;
@@ -672,15 +1173,13 @@ public:
 					vertex.uv = Point2(0.0f);
 				}
 
-				VertexMapType::iterator it = vertexMap.find(vertex);
-				if (it != vertexMap.end()) {
-					key = it->second;
-					numMerged++;
-				} else {
-					key = (uint32_t) vertexBuffer.size();
-					vertexMap[vertex] = key;
+				std::pair<VertexMapType::iterator, bool> result =
+					vertexMap.insert(std::make_pair(vertex, (uint32_t) vertexBuffer.size()));
+				key = result.first->second;
+				if (result.second)
 					vertexBuffer.push_back(vertex);
-				}
+				else
+					numMerged++;
 
 				tri.idx[j] = key;
 			}
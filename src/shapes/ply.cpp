@@ -21,8 +21,18 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/filesystem.h>
+#include <mitsuba/core/mmap.h>
 #include <ply/ply_parser.hpp>
 #include <functional>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+/// Minimum number of vertices or faces per thread of the bulk PLY loader
+#define MTS_PLY_PARALLEL_GRAINSIZE 65536
+
+/// The bulk PLY loader gives up when it cannot find the end of the header within this many bytes
+#define MTS_PLY_MAX_HEADER_SIZE (1024*1024)
 
 MTS_NAMESPACE_BEGIN
 
@@ -66,6 +76,13 @@ MTS_NAMESPACE_BEGIN
  * The current plugin implementation supports triangle meshes with optional
  * UV coordinates, vertex normals, and vertex colors.
  *
+ * Binary files that consist of a \code{vertex} and a \code{face} element are
+ * decoded by a separate bulk loader, which converts the data directly into
+ * the mesh arrays using all available cores. When the vertices only consist of
+ * single precision \code{x}, \code{y} and \code{z} coordinates in the native
+ * byte order and no \code{toWorld} transformation is specified, the positions
+ * are used in place from a memory-mapped view of the file.
+ *
  * When loading meshes that contain vertex colors, note that they need to be
  * explicitly referenced in a BSDF using a special texture named
  * \pluginref{vertexcolors}.
@@ -110,21 +127,132 @@ public:
 				"can't be specified at the same time!");
 			rebuildTopology(props.getFloat("maxSmoothAngle"));
 		}
-
-		if (m_triangleCount < m_faceCount * 2) {
-			/* Needed less memory than the earlier conservative estimate -- free it! */
-			Triangle *temp = new Triangle[m_triangleCount];
-			memcpy(temp, m_triangles, sizeof(Triangle) * m_triangleCount);
-			delete[] m_triangles;
-			m_triangles = temp;
-		}
 	}
 
 
 	PLYLoader(Stream *stream, InstanceManager *manager) : TriMesh(stream, manager) { }
 
+	/// Load a PLY file using \ref loadBinaryPLY() or \ref loadPLYCallbacks()
 	void loadPLY(const fs::path &path);
 
+	/// Load a PLY file using the generic callback-based parser
+	void loadPLYCallbacks(const fs::path &path);
+
+	/// Scalar types that can occur in a PLY file
+	enum EPLYType {
+		EPLYInvalid = 0,
+		EPLYInt8, EPLYUInt8,
+		EPLYInt16, EPLYUInt16,
+		EPLYInt32, EPLYUInt32,
+		EPLYFloat32, EPLYFloat64
+	};
+
+	/// Property of a PLY element (list properties have a valid \c countType)
+	struct PLYProperty {
+		std::string name;
+		EPLYType type, countType;
+		size_t offset;
+	};
+
+	struct PLYElement {
+		std::string name;
+		size_t count;
+		std::vector<PLYProperty> properties;
+		/// Size of an entry in bytes (not counting list properties)
+		size_t stride;
+
+		/// Return the index of the property with one of the given names, or -1
+		int find(const char *name1, const char *name2 = NULL, const char *name3 = NULL) const {
+			for (size_t i=0; i<properties.size(); ++i) {
+				const std::string &name = properties[i].name;
+				if (name == name1 || (name2 && name == name2) || (name3 && name == name3))
+					return (int) i;
+			}
+			return -1;
+		}
+	};
+
+	static EPLYType parseType(const std::string &name) {
+		#define PLY_CHECK_TYPE(type, value) \
+			if (name == ply::type_traits<ply::type>::name() || \
+				name == ply::type_traits<ply::type>::old_name()) \
+				return value;
+		PLY_CHECK_TYPE(int8, EPLYInt8)
+		PLY_CHECK_TYPE(uint8, EPLYUInt8)
+		PLY_CHECK_TYPE(int16, EPLYInt16)
+		PLY_CHECK_TYPE(uint16, EPLYUInt16)
+		PLY_CHECK_TYPE(int32, EPLYInt32)
+		PLY_CHECK_TYPE(uint32, EPLYUInt32)
+		PLY_CHECK_TYPE(float32, EPLYFloat32)
+		PLY_CHECK_TYPE(float64, EPLYFloat64)
+		#undef PLY_CHECK_TYPE
+		return EPLYInvalid;
+	}
+
+	static inline size_t typeSize(EPLYType type) {
+		static const size_t sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+		return sizes[type];
+	}
+
+	static inline bool isFloatType(EPLYType type) {
+		return type == EPLYFloat32 || type == EPLYFloat64;
+	}
+
+	/// Load a value of type \c T, optionally reversing its byte order
+	template <typename T> static inline T load(const uint8_t *ptr, bool swap) {
+		T value;
+		if (swap) {
+			uint8_t tmp[sizeof(T)];
+			for (size_t i=0; i<sizeof(T); ++i)
+				tmp[i] = ptr[sizeof(T) - 1 - i];
+			memcpy(&value, tmp, sizeof(T));
+		} else {
+			memcpy(&value, ptr, sizeof(T));
+		}
+		return value;
+	}
+
+	static inline double loadScalar(const uint8_t *ptr, EPLYType type, bool swap) {
+		switch (type) {
+			case EPLYInt8: return (double) load<int8_t>(ptr, swap);
+			case EPLYUInt8: return (double) load<uint8_t>(ptr, swap);
+			case EPLYInt16: return (double) load<int16_t>(ptr, swap);
+			case EPLYUInt16: return (double) load<uint16_t>(ptr, swap);
+			case EPLYInt32: return (double) load<int32_t>(ptr, swap);
+			case EPLYUInt32: return (double) load<uint32_t>(ptr, swap);
+			case EPLYFloat32: return (double) load<float>(ptr, swap);
+			case EPLYFloat64: return load<double>(ptr, swap);
+			default: return 0;
+		}
+	}
+
+	static inline uint32_t loadIndex(const uint8_t *ptr, EPLYType type, bool swap) {
+		switch (type) {
+			case EPLYUInt8: return load<uint8_t>(ptr, swap);
+			case EPLYUInt16: return load<uint16_t>(ptr, swap);
+			case EPLYUInt32: return load<uint32_t>(ptr, swap);
+			/* Negative values turn into invalid indices */
+			case EPLYInt8: return (uint32_t) (int32_t) load<int8_t>(ptr, swap);
+			case EPLYInt16: return (uint32_t) (int32_t) load<int16_t>(ptr, swap);
+			case EPLYInt32: return (uint32_t) load<int32_t>(ptr, swap);
+			default: return 0;
+		}
+	}
+
+	/// Run \c functor(start, end) over chunks of <tt>[0, count)</tt> using multiple threads
+	template <typename Functor> static void parallelFor(size_t count, const Functor &functor) {
+		size_t chunks = std::min((size_t) std::max(1, getCoreCount()),
+			std::max((size_t) 1, count / MTS_PLY_PARALLEL_GRAINSIZE));
+		std::vector<std::thread> workers;
+		for (size_t i=1; i<chunks; ++i)
+			workers.push_back(std::thread(functor, count * i / chunks, count * (i+1) / chunks));
+		functor(0, count / chunks);
+		for (size_t i=0; i<workers.size(); ++i)
+			workers[i].join();
+	}
+
+	bool loadBinaryPLY(const fs::path &path);
+
 	void info_callback(const std::string& filename, std::size_t line_number,
 			const std::string& message) {
 		Log(EInfo, "\"%s\" [line %i] info: %s", filename.c_str(), line_number,
@@ -439,7 +567,7 @@ template<> std::tuple<std::function<void (ply::uint32)>,
 }
 
 
-void PLYLoader::loadPLY(const fs::path &path) {
+void PLYLoader::loadPLYCallbacks(const fs::path &path) {
 	ply::ply_parser ply_parser;
 	ply_parser.info_callback(std::bind(&PLYLoader::info_callback,
 		this, std::ref(m_name), _1, _2));
@@ -475,9 +603,23 @@ void PLYLoader::loadPLY(const fs::path &path) {
 	ply_parser.scalar_property_definition_callbacks(scalar_property_definition_callbacks);
 	ply_parser.list_property_definition_callbacks(list_property_definition_callbacks);
 
-	ref<Timer> timer = new Timer();
 	ply_parser.parse(path);
 
+	if (m_triangleCount < m_faceCount * 2) {
+		/* Needed less memory than the earlier conservative estimate -- free it! */
+		Triangle *temp = new Triangle[m_triangleCount];
+		memcpy(temp, m_triangles, sizeof(Triangle) * m_triangleCount);
+		delete[] m_triangles;
+		m_triangles = temp;
+	}
+}
+
+void PLYLoader::loadPLY(const fs::path &path) {
+	ref<Timer> timer = new Timer();
+	bool bulk = loadBinaryPLY(path);
+	if (!bulk)
+		loadPLYCallbacks(path);
+
 	size_t vertexSize = sizeof(Point);
 	if (m_normals)
 		vertexSize += sizeof(Normal);
@@ -487,9 +629,282 @@ void PLYLoader::loadPLY(const fs::path &path) {
 		vertexSize += sizeof(Point2);
 
 	Log(EInfo, "\"%s\": Loaded " SIZE_T_FMT " triangles, " SIZE_T_FMT
-			" vertices (%s in %i ms).", m_name.c_str(), m_triangleCount, m_vertexCount,
+			" vertices (%s in %i ms%s).", m_name.c_str(), m_triangleCount, m_vertexCount,
 			memString(sizeof(uint32_t) * m_triangleCount * 3 + vertexSize * m_vertexCount).c_str(),
-			timer->getMilliseconds());
+			timer->getMilliseconds(), bulk ? ", bulk loader" : "");
+}
+
+/**
+ * Bulk loader for binary PLY files with a vertex and a face element. The
+ * elements are decoded using several threads, and the vertex positions are
+ * used in place when their layout matches the in-memory representation.
+ * Returns \c false (without modifying the mesh) when the file does not
+ * have the expected structure, in which case the callback-based parser
+ * should be used instead.
+ */
+bool PLYLoader::loadBinaryPLY(const fs::path &path) {
+	std::error_code ec;
+	size_t size = (size_t) fs::file_size(path, ec);
+	if (ec.value() || size < 3)
+		return false;
+
+	ref<MemoryMappedFile> mmap = MemoryMappedFile::mapCopyOnWrite(fs::encode_pathstr(path));
+	const uint8_t *data = static_cast<const uint8_t *>(mmap->getData());
+	const char *text = reinterpret_cast<const char *>(data);
+	if (memcmp(text, "ply", 3) != 0)
+		return false;
+
+	/* Locate the end of the header */
+	const char *headerEnd = NULL;
+	size_t searchSize = std::min(size, (size_t) MTS_PLY_MAX_HEADER_SIZE);
+	const char *ptr = text;
+	while ((ptr = static_cast<const char *>(memchr(ptr, 'e', text + searchSize - ptr))) != NULL) {
+		if ((size_t) (text + searchSize - ptr) >= 11 && memcmp(ptr, "end_header", 10) == 0
+				&& ptr[-1] == '\n') {
+			headerEnd = ptr;
+			break;
+		}
+		++ptr;
+	}
+	if (!headerEnd)
+		return false;
+	size_t dataOffset = headerEnd - text + 10;
+	if (text[dataOffset] == '\r' && dataOffset + 1 < size)
+		++dataOffset;
+	if (text[dataOffset++] != '\n')
+		return false;
+
+	/* Parse the header */
+	std::istringstream is(std::string(text, headerEnd));
+	std::vector<PLYElement> elements;
+	std::string line, keyword;
+	bool bigEndian = false;
+	while (std::getline(is, line)) {
+		std::istringstream ls(line);
+		if (!(ls >> keyword))
+			continue;
+		if (keyword == "format") {
+			std::string format;
+			ls >> format;
+			if (format == "binary_little_endian")
+				bigEndian = false;
+			else if (format == "binary_big_endian")
+				bigEndian = true;
+			else
+				return false;
+		} else if (keyword == "element") {
+			PLYElement element;
+			if (!(ls >> element.name >> element.count))
+				return false;
+			element.stride = 0;
+			elements.push_back(element);
+		} else if (keyword == "property") {
+			if (elements.empty())
+				return false;
+			PLYElement &element = elements.back();
+			PLYProperty prop;
+			std::string type;
+			ls >> type;
+			if (type == "list") {
+				std::string countType, indexType;
+				ls >> countType >> indexType;
+				prop.countType = parseType(countType);
+				prop.type = parseType(indexType);
+				if (prop.countType == EPLYInvalid || prop.type == EPLYInvalid)
+					return false;
+			} else {
+				prop.type = parseType(type);
+				prop.countType = EPLYInvalid;
+				if (prop.type == EPLYInvalid)
+					return false;
+			}
+			if (!(ls >> prop.name))
+				return false;
+			prop.offset = element.stride;
+			if (prop.countType == EPLYInvalid)
+				element.stride += typeSize(prop.type);
+			element.properties.push_back(prop);
+		}
+	}
+
+	/* Check that the elements match the supported schema */
+	if (elements.size() != 2 || elements[0].name != "vertex" || elements[1].name != "face")
+		return false;
+	const PLYElement &vertex = elements[0], &face = elements[1];
+	for (size_t i=0; i<vertex.properties.size(); ++i) {
+		if (vertex.properties[i].countType != EPLYInvalid)
+			return false;
+	}
+
+	int px = vertex.find("x"), py = vertex.find("y"), pz = vertex.find("z"),
+	    nx = vertex.find("nx"), ny = vertex.find("ny"), nz = vertex.find("nz"),
+	    u = vertex.find("u", "texture_u", "s"), v = vertex.find("v", "texture_v", "t"),
+	    red = vertex.find("red", "diffuse_red"), green = vertex.find("green", "diffuse_green"),
+	    blue = vertex.find("blue", "diffuse_blue");
+	bool hasNormals = nx >= 0, hasTexcoords = u >= 0, hasColors = red >= 0;
+	if (px < 0 || py < 0 || pz < 0 || (hasNormals && (ny < 0 || nz < 0)) ||
+		(hasTexcoords && v < 0) || (hasColors && (green < 0 || blue < 0)))
+		return false;
+	const int floatProps[] = { px, py, pz, nx, ny, nz, u, v };
+	for (int i=0; i<8; ++i) {
+		if (floatProps[i] >= 0 && !isFloatType(vertex.properties[floatProps[i]].type))
+			return false;
+	}
+	EPLYType colorType = hasColors ? vertex.properties[red].type : EPLYInvalid;
+	if (hasColors && ((colorType != EPLYUInt8 && !isFloatType(colorType)) ||
+		vertex.properties[green].type != colorType || vertex.properties[blue].type != colorType))
+		return false;
+
+	int list = face.find("vertex_indices", "vertex_index");
+	if (list < 0)
+		return false;
+	const PLYProperty &indices = face.properties[list];
+	if (indices.countType == EPLYInvalid || isFloatType(indices.countType) || isFloatType(indices.type))
+		return false;
+	for (size_t i=0; i<face.properties.size(); ++i) {
+		if ((int) i != list && face.properties[i].countType != EPLYInvalid)
+			return false;
+	}
+
+	/* Determine where the element data is located */
+	size_t vertexCount = vertex.count, faceCount = face.count;
+	if (vertexCount == 0 || faceCount == 0 || vertex.stride == 0 ||
+		vertexCount > (size - dataOffset) / vertex.stride)
+		return false;
+	const uint8_t *vertexData = data + dataOffset;
+	const uint8_t *faceData = vertexData + vertexCount * vertex.stride;
+	size_t faceBytes = size - (faceData - data);
+	size_t countSize = typeSize(indices.countType), indexSize = typeSize(indices.type);
+	size_t listOffset = indices.offset, otherSize = face.stride;
+
+	/* When all faces have the same number of vertices, the faces are located at known offsets */
+	uint32_t uniformSize = 0;
+	for (uint32_t k=3; k<=4; ++k) {
+		size_t faceStride = otherSize + countSize + k * indexSize;
+		if (faceBytes % faceStride == 0 && faceBytes / faceStride == faceCount)
+			uniformSize = k;
+	}
+
+	bool swap = bigEndian != (Stream::getHostByteOrder() == Stream::EBigEndian);
+	bool mapPositions = !swap && sizeof(Float) == sizeof(float)
+		&& vertex.stride == sizeof(Point) && vertex.properties.size() == 3
+		&& vertex.properties[px].offset == 0 && vertex.properties[px].type == EPLYFloat32
+		&& vertex.properties[py].offset == sizeof(float) && vertex.properties[py].type == EPLYFloat32
+		&& vertex.properties[pz].offset == 2*sizeof(float) && vertex.properties[pz].type == EPLYFloat32
+		&& dataOffset % sizeof(float) == 0 && m_objectToWorld.isIdentity();
+
+	/* Count the triangles (and validate the face data) when the faces have different sizes */
+	size_t triangleCount = faceCount * (uniformSize == 4 ? 2 : 1);
+	if (uniformSize == 0) {
+		triangleCount = 0;
+		const uint8_t *face = faceData, *end = data + size;
+		for (size_t i=0; i<faceCount; ++i) {
+			if ((size_t) (end - face) < otherSize + countSize)
+				Log(EError, "\"%s\": the face data is truncated!", m_name.c_str());
+			uint32_t count = loadIndex(face + listOffset, indices.countType, swap);
+			if (count != 3 && count != 4)
+				Log(EError, "Encountered a face with %i vertices! "
+					"Only triangle and quad-based PLY meshes are supported for now.", count);
+			face += otherSize + countSize + count * indexSize;
+			if (face > end)
+				Log(EError, "\"%s\": the face data is truncated!", m_name.c_str());
+			triangleCount += count - 2;
+		}
+	}
+
+	/* Decode the vertices */
+	m_vertexCount = vertexCount;
+	m_positions = mapPositions ? reinterpret_cast<Point *>(const_cast<uint8_t *>(vertexData))
+		: new Point[vertexCount];
+	if (hasNormals)
+		m_normals = new Normal[vertexCount];
+	if (hasTexcoords)
+		m_texcoords = new Point2[vertexCount];
+	if (hasColors)
+		m_colors = new Color3[vertexCount];
+	if (mapPositions)
+		m_mapping = mmap;
+
+	std::mutex mutex;
+	parallelFor(vertexCount, [&](size_t start, size_t end) {
+		AABB aabb;
+		for (size_t i=start; i<end; ++i) {
+			const uint8_t *ptr = vertexData + i * vertex.stride;
+			#define PLY_LOAD(prop) ((Float) loadScalar(ptr + vertex.properties[prop].offset, \
+				vertex.properties[prop].type, swap))
+			if (!mapPositions)
+				m_positions[i] = m_objectToWorld(Point(PLY_LOAD(px), PLY_LOAD(py), PLY_LOAD(pz)));
+			aabb.expandBy(m_positions[i]);
+			if (hasNormals)
+				m_normals[i] = normalize(m_objectToWorld(Normal(PLY_LOAD(nx), PLY_LOAD(ny), PLY_LOAD(nz))));
+			if (hasTexcoords)
+				m_texcoords[i] = Point2(PLY_LOAD(u), PLY_LOAD(v));
+			if (hasColors) {
+				Float r = PLY_LOAD(red), g = PLY_LOAD(green), b = PLY_LOAD(blue);
+				if (colorType == EPLYUInt8) {
+					r /= 255.0f; g /= 255.0f; b /= 255.0f;
+				}
+				if (m_sRGB)
+					m_colors[i] = Color3(fromSRGBComponent(r),
+						fromSRGBComponent(g), fromSRGBComponent(b));
+				else
+					m_colors[i] = Color3(r, g, b);
+			}
+			#undef PLY_LOAD
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		m_aabb.expandBy(aabb);
+	});
+
+	/* Decode the faces */
+	m_triangleCount = triangleCount;
+	m_triangles = new Triangle[triangleCount];
+	std::atomic<bool> invalid(false);
+	auto decodeFace = [&](const uint8_t *ptr, uint32_t count, Triangle *target) {
+		uint32_t idx[4];
+		for (uint32_t j=0; j<count; ++j) {
+			idx[j] = loadIndex(ptr + j * indexSize, indices.type, swap);
+			if (idx[j] >= vertexCount)
+				invalid = true;
+		}
+		target[0].idx[0] = idx[0]; target[0].idx[1] = idx[1]; target[0].idx[2] = idx[2];
+		if (count == 4) {
+			target[1].idx[0] = idx[3]; target[1].idx[1] = idx[0]; target[1].idx[2] = idx[2];
+		}
+	};
+
+	if (uniformSize != 0) {
+		size_t faceStride = otherSize + countSize + uniformSize * indexSize;
+		parallelFor(faceCount, [&](size_t start, size_t end) {
+			for (size_t i=start; i<end; ++i) {
+				const uint8_t *ptr = faceData + i * faceStride + listOffset;
+				if (loadIndex(ptr, indices.countType, swap) != uniformSize) {
+					invalid = true;
+					return;
+				}
+				decodeFace(ptr + countSize, uniformSize, m_triangles + i * (uniformSize - 2));
+			}
+		});
+	} else {
+		const uint8_t *ptr = faceData;
+		Triangle *target = m_triangles;
+		for (size_t i=0; i<faceCount; ++i) {
+			uint32_t count = loadIndex(ptr + listOffset, indices.countType, swap);
+			decodeFace(ptr + listOffset + countSize, count, target);
+			ptr += otherSize + countSize + count * indexSize;
+			target += count - 2;
+		}
+	}
+
+	if (invalid)
+		Log(EError, "\"%s\": the face data is invalid (vertex indices "
+			"out of bounds or inconsistent face sizes)!", m_name.c_str());
+
+	m_faceCount = m_faceCtr = faceCount;
+	m_vertexCtr = vertexCount;
+	m_hasNormals = hasNormals;
+	m_hasTexCoords = hasTexcoords;
+	return true;
 }
 
 
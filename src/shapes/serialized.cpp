@@ -24,6 +24,15 @@
 #include <mitsuba/core/lrucache.h>
 #include <mitsuba/core/thread.h>
 #include <mitsuba/core/filesystem.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/lock.h>
+#include <mitsuba/core/workerpool.h>
+#include <mitsuba/render/emitter.h>
+#include <mitsuba/render/bsdf.h>
+#include <mitsuba/render/subsurface.h>
+#include <mitsuba/render/medium.h>
+#include <mitsuba/render/sensor.h>
+#include <atomic>
 
 /// How many files to keep open in the cache, per thread
 #define MTS_SERIALIZED_CACHE_SIZE 4
@@ -43,6 +52,11 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  *	       A \code{.serialized} file may contain several separate meshes. This parameter
  *	       specifies which one should be loaded. \default{\code{0}, i.e. the first one}
  *	   }
+ *	   \parameter{loadAll}{\Boolean}{
+ *	       Load all meshes stored in the file as separate shapes instead of a
+ *	       single one. The meshes are loaded and prepared in parallel. Cannot be
+ *	       combined with \code{shapeIndex}. \default{\code{false}}
+ *	   }
  *     \parameter{faceNormals}{\Boolean}{
  *       When set to \code{true}, any existing or computed vertex normals are
  *       discarded and \emph{face normals} will instead be used during rendering.
@@ -142,15 +156,55 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  * \bottomrule
  * \end{longtable}
  * \end{center}
+ *
+ * \paragraph{Aligned variant:} Version \code{0x0005} of the format stores the
+ * same fields without compression. In addition, every array is preceded by zero
+ * padding so that it starts at a file offset that is a multiple of 64 bytes.
+ * Such files are larger, but they are memory-mapped instead of being read:
+ * the meshes refer to the mapped file directly, which avoids copying the
+ * geometry and makes loading nearly instantaneous. Modifications (e.g. due to
+ * \code{toWorld} or \code{flipNormals}) only copy the affected pages and never
+ * change the file. The \code{mtsimport} converter creates such files when it is
+ * invoked with the \code{-u} flag.
  */
 class SerializedMesh : public TriMesh {
 public:
 	SerializedMesh(const Properties &props) : TriMesh(props) {
 		fs::path filePath = fs::decode_pathstr(Thread::getThread()->getFileResolver()->resolve(
 			fs::pathstr(props.getString("filename"))));
+		mitsuba::pushSceneCleanupHandler(&SerializedMesh::flushCache);
 
+		LoadOptions options;
 		/* Object-space -> World-space transformation */
-		Transform objectToWorld = props.getTransform("toWorld", Transform());
+		options.objectToWorld = props.getTransform("toWorld", Transform());
+
+		/* By default, any existing normals will be used for
+		   rendering. If no normals are found, Mitsuba will
+		   automatically generate smooth vertex normals.
+		   Setting the 'faceNormals' parameter instead forces
+		   the use of face normals, which will result in a faceted
+		   appearance.
+		*/
+		options.faceNormals = props.getBoolean("faceNormals", false);
+
+		/* Causes all normals to be flipped */
+		options.flipNormals = props.getBoolean("flipNormals", false);
+
+		options.rebuildTopology = props.hasProperty("maxSmoothAngle");
+		if (options.rebuildTopology) {
+			if (options.faceNormals)
+				Log(EError, "The properties 'maxSmoothAngle' and 'faceNormals' "
+				"can't be specified at the same time!");
+			options.maxSmoothAngle = props.getFloat("maxSmoothAngle");
+		}
+
+		if (props.getBoolean("loadAll", false)) {
+			if (props.hasProperty("shapeIndex"))
+				Log(EError, "The properties 'loadAll' and 'shapeIndex' "
+				"can't be specified at the same time!");
+			loadAll(filePath, options);
+			return;
+		}
 
 		/// When the file contains multiple meshes, this index specifies which one to load
 		int shapeIndex = props.getInteger("shapeIndex", 0);
@@ -162,25 +216,141 @@ public:
 		/* Load the geometry */
 		Log(EInfo, "Loading shape %i from \"%s\" ..", shapeIndex, filePath.filename().string().c_str());
 		ref<Timer> timer = new Timer();
+		load(filePath, shapeIndex, name, options);
+		Log(EDebug, "Done (" SIZE_T_FMT " triangles, " SIZE_T_FMT " vertices, %i ms%s)",
+			m_triangleCount, m_vertexCount, timer->getMilliseconds(),
+			m_mapping ? ", memory-mapped" : "");
+	}
+
+	SerializedMesh(Stream *stream, InstanceManager *manager)
+		: TriMesh(stream, manager) { }
+
+	void configure() {
+		if (m_meshes.empty()) {
+			TriMesh::configure();
+			return;
+		}
+
+		Shape::configure();
+		parallelFor(m_meshes.size(), [&](size_t i) {
+			m_meshes[i]->configure();
+		});
+
+		m_aabb.reset();
+		for (size_t i=0; i<m_meshes.size(); ++i)
+			m_aabb.expandBy(m_meshes[i]->getAABB());
+	}
+
+	void addChild(const std::string &name, ConfigurableObject *child) {
+		if (m_meshes.empty()) {
+			TriMesh::addChild(name, child);
+			return;
+		}
+
+		const Class *cClass = child->getClass();
+		if (cClass->derivesFrom(MTS_CLASS(BSDF)) || cClass->derivesFrom(MTS_CLASS(Medium))) {
+			Shape::addChild(name, child);
+			for (size_t i=0; i<m_meshes.size(); ++i)
+				m_meshes[i]->addChild(name, child);
+		} else if (cClass->derivesFrom(MTS_CLASS(Emitter)) ||
+				cClass->derivesFrom(MTS_CLASS(Sensor))) {
+			if (m_meshes.size() > 1)
+				Log(EError, "Cannot attach an emitter or sensor to a serialized file "
+					"whose meshes are loaded all at once!");
+			child->setParent(m_meshes[0]);
+			m_meshes[0]->addChild(name, child);
+		} else if (cClass->derivesFrom(MTS_CLASS(Subsurface))) {
+			for (size_t i=0; i<m_meshes.size(); ++i) {
+				child->setParent(m_meshes[i]);
+				m_meshes[i]->addChild(name, child);
+			}
+		} else {
+			Shape::addChild(name, child);
+		}
+	}
+
+	bool isCompound() const {
+		return !m_meshes.empty();
+	}
+
+	Shape *getElement(int index) {
+		if (index >= (int) m_meshes.size())
+			return NULL;
+		Shape *shape = m_meshes[index];
+		BSDF *bsdf = shape->getBSDF();
+		Emitter *emitter = shape->getEmitter();
+		Subsurface *subsurface = shape->getSubsurface();
+		if (bsdf)
+			bsdf->setParent(shape);
+		if (emitter)
+			emitter->setParent(shape);
+		if (subsurface)
+			subsurface->setParent(shape);
+		return shape;
+	}
+
+	AABB getAABB() const {
+		return m_aabb;
+	}
+
+	Float getSurfaceArea() const {
+		if (m_meshes.empty())
+			return TriMesh::getSurfaceArea();
+		Float sa = 0;
+		for (size_t i=0; i<m_meshes.size(); ++i)
+			sa += m_meshes[i]->getSurfaceArea();
+		return sa;
+	}
+
+	size_t getPrimitiveCount() const {
+		if (m_meshes.empty())
+			return TriMesh::getPrimitiveCount();
+		size_t result = 0;
+		for (size_t i=0; i<m_meshes.size(); ++i)
+			result += m_meshes[i]->getPrimitiveCount();
+		return result;
+	}
+
+	size_t getEffectivePrimitiveCount() const {
+		if (m_meshes.empty())
+			return TriMesh::getEffectivePrimitiveCount();
+		size_t result = 0;
+		for (size_t i=0; i<m_meshes.size(); ++i)
+			result += m_meshes[i]->getEffectivePrimitiveCount();
+		return result;
+	}
+
+	MTS_DECLARE_CLASS()
+
+private:
+	/// Plugin parameters that affect the loaded geometry
+	struct LoadOptions {
+		Transform objectToWorld;
+		bool faceNormals;
+		bool flipNormals;
+		bool rebuildTopology;
+		Float maxSmoothAngle;
+	};
+
+	/// Create one of the meshes of a file loaded with 'loadAll'
+	SerializedMesh(const fs::path &filePath, int shapeIndex,
+			const std::string &name, const LoadOptions &options)
+		: TriMesh(name, 0, 0) {
+		load(filePath, shapeIndex, name, options);
+	}
+
+	/// Load a mesh and apply the plugin parameters
+	void load(const fs::path &filePath, int shapeIndex,
+			const std::string &name, const LoadOptions &options) {
 		loadCompressed(filePath, shapeIndex);
-		Log(EDebug, "Done (" SIZE_T_FMT " triangles, " SIZE_T_FMT " vertices, %i ms)",
-			m_triangleCount, m_vertexCount, timer->getMilliseconds());
 
 		if (m_name.empty())
 			m_name = name;
 
-		/* By default, any existing normals will be used for
-		   rendering. If no normals are found, Mitsuba will
-		   automatically generate smooth vertex normals.
-		   Setting the 'faceNormals' parameter instead forces
-		   the use of face normals, which will result in a faceted
-		   appearance.
-		*/
-		m_faceNormals = props.getBoolean("faceNormals", false);
-
-		/* Causes all normals to be flipped */
-		m_flipNormals = props.getBoolean("flipNormals", false);
+		m_faceNormals = options.faceNormals;
+		m_flipNormals = options.flipNormals;
 
+		const Transform &objectToWorld = options.objectToWorld;
 		if (!objectToWorld.isIdentity()) {
 			m_aabb.reset();
 			for (size_t i=0; i<m_vertexCount; ++i) {
@@ -201,20 +371,52 @@ public:
 			}
 		}
 
-		if (props.hasProperty("maxSmoothAngle")) {
-			if (m_faceNormals)
-				Log(EError, "The properties 'maxSmoothAngle' and 'faceNormals' "
-				"can't be specified at the same time!");
-			rebuildTopology(props.getFloat("maxSmoothAngle"));
-		}
+		if (options.rebuildTopology)
+			rebuildTopology(options.maxSmoothAngle);
 	}
 
-	SerializedMesh(Stream *stream, InstanceManager *manager)
-		: TriMesh(stream, manager) { }
+	/// Load all meshes of a file in parallel
+	void loadAll(const fs::path &filePath, const LoadOptions &options) {
+		Log(EInfo, "Loading all shapes from \"%s\" ..", filePath.filename().string().c_str());
+		ref<Timer> timer = new Timer();
 
-	MTS_DECLARE_CLASS()
+		std::shared_ptr<MappedFile> mappedFile = getMappedFile(filePath);
+		size_t shapeCount = mappedFile ? mappedFile->offsets.size()
+			: getFileStreamCache()->get(filePath)->getShapeCount();
+		if (shapeCount == 0)
+			Log(EError, "\"%s\" does not contain any meshes!", filePath.string().c_str());
 
-private:
+		std::string stem = filePath.stem().string();
+		m_meshes.resize(shapeCount);
+		parallelFor(shapeCount, [&](size_t i) {
+			m_meshes[i] = new SerializedMesh(filePath, (int) i,
+				formatString("%s@%i", stem.c_str(), (int) i), options);
+		});
+
+		/* The bounds are computed by configure() */
+		m_aabb.reset();
+
+		Log(EDebug, "Done (" SIZE_T_FMT " shapes, %i ms%s)", shapeCount,
+			timer->getMilliseconds(), mappedFile ? ", memory-mapped" : "");
+	}
+
+	/// Run \c func for the indices <tt>0, .., count-1</tt> on all cores
+	static void parallelFor(size_t count, const std::function<void (size_t)> &func) {
+		int workers = (int) std::min((size_t) getCoreCount(), count);
+		if (workers <= 1) {
+			for (size_t i=0; i<count; ++i)
+				func(i);
+			return;
+		}
+
+		std::atomic<size_t> next(0);
+		ref<WorkerPool> pool = new WorkerPool("serialized", workers);
+		pool->run([&](int) {
+			size_t i;
+			while ((i = next++) < count)
+				func(i);
+		}, workers);
+	}
 
 	/**
 	 * Helper class for loading serialized meshes from the same file
@@ -242,7 +444,7 @@ private:
 		 * Returns the modified stream.
 		 */
 		inline FileStream* seekStream(size_t shapeIndex) {
-			if (shapeIndex > m_offsets.size()) {
+			if (shapeIndex >= m_offsets.size()) {
 				SLog(EError, "Unable to unserialize mesh, "
 					"shape index is out of range! (requested %i out of 0..%i)",
 					shapeIndex, (int) (m_offsets.size()-1));
@@ -252,6 +454,9 @@ private:
 			return m_fstream;
 		}
 
+		/// Return the number of meshes in the file
+		inline size_t getShapeCount() const { return m_offsets.size(); }
+
 	private:
 		std::vector<size_t> m_offsets;
 		ref<FileStream> m_fstream;
@@ -276,35 +481,90 @@ private:
 		}
 	};
 
-	/// Release all currently held offset caches / file streams
+	/**
+	 * File in the aligned format, which is mapped into memory once and
+	 * shared by all threads. The meshes keep a reference to the mapping.
+	 */
+	struct MappedFile {
+		ref<MemoryMappedFile> mapping;
+		std::vector<size_t> offsets;
+	};
+
+	typedef std::map<fs::path, std::shared_ptr<MappedFile> > MappedFileMap;
+
+	/// Return the mapping of a file in the aligned format, or \c NULL for other files
+	static std::shared_ptr<MappedFile> getMappedFile(const fs::path &filePath) {
+		LockGuard lock(m_mappedFilesLock);
+		MappedFileMap::iterator it = m_mappedFiles.find(filePath);
+		if (it != m_mappedFiles.end())
+			return it->second;
+
+		std::shared_ptr<MappedFile> result;
+		ref<FileStream> fstream = new FileStream(fs::encode_pathstr(filePath), FileStream::EReadOnly);
+		fstream->setByteOrder(Stream::ELittleEndian);
+		const short version = readHeader(fstream);
+		if (isAlignedVersion(version)) {
+			result = std::make_shared<MappedFile>();
+			if (readOffsetDictionary(fstream, version, result->offsets) < 0)
+				result->offsets.resize(1, 0);
+			fstream->close();
+			/* Copy-on-write: transformations modify the meshes in place */
+			result->mapping = MemoryMappedFile::mapCopyOnWrite(fs::encode_pathstr(filePath));
+		}
+		m_mappedFiles[filePath] = result;
+		return result;
+	}
+
+	/// Return the file stream cache of the current thread
+	static FileStreamCache *getFileStreamCache() {
+		// Get the thread local cache; create it if this is the first time
+		FileStreamCache* cache = m_cache.get();
+		if (EXPECT_NOT_TAKEN(cache == NULL)) {
+			cache = new FileStreamCache();
+			m_cache.set(cache);
+		}
+		return cache;
+	}
+
+	/// Release all currently held offset caches / file streams / mappings
 	static void flushCache() {
 		m_cache.set(NULL);
+		LockGuard lock(m_mappedFilesLock);
+		m_mappedFiles.clear();
 	}
 
-	/// Loads the mesh from the thread-local file stream cache
+	/// Loads the mesh from the shared mapping or the thread-local file stream cache
 	void loadCompressed(const fs::path& filePath, const int idx) {
 		if (EXPECT_NOT_TAKEN(idx < 0)) {
 			Log(EError, "Unable to unserialize mesh, "
 				"shape index is negative! (requested %i out of 0..%i)", idx);
 		}
 
-		// Get the thread local cache; create it if this is the first time
-		FileStreamCache* cache = m_cache.get();
-		if (EXPECT_NOT_TAKEN(cache == NULL)) {
-			cache = new FileStreamCache();
-			m_cache.set(cache);
-			mitsuba::pushSceneCleanupHandler(&SerializedMesh::flushCache);
+		std::shared_ptr<MappedFile> mappedFile = getMappedFile(filePath);
+		if (mappedFile) {
+			if ((size_t) idx >= mappedFile->offsets.size())
+				Log(EError, "Unable to unserialize mesh, "
+					"shape index is out of range! (requested %i out of 0..%i)",
+					idx, (int) (mappedFile->offsets.size()-1));
+			TriMesh::loadMapped(mappedFile->mapping, mappedFile->offsets[idx]);
+			return;
 		}
 
-		std::shared_ptr<MeshLoader> meshLoader = cache->get(filePath);
+		std::shared_ptr<MeshLoader> meshLoader = getFileStreamCache()->get(filePath);
 		Assert(meshLoader != NULL);
 		TriMesh::loadCompressed(meshLoader->seekStream((size_t) idx));
 	}
 
+	ref_vector<TriMesh> m_meshes;
+
 	static ThreadLocal<FileStreamCache> m_cache;
+	static MappedFileMap m_mappedFiles;
+	static ref<Mutex> m_mappedFilesLock;
 };
 
 ThreadLocal<SerializedMesh::FileStreamCache> SerializedMesh::m_cache;
+SerializedMesh::MappedFileMap SerializedMesh::m_mappedFiles;
+ref<Mutex> SerializedMesh::m_mappedFilesLock = new Mutex();
 
 MTS_IMPLEMENT_CLASS_S(SerializedMesh, false, TriMesh)
 MTS_EXPORT_PLUGIN(SerializedMesh, "Serialized mesh loader");
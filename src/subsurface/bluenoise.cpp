@@ -83,7 +83,7 @@ void blueNoisePointSet(const Scene *scene, const std::vector<Shape *> &shapes,
 		t_aabb[i].reset();
 	}
 
-	DiscreteDistribution areaDistr;
+	AliasDistribution areaDistr;
 	std::vector<int> shapeMap(shapes.size());
 	for (size_t i=0; i<shapes.size(); ++i) {
 		shapeMap[i] = -1;
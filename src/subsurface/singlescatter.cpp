@@ -1666,6 +1666,10 @@ public:
 				MTS_CLASS(SamplingIntegrator)))
 			Log(EError, "The single scattering pluging requires "
 						"a sampling-based surface integrator!");
+		if (scene->getKDTree()->getAccelerator() != ShapeKDTree::EKDTree)
+			Log(EError, "The single scattering plugin traverses the scene's "
+						"kd-tree and does not support the \"%s\" accelerator!",
+						ShapeKDTree::getAcceleratorName(scene->getKDTree()->getAccelerator()).c_str());
 		return true;
 	}
 
@@ -0,0 +1,170 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/warp.h>
+#include <mitsuba/render/testcase.h>
+
+/* Relative bound on what is still accepted as roundoff error */
+#if defined(SINGLE_PRECISION)
+	#define ERROR_REQ 1e-3f
+#else
+	#define ERROR_REQ 1e-6
+#endif
+
+/* Fraction of queries that may disagree due to sampling decisions
+   that flip when the inputs are perturbed by roundoff errors */
+#define MISMATCH_REQ 0.002f
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * This testcase checks that the batched BSDF interface (\ref BSDF::evalBatch()
+ * and friends) agrees with the scalar methods for all BSDF instances used by
+ * the chi-square test
+ */
+class TestBSDFBatch : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_BSDFBatch)
+	MTS_END_TESTCASE()
+
+	static bool mismatch(const Spectrum &a, const Spectrum &b) {
+		for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+			if (mismatch(a[i], b[i]))
+				return true;
+		return false;
+	}
+
+	static bool mismatch(Float a, Float b) {
+		return !(std::abs(a - b) <= ERROR_REQ * std::max((Float) 1, std::abs(a)));
+	}
+
+	ref<Sampler> createSampler(int64_t seed) {
+		Properties props("independent");
+		props.setLong("seed", seed);
+		return static_cast<Sampler *> (PluginManager::getInstance()->
+			createObject(MTS_CLASS(Sampler), props));
+	}
+
+	void test01_BSDFBatch() {
+		/* Load the set of BSDF instances used by the chi-square test */
+		FileResolver *resolver = Thread::getThread()->getFileResolver();
+		const fs::pathstr scenePath =
+			resolver->resolveAbsolute(fs::pathstr("data/tests/test_bsdf.xml"));
+		ref<Scene> scene = loadScene(scenePath);
+
+		const ref_vector<ConfigurableObject> &objects = scene->getReferencedObjects();
+		ref<Sampler> sampler = createSampler(1);
+		const size_t count = 1001;
+
+		Intersection its;
+		its.uv = Point2(0.0f);
+		its.dpdu = Vector(1, 0, 0);
+		its.dpdv = Vector(0, 1, 0);
+		its.dudx = its.dvdy = 0.01f;
+		its.dudy = its.dvdx = 0.00f;
+		its.shFrame = Frame(Normal(0, 0, 1));
+
+		std::vector<const Intersection *> itsPtr(count, &its);
+		std::vector<Float> wi[3], wo[3], pdfBatch(count);
+		std::vector<Spectrum> valueBatch(count);
+		std::vector<Point2> samples(count);
+		std::vector<unsigned int> sampledType(count);
+		for (int k=0; k<3; ++k) {
+			wi[k].resize(count);
+			wo[k].resize(count);
+		}
+
+		for (size_t i=0; i<objects.size(); ++i) {
+			if (!objects[i]->getClass()->derivesFrom(MTS_CLASS(BSDF)))
+				continue;
+
+			const BSDF *bsdf = static_cast<const BSDF *>(objects[i].get());
+			Log(EInfo, "Processing BSDF model %s", bsdf->toString().c_str());
+
+			for (int comp=-1; comp<bsdf->getComponentCount(); ++comp) {
+				for (size_t j=0; j<count; ++j) {
+					Vector wiSample = (bsdf->getType() & BSDF::EBackSide)
+						? warp::squareToUniformSphere(sampler->next2D())
+						: warp::squareToCosineHemisphere(sampler->next2D());
+					Vector woSample = warp::squareToUniformSphere(sampler->next2D());
+					for (int k=0; k<3; ++k) {
+						wi[k][j] = wiSample[k];
+						wo[k][j] = woSample[k];
+					}
+					samples[j] = sampler->next2D();
+				}
+
+				BSDFQueryBatch batch;
+				batch.size = count;
+				batch.its = &itsPtr[0];
+				batch.wiX = &wi[0][0]; batch.wiY = &wi[1][0]; batch.wiZ = &wi[2][0];
+				batch.woX = &wo[0][0]; batch.woY = &wo[1][0]; batch.woZ = &wo[2][0];
+				batch.sampledType = &sampledType[0];
+				batch.component = comp;
+				batch.mode = comp == 0 ? EImportance : ERadiance;
+
+				/* Evaluation and sampling density */
+				size_t evalMismatches = 0, pdfMismatches = 0, sampleMismatches = 0;
+				bsdf->evalBatch(batch, &valueBatch[0]);
+				bsdf->pdfBatch(batch, &pdfBatch[0]);
+				for (size_t j=0; j<count; ++j) {
+					BSDFSamplingRecord bRec = batch.getRecord(j);
+					if (mismatch(bsdf->eval(bRec), valueBatch[j]))
+						++evalMismatches;
+					if (mismatch(bsdf->pdf(bRec), pdfBatch[j]))
+						++pdfMismatches;
+				}
+
+				/* Sampling (both versions use the same sequence of random numbers) */
+				ref<Sampler> batchSampler = createSampler(2);
+				batch.sampler = batchSampler;
+				bsdf->sampleBatch(batch, &samples[0], &valueBatch[0], &pdfBatch[0]);
+				ref<Sampler> scalarSampler = createSampler(2);
+				for (size_t j=0; j<count; ++j) {
+					BSDFSamplingRecord bRec(its, scalarSampler, batch.mode);
+					bRec.wi = Vector(wi[0][j], wi[1][j], wi[2][j]);
+					bRec.component = comp;
+					Float samplePdf = 0;
+					Spectrum weight = bsdf->sample(bRec, samplePdf, samples[j]);
+					if (weight.isZero())
+						samplePdf = 0;
+					if (mismatch(weight, valueBatch[j]) || mismatch(samplePdf, pdfBatch[j]) ||
+						(!weight.isZero() && (bRec.sampledType != sampledType[j] ||
+						(bRec.wo - Vector(wo[0][j], wo[1][j], wo[2][j])).length() > ERROR_REQ)))
+						++sampleMismatches;
+				}
+
+				Log(EInfo, "Component %i: " SIZE_T_FMT " eval, " SIZE_T_FMT " pdf and "
+					SIZE_T_FMT " sample mismatches out of " SIZE_T_FMT " queries", comp,
+					evalMismatches, pdfMismatches, sampleMismatches, count);
+
+				if (evalMismatches + pdfMismatches + sampleMismatches > MISMATCH_REQ * count)
+					failAndContinue(formatString("The batched and scalar implementations of "
+						"BSDF component %i disagree", comp));
+				else
+					succeed();
+			}
+		}
+	}
+};
+
+MTS_EXPORT_TESTCASE(TestBSDFBatch, "Consistency test for batched BSDF evaluation")
+MTS_NAMESPACE_END
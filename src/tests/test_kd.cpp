@@ -29,6 +29,7 @@ public:
 	MTS_DECLARE_TEST(test01_sutherlandHodgman)
 	MTS_DECLARE_TEST(test02_bunnyBenchmark)
 	MTS_DECLARE_TEST(test03_pointKDTree)
+	MTS_DECLARE_TEST(test04_pointKDTreeBatch)
 	MTS_END_TESTCASE()
 
 	void test01_sutherlandHodgman() {
@@ -214,6 +215,42 @@ public:
 		Log(EInfo, "Normal node size = " SIZE_T_FMT " bytes", sizeof(KDTree2::NodeType));
 		Log(EInfo, "Left-balanced node size = " SIZE_T_FMT " bytes", sizeof(KDTree2Left::NodeType));
 	}
+
+	void test04_pointKDTreeBatch() {
+		typedef PointKDTree< SimpleKDNode<Point, Float> > KDTree3;
+
+		size_t nPoints = 200000, nQueries = 64, k = 10;
+		ref<Random> random = new Random();
+
+		KDTree3 kdtree(nPoints, KDTree3::EBalanced);
+		for (size_t i=0; i<nPoints; ++i) {
+			kdtree[i].setPosition(Point(random->nextFloat(), random->nextFloat(), random->nextFloat()));
+			kdtree[i].setData(random->nextFloat());
+		}
+
+		Log(EInfo, "Testing batched k-nn queries on a parallel-built kd-tree");
+		kdtree.build(true);
+
+		std::vector<Point> queries(nQueries);
+		for (size_t i=0; i<nQueries; ++i)
+			queries[i] = Point(random->nextFloat(), random->nextFloat(), random->nextFloat());
+
+		std::vector<KDTree3::SearchResult> results(nQueries * (k+1)), resultsBF;
+		std::vector<size_t> resultCount(nQueries);
+		kdtree.nnSearchBatch(&queries[0], nQueries, NULL, k, &results[0], &resultCount[0]);
+
+		for (size_t i=0; i<nQueries; ++i) {
+			assertEquals((int) resultCount[i], (int) k);
+			resultsBF.clear();
+			for (size_t j=0; j<nPoints; ++j)
+				resultsBF.push_back(KDTree3::SearchResult((kdtree[j].getPosition()-queries[i]).lengthSquared(), (uint32_t) j));
+			KDTree3::SearchResult *r = &results[i * (k+1)];
+			std::sort(r, r + k, KDTree3::SearchResultComparator());
+			std::sort(resultsBF.begin(), resultsBF.end(), KDTree3::SearchResultComparator());
+			for (size_t j=0; j<k; ++j)
+				assertTrue(r[j].distSquared == resultsBF[j].distSquared);
+		}
+	}
 };
 
 MTS_EXPORT_TESTCASE(TestKDTree, "Testcase for kd-tree related code")
@@ -0,0 +1,95 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/version.h>
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/render/lightbvh.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * This testcase checks that emitter sampling follows an area emitter,
+ * which was moved and scaled through the incremental scene update API
+ * (\ref Shape::applyTransform() and \ref Scene::updateGeometry())
+ */
+class TestSceneUpdate : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_moveAreaEmitter)
+	MTS_END_TESTCASE()
+
+	void test01_moveAreaEmitter() {
+		/* Two cubes with an edge length of 2, both area emitters */
+		ref<Scene> scene = loadSceneFromString(
+			"<scene version=\"" MTS_VERSION "\">\n"
+			"	<string name=\"emitterSampling\" value=\"lightbvh\"/>\n"
+			"	<shape type=\"cube\">\n"
+			"		<emitter type=\"area\"><spectrum name=\"radiance\" value=\"1\"/></emitter>\n"
+			"	</shape>\n"
+			"	<shape type=\"cube\">\n"
+			"		<transform name=\"toWorld\"><translate x=\"10\"/></transform>\n"
+			"		<emitter type=\"area\"><spectrum name=\"radiance\" value=\"1\"/></emitter>\n"
+			"	</shape>\n"
+			"</scene>\n");
+		scene->initialize();
+
+		Shape *shape = NULL;
+		for (size_t i=0; i<scene->getShapes().size(); ++i) {
+			Shape *s = scene->getShapes()[i].get();
+			if (s->getEmitter() && s->getAABB().contains(Point(0.0f)))
+				shape = s;
+		}
+		assertTrue(shape != NULL);
+		const Emitter *emitter = shape->getEmitter();
+
+		/* Move the first cube far away and double its size */
+		assertTrue(shape->applyTransform(Transform::translate(Vector(-100, 0, 0))
+			* Transform::scale(Vector(2.0f))));
+		scene->updateGeometry();
+
+		/* The emitted power follows the new surface area */
+		PositionSamplingRecord pRec(0.0f);
+		Spectrum power = emitter->samplePosition(pRec, Point2(0.5f), NULL);
+		assertEqualsEpsilon(power, Spectrum((Float) (96 * M_PI)), 1e-3f);
+		assertTrue(shape->getAABB().contains(pRec.p));
+
+		/* Next to the moved cube, the light BVH must almost always select it */
+		const LightBVH *lightBVH = scene->getLightBVH();
+		assertTrue(lightBVH != NULL);
+		Point p(-100, 0, 5);
+		Normal n(0, 0, -1);
+		assertTrue(lightBVH->pdf(p, n, emitter) > 0.95f);
+
+		/* Sampled positions lie on the moved cube and agree with the pdf */
+		ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+			createObject(MTS_CLASS(Sampler), Properties("independent")));
+		for (int i=0; i<100; ++i) {
+			DirectSamplingRecord dRec(p, 0.0f);
+			dRec.refN = n;
+			Spectrum value = scene->sampleEmitterDirect(dRec, sampler->next2D(), false);
+			if (value.isZero() || dRec.object != emitter)
+				continue;
+			assertTrue(shape->getAABB().contains(dRec.p));
+			assertEqualsEpsilon(scene->pdfEmitterDirect(dRec), dRec.pdf, 1e-3f * dRec.pdf);
+		}
+	}
+};
+
+MTS_EXPORT_TESTCASE(TestSceneUpdate, "Emitter sampling after incremental scene updates")
+MTS_NAMESPACE_END
@@ -77,6 +77,11 @@ MTS_NAMESPACE_BEGIN
  *        \emph{filename}\code{.mip} to be created.
  *        \default{automatic---use caching for textures larger than 1M pixels.}
  *     }
+ *     \parameter{tiled}{\Boolean}{
+ *        Keep the texture out of core: store the MIP map in a tiled cache file
+ *        named \emph{filename}\code{.tmip}, whose tiles are loaded on demand into
+ *        a texture cache shared by all tiled textures. \default{\code{false}}
+ *     }
  *     \parameter{uoffset, voffset}{\Float}{
  *       Numerical offset that should be applied to UV lookups
  *     }
@@ -164,6 +169,16 @@ MTS_NAMESPACE_BEGIN
  * \begin{shell}
  * $\code{\$}$ find . -name "*.mip" -delete
  * \end{shell}
+ *
+ * Scenes with a large number of high-resolution textures can exceed the main
+ * memory even when the MIP maps are memory-mapped. For those, the \code{tiled}
+ * parameter stores the MIP map in a \emph{filename}\code{.tmip} file made of
+ * $64\times 64$ texel tiles. Tiles are only read when a texture lookup needs them
+ * and are kept in a cache that is shared by all tiled textures. When the cache
+ * reaches its memory budget, the least recently used tiles are evicted. The budget
+ * defaults to 1 GiB and can be changed with the \code{MITSUBA\_TEXCACHE\_SIZE}
+ * environment variable (in MiB). The hit rate of the cache is reported in the
+ * rendering statistics.
  */
 
 class BitmapTexture : public Texture2D {
@@ -180,8 +195,8 @@ public:
 
 	BitmapTexture(const Properties &props) : Texture2D(props) {
 		uint64_t timestamp = 0;
-		bool tryReuseCache = false;
-		fs::path cacheFile;
+		bool tryReuseCache = false, tiled = false;
+		fs::path cacheFile, tiledFile;
 		ref<Bitmap> bitmap;
 
 		m_channel = to_lower_copy(props.getString("channel", ""));
@@ -210,6 +225,12 @@ public:
 				cacheFile.replace_extension(formatString(".%s.mip", m_channel.c_str()));
 
 			tryReuseCache = fs::exists(cacheFile) && props.getBoolean("cache", true);
+
+			tiled = props.getBoolean("tiled", false);
+			if (tiled) {
+				tiledFile = cacheFile;
+				tiledFile.replace_extension(".tmip");
+			}
 		}
 
 		std::string filterType = to_lower_copy(props.getString("filterType", "ewa"));
@@ -237,11 +258,21 @@ public:
 			m_maxAnisotropy = 1.0f;
 
 		fs::pathstr scacheFile = fs::encode_pathstr(cacheFile);
-		if (tryReuseCache && MIPMap3::validateCacheFile(scacheFile, timestamp,
+		fs::pathstr stiledFile = fs::encode_pathstr(tiledFile);
+		bool tryReuseTiled = tiled && fs::exists(tiledFile);
+		if (tryReuseTiled && MIPMap3::validateCacheFile(stiledFile, timestamp,
+				Bitmap::ERGB, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma, true)) {
+			/* Reuse an existing tiled MIP map cache file */
+			m_mipmap3 = new MIPMap3(stiledFile, m_maxAnisotropy);
+		} else if (tryReuseTiled && MIPMap1::validateCacheFile(stiledFile, timestamp,
+				Bitmap::ELuminance, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma, true)) {
+			/* Reuse an existing tiled MIP map cache file */
+			m_mipmap1 = new MIPMap1(stiledFile, m_maxAnisotropy);
+		} else if (tryReuseCache && !tiled && MIPMap3::validateCacheFile(scacheFile, timestamp,
 				Bitmap::ERGB, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma)) {
 			/* Reuse an existing MIP map cache file */
 			m_mipmap3 = new MIPMap3(scacheFile, m_maxAnisotropy);
-		} else if (tryReuseCache && MIPMap1::validateCacheFile(scacheFile, timestamp,
+		} else if (tryReuseCache && !tiled && MIPMap1::validateCacheFile(scacheFile, timestamp,
 				Bitmap::ELuminance, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma)) {
 			/* Reuse an existing MIP map cache file */
 			m_mipmap1 = new MIPMap1(scacheFile, m_maxAnisotropy);
@@ -290,7 +321,7 @@ public:
 			rfilter->configure();
 
 			/* Potentially create a new MIP map cache file */
-			bool createCache = !cacheFile.empty() && props.getBoolean("cache",
+			bool createCache = !cacheFile.empty() && !tiled && props.getBoolean("cache",
 				bitmap->getSize().x * bitmap->getSize().y > 1024*1024);
 
 			if (pixelFormat == Bitmap::ELuminance)
@@ -301,6 +332,18 @@ public:
 				m_mipmap3 = new MIPMap3(bitmap, pixelFormat, Bitmap::EFloat,
 					rfilter, m_wrapModeU, m_wrapModeV, m_filterType, m_maxAnisotropy,
 					createCache ? scacheFile : fs::pathstr(), timestamp);
+
+			if (tiled) {
+				/* Write the tiled cache file and release the in-memory MIP map */
+				Log(EInfo, "Generating tiled MIP map cache file \"%s\" ..", stiledFile.s.c_str());
+				if (m_mipmap1.get()) {
+					m_mipmap1->writeTiledFile(stiledFile, timestamp, bitmap->getGamma());
+					m_mipmap1 = new MIPMap1(stiledFile, m_maxAnisotropy);
+				} else {
+					m_mipmap3->writeTiledFile(stiledFile, timestamp, bitmap->getGamma());
+					m_mipmap3 = new MIPMap3(stiledFile, m_maxAnisotropy);
+				}
+			}
 		}
 	}
 
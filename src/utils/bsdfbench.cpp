@@ -0,0 +1,226 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/bsdf.h>
+#include <mitsuba/render/sampler.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/warp.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class BSDFBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: BSDF benchmark. Compares the throughput of the scalar BSDF" << endl;
+		cout << "interface against the batched one (BSDF::evalBatch() and friends) for a" << endl;
+		cout << "set of common reflectance models, and reports any disagreement." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil bsdfbench [options]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of queries per model (default: 1000000)" << endl << endl;
+	}
+
+	ref<Object> createObject(const Class *type, const Properties &props) {
+		ref<ConfigurableObject> object = static_cast<ConfigurableObject *> (
+			PluginManager::getInstance()->createObject(type, props));
+		object->configure();
+		return object.get();
+	}
+
+	ref<Sampler> createSampler(int64_t seed) {
+		Properties props("independent");
+		props.setLong("seed", seed);
+		return static_cast<Sampler *>(createObject(MTS_CLASS(Sampler), props).get());
+	}
+
+	static bool mismatch(Float a, Float b) {
+		return !(std::abs(a - b) <= 1e-3f * std::max((Float) 1, std::abs(a)));
+	}
+
+	static bool mismatch(const Spectrum &a, const Spectrum &b) {
+		for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+			if (mismatch(a[i], b[i]))
+				return true;
+		return false;
+	}
+
+	void benchmark(const BSDF *bsdf, const std::string &name, size_t count) {
+		ref<Random> random = new Random();
+		Intersection its;
+		its.uv = Point2(0.5f);
+		its.dpdu = Vector(1, 0, 0);
+		its.dpdv = Vector(0, 1, 0);
+		its.shFrame = Frame(Normal(0, 0, 1));
+		bool twoSided = bsdf->getType() & BSDF::EBackSide;
+
+		std::vector<const Intersection *> itsPtr(count, &its);
+		std::vector<Float> wi[3], wo[3], woSampled[3];
+		std::vector<Float> pdf(count), pdfBatch(count);
+		std::vector<Spectrum> value(count), valueBatch(count);
+		std::vector<Point2> samples(count);
+		for (int k=0; k<3; ++k) {
+			wi[k].resize(count);
+			wo[k].resize(count);
+			woSampled[k].resize(count);
+		}
+
+		for (size_t i=0; i<count; ++i) {
+			Point2 sample(random->nextFloat(), random->nextFloat());
+			Vector wiSample = twoSided ? warp::squareToUniformSphere(sample)
+				: warp::squareToCosineHemisphere(sample);
+			Vector woSample = warp::squareToUniformSphere(
+				Point2(random->nextFloat(), random->nextFloat()));
+			for (int k=0; k<3; ++k) {
+				wi[k][i] = wiSample[k];
+				wo[k][i] = woSample[k];
+			}
+			samples[i] = Point2(random->nextFloat(), random->nextFloat());
+		}
+
+		BSDFQueryBatch batch;
+		batch.size = count;
+		batch.its = &itsPtr[0];
+		batch.wiX = &wi[0][0]; batch.wiY = &wi[1][0]; batch.wiZ = &wi[2][0];
+		batch.woX = &wo[0][0]; batch.woY = &wo[1][0]; batch.woZ = &wo[2][0];
+
+		/* Evaluation */
+		ref<Timer> timer = new Timer();
+		for (size_t i=0; i<count; ++i)
+			value[i] = bsdf->eval(batch.getRecord(i));
+		Float evalScalar = timer->lap();
+		bsdf->evalBatch(batch, &valueBatch[0]);
+		Float evalBatch = timer->lap();
+
+		size_t evalMismatches = 0;
+		for (size_t i=0; i<count; ++i)
+			evalMismatches += mismatch(value[i], valueBatch[i]) ? 1 : 0;
+
+		/* Sampling density */
+		timer->reset();
+		for (size_t i=0; i<count; ++i)
+			pdf[i] = bsdf->pdf(batch.getRecord(i));
+		Float pdfScalar = timer->lap();
+		bsdf->pdfBatch(batch, &pdfBatch[0]);
+		Float pdfBatchTime = timer->lap();
+
+		size_t pdfMismatches = 0;
+		for (size_t i=0; i<count; ++i)
+			pdfMismatches += mismatch(pdf[i], pdfBatch[i]) ? 1 : 0;
+
+		/* Sampling (both versions consume the same random number sequence) */
+		ref<Sampler> sampler = createSampler(1);
+		timer->reset();
+		for (size_t i=0; i<count; ++i) {
+			BSDFSamplingRecord bRec(its, sampler);
+			bRec.wi = Vector(wi[0][i], wi[1][i], wi[2][i]);
+			value[i] = bsdf->sample(bRec, pdf[i], samples[i]);
+			for (int k=0; k<3; ++k)
+				woSampled[k][i] = bRec.wo[k];
+		}
+		ref<Sampler> batchSampler = createSampler(1);
+		batch.sampler = batchSampler;
+		Float sampleScalar = timer->lap();
+		bsdf->sampleBatch(batch, &samples[0], &valueBatch[0], &pdfBatch[0]);
+		Float sampleBatch = timer->lap();
+
+		size_t sampleMismatches = 0;
+		for (size_t i=0; i<count; ++i) {
+			if (value[i].isZero())
+				pdf[i] = 0;
+			if (mismatch(value[i], valueBatch[i]) || mismatch(pdf[i], pdfBatch[i]) ||
+				(!value[i].isZero() && (mismatch(woSampled[0][i], wo[0][i]) ||
+				 mismatch(woSampled[1][i], wo[1][i]) || mismatch(woSampled[2][i], wo[2][i]))))
+				++sampleMismatches;
+		}
+
+		Log(EInfo, "%s:", name.c_str());
+		Log(EInfo, "  eval:   scalar %.2f M/s, batched %.2f M/s (%.2fx), " SIZE_T_FMT " mismatches",
+			count / (evalScalar * 1e6f), count / (evalBatch * 1e6f), evalScalar / evalBatch, evalMismatches);
+		Log(EInfo, "  pdf:    scalar %.2f M/s, batched %.2f M/s (%.2fx), " SIZE_T_FMT " mismatches",
+			count / (pdfScalar * 1e6f), count / (pdfBatchTime * 1e6f), pdfScalar / pdfBatchTime, pdfMismatches);
+		Log(EInfo, "  sample: scalar %.2f M/s, batched %.2f M/s (%.2fx), " SIZE_T_FMT " mismatches",
+			count / (sampleScalar * 1e6f), count / (sampleBatch * 1e6f), sampleScalar / sampleBatch, sampleMismatches);
+	}
+
+	int run(int argc, char **argv) {
+		int optchar;
+		char *end_ptr = NULL;
+		size_t count = 1000000;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n':
+					count = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || count == 0)
+						SLog(EError, "Could not parse the query count!");
+					break;
+			};
+		}
+
+		struct Model {
+			const char *plugin, *distribution;
+			Float alpha;
+		} models[] = {
+			{ "diffuse",         "",         0.0f },
+			{ "roughconductor",  "ggx",      0.1f },
+			{ "roughconductor",  "beckmann", 0.3f },
+			{ "roughdielectric", "ggx",      0.2f },
+			{ "roughdielectric", "beckmann", 0.2f },
+			{ "roughplastic",    "ggx",      0.1f },
+			{ "roughplastic",    "beckmann", 0.3f }
+		};
+
+		Log(EInfo, "Running " SIZE_T_FMT " queries per model", count);
+		for (size_t i=0; i<sizeof(models) / sizeof(models[0]); ++i) {
+			const Model &model = models[i];
+			Properties props(model.plugin);
+			std::string name = model.plugin;
+			if (model.alpha != 0) {
+				props.setString("distribution", model.distribution);
+				props.setFloat("alpha", model.alpha);
+				name += formatString(" (%s, alpha=%.2f)", model.distribution, model.alpha);
+			}
+			ref<BSDF> bsdf = static_cast<BSDF *>(createObject(MTS_CLASS(BSDF), props).get());
+			benchmark(bsdf, name, count);
+		}
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(BSDFBench, "Scalar vs. batched BSDF evaluation benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,235 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/render/skdtree.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class DeformBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Motion blur benchmark of the 'deformable' shape. Generates a" << endl;
+		cout << "deforming mesh with many keyframes (a wobbling sphere that travels along a" << endl;
+		cout << "curved path), and renders it with camera rays at random times, a diffuse" << endl;
+		cout << "shading model and one shadow ray per hit. Reports the construction time of" << endl;
+		cout << "each acceleration data structure and the ray throughput, and compares the" << endl;
+		cout << "rendered images." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil deformbench [options]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -r rings       Tessellation of the sphere, which has 4*rings^2 triangles (default: 64)" << endl << endl;
+		cout << "   -f frames      Number of keyframes (default: 120)" << endl << endl;
+		cout << "   -s size        Image resolution (default: 256)" << endl << endl;
+		cout << "   -p spp         Samples per pixel (default: 4)" << endl << endl;
+		cout << "   -a accels      Comma-separated list of acceleration data structures" << endl;
+		cout << "                  (default: bvh,kdtree)" << endl << endl;
+	}
+
+	/// Generate the keyframe at time \c time (in [0, 1])
+	ref<TriMesh> generateFrame(int rings, Float time) {
+		int segments = 2 * rings;
+		ref<TriMesh> mesh = new TriMesh("deformbench", 2 * (size_t) rings * segments,
+			(size_t) (rings + 1) * (segments + 1), true);
+
+		/* Non-linear path and a traveling wave on the surface */
+		Point center(3 * std::sin(2 * M_PI * time), 0.5f * std::sin(4 * M_PI * time), 0);
+		Point *positions = mesh->getVertexPositions();
+		for (int i=0; i<=rings; ++i) {
+			Float theta = M_PI * i / rings;
+			for (int j=0; j<=segments; ++j) {
+				Float phi = 2 * M_PI * j / segments;
+				Float radius = 1 + 0.15f * std::sin(5 * phi + 6 * M_PI * time) * std::sin(3 * theta);
+				*positions++ = center + radius * Vector(std::sin(theta) * std::cos(phi),
+					std::sin(theta) * std::sin(phi), std::cos(theta));
+			}
+		}
+
+		Triangle *triangles = mesh->getTriangles();
+		for (int i=0; i<rings; ++i) {
+			for (int j=0; j<segments; ++j) {
+				uint32_t idx0 = i * (segments + 1) + j, idx1 = idx0 + 1,
+				         idx2 = idx0 + segments + 1, idx3 = idx2 + 1;
+				triangles->idx[0] = idx0; triangles->idx[1] = idx2; triangles->idx[2] = idx1;
+				++triangles;
+				triangles->idx[0] = idx1; triangles->idx[1] = idx2; triangles->idx[2] = idx3;
+				++triangles;
+			}
+		}
+		mesh->computeNormals();
+		return mesh;
+	}
+
+	ref<Shape> createShape(std::vector<ref<TriMesh> > &frames, const std::string &accel) {
+		std::ostringstream oss;
+		for (size_t i=0; i<frames.size(); ++i)
+			oss << (i > 0 ? ", " : "") << (Float) i / (frames.size() - 1);
+
+		Properties props("deformable");
+		props.setString("times", oss.str());
+		props.setString("accel", accel);
+		ref<Shape> shape = static_cast<Shape *> (PluginManager::getInstance()->
+			createObject(MTS_CLASS(Shape), props));
+		for (size_t i=0; i<frames.size(); ++i)
+			shape->addChild(frames[i]);
+
+		ref<Timer> timer = new Timer();
+		shape->configure();
+		Log(EInfo, "  %-8s build: %8i ms", accel.c_str(), timer->getMilliseconds());
+		return shape;
+	}
+
+	/// Render the shape with motion blur, returns the number of traced rays
+	size_t render(const Shape *shape, int size, int spp, std::vector<Float> &image) {
+		uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+		ref<Random> random = new Random((uint64_t) 1);
+		const Float tanHalfFov = std::tan(degToRad(25.0f));
+		const Point origin(0, 0, 10);
+		const Vector light = normalize(Vector(1, 1, 1));
+		size_t rayCount = 0;
+
+		image.resize((size_t) size * size);
+		for (int y=0; y<size; ++y) {
+			for (int x=0; x<size; ++x) {
+				Float value = 0;
+				for (int i=0; i<spp; ++i) {
+					Vector d(
+						(2 * (x + random->nextFloat()) / size - 1) * tanHalfFov,
+						(1 - 2 * (y + random->nextFloat()) / size) * tanHalfFov, -1);
+					Ray ray(origin, normalize(d), random->nextFloat());
+					++rayCount;
+
+					Float t;
+					if (!shape->rayIntersect(ray, 0, std::numeric_limits<Float>::infinity(), t, temp))
+						continue;
+
+					Intersection its;
+					its.t = t;
+					shape->fillIntersectionRecord(ray, temp, its);
+					Float cosTheta = dot(its.shFrame.n, light);
+					if (dot(its.geoFrame.n, ray.d) > 0)
+						cosTheta = -cosTheta;
+					if (cosTheta <= 0)
+						continue;
+
+					Ray shadowRay(its.p, light, ray.time);
+					++rayCount;
+					if (!shape->rayIntersect(shadowRay, Epsilon, std::numeric_limits<Float>::infinity()))
+						value += cosTheta;
+				}
+				image[y * size + x] = value / spp;
+			}
+		}
+		return rayCount;
+	}
+
+	int run(int argc, char **argv) {
+		int optchar;
+		char *end_ptr = NULL;
+		int rings = 64, frameCount = 120, size = 256, spp = 4;
+		std::vector<std::string> accels;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "r:f:s:p:a:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'r':
+					rings = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || rings < 2)
+						SLog(EError, "Could not parse the sphere tessellation!");
+					break;
+				case 'f':
+					frameCount = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || frameCount < 2)
+						SLog(EError, "Could not parse the number of keyframes!");
+					break;
+				case 's':
+					size = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || size < 1)
+						SLog(EError, "Could not parse the image resolution!");
+					break;
+				case 'p':
+					spp = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || spp < 1)
+						SLog(EError, "Could not parse the sample count!");
+					break;
+				case 'a':
+					accels = tokenize(optarg, ",");
+					break;
+			};
+		}
+
+		if (accels.empty()) {
+			accels.push_back("bvh");
+			accels.push_back("kdtree");
+		}
+
+		std::vector<ref<TriMesh> > frames(frameCount);
+		for (int i=0; i<frameCount; ++i)
+			frames[i] = generateFrame(rings, (Float) i / (frameCount - 1));
+		Log(EInfo, "Generated %i keyframes with " SIZE_T_FMT " triangles", frameCount,
+			frames[0]->getTriangleCount());
+
+		std::vector<ref<Shape> > shapes;
+		for (size_t i=0; i<accels.size(); ++i)
+			shapes.push_back(createShape(frames, accels[i]));
+
+		Log(EInfo, "Rendering %ix%i pixels with %i samples per pixel:", size, size, spp);
+		std::vector<Float> reference;
+		for (size_t i=0; i<shapes.size(); ++i) {
+			std::vector<Float> image;
+			ref<Timer> timer = new Timer();
+			size_t rayCount = render(shapes[i], size, spp, image);
+			Float time = timer->getSeconds();
+
+			size_t differences = 0;
+			if (i == 0)
+				reference.swap(image);
+			else
+				for (size_t j=0; j<image.size(); ++j)
+					differences += std::abs(image[j] - reference[j]) > 1e-3f ? 1 : 0;
+
+			Log(EInfo, "  %-8s %7.3f Mrays/s (" SIZE_T_FMT " rays in %.2f s), "
+				SIZE_T_FMT " pixels differ from %s", accels[i].c_str(),
+				rayCount / (time * 1e6f), rayCount, time, differences, accels[0].c_str());
+		}
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(DeformBench, "Motion blur benchmark of the deformable shape (motion BVH vs. space-time kd-tree)")
+MTS_NAMESPACE_END
@@ -0,0 +1,268 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/shape.h>
+#include <mitsuba/render/skdtree.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/filesystem.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/warp.h>
+#include <fstream>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class HairBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Hair intersection benchmark. Compares the loading time, ray" << endl;
+		cout << "throughput and number of segment intersection tests of the kd-tree and of" << endl;
+		cout << "the BVH with oriented bounds used by the hair shape. Unless a hair file is" << endl;
+		cout << "specified, a synthetic groom made of curly diagonal strands is generated and" << endl;
+		cout << "stored in both the ASCII and the indexed binary format." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil hairbench [options] [hair file]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -s strands     Number of strands of the synthetic groom (default: 20000)" << endl << endl;
+		cout << "   -v vertices    Number of vertices per synthetic strand (default: 32)" << endl << endl;
+		cout << "   -r radius      Hair radius (default: 0.025)" << endl << endl;
+		cout << "   -n count       Number of rays (default: 1000000)" << endl << endl;
+	}
+
+	/// Generate strands growing from a sphere, which are pulled down by gravity and curl around
+	void generateGroom(size_t strandCount, size_t vertexCount,
+			std::vector<Point> &positions) {
+		ref<Random> random = new Random();
+		const Float headRadius = 10.0f, stepLength = 0.4f;
+		positions.reserve(strandCount * vertexCount);
+
+		for (size_t i=0; i<strandCount; ++i) {
+			Vector n = warp::squareToUniformHemisphere(
+				Point2(random->nextFloat(), random->nextFloat()));
+			Vector s, t;
+			coordinateSystem(n, s, t);
+			Point p = Point(n * headRadius);
+			Vector dir = n;
+			Float phase = random->nextFloat() * 2 * M_PI;
+			for (size_t j=0; j<vertexCount; ++j) {
+				positions.push_back(p);
+				Float angle = phase + j * 0.7f;
+				dir = normalize(dir + Vector(0, 0, -0.15f)
+					+ 0.3f * (std::cos(angle) * s + std::sin(angle) * t));
+				p += dir * stepLength;
+			}
+		}
+	}
+
+	void writeASCII(const fs::path &path, const std::vector<Point> &positions,
+			size_t vertexCount) {
+		std::ofstream os(path.string().c_str());
+		for (size_t i=0; i<positions.size(); ++i) {
+			if (i > 0 && i % vertexCount == 0)
+				os << endl;
+			os << positions[i].x << " " << positions[i].y << " " << positions[i].z << endl;
+		}
+	}
+
+	void writeIndexed(const fs::path &path, const std::vector<Point> &positions,
+			size_t vertexCount) {
+		size_t strandCount = positions.size() / vertexCount;
+		ref<FileStream> os = new FileStream(fs::encode_pathstr(path), FileStream::ETruncReadWrite);
+		os->setByteOrder(Stream::ELittleEndian);
+		os->write("INDEXED_HAIR", 12);
+		os->writeUInt(1);
+		os->writeULong(strandCount);
+		os->writeULong(positions.size());
+		for (size_t i=0; i<=strandCount; ++i)
+			os->writeULong(i * vertexCount);
+		for (size_t i=0; i<positions.size(); ++i)
+			for (int k=0; k<3; ++k)
+				os->writeSingle((float) positions[i][k]);
+		os->close();
+	}
+
+	ref<Shape> loadHair(const fs::path &path, const std::string &accel, Float radius) {
+		Properties props("hair");
+		props.setString("filename", path.string());
+		props.setString("accel", accel);
+		props.setFloat("radius", radius);
+
+		ref<Timer> timer = new Timer();
+		ref<Shape> shape = static_cast<Shape *> (PluginManager::getInstance()->
+			createObject(MTS_CLASS(Shape), props));
+		shape->configure();
+		Log(EInfo, "  %-30s %8i ms", (path.filename().string() + " (" + accel + ")").c_str(),
+			timer->getMilliseconds());
+		return shape;
+	}
+
+	/// Return the average number of segment intersection tests per ray since the last reset
+	std::string getSegmentTests() {
+		const std::string name = "Segment intersection tests per ray : ";
+		std::istringstream iss(Statistics::getInstance()->getStats());
+		std::string line;
+		while (std::getline(iss, line)) {
+			size_t pos = line.find(name);
+			if (pos != std::string::npos)
+				return line.substr(pos + name.length());
+		}
+		return "n/a";
+	}
+
+	void benchmark(const Shape *shape, const std::string &name,
+			const std::vector<Ray> &rays, std::vector<Float> &hitT) {
+		uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+		hitT.resize(rays.size());
+
+		Statistics::getInstance()->resetAll();
+		ref<Timer> timer = new Timer();
+		for (size_t i=0; i<rays.size(); ++i) {
+			Float t;
+			hitT[i] = shape->rayIntersect(rays[i], 0, std::numeric_limits<Float>::infinity(), t, temp)
+				? t : std::numeric_limits<Float>::infinity();
+		}
+		Float time = timer->lap();
+		std::string tests = getSegmentTests();
+
+		size_t occluded = 0;
+		timer->reset();
+		for (size_t i=0; i<rays.size(); ++i)
+			occluded += shape->rayIntersect(rays[i], 0, std::numeric_limits<Float>::infinity()) ? 1 : 0;
+		Float shadowTime = timer->lap();
+
+		Log(EInfo, "  %-8s %7.3f Mrays/s (shadow rays: %7.3f Mrays/s, " SIZE_T_FMT " occluded), "
+			"segment tests per ray: %s", name.c_str(), rays.size() / (time * 1e6f),
+			rays.size() / (shadowTime * 1e6f), occluded, tests.c_str());
+	}
+
+	int run(int argc, char **argv) {
+		int optchar;
+		char *end_ptr = NULL;
+		size_t strandCount = 20000, vertexCount = 32, rayCount = 1000000;
+		Float radius = 0.025f;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "s:v:r:n:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 's':
+					strandCount = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || strandCount == 0)
+						SLog(EError, "Could not parse the strand count!");
+					break;
+				case 'v':
+					vertexCount = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || vertexCount < 2)
+						SLog(EError, "Could not parse the vertex count!");
+					break;
+				case 'r':
+					radius = (Float) strtod(optarg, &end_ptr);
+					if (*end_ptr != '\0' || !(radius > 0))
+						SLog(EError, "Could not parse the hair radius!");
+					break;
+				case 'n':
+					rayCount = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || rayCount == 0)
+						SLog(EError, "Could not parse the ray count!");
+					break;
+			};
+		}
+
+		ref<Shape> kdtree, bvh;
+		fs::path tempDir;
+		Log(EInfo, "Loading time (including the construction of the acceleration data structure):");
+		if (optind < argc) {
+			fs::path path(argv[optind]);
+			kdtree = loadHair(path, "kdtree", radius);
+			bvh = loadHair(path, "bvh", radius);
+		} else {
+			std::vector<Point> positions;
+			generateGroom(strandCount, vertexCount, positions);
+
+			ref<Random> random = new Random();
+			tempDir = fs::temp_directory_path() / formatString("mtshairbench-%08x",
+				(uint32_t) random->nextULong());
+			fs::create_directories(tempDir);
+			writeASCII(tempDir / "groom.txt", positions, vertexCount);
+			writeIndexed(tempDir / "groom.hair", positions, vertexCount);
+
+			loadHair(tempDir / "groom.txt", "kdtree", radius);
+			kdtree = loadHair(tempDir / "groom.hair", "kdtree", radius);
+			bvh = loadHair(tempDir / "groom.hair", "bvh", radius);
+		}
+
+		/* Half of the rays come from outside, the others start within the hair */
+		AABB aabb = kdtree->getAABB();
+		BSphere bsphere = aabb.getBSphere();
+		ref<Random> random = new Random();
+		std::vector<Ray> rays(rayCount);
+		for (size_t i=0; i<rayCount; ++i) {
+			Point target = aabb.min + Vector(aabb.getExtents().x * random->nextFloat(),
+				aabb.getExtents().y * random->nextFloat(), aabb.getExtents().z * random->nextFloat());
+			if (i % 2 == 0) {
+				Point origin = bsphere.center + bsphere.radius * warp::squareToUniformSphere(
+					Point2(random->nextFloat(), random->nextFloat()));
+				rays[i] = Ray(origin, normalize(target - origin), 0.0f);
+			} else {
+				rays[i] = Ray(target, warp::squareToUniformSphere(
+					Point2(random->nextFloat(), random->nextFloat())), 0.0f);
+			}
+		}
+
+		Log(EInfo, "Tracing " SIZE_T_FMT " rays:", rayCount);
+		std::vector<Float> hitKD, hitBVH;
+		benchmark(kdtree, "kdtree", rays, hitKD);
+		benchmark(bvh, "bvh", rays, hitBVH);
+
+		size_t hits = 0, mismatches = 0;
+		for (size_t i=0; i<rayCount; ++i) {
+			if (std::isfinite(hitKD[i]))
+				++hits;
+			if (hitKD[i] != hitBVH[i] && !(std::abs(hitKD[i] - hitBVH[i])
+					<= 1e-4f * std::max((Float) 1, std::abs(hitKD[i]))))
+				++mismatches;
+		}
+		Log(EInfo, SIZE_T_FMT " rays hit the hair, " SIZE_T_FMT
+			" rays have different intersections", hits, mismatches);
+
+		if (!tempDir.empty())
+			fs::remove_all(tempDir);
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(HairBench, "Hair intersection benchmark (kd-tree vs. oriented BVH)")
+MTS_NAMESPACE_END
@@ -0,0 +1,159 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/core/filesystem.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/timer.h>
+#include <fstream>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class HairConv : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Converts a hair file in the ASCII or \"BINARY_HAIR\" format into" << endl;
+		cout << "the indexed binary format, which the hair shape can map into memory and" << endl;
+		cout << "load using several threads." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil hairconv [options] <input file> <output file>" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+	}
+
+	/// Finish the current strand (empty strands are dropped)
+	inline void startStrand(std::vector<uint64_t> &offsets, size_t vertexCount) {
+		if (offsets.back() != vertexCount)
+			offsets.push_back(vertexCount);
+	}
+
+	void readBinary(Stream *stream, std::vector<uint64_t> &offsets,
+			std::vector<float> &positions) {
+		size_t vertexCount = stream->readUInt();
+		positions.reserve(vertexCount * 3);
+		for (size_t i=0; i<vertexCount; ++i) {
+			float value = stream->readSingle();
+			if (std::isinf(value)) {
+				startStrand(offsets, i);
+				value = stream->readSingle();
+			}
+			positions.push_back(value);
+			positions.push_back(stream->readSingle());
+			positions.push_back(stream->readSingle());
+		}
+	}
+
+	void readASCII(const fs::pathstr &path, std::vector<uint64_t> &offsets,
+			std::vector<float> &positions) {
+		std::ifstream is(decode_pathstr(path).string().c_str());
+		if (is.fail())
+			Log(EError, "Could not open \"%s\"!", path.s.c_str());
+		std::string line;
+		while (std::getline(is, line)) {
+			if (line.length() > 0 && line[0] == '#') {
+				startStrand(offsets, positions.size() / 3);
+				continue;
+			}
+			std::istringstream iss(line);
+			float x, y, z;
+			iss >> x >> y >> z;
+			if (!iss.fail()) {
+				positions.push_back(x);
+				positions.push_back(y);
+				positions.push_back(z);
+			} else {
+				startStrand(offsets, positions.size() / 3);
+			}
+		}
+	}
+
+	int run(int argc, char **argv) {
+		int optchar;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+			};
+		}
+
+		if (argc - optind != 2) {
+			help();
+			return -1;
+		}
+
+		fs::pathstr inputPath(argv[optind]), outputPath(argv[optind+1]);
+		ref<Timer> timer = new Timer();
+		std::vector<uint64_t> offsets(1, 0);
+		std::vector<float> positions;
+
+		ref<FileStream> input = new FileStream(inputPath, FileStream::EReadOnly);
+		input->setByteOrder(Stream::ELittleEndian);
+		char header[11];
+		if (input->getSize() >= 11) {
+			input->read(header, 11);
+			if (memcmp(header, "BINARY_HAIR", 11) == 0) {
+				readBinary(input, offsets, positions);
+			} else {
+				input->close();
+				readASCII(inputPath, offsets, positions);
+			}
+		} else {
+			input->close();
+			readASCII(inputPath, offsets, positions);
+		}
+
+		size_t vertexCount = positions.size() / 3;
+		startStrand(offsets, vertexCount);
+		size_t strandCount = offsets.size() - 1;
+		Log(EInfo, "Read " SIZE_T_FMT " strands with " SIZE_T_FMT " vertices from \"%s\" (took %i ms)",
+			strandCount, vertexCount, inputPath.s.c_str(), timer->getMilliseconds());
+
+		ref<FileStream> output = new FileStream(outputPath, FileStream::ETruncReadWrite);
+		output->setByteOrder(Stream::ELittleEndian);
+		output->write("INDEXED_HAIR", 12);
+		output->writeUInt(1);
+		output->writeULong(strandCount);
+		output->writeULong(vertexCount);
+		output->writeULongArray(&offsets[0], offsets.size());
+		if (vertexCount > 0)
+			output->writeSingleArray(&positions[0], positions.size());
+		output->close();
+
+		Log(EInfo, "Wrote \"%s\" (%s)", outputPath.s.c_str(),
+			memString(12 + 4 + 2 * sizeof(uint64_t) + offsets.size() * sizeof(uint64_t)
+				+ positions.size() * sizeof(float)).c_str());
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(HairConv, "Convert hair files into the indexed binary format")
+MTS_NAMESPACE_END
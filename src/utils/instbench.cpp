@@ -0,0 +1,325 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/render/skdtree.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/filesystem.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#include "../shapes/instancearray.h"
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class InstBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Instancing benchmark. Generates a forest of randomly placed, rotated" << endl;
+		cout << "and scaled copies of a tessellated ellipsoid, and compares separate 'instance'" << endl;
+		cout << "shapes in the scene kd-tree against a single 'instancearray' shape. Reports" << endl;
+		cout << "the construction time, the memory usage per instance and the ray throughput." << endl;
+		cout << "Afterwards, all instances are moved slightly, and the time needed to update" << endl;
+		cout << "the acceleration data structures is measured (refit and rebuild of the BVH" << endl;
+		cout << "of the instance array, rebuild of the scene kd-tree)." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil instbench [options]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of instances (default: 200000)" << endl << endl;
+		cout << "   -r rings       Tessellation of the instanced ellipsoid, which has" << endl;
+		cout << "                  4*rings^2 triangles (default: 16)" << endl << endl;
+		cout << "   -c rays        Number of rays (default: 1000000)" << endl << endl;
+		cout << "   -j jitter      Displacement of the instances during the update (default: 0.5)" << endl << endl;
+		cout << "   -a             Only benchmark the instance array (e.g. for very large counts)" << endl << endl;
+	}
+
+	ref<TriMesh> generateMesh(int rings) {
+		int segments = 2 * rings;
+		ref<TriMesh> mesh = new TriMesh("instbench", 2 * (size_t) rings * segments,
+			(size_t) (rings + 1) * (segments + 1), true);
+
+		Point *positions = mesh->getVertexPositions();
+		for (int i=0; i<=rings; ++i) {
+			Float theta = M_PI * i / rings;
+			for (int j=0; j<=segments; ++j) {
+				Float phi = 2 * M_PI * j / segments;
+				*positions++ = Point(std::sin(theta) * std::cos(phi),
+					std::cos(theta), std::sin(theta) * std::sin(phi));
+			}
+		}
+
+		Triangle *triangles = mesh->getTriangles();
+		for (int i=0; i<rings; ++i) {
+			for (int j=0; j<segments; ++j) {
+				uint32_t idx0 = i * (segments + 1) + j, idx1 = idx0 + 1,
+				         idx2 = idx0 + segments + 1, idx3 = idx2 + 1;
+				triangles->idx[0] = idx0; triangles->idx[1] = idx1; triangles->idx[2] = idx2;
+				++triangles;
+				triangles->idx[0] = idx1; triangles->idx[1] = idx3; triangles->idx[2] = idx2;
+				++triangles;
+			}
+		}
+		mesh->computeNormals();
+		return mesh;
+	}
+
+	/// Place stretched ellipsoids ("trees") on a jittered grid in the XZ plane
+	void generateForest(size_t count, std::vector<Transform> &transforms) {
+		ref<Random> random = new Random();
+		size_t side = (size_t) std::ceil(std::sqrt((Float) count));
+		transforms.resize(count);
+		for (size_t i=0; i<count; ++i) {
+			Float x = 3 * ((i % side) + random->nextFloat()),
+			      z = 3 * ((i / side) + random->nextFloat());
+			Float height = 1.5f + 1.5f * random->nextFloat();
+			transforms[i] = Transform::translate(Vector(x, height, z))
+				* Transform::rotate(Vector(0, 1, 0), 360 * random->nextFloat())
+				* Transform::rotate(Vector(1, 0, 0), 10 * (random->nextFloat() - 0.5f))
+				* Transform::scale(Vector(0.8f + 0.4f * random->nextFloat(), height,
+					0.8f + 0.4f * random->nextFloat()));
+		}
+	}
+
+	void writeTransforms(const fs::path &path, const std::vector<Transform> &transforms) {
+		ref<FileStream> os = new FileStream(fs::encode_pathstr(path), FileStream::ETruncReadWrite);
+		os->setByteOrder(Stream::ELittleEndian);
+		for (size_t i=0; i<transforms.size(); ++i) {
+			const Matrix4x4 &matrix = transforms[i].getMatrix();
+			for (int j=0; j<3; ++j)
+				for (int k=0; k<4; ++k)
+					os->writeSingle((float) matrix.m[j][k]);
+		}
+		os->close();
+	}
+
+	ref<Shape> createShape(const std::string &type, Properties &props, ShapeGroup *group) {
+		props.setPluginName(type);
+		ref<Shape> shape = static_cast<Shape *> (PluginManager::getInstance()->
+			createObject(MTS_CLASS(Shape), props));
+		shape->addChild(group);
+		shape->configure();
+		return shape;
+	}
+
+	/// Trace all rays, returns the intersection records and the throughput in Mrays/s
+	Float trace(const ShapeKDTree *kdtree, const std::vector<Ray> &rays,
+			std::vector<Intersection> &its) {
+		its.resize(rays.size());
+		ref<Timer> timer = new Timer();
+		for (size_t i=0; i<rays.size(); ++i) {
+			if (!kdtree->rayIntersect(rays[i], its[i]))
+				its[i].t = std::numeric_limits<Float>::infinity();
+		}
+		return rays.size() / (timer->getSeconds() * 1e6f);
+	}
+
+	/// Count the rays with different hits, and compare shading normal derivatives
+	void compare(const std::vector<Intersection> &its1, const std::vector<Intersection> &its2) {
+		size_t hits = 0, mismatches = 0, derivatives = 0, derivativeMismatches = 0;
+		for (size_t i=0; i<its1.size(); ++i) {
+			Float t1 = its1[i].t, t2 = its2[i].t;
+			if (!std::isfinite(t1) || !std::isfinite(t2)) {
+				if (std::isfinite(t1) != std::isfinite(t2))
+					++mismatches;
+				continue;
+			}
+			++hits;
+			if (std::abs(t1 - t2) > 1e-3f * std::max((Float) 1, t1)) {
+				++mismatches;
+				continue;
+			}
+			if (i % 64 == 0) {
+				Vector dndu1, dndv1, dndu2, dndv2;
+				its1[i].instance->getNormalDerivative(its1[i], dndu1, dndv1, true);
+				its2[i].instance->getNormalDerivative(its2[i], dndu2, dndv2, true);
+				Float scale = std::max((Float) 1, std::max(dndu1.length(), dndv1.length()));
+				if ((dndu1 - dndu2).length() > 1e-2f * scale || (dndv1 - dndv2).length() > 1e-2f * scale)
+					++derivativeMismatches;
+				++derivatives;
+			}
+		}
+		Log(EInfo, "  " SIZE_T_FMT " rays hit the forest, " SIZE_T_FMT " rays have different "
+			"intersections, " SIZE_T_FMT "/" SIZE_T_FMT " normal derivatives differ", hits,
+			mismatches, derivativeMismatches, derivatives);
+	}
+
+	int run(int argc, char **argv) {
+		int optchar;
+		char *end_ptr = NULL;
+		size_t count = 200000, rayCount = 1000000;
+		int rings = 16;
+		Float jitter = 0.5f;
+		bool arrayOnly = false;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:r:c:j:ah")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n':
+					count = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || count == 0)
+						SLog(EError, "Could not parse the instance count!");
+					break;
+				case 'r':
+					rings = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || rings < 2)
+						SLog(EError, "Could not parse the tessellation!");
+					break;
+				case 'c':
+					rayCount = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || rayCount == 0)
+						SLog(EError, "Could not parse the ray count!");
+					break;
+				case 'j':
+					jitter = (Float) strtod(optarg, &end_ptr);
+					if (*end_ptr != '\0' || jitter < 0)
+						SLog(EError, "Could not parse the jitter!");
+					break;
+				case 'a':
+					arrayOnly = true;
+					break;
+			};
+		}
+
+		ref<ShapeGroup> group = static_cast<ShapeGroup *> (PluginManager::getInstance()->
+			createObject(MTS_CLASS(Shape), Properties("shapegroup")));
+		group->addChild(generateMesh(rings));
+		group->configure();
+
+		std::vector<Transform> transforms;
+		generateForest(count, transforms);
+		ref<Random> random = new Random();
+		fs::path tempDir = fs::temp_directory_path() / formatString("mtsinstbench-%08x",
+			(uint32_t) random->nextULong());
+		fs::create_directories(tempDir);
+		writeTransforms(tempDir / "forest.bin", transforms);
+
+		Log(EInfo, "Instancing a mesh with %i triangles " SIZE_T_FMT " times:",
+			4 * rings * rings, count);
+
+		/* Instance array (measured first, so that its memory
+		   usage isn't hidden by memory freed by the other test) */
+		size_t memory = getPrivateMemoryUsage();
+		ref<Timer> timer = new Timer();
+		Properties props;
+		props.setString("filename", (tempDir / "forest.bin").string());
+		ref<Shape> array = createShape("instancearray", props, group);
+		ref<ShapeKDTree> arrayTree = new ShapeKDTree();
+		arrayTree->addShape(array);
+		arrayTree->build();
+		int arrayTime = timer->getMilliseconds();
+		Float arrayMemory = (Float) (getPrivateMemoryUsage() - memory) / count;
+		InstanceArray *instanceArray = static_cast<InstanceArray *>(array.get());
+		Log(EInfo, "  instancearray: loading and construction took %6i ms, "
+			"%.1f bytes per instance (%.1f bytes in the BVH and transformations)",
+			arrayTime, arrayMemory, (Float) instanceArray->getMemoryUsage() / count);
+		fs::remove_all(tempDir);
+
+		/* Separate instances in the scene kd-tree */
+		ref<ShapeKDTree> instanceTree;
+		std::vector<ref<Shape> > instances;
+		if (!arrayOnly) {
+			memory = getPrivateMemoryUsage();
+			timer->reset();
+			instanceTree = new ShapeKDTree();
+			instances.resize(count);
+			for (size_t i=0; i<count; ++i) {
+				Properties props;
+				props.setTransform("toWorld", transforms[i]);
+				instances[i] = createShape("instance", props, group);
+				instanceTree->addShape(instances[i]);
+			}
+			instanceTree->build();
+			int instanceTime = timer->getMilliseconds();
+			Float instanceMemory = (Float) (getPrivateMemoryUsage() - memory) / count;
+			Log(EInfo, "  instance:      construction took %6i ms, %.1f bytes per instance",
+				instanceTime, instanceMemory);
+		}
+
+		/* Rays from above the forest towards random points on the ground */
+		AABB aabb = array->getAABB();
+		std::vector<Ray> rays(rayCount);
+		for (size_t i=0; i<rayCount; ++i) {
+			Point target(aabb.min.x + aabb.getExtents().x * random->nextFloat(), 0,
+				aabb.min.z + aabb.getExtents().z * random->nextFloat());
+			Point origin = target + Vector(20 * (random->nextFloat() - 0.5f), 10,
+				20 * (random->nextFloat() - 0.5f));
+			rays[i] = Ray(origin, normalize(target - origin), 0.0f);
+		}
+
+		Log(EInfo, "Tracing " SIZE_T_FMT " rays:", rayCount);
+		std::vector<Intersection> arrayIts, instanceIts;
+		Log(EInfo, "  instancearray: %7.3f Mrays/s", trace(arrayTree, rays, arrayIts));
+		if (!arrayOnly) {
+			Log(EInfo, "  instance:      %7.3f Mrays/s", trace(instanceTree, rays, instanceIts));
+			compare(arrayIts, instanceIts);
+		}
+
+		/* Move every instance by a small random offset */
+		Log(EInfo, "Moving all instances (jitter: %.2f):", jitter);
+		std::vector<Transform> offsets(count);
+		for (size_t i=0; i<count; ++i)
+			offsets[i] = Transform::translate(Vector(random->nextFloat() - 0.5f,
+				0.2f * (random->nextFloat() - 0.5f), random->nextFloat() - 0.5f) * (2 * jitter));
+
+		std::vector<Intersection> refitIts;
+		for (int rebuild=0; rebuild<2; ++rebuild) {
+			timer->reset();
+			if (!rebuild) {
+				for (size_t i=0; i<count; ++i)
+					instanceArray->setTransform(i, offsets[i] * instanceArray->getTransform(i));
+			}
+			instanceArray->update(rebuild != 0);
+			arrayTree->update();
+			int updateTime = timer->getMilliseconds();
+			Log(EInfo, "  instancearray (%s): %6i ms, %7.3f Mrays/s", rebuild ? "rebuild" : "refit  ",
+				updateTime, trace(arrayTree, rays, rebuild ? arrayIts : refitIts));
+		}
+		if (!arrayOnly) {
+			timer->reset();
+			for (size_t i=0; i<count; ++i)
+				instances[i]->applyTransform(offsets[i]);
+			instanceTree->update();
+			int updateTime = timer->getMilliseconds();
+			Log(EInfo, "  instance (kd-tree rebuild): %6i ms, %7.3f Mrays/s",
+				updateTime, trace(instanceTree, rays, instanceIts));
+			compare(arrayIts, instanceIts);
+		}
+		compare(refitIts, arrayIts);
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(InstBench, "Instancing benchmark (instance array vs. separate instances)")
+MTS_NAMESPACE_END
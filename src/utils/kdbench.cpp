@@ -57,6 +57,9 @@ public:
 		cout << "                  optimization method." << endl << endl;
 		cout << "   -f             Try to empirically find the best SAH cost values by" << endl;
 		cout << "                  fitting the cost model to collected performance data" << endl << endl;
+		cout << "   -a accels      Comma-separated list of acceleration data structures to" << endl;
+		cout << "                  compare (kdtree, bvh4, bvh8). Reports build time, memory" << endl;
+		cout << "                  usage and ray tracing performance of each (default: kdtree)" << endl << endl;
 		cout << "Examples:" << endl;
 		cout << "  E.g. to build a tree for the Stanford bunny having a low SAH cost, type " << endl << endl;
 		cout << "  $ mtsutil kdbench -e .9 -l1 -d48 -x100000 data/tests/bunny.ply" << endl << endl;
@@ -64,6 +67,8 @@ public:
 		cout << "  The high -x paramer effectively disables Min-Max binning, which " << endl;
 		cout << "  leads to a slower and more memory-intensive build, so don't try" << endl;
 		cout << "  this on a huge model." << endl << endl;
+		cout << "  To compare the kd-tree against the wide BVHs, type" << endl << endl;
+		cout << "  $ mtsutil kdbench -a kdtree,bvh4,bvh8 data/tests/bunny.ply" << endl << endl;
 	}
 
 	int run(int argc, char **argv) {
@@ -73,10 +78,11 @@ public:
 		Float intersectionCost = -1, traversalCost = -1, emptySpaceBonus = -1;
 		int stopPrims = -1, maxDepth = -1, exactPrims = -1, minMaxBins = -1;
 		bool clip = true, parallel = true, retract = true, fitParameters = false;
+		std::vector<ShapeKDTree::EAccelerator> accelerators;
 		optind = 1;
 
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:hf")) != -1) {
+		while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:a:hf")) != -1) {
 			switch (optchar) {
 				case 'h': {
 						help();
@@ -86,6 +92,12 @@ public:
 				case 'f':
 					fitParameters = true;
 					break;
+				case 'a': {
+						std::vector<std::string> names = tokenize(optarg, ",");
+						for (size_t i=0; i<names.size(); ++i)
+							accelerators.push_back(ShapeKDTree::getAccelerator(names[i]));
+					}
+					break;
 				case 'i':
 					intersectionCost = (Float) strtod(optarg, &end_ptr);
 					if (*end_ptr != '\0')
@@ -198,53 +210,93 @@ public:
 		kdtree->setRetract(retract);
 		kdtree->setParallelBuild(parallel);
 
+		if (accelerators.empty())
+			accelerators.push_back(ShapeKDTree::EKDTree);
+		if (fitParameters && (accelerators.size() != 1 || accelerators[0] != ShapeKDTree::EKDTree))
+			Log(EError, "Cost fitting (-f) is only supported for the kd-tree!");
+		kdtree->setAccelerator(accelerators[0]);
+
 		/* Show some statistics, and make sure it roughly fits in 80cols */
 		Logger *logger = Thread::getThread()->getLogger();
 		DefaultFormatter *formatter = ((DefaultFormatter *) logger->getFormatter());
 		logger->setLogLevel(EDebug);
 		formatter->setHaveDate(false);
 
-		if (scene)
-			scene->initialize();
-		else
-			kdtree->build();
+		std::vector<unsigned int> buildTimes(accelerators.size());
+		std::vector<size_t> memoryUsage(accelerators.size());
+		std::vector<Float> performance(accelerators.size());
 
-		BSphere bsphere(kdtree->getAABB().getBSphere());
-		const size_t nRays = 5000000;
+		for (size_t k=0; k<accelerators.size(); ++k) {
+			ref<Timer> buildTimer = new Timer();
+			if (k == 0) {
+				if (scene)
+					scene->initialize();
+				else
+					kdtree->build();
+			} else {
+				/* Rebuild over the (already expanded) shapes of the first tree */
+				ref<ShapeKDTree> tree = new ShapeKDTree();
+				const std::vector<const Shape *> &shapes = kdtree->getShapes();
+				for (size_t i=0; i<shapes.size(); ++i)
+					tree->addShape(shapes[i]);
+				tree->setAccelerator(accelerators[k]);
+				tree->setParallelBuild(parallel);
+				tree->build();
+				kdtree = tree;
+			}
+			buildTimes[k] = buildTimer->getMilliseconds();
+			memoryUsage[k] = kdtree->getMemoryUsage();
+			Log(EInfo, "Built the %s in %u ms (%s)",
+				ShapeKDTree::getAcceleratorName(accelerators[k]).c_str(),
+				buildTimes[k], memString(memoryUsage[k]).c_str());
 
-		if (!fitParameters) {
-			Log(EInfo, "Bounding sphere: %s", bsphere.toString().c_str());
-			Float best = 0;
-			for (int j=0; j<3; ++j) {
-				ref<Random> random = new Random();
-				ref<Timer> timer = new Timer();
-				size_t nIntersections = 0;
+			BSphere bsphere(kdtree->getAABB().getBSphere());
+			const size_t nRays = 5000000;
 
-				Log(EInfo, "Shooting " SIZE_T_FMT " rays (1 thread, incoherent) ..", nRays);
+			if (!fitParameters) {
+				Log(EInfo, "Bounding sphere: %s", bsphere.toString().c_str());
+				Float best = 0;
+				for (int j=0; j<3; ++j) {
+					ref<Random> random = new Random();
+					ref<Timer> timer = new Timer();
+					size_t nIntersections = 0;
 
-				for (size_t i=0; i<nRays; ++i) {
-					Point2 sample1(random->nextFloat(), random->nextFloat()),
-						sample2(random->nextFloat(), random->nextFloat());
-					Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
-					Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
-					Ray r(p1, normalize(p2-p1), 0.0f);
+					Log(EInfo, "Shooting " SIZE_T_FMT " rays (1 thread, incoherent) ..", nRays);
 
-					Intersection its;
-					if (kdtree->rayIntersect(r, its))
-						nIntersections++;
-				}
+					for (size_t i=0; i<nRays; ++i) {
+						Point2 sample1(random->nextFloat(), random->nextFloat()),
+							sample2(random->nextFloat(), random->nextFloat());
+						Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+						Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+						Ray r(p1, normalize(p2-p1), 0.0f);
 
-				Log(EInfo, "Found " SIZE_T_FMT " intersections in %i ms",
-					nIntersections, timer->getMilliseconds());
-				Float mrays = nRays / (timer->getMilliseconds() * (Float) 1000);
-				Log(EInfo, "-> %.3f MRays/s", mrays);
-				Log(EInfo, "");
-				best = std::max(best, mrays);
+						Intersection its;
+						if (kdtree->rayIntersect(r, its))
+							nIntersections++;
+					}
+
+					Log(EInfo, "Found " SIZE_T_FMT " intersections in %i ms",
+						nIntersections, timer->getMilliseconds());
+					Float mrays = nRays / (timer->getMilliseconds() * (Float) 1000);
+					Log(EInfo, "-> %.3f MRays/s", mrays);
+					Log(EInfo, "");
+					best = std::max(best, mrays);
+				}
+				Log(EInfo, "Best of three: %.3f MRays/s", best);
+				performance[k] = best;
+			} else {
+				Float intersectionCost, traversalCost;
+				kdtree->findCosts(intersectionCost, traversalCost);
 			}
-			Log(EInfo, "Best of three: %.3f MRays/s", best);
-		} else {
-			Float intersectionCost, traversalCost;
-			kdtree->findCosts(intersectionCost, traversalCost);
+		}
+
+		if (accelerators.size() > 1 && !fitParameters) {
+			Log(EInfo, "");
+			Log(EInfo, "%-8s %14s %12s %12s", "accel", "build [ms]", "memory", "MRays/s");
+			for (size_t k=0; k<accelerators.size(); ++k)
+				Log(EInfo, "%-8s %14u %12s %12.3f",
+					ShapeKDTree::getAcceleratorName(accelerators[k]).c_str(),
+					buildTimes[k], memString(memoryUsage[k]).c_str(), performance[k]);
 		}
 
 		Thread::getThread()->getLogger()->setLogLevel(EInfo);
@@ -0,0 +1,227 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/core/kdtree.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class KNNBench : public Utility {
+public:
+	typedef PointKDTree<SimpleKDNode<Point, uint32_t> > Tree;
+	typedef PointKDTree<LeftBalancedKDNode<Point, uint32_t> > TreeLB;
+
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Point kd-tree benchmark. Compares sequential and parallel tree" << endl;
+		cout << "construction as well as individual and batched k-nearest-neighbor queries" << endl;
+		cout << "on a clustered random point set." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil knnbench [options]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of points (default: 10000000)" << endl << endl;
+		cout << "   -q count       Number of queries (default: 1000000)" << endl << endl;
+		cout << "   -k count       Number of neighbors per query (default: 16)" << endl << endl;
+		cout << "   -u             Issue the queries in random order instead of sorting" << endl;
+		cout << "                  them along a Morton curve" << endl << endl;
+	}
+
+	/// Spread the lower 10 bits of a value so that they occupy every third bit
+	static inline uint32_t spreadBits(uint32_t x) {
+		x = (x | (x << 16)) & 0x030000FF;
+		x = (x | (x <<  8)) & 0x0300F00F;
+		x = (x | (x <<  4)) & 0x030C30C3;
+		x = (x | (x <<  2)) & 0x09249249;
+		return x;
+	}
+
+	static inline uint32_t mortonCode(const Point &p) {
+		uint32_t x = (uint32_t) std::min(std::max(p.x * 1024.0f, 0.0f), 1023.0f),
+			y = (uint32_t) std::min(std::max(p.y * 1024.0f, 0.0f), 1023.0f),
+			z = (uint32_t) std::min(std::max(p.z * 1024.0f, 0.0f), 1023.0f);
+		return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+	}
+
+	/// Points concentrated around a few hundred random centers (similar to a photon map)
+	Point samplePoint(Random *random, const std::vector<Point> &centers) {
+		const Point &center = centers[random->nextUInt((uint32_t) centers.size())];
+		Point p = center + Vector(random->nextFloat() - 0.5f,
+			random->nextFloat() - 0.5f, random->nextFloat() - 0.5f) * 0.1f;
+		return Point(math::clamp(p.x, (Float) 0, (Float) 1),
+			math::clamp(p.y, (Float) 0, (Float) 1),
+			math::clamp(p.z, (Float) 0, (Float) 1));
+	}
+
+	template <typename TreeType> void fill(TreeType &tree, const std::vector<Point> &points) {
+		tree.clear();
+		tree.resize(points.size());
+		for (size_t i=0; i<points.size(); ++i) {
+			tree[i].setPosition(points[i]);
+			tree[i].setData((uint32_t) i);
+		}
+		tree.setAABB(AABB(Point(0.0f), Point(1.0f)));
+	}
+
+	template <typename TreeType> Float timeBuild(TreeType &tree, const std::vector<Point> &points,
+			bool parallel) {
+		fill(tree, points);
+		tree.setParallelBuild(parallel);
+		ref<Timer> timer = new Timer();
+		tree.build();
+		return timer->getMilliseconds() / 1000.0f;
+	}
+
+	/// Compare the distances of two (unsorted) k-nn query results
+	template <typename ResultType> static bool sameResults(ResultType *a, size_t countA,
+			ResultType *b, size_t countB) {
+		if (countA != countB)
+			return false;
+		std::vector<Float> distA(countA), distB(countB);
+		for (size_t i=0; i<countA; ++i) {
+			distA[i] = a[i].distSquared;
+			distB[i] = b[i].distSquared;
+		}
+		std::sort(distA.begin(), distA.end());
+		std::sort(distB.begin(), distB.end());
+		return distA == distB;
+	}
+
+	template <typename TreeType> void benchmarkQueries(const TreeType &tree,
+			const std::vector<Point> &queries, size_t k) {
+		typedef typename TreeType::SearchResult SearchResult;
+		const size_t queryCount = queries.size();
+		std::vector<SearchResult> results(queryCount * (k+1)), batchResults(queryCount * (k+1));
+		std::vector<size_t> counts(queryCount), batchCounts(queryCount);
+		std::vector<Float> radii(queryCount, std::numeric_limits<Float>::infinity());
+
+		ref<Timer> timer = new Timer();
+		for (size_t i=0; i<queryCount; ++i)
+			counts[i] = tree.nnSearch(queries[i], k, &results[i * (k+1)]);
+		Float scalarTime = timer->lap();
+
+		tree.nnSearchBatch(&queries[0], queryCount, &radii[0], k,
+			&batchResults[0], &batchCounts[0]);
+		Float batchTime = timer->lap();
+
+		size_t mismatches = 0;
+		for (size_t i=0; i<queryCount; ++i) {
+			if (!sameResults(&results[i * (k+1)], counts[i],
+					&batchResults[i * (k+1)], batchCounts[i]))
+				++mismatches;
+		}
+
+		Log(EInfo, "  Queries: individual %.3f M/s, batched %.3f M/s (%.2fx), "
+			SIZE_T_FMT " mismatches", queryCount / (scalarTime * 1e6f),
+			queryCount / (batchTime * 1e6f), scalarTime / batchTime, mismatches);
+	}
+
+	int run(int argc, char **argv) {
+		int optchar;
+		char *end_ptr = NULL;
+		size_t pointCount = 10000000, queryCount = 1000000, k = 16;
+		bool sortQueries = true;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:q:k:uh")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n':
+					pointCount = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || pointCount == 0)
+						SLog(EError, "Could not parse the point count!");
+					break;
+				case 'q':
+					queryCount = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || queryCount == 0)
+						SLog(EError, "Could not parse the query count!");
+					break;
+				case 'k':
+					k = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || k == 0)
+						SLog(EError, "Could not parse the neighbor count!");
+					break;
+				case 'u':
+					sortQueries = false;
+					break;
+			};
+		}
+
+		ref<Random> random = new Random();
+		std::vector<Point> centers(256);
+		for (size_t i=0; i<centers.size(); ++i)
+			centers[i] = Point(random->nextFloat(), random->nextFloat(), random->nextFloat());
+
+		std::vector<Point> points(pointCount), queries(queryCount);
+		for (size_t i=0; i<pointCount; ++i)
+			points[i] = samplePoint(random, centers);
+		for (size_t i=0; i<queryCount; ++i)
+			queries[i] = samplePoint(random, centers);
+
+		if (sortQueries) {
+			std::vector<std::pair<uint32_t, Point> > keys(queryCount);
+			for (size_t i=0; i<queryCount; ++i)
+				keys[i] = std::make_pair(mortonCode(queries[i]), queries[i]);
+			std::sort(keys.begin(), keys.end(),
+				[](const std::pair<uint32_t, Point> &a, const std::pair<uint32_t, Point> &b) {
+					return a.first < b.first;
+				});
+			for (size_t i=0; i<queryCount; ++i)
+				queries[i] = keys[i].second;
+		}
+
+		Log(EInfo, SIZE_T_FMT " points, " SIZE_T_FMT " %s queries, k=" SIZE_T_FMT ", %i cores",
+			pointCount, queryCount, sortQueries ? "Morton-sorted" : "unsorted", k, getCoreCount());
+
+		const char *heuristics[] = { "balanced", "left-balanced", "sliding midpoint" };
+		for (int h=0; h<3; ++h) {
+			Tree tree(0, (Tree::EHeuristic) h);
+			Float sequential = timeBuild(tree, points, false);
+			Float parallel = timeBuild(tree, points, true);
+			Log(EInfo, "Heuristic \"%s\": build %.3f s sequential, %.3f s parallel (%.2fx), depth "
+				SIZE_T_FMT, heuristics[h], sequential, parallel, sequential / parallel, tree.getDepth());
+			benchmarkQueries(tree, queries, k);
+		}
+
+		TreeLB treeLB(0, TreeLB::ELeftBalanced);
+		Float sequential = timeBuild(treeLB, points, false);
+		Float parallel = timeBuild(treeLB, points, true);
+		Log(EInfo, "Left-balanced layout: build %.3f s sequential, %.3f s parallel (%.2fx), depth "
+			SIZE_T_FMT, sequential, parallel, sequential / parallel, treeLB.getDepth());
+		benchmarkQueries(treeLB, queries, k);
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(KNNBench, "Point kd-tree construction and k-nn query benchmark")
+MTS_NAMESPACE_END
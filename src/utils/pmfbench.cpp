@@ -0,0 +1,137 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/core/pmf.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class PMFBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Discrete distribution benchmark. Compares the per-sample cost of" << endl;
+		cout << "CDF inversion (DiscreteDistribution) against the alias method" << endl;
+		cout << "(AliasDistribution) for distributions with 1K, 1M and 100M entries." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil pmfbench [options]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -n count       Number of samples per distribution (default: 10000000)" << endl << endl;
+		cout << "   -m size        Skip distributions with more than 'size' entries" << endl << endl;
+	}
+
+	/// Fill a distribution with heavy-tailed weights (similar to triangle areas)
+	template <typename Distribution> void fill(Distribution &distr, size_t size) {
+		ref<Random> random = new Random();
+		distr.reserve(size);
+		for (size_t i=0; i<size; ++i) {
+			Float value = random->nextFloat();
+			distr.append(value * value * value);
+		}
+	}
+
+	template <typename Distribution> void benchmark(const std::string &name,
+			size_t size, const std::vector<Float> &samples) {
+		Distribution distr;
+		fill(distr, size);
+
+		ref<Timer> timer = new Timer();
+		distr.normalize();
+		Float buildTime = timer->lap();
+
+		/* Accumulate the results so that the loops cannot be optimized away */
+		size_t checksum = 0;
+		timer->reset();
+		for (size_t i=0; i<samples.size(); ++i)
+			checksum += distr.sample(samples[i]);
+		Float sampleTime = timer->lap();
+
+		Float pdfSum = 0;
+		timer->reset();
+		for (size_t i=0; i<samples.size(); ++i) {
+			Float sample = samples[i], pdf;
+			checksum += distr.sampleReuse(sample, pdf);
+			pdfSum += pdf + sample;
+		}
+		Float reuseTime = timer->lap();
+
+		Log(EInfo, "  %-20s build %8.2f ms, sample() %6.2f ns, sampleReuse() %6.2f ns  (checksum "
+			SIZE_T_FMT ", %f)", name.c_str(), buildTime * 1e3f,
+			sampleTime * 1e9f / samples.size(), reuseTime * 1e9f / samples.size(),
+			checksum, pdfSum);
+	}
+
+	int run(int argc, char **argv) {
+		int optchar;
+		char *end_ptr = NULL;
+		size_t count = 10000000, maxSize = 100000000;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "n:m:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'n':
+					count = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || count == 0)
+						SLog(EError, "Could not parse the sample count!");
+					break;
+				case 'm':
+					maxSize = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0')
+						SLog(EError, "Could not parse the maximum distribution size!");
+					break;
+			};
+		}
+
+		std::vector<Float> samples(count);
+		ref<Random> random = new Random();
+		for (size_t i=0; i<count; ++i)
+			samples[i] = random->nextFloat();
+
+		const size_t sizes[] = { 1000, 1000000, 100000000 };
+		Log(EInfo, "Drawing " SIZE_T_FMT " samples per distribution", count);
+		for (size_t i=0; i<sizeof(sizes) / sizeof(sizes[0]); ++i) {
+			if (sizes[i] > maxSize)
+				continue;
+			Log(EInfo, SIZE_T_FMT " entries:", sizes[i]);
+			/* The distributions are destroyed right away to limit the memory usage */
+			benchmark<DiscreteDistribution>("DiscreteDistribution", sizes[i], samples);
+			benchmark<AliasDistribution>("AliasDistribution", sizes[i], samples);
+		}
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(PMFBench, "Discrete distribution sampling benchmark")
+MTS_NAMESPACE_END
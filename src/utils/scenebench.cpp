@@ -0,0 +1,537 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/scene.h>
+#include <mitsuba/render/renderjob.h>
+#include <mitsuba/render/renderqueue.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/version.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/filesystem.h>
+#include <mitsuba/core/warp.h>
+#include <fstream>
+#include <map>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class SceneBench : public Utility {
+public:
+	/// One measurement
+	struct Result {
+		std::string scene, test, name;
+		size_t count;
+		Float time;
+
+		inline Float getRate() const { return time > 0 ? count / time : 0; }
+	};
+
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Scene-level rendering benchmark. Measures the operations that" << endl;
+		cout << "dominate rendering time on a fixed set of scenes, using a fixed random seed:" << endl;
+		cout << "   build      Construction of the scene's acceleration data structure" << endl;
+		cout << "   primary    Coherent camera rays, traced in 16x16 pixel tiles" << endl;
+		cout << "   secondary  Incoherent rays leaving the primary hits (cosine-weighted)" << endl;
+		cout << "   shadow     Shadow rays from the primary hits to sampled emitter positions" << endl;
+		cout << "   bsdf       BSDF sampling and evaluation at the primary hits, per plugin" << endl;
+		cout << "   texture    Texture lookups at the primary hits: every top-level texture," << endl;
+		cout << "              and the diffuse reflectance of every BSDF" << endl;
+		cout << "   render     End-to-end rendering throughput (samples per second), for the" << endl;
+		cout << "              scene's integrator or for every integrator given with -i" << endl;
+		cout << "All but the last test run on a single thread and report the best of several" << endl;
+		cout << "repetitions. The results are written as CSV or JSON, so that they can be" << endl;
+		cout << "compared between builds." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil scenebench [options] <One or more scene XML files>" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -l file        Read additional scene file names from \"file\" (one per line)" << endl << endl;
+		cout << "   -t tests       Comma-separated list of tests to run (default: all)" << endl << endl;
+		cout << "   -n count       Number of rays or lookups per test (default: 1000000)" << endl << endl;
+		cout << "   -r count       Number of repetitions of the single-threaded tests (default: 3)" << endl << endl;
+		cout << "   -s seed        Random seed (default: 1)" << endl << endl;
+		cout << "   -e spp         Samples per pixel of the render test (default: that of the scene)" << endl << endl;
+		cout << "   -i names       Comma-separated list of integrator plugins for the render test" << endl << endl;
+		cout << "   -f format      Output format: csv or json (default: csv)" << endl << endl;
+		cout << "   -o file        Write the results to \"file\" instead of the console" << endl << endl;
+		cout << "Examples:" << endl;
+		cout << "  $ mtsutil scenebench -f json -o results.json -i path,volpath scene1.xml scene2.xml" << endl << endl;
+	}
+
+	int run(int argc, char **argv) {
+		ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
+		int optchar;
+		char *end_ptr = NULL;
+		std::vector<std::string> sceneFiles, tests, integrators;
+		std::string format = "csv", outputFile;
+		size_t count = 1000000;
+		int repetitions = 3, spp = -1;
+		uint64_t seed = 1;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "l:t:n:r:s:e:i:f:o:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'l': {
+						std::ifstream is(optarg);
+						if (is.fail())
+							Log(EError, "Could not open the scene list \"%s\"!", optarg);
+						std::string line;
+						while (std::getline(is, line)) {
+							line = trim(line);
+							if (!line.empty() && line[0] != '#')
+								sceneFiles.push_back(line);
+						}
+					}
+					break;
+				case 't':
+					tests = tokenize(optarg, ",");
+					break;
+				case 'n':
+					count = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || count == 0)
+						SLog(EError, "Could not parse the ray count!");
+					break;
+				case 'r':
+					repetitions = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || repetitions <= 0)
+						SLog(EError, "Could not parse the repetition count!");
+					break;
+				case 's':
+					seed = (uint64_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0')
+						SLog(EError, "Could not parse the random seed!");
+					break;
+				case 'e':
+					spp = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || spp <= 0)
+						SLog(EError, "Could not parse the sample count!");
+					break;
+				case 'i':
+					integrators = tokenize(optarg, ",");
+					break;
+				case 'f':
+					format = to_lower_copy(std::string(optarg));
+					if (format != "csv" && format != "json")
+						SLog(EError, "Unknown output format \"%s\"!", optarg);
+					break;
+				case 'o':
+					outputFile = optarg;
+					break;
+			};
+		}
+
+		for (int i=optind; i<argc; ++i)
+			sceneFiles.push_back(argv[i]);
+
+		if (sceneFiles.empty()) {
+			help();
+			return 0;
+		}
+
+		const char *testNames[] = { "build", "primary", "secondary", "shadow", "bsdf", "texture", "render" };
+		if (tests.empty())
+			tests.assign(testNames, testNames + sizeof(testNames) / sizeof(testNames[0]));
+		for (size_t i=0; i<tests.size(); ++i) {
+			if (std::find(testNames, testNames + sizeof(testNames) / sizeof(testNames[0]),
+					tests[i]) == testNames + sizeof(testNames) / sizeof(testNames[0]))
+				Log(EError, "Unknown test \"%s\"!", tests[i].c_str());
+		}
+
+		m_count = count;
+		m_repetitions = repetitions;
+		m_seed = seed;
+		m_checksum = 0;
+		m_results.clear();
+
+		for (size_t i=0; i<sceneFiles.size(); ++i) {
+			fs::path filename = fs::decode_pathstr(fileResolver->resolve(fs::pathstr(sceneFiles[i])));
+			ref<FileResolver> frClone = fileResolver->clone();
+			frClone->prependPath(fs::encode_pathstr(fs::absolute(filename).parent_path()));
+			Thread::getThread()->setFileResolver(frClone);
+
+			Log(EInfo, "Benchmarking \"%s\" ..", sceneFiles[i].c_str());
+			m_sceneName = filename.filename().string();
+			ref<Scene> scene = loadScene(fs::encode_pathstr(filename));
+			scene->setSourceFile(fs::encode_pathstr(filename));
+
+			ref<Timer> timer = new Timer();
+			scene->initialize();
+			if (hasTest(tests, "build"))
+				addResult("build", ShapeKDTree::getAcceleratorName(scene->getKDTree()->getAccelerator()),
+					scene->getKDTree()->getPrimitiveCount(), timer->getSeconds());
+
+			benchmarkRays(scene, tests);
+			if (hasTest(tests, "render"))
+				benchmarkRender(scene, spp, integrators);
+
+			Thread::getThread()->setFileResolver(fileResolver);
+		}
+
+		std::ostringstream oss;
+		if (format == "json")
+			writeJSON(oss);
+		else
+			writeCSV(oss);
+
+		if (outputFile.empty()) {
+			cout << oss.str();
+		} else {
+			ref<FileStream> fs = new FileStream(fs::pathstr(outputFile), FileStream::ETruncWrite);
+			std::string str = oss.str();
+			fs->write(str.c_str(), str.length());
+			Log(EInfo, "Wrote " SIZE_T_FMT " results to \"%s\"", m_results.size(), outputFile.c_str());
+		}
+
+		return 0;
+	}
+
+	/// Trace the ray batches and evaluate the BSDFs and textures on a single thread
+	void benchmarkRays(Scene *scene, const std::vector<std::string> &tests) {
+		const Sensor *sensor = scene->getSensor();
+		const Film *film = sensor->getFilm();
+		const Vector2i size = film->getCropSize();
+		const Point2i offset = film->getCropOffset();
+		const int tileSize = 16;
+		ref<Random> random = new Random(m_seed);
+
+		/* Generate the primary rays in tile order */
+		std::vector<Ray> primary;
+		primary.reserve(m_count);
+		while (primary.size() < m_count) {
+			for (int ty=0; ty<size.y && primary.size() < m_count; ty += tileSize) {
+				for (int tx=0; tx<size.x && primary.size() < m_count; tx += tileSize) {
+					for (int y=ty; y<std::min(ty + tileSize, size.y); ++y) {
+						for (int x=tx; x<std::min(tx + tileSize, size.x); ++x) {
+							Point2 samplePos(offset.x + x + random->nextFloat(),
+								offset.y + y + random->nextFloat());
+							Point2 apertureSample(random->nextFloat(), random->nextFloat());
+							Ray ray;
+							sensor->sampleRay(ray, samplePos, apertureSample, random->nextFloat());
+							primary.push_back(ray);
+						}
+					}
+				}
+			}
+			if (primary.empty())
+				Log(EError, "The sensor has an empty crop window!");
+		}
+		primary.resize(m_count);
+
+		/* Keep the hits of a subset of the primary rays as lookup locations */
+		const size_t maxHits = 65536, stride = (m_count + maxHits - 1) / maxHits;
+		std::vector<Intersection> hits;
+		for (size_t i=0; i<primary.size(); i += stride) {
+			Intersection its;
+			if (scene->rayIntersect(primary[i], its))
+				hits.push_back(its);
+		}
+		Log(EInfo, "  " SIZE_T_FMT " of " SIZE_T_FMT " sampled primary rays hit the scene",
+			hits.size(), (primary.size() + stride - 1) / stride);
+
+		if (hasTest(tests, "primary")) {
+			addResult("primary", "rays", primary.size(), bestOf([&]() {
+				size_t nHits = 0;
+				for (size_t i=0; i<primary.size(); ++i) {
+					Intersection its;
+					nHits += scene->rayIntersect(primary[i], its) ? 1 : 0;
+				}
+				return nHits;
+			}));
+		}
+
+		if (hits.empty())
+			return;
+
+		if (hasTest(tests, "secondary")) {
+			std::vector<Ray> secondary(m_count);
+			for (size_t i=0; i<m_count; ++i) {
+				const Intersection &its = hits[random->nextSize(hits.size())];
+				Vector d = warp::squareToCosineHemisphere(Point2(random->nextFloat(), random->nextFloat()));
+				if (dot(its.geoFrame.n, its.shFrame.n) < 0)
+					d.z = -d.z;
+				secondary[i] = Ray(its.p, its.shFrame.toWorld(d), its.time);
+			}
+			addResult("secondary", "rays", secondary.size(), bestOf([&]() {
+				size_t nHits = 0;
+				for (size_t i=0; i<secondary.size(); ++i) {
+					Intersection its;
+					nHits += scene->rayIntersect(secondary[i], its) ? 1 : 0;
+				}
+				return nHits;
+			}));
+		}
+
+		if (hasTest(tests, "shadow") && !scene->getEmitters().empty()) {
+			std::vector<Ray> shadow;
+			shadow.reserve(m_count);
+			for (size_t i=0; i<m_count; ++i) {
+				const Intersection &its = hits[random->nextSize(hits.size())];
+				DirectSamplingRecord dRec(its);
+				Point2 sample(random->nextFloat(), random->nextFloat());
+				if (scene->sampleEmitterDirect(dRec, sample, false).isZero())
+					continue;
+				shadow.push_back(Ray(its.p, dRec.d, Epsilon,
+					dRec.dist * (1 - ShadowEpsilon), its.time));
+			}
+			addResult("shadow", "rays", shadow.size(), bestOf([&]() {
+				size_t nOccluded = 0;
+				for (size_t i=0; i<shadow.size(); ++i)
+					nOccluded += scene->rayIntersect(shadow[i]) ? 1 : 0;
+				return nOccluded;
+			}));
+		}
+
+		const bool bsdfTest = hasTest(tests, "bsdf"), textureTest = hasTest(tests, "texture");
+		if (!bsdfTest && !textureTest)
+			return;
+
+		/* Group the primary hits by BSDF */
+		std::map<const BSDF *, std::vector<size_t> > hitsByBSDF;
+		for (size_t i=0; i<hits.size(); ++i) {
+			if (hits[i].getBSDF())
+				hitsByBSDF[hits[i].getBSDF()].push_back(i);
+		}
+
+		/* Sort the BSDFs by name to keep the output order stable */
+		std::vector<std::pair<std::string, const BSDF *> > bsdfs;
+		for (std::map<const BSDF *, std::vector<size_t> >::const_iterator it = hitsByBSDF.begin();
+				it != hitsByBSDF.end(); ++it)
+			bsdfs.push_back(std::make_pair(getObjectName(it->first), it->first));
+		std::sort(bsdfs.begin(), bsdfs.end());
+
+		Properties samplerProps("independent");
+		samplerProps.setLong("seed", (int64_t) m_seed);
+		ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+				createObject(MTS_CLASS(Sampler), samplerProps));
+		sampler->configure();
+
+		for (size_t k=0; k<bsdfs.size(); ++k) {
+			const BSDF *bsdf = bsdfs[k].second;
+			const std::vector<size_t> &indices = hitsByBSDF[bsdf];
+			const std::string &name = bsdfs[k].first;
+
+			/* Precompute the lookup locations, directions and samples */
+			std::vector<size_t> its(m_count);
+			std::vector<Vector> wo(m_count);
+			std::vector<Point2> samples(m_count);
+			for (size_t i=0; i<m_count; ++i) {
+				its[i] = indices[random->nextSize(indices.size())];
+				wo[i] = warp::squareToUniformSphere(Point2(random->nextFloat(), random->nextFloat()));
+				samples[i] = Point2(random->nextFloat(), random->nextFloat());
+			}
+
+			if (bsdfTest) {
+				addResult("bsdf-sample", name, m_count, bestOf([&]() {
+					size_t nValid = 0;
+					for (size_t i=0; i<m_count; ++i) {
+						BSDFSamplingRecord bRec(hits[its[i]], sampler);
+						nValid += bsdf->sample(bRec, samples[i]).isZero() ? 0 : 1;
+					}
+					return nValid;
+				}));
+				addResult("bsdf-eval", name, m_count, bestOf([&]() {
+					size_t nValid = 0;
+					for (size_t i=0; i<m_count; ++i) {
+						const Intersection &isect = hits[its[i]];
+						BSDFSamplingRecord bRec(isect, isect.wi, wo[i]);
+						nValid += bsdf->eval(bRec).isZero() ? 0 : 1;
+					}
+					return nValid;
+				}));
+			}
+
+			if (textureTest) {
+				addResult("texture", name + ".reflectance", m_count, bestOf([&]() {
+					size_t nValid = 0;
+					for (size_t i=0; i<m_count; ++i)
+						nValid += bsdf->getDiffuseReflectance(hits[its[i]]).isZero() ? 0 : 1;
+					return nValid;
+				}));
+			}
+		}
+
+		if (textureTest) {
+			const ref_vector<ConfigurableObject> &objects = scene->getReferencedObjects();
+			for (size_t k=0; k<objects.size(); ++k) {
+				if (!objects[k]->getClass()->derivesFrom(MTS_CLASS(Texture)))
+					continue;
+				const Texture *texture = static_cast<const Texture *>(objects[k].get());
+				std::vector<size_t> its(m_count);
+				for (size_t i=0; i<m_count; ++i)
+					its[i] = random->nextSize(hits.size());
+				addResult("texture", getObjectName(texture), m_count, bestOf([&]() {
+					size_t nValid = 0;
+					for (size_t i=0; i<m_count; ++i)
+						nValid += texture->eval(hits[its[i]]).isZero() ? 0 : 1;
+					return nValid;
+				}));
+			}
+		}
+	}
+
+	/// Render the scene with all processors and report the samples per second
+	void benchmarkRender(Scene *scene, int spp, const std::vector<std::string> &integrators) {
+		Properties samplerProps(scene->getSampler()->getProperties());
+		if (spp > 0)
+			samplerProps.setInteger("sampleCount", spp, false);
+
+		std::vector<ref<Integrator> > candidates;
+		if (integrators.empty()) {
+			candidates.push_back(scene->getIntegrator());
+		} else {
+			for (size_t i=0; i<integrators.size(); ++i) {
+				ref<Integrator> integrator = static_cast<Integrator *> (PluginManager::getInstance()->
+					createObject(MTS_CLASS(Integrator), Properties(integrators[i])));
+				integrator->configure();
+				candidates.push_back(integrator);
+			}
+		}
+
+		/* The rendered images are not of interest */
+		ref<Random> random = new Random();
+		fs::path tempDir = fs::temp_directory_path() / formatString("mtsbench-%08x",
+			(uint32_t) random->nextULong());
+		fs::create_directories(tempDir);
+		const Vector2i size = scene->getFilm()->getCropSize();
+
+		for (size_t i=0; i<candidates.size(); ++i) {
+			/* Every integrator requests its own sample arrays */
+			ref<Sampler> sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+					createObject(MTS_CLASS(Sampler), samplerProps));
+			sampler->configure();
+
+			ref<Scene> copy = new Scene(scene);
+			copy->setIntegrator(candidates[i]);
+			copy->setSampler(sampler);
+			copy->setDestinationFile(fs::encode_pathstr(tempDir / "image"));
+			candidates[i]->configureSampler(copy, sampler);
+
+			ref<RenderQueue> queue = new RenderQueue();
+			ref<RenderJob> job = new RenderJob("bench", copy, queue);
+			ref<Timer> timer = new Timer();
+			job->start();
+			queue->waitLeft(0);
+			Float time = timer->getSeconds();
+			queue->join();
+
+			std::string name = integrators.empty() ? getObjectName(candidates[i]) : integrators[i];
+			addResult("render", name, (size_t) size.x * size.y * sampler->getSampleCount(), time);
+		}
+
+		fs::remove_all(tempDir);
+	}
+
+	/// Run a single-threaded measurement several times and return the best time
+	template <typename Functor> Float bestOf(const Functor &functor) {
+		Float best = std::numeric_limits<Float>::infinity();
+		for (int i=0; i<m_repetitions; ++i) {
+			ref<Timer> timer = new Timer();
+			m_checksum += functor();
+			best = std::min(best, timer->getSeconds());
+		}
+		return best;
+	}
+
+	void addResult(const std::string &test, const std::string &name, size_t count, Float time) {
+		Result result;
+		result.scene = m_sceneName;
+		result.test = test;
+		result.name = name;
+		result.count = count;
+		result.time = time;
+		m_results.push_back(result);
+		Log(EInfo, "  %-12s %-28s %12.3f M/s", test.c_str(), name.c_str(), result.getRate() * 1e-6f);
+	}
+
+	/// Name of a plugin instance, including its ID when one was given in the scene
+	static std::string getObjectName(const ConfigurableObject *object) {
+		std::string name = object->getClass()->getName();
+		const std::string &id = object->getID();
+		if (!id.empty() && id != "unnamed")
+			name += "[" + id + "]";
+		return name;
+	}
+
+	static bool hasTest(const std::vector<std::string> &tests, const std::string &name) {
+		return std::find(tests.begin(), tests.end(), name) != tests.end();
+	}
+
+	static std::string escapeJSON(const std::string &str) {
+		std::string result;
+		for (size_t i=0; i<str.length(); ++i) {
+			if (str[i] == '"' || str[i] == '\\')
+				result += '\\';
+			result += str[i];
+		}
+		return result;
+	}
+
+	void writeCSV(std::ostream &os) const {
+		os << "scene,test,name,count,time_ms,rate_per_s" << endl;
+		for (size_t i=0; i<m_results.size(); ++i) {
+			const Result &r = m_results[i];
+			os << '"' << r.scene << "\"," << r.test << ",\"" << r.name << "\","
+			   << r.count << "," << r.time * 1000 << "," << r.getRate() << endl;
+		}
+	}
+
+	void writeJSON(std::ostream &os) const {
+		os << "{" << endl
+		   << "  \"version\": \"" << Version(MTS_VERSION).toStringComplete() << "\"," << endl
+		   << "  \"host\": \"" << escapeJSON(getHostName()) << "\"," << endl
+		   << "  \"cores\": " << getCoreCount() << "," << endl
+		   << "  \"seed\": " << m_seed << "," << endl
+		   << "  \"repetitions\": " << m_repetitions << "," << endl
+		   << "  \"results\": [";
+		for (size_t i=0; i<m_results.size(); ++i) {
+			const Result &r = m_results[i];
+			os << (i > 0 ? "," : "") << endl
+			   << "    {\"scene\": \"" << escapeJSON(r.scene) << "\", \"test\": \"" << r.test
+			   << "\", \"name\": \"" << escapeJSON(r.name) << "\", \"count\": " << r.count
+			   << ", \"time_ms\": " << r.time * 1000 << ", \"rate_per_s\": " << r.getRate() << "}";
+		}
+		os << endl << "  ]" << endl << "}" << endl;
+	}
+
+	MTS_DECLARE_UTILITY()
+private:
+	std::vector<Result> m_results;
+	std::string m_sceneName;
+	size_t m_count;
+	int m_repetitions;
+	uint64_t m_seed;
+	size_t m_checksum;
+};
+
+MTS_EXPORT_UTILITY(SceneBench, "Scene-level rendering benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,277 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/sparsevol.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/timer.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class SparseVol : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Converts a dense volume in the format of the 'gridvolume' plugin" << endl;
+		cout << "into a sparse brick-based volume that can be loaded using the 'sparsevolume'" << endl;
+		cout << "plugin. Only bricks containing nonzero values are stored." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil sparsevol [options] <input .vol file> <output file>" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -b size        Number of cells per brick along each axis. Must be a power" << endl;
+		cout << "                  of two (default: 8)" << endl << endl;
+		cout << "   -q             Quantize the samples to 8 bits using a per-brick range" << endl << endl;
+		cout << "   -e threshold   Treat bricks whose values all lie below the threshold as" << endl;
+		cout << "                  empty (default: 0)" << endl << endl;
+	}
+
+	/// Return a sample of the dense volume (zero outside of its bounds)
+	inline float fetch(int x, int y, int z, int c) const {
+		if (x >= m_res.x || y >= m_res.y || z >= m_res.z)
+			return 0.0f;
+		size_t idx = (((size_t) z * m_res.y + y) * m_res.x + x) * m_channels + c;
+		if (m_uint8)
+			return ((const uint8_t *) m_data)[idx] * (1.0f / 255.0f);
+		else
+			return ((const float *) m_data)[idx];
+	}
+
+	/// Copy the samples of a brick into \c target
+	void gatherBrick(int bx, int by, int bz, float *target) const {
+		for (int z=0; z<=m_brickSize; ++z)
+			for (int y=0; y<=m_brickSize; ++y)
+				for (int x=0; x<=m_brickSize; ++x)
+					for (int c=0; c<m_channels; ++c)
+						*target++ = fetch(bx*m_brickSize + x, by*m_brickSize + y,
+							bz*m_brickSize + z, c);
+	}
+
+	int run(int argc, char **argv) {
+		int optchar;
+		char *end_ptr = NULL;
+		bool quantize = false;
+		Float threshold = 0;
+		m_brickSize = 8;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "b:qe:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'b':
+					m_brickSize = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || m_brickSize < 2 || (m_brickSize & (m_brickSize-1)) != 0)
+						SLog(EError, "The brick size must be a power of two!");
+					break;
+				case 'q':
+					quantize = true;
+					break;
+				case 'e':
+					threshold = (Float) strtod(optarg, &end_ptr);
+					if (*end_ptr != '\0' || threshold < 0)
+						SLog(EError, "Could not parse the threshold!");
+					break;
+			};
+		}
+
+		if (argc - optind != 2) {
+			help();
+			return 0;
+		}
+
+		ref<Timer> timer = new Timer();
+		fs::pathstr inputFile(argv[optind]), outputFile(argv[optind+1]);
+		ref<MemoryMappedFile> mmap = new MemoryMappedFile(inputFile);
+		const uint8_t *input = (const uint8_t *) mmap->getData();
+		if (mmap->getSize() < 48 || input[0] != 'V' || input[1] != 'O' || input[2] != 'L' || input[3] != 3)
+			Log(EError, "\"%s\": not a dense volume file (version 3)", inputFile.s.c_str());
+
+		int32_t encoding, res[3], channels;
+		float aabb[6];
+		memcpy(&encoding, input + 4, sizeof(int32_t));
+		memcpy(res, input + 8, 3 * sizeof(int32_t));
+		memcpy(&channels, input + 20, sizeof(int32_t));
+		memcpy(aabb, input + 24, 6 * sizeof(float));
+		if (encoding != 1 && encoding != 3)
+			Log(EError, "\"%s\": only float32 and uint8 volumes are supported", inputFile.s.c_str());
+		if (channels != 1 && channels != 3)
+			Log(EError, "\"%s\": only volumes with 1 or 3 channels are supported", inputFile.s.c_str());
+		if (res[0] < 2 || res[1] < 2 || res[2] < 2)
+			Log(EError, "\"%s\": invalid resolution", inputFile.s.c_str());
+
+		m_res = Vector3i(res[0], res[1], res[2]);
+		m_channels = channels;
+		m_uint8 = encoding == 3;
+		m_data = input + 48;
+		size_t inputSize = (size_t) res[0] * res[1] * res[2] * channels * (m_uint8 ? 1 : 4);
+		if (mmap->getSize() < 48 + inputSize)
+			Log(EError, "\"%s\": the file is truncated!", inputFile.s.c_str());
+
+		SparseVolumeHeader header;
+		memset(&header, 0, sizeof(SparseVolumeHeader));
+		memcpy(header.magic, "SVOL", 4);
+		header.version = MTS_SPARSEVOL_VERSION;
+		header.channels = (uint32_t) channels;
+		header.encoding = quantize ? SparseVolumeHeader::EUInt8 : SparseVolumeHeader::EFloat32;
+		for (int i=0; i<3; ++i) {
+			header.res[i] = res[i];
+			header.aabbMin[i] = aabb[i];
+			header.aabbMax[i] = aabb[i+3];
+		}
+		header.brickSize = (uint32_t) m_brickSize;
+
+		/* Pass 1: find the occupied bricks and their value ranges */
+		const int brickRes[3] = { header.getBrickRes(0), header.getBrickRes(1), header.getBrickRes(2) };
+		const size_t sampleCount = header.getBrickSampleCount() * channels;
+		std::vector<float> samples(sampleCount);
+		std::vector<uint32_t> index(header.getIndexSize(), MTS_SPARSEVOL_EMPTY);
+		std::vector<SparseVolumeBrick> bricks;
+		size_t brickIdx = 0;
+
+		for (int bz=0; bz<brickRes[2]; ++bz) {
+			for (int by=0; by<brickRes[1]; ++by) {
+				for (int bx=0; bx<brickRes[0]; ++bx) {
+					gatherBrick(bx, by, bz, &samples[0]);
+					SparseVolumeBrick brick;
+					memset(&brick, 0, sizeof(SparseVolumeBrick));
+					float minValue[3], maxValue[3];
+					bool empty = true;
+					for (int c=0; c<channels; ++c) {
+						minValue[c] = std::numeric_limits<float>::infinity();
+						maxValue[c] = -std::numeric_limits<float>::infinity();
+					}
+					for (size_t i=0; i<sampleCount; ++i) {
+						const int c = (int) (i % channels);
+						minValue[c] = std::min(minValue[c], samples[i]);
+						maxValue[c] = std::max(maxValue[c], samples[i]);
+						empty &= std::abs(samples[i]) <= threshold;
+					}
+
+					if (!empty) {
+						brick.maxValue = maxValue[0];
+						for (int c=0; c<channels; ++c) {
+							brick.offset[c] = minValue[c];
+							brick.scale[c] = (maxValue[c] - minValue[c]) / 255.0f;
+						}
+						index[brickIdx] = (uint32_t) bricks.size();
+						bricks.push_back(brick);
+					}
+					++brickIdx;
+				}
+			}
+		}
+		header.brickCount = (uint32_t) bricks.size();
+
+		/* Pass 2: write the header, index, brick records and brick data */
+		ref<FileStream> fs = new FileStream(outputFile, FileStream::ETruncReadWrite);
+		fs->setByteOrder(Stream::ELittleEndian);
+		writeHeader(fs, header);
+		pad(fs, header.getIndexOffset());
+		fs->writeUIntArray(&index[0], index.size());
+		pad(fs, header.getBrickOffset());
+		for (size_t i=0; i<bricks.size(); ++i) {
+			const SparseVolumeBrick &brick = bricks[i];
+			fs->writeSingle(brick.maxValue);
+			fs->writeSingleArray(brick.offset, 3);
+			fs->writeSingleArray(brick.scale, 3);
+			fs->writeUInt(brick.reserved);
+		}
+		pad(fs, header.getDataOffset());
+
+		const size_t brickDataSize = header.getBrickDataSize();
+		std::vector<uint8_t> quantized(sampleCount);
+		brickIdx = 0;
+		for (int bz=0; bz<brickRes[2]; ++bz) {
+			for (int by=0; by<brickRes[1]; ++by) {
+				for (int bx=0; bx<brickRes[0]; ++bx) {
+					uint32_t brick = index[brickIdx++];
+					if (brick == MTS_SPARSEVOL_EMPTY)
+						continue;
+					gatherBrick(bx, by, bz, &samples[0]);
+					size_t start = fs->getPos();
+					if (quantize) {
+						const SparseVolumeBrick &info = bricks[brick];
+						for (size_t i=0; i<sampleCount; ++i) {
+							const int c = (int) (i % channels);
+							float value = info.scale[c] == 0 ? 0.0f :
+								(samples[i] - info.offset[c]) / info.scale[c];
+							quantized[i] = (uint8_t) math::clamp(math::roundToInt(value), 0, 255);
+						}
+						fs->write(&quantized[0], sampleCount);
+					} else {
+						fs->writeSingleArray(&samples[0], sampleCount);
+					}
+					pad(fs, start + brickDataSize);
+				}
+			}
+		}
+
+		size_t outputSize = fs->getPos();
+		fs->close();
+
+		Log(EInfo, "Wrote \"%s\" in %i ms: %u of " SIZE_T_FMT " bricks occupied (%.1f%%), "
+			"%s -> %s (%.1fx smaller)", outputFile.s.c_str(), timer->getMilliseconds(),
+			header.brickCount, index.size(), 100.0f * header.brickCount / index.size(),
+			memString(48 + inputSize).c_str(), memString(outputSize).c_str(),
+			(48 + inputSize) / (Float) outputSize);
+
+		return 0;
+	}
+
+	/// Write the header field by field using the byte order of the stream
+	void writeHeader(Stream *stream, const SparseVolumeHeader &header) {
+		stream->write(header.magic, 4);
+		stream->writeUInt(header.version);
+		stream->writeUInt(header.channels);
+		stream->writeUInt(header.encoding);
+		stream->writeIntArray(header.res, 3);
+		stream->writeUInt(header.brickSize);
+		stream->writeSingleArray(header.aabbMin, 3);
+		stream->writeSingleArray(header.aabbMax, 3);
+		stream->writeUInt(header.brickCount);
+		stream->writeUInt(header.reserved);
+	}
+
+	/// Write zeros until the stream reaches the given position
+	void pad(FileStream *fs, size_t position) {
+		static const uint8_t zeros[MTS_SPARSEVOL_ALIGNMENT] = { 0 };
+		while (fs->getPos() < position)
+			fs->write(zeros, std::min(position - fs->getPos(), (size_t) MTS_SPARSEVOL_ALIGNMENT));
+	}
+
+	MTS_DECLARE_UTILITY()
+protected:
+	const uint8_t *m_data;
+	Vector3i m_res;
+	int m_channels, m_brickSize;
+	bool m_uint8;
+};
+
+MTS_EXPORT_UTILITY(SparseVol, "Convert a dense volume into a sparse brick volume")
+MTS_NAMESPACE_END
@@ -0,0 +1,187 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/splattiles.h>
+#include <mitsuba/core/workerpool.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/plugin.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class SplatBench : public Utility {
+public:
+	enum EMode {
+		EAtomic = 0,
+		ETiles,
+		EPrivate,
+		EModeCount
+	};
+
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Splatting performance benchmark. Compares the accumulation modes" << endl;
+		cout << "available to splatting integrators (MLT, ERPT, BDPT light paths) for an" << endl;
+		cout << "increasing number of threads:" << endl;
+		cout << "   atomic   All threads splat into one image block with atomic updates" << endl;
+		cout << "   tiles    Per-thread sparse tiles, merged lock-free (SplatTiles)" << endl;
+		cout << "   private  One full-resolution image block per thread" << endl;
+		cout << endl;
+		cout << "Usage: mtsutil splatbench [options]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -r resolution  Image resolution (default: 1024)" << endl << endl;
+		cout << "   -n count       Splats per thread (default: 2000000)" << endl << endl;
+		cout << "   -c fraction    Fraction of splats landing in a small, caustic-like" << endl;
+		cout << "                  hot spot of 8x8 pixels (default: 0.5)" << endl << endl;
+		cout << "   -t tiles       Tiles per thread in tiles mode (default: 256)" << endl << endl;
+		cout << "   -p threads     Maximum number of threads (default: core count)" << endl << endl;
+	}
+
+	int run(int argc, char **argv) {
+		int optchar;
+		char *end_ptr = NULL;
+		int resolution = 1024, splatTiles = 256, maxThreads = getCoreCount();
+		size_t splatCount = 2000000;
+		Float hotFraction = 0.5f;
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "r:n:c:t:p:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'r':
+					resolution = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || resolution <= 0)
+						SLog(EError, "Could not parse the resolution!");
+					break;
+				case 'n':
+					splatCount = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0')
+						SLog(EError, "Could not parse the splat count!");
+					break;
+				case 'c':
+					hotFraction = (Float) strtod(optarg, &end_ptr);
+					if (*end_ptr != '\0')
+						SLog(EError, "Could not parse the hot spot fraction!");
+					break;
+				case 't':
+					splatTiles = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || splatTiles <= 0)
+						SLog(EError, "Could not parse the tile count!");
+					break;
+				case 'p':
+					maxThreads = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || maxThreads <= 0)
+						SLog(EError, "Could not parse the thread count!");
+					break;
+			};
+		}
+
+		ref<ReconstructionFilter> filter = static_cast<ReconstructionFilter *> (PluginManager::getInstance()->
+				createObject(MTS_CLASS(ReconstructionFilter), Properties("gaussian")));
+		filter->configure();
+
+		ref<WorkerPool> pool = new WorkerPool("splat", maxThreads);
+		const Vector2i size(resolution, resolution);
+		const char *modeNames[] = { "atomic", "tiles", "private" };
+
+		Log(EInfo, "Splatting " SIZE_T_FMT " samples per thread into %ix%i pixels, %.0f%% in a hot spot",
+			splatCount, resolution, resolution, hotFraction * 100);
+		Log(EInfo, "%8s %8s %12s %12s %12s", "threads", "mode", "MSplats/s", "merge [ms]", "memory");
+
+		for (int threads = 1; threads <= maxThreads; threads = (threads == maxThreads) ? threads + 1 : std::min(threads * 2, maxThreads)) {
+			for (int mode = 0; mode < EModeCount; ++mode) {
+				ref_vector<ImageBlock> blocks(threads);
+				ref<ImageBlock> shared;
+				ref<SplatTiles> tiles;
+				size_t memory = 0;
+
+				if (mode == EPrivate) {
+					for (int i = 0; i < threads; ++i) {
+						blocks[i] = new ImageBlock(Bitmap::ESpectrumAlpha, size, filter);
+						blocks[i]->clear();
+					}
+					memory = blocks[0]->getBitmap()->getBufferSize() * threads;
+				} else {
+					shared = new ImageBlock(Bitmap::ESpectrumAlpha, size, filter);
+					shared->clear();
+					memory = shared->getBitmap()->getBufferSize();
+					if (mode == ETiles) {
+						tiles = new SplatTiles(shared, threads, splatTiles);
+						memory += tiles->getMemoryUsage();
+					}
+					for (int i = 0; i < threads; ++i)
+						blocks[i] = tiles ? new ImageBlock(shared, tiles, i) : shared.get();
+				}
+
+				ref<Timer> timer = new Timer();
+				pool->run([&](int tid) {
+					ref<Random> random = new Random((uint64_t) tid + 1);
+					ImageBlock *block = blocks[tid];
+					const Point2 hotSpot(resolution * 0.5f, resolution * 0.5f);
+					for (size_t i = 0; i < splatCount; ++i) {
+						Point2 pos;
+						if (random->nextFloat() < hotFraction)
+							pos = hotSpot + Vector2(random->nextFloat(), random->nextFloat()) * 8.0f;
+						else
+							pos = Point2(random->nextFloat(), random->nextFloat()) * (Float) resolution;
+						Spectrum value(random->nextFloat());
+						if (mode == EPrivate)
+							block->put(pos, value, 1.0f);
+						else
+							block->putAtomic(pos, value, 1.0f);
+					}
+				}, threads);
+				Float splatTime = timer->lap();
+
+				/* Merge step performed at develop time */
+				if (tiles) {
+					tiles->flushAll();
+				} else if (mode == EPrivate) {
+					ref<ImageBlock> target = new ImageBlock(Bitmap::ESpectrumAlpha, size, filter);
+					target->clear();
+					for (int i = 0; i < threads; ++i)
+						target->put(blocks[i]);
+				}
+				Float mergeTime = timer->lap();
+
+				Log(EInfo, "%8i %8s %12.3f %12.3f %12s", threads, modeNames[mode],
+					threads * splatCount / (splatTime * 1e6f), mergeTime * 1000,
+					memString(memory).c_str());
+			}
+		}
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(SplatBench, "Splat accumulation benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,223 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/medium.h>
+#include <mitsuba/render/sampler.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/warp.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/filesystem.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#else
+#include <unistd.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class VolBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Woodcock tracking benchmark. Shoots random rays through a" << endl;
+		cout << "heterogeneous medium and compares the performance of distance sampling" << endl;
+		cout << "and transmittance estimation for different majorant grid resolutions." << endl;
+		cout << "Without a volume file, a synthetic cloud consisting of a thin medium with" << endl;
+		cout << "a few dense cores is used." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil volbench [options] [density .vol file]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -r resolution  Resolution of the synthetic volume (default: 128)" << endl << endl;
+		cout << "   -s scale       Density scale factor of the medium (default: 50)" << endl << endl;
+		cout << "   -n count       Number of rays (default: 1000000)" << endl << endl;
+		cout << "   -g list        Comma-separated list of majorant grid resolutions" << endl;
+		cout << "                  (default: 1,4,8,16,32)" << endl << endl;
+	}
+
+	/// Write a synthetic cloud in the gridvolume file format
+	void writeSyntheticVolume(const fs::pathstr &filename, int res) {
+		ref<FileStream> fs = new FileStream(filename, FileStream::ETruncReadWrite);
+		fs->setByteOrder(Stream::ELittleEndian);
+		fs->write("VOL", 3);
+		fs->writeUChar(3);
+		fs->writeInt(1); /* float32 */
+		fs->writeInt(res); fs->writeInt(res); fs->writeInt(res);
+		fs->writeInt(1);
+		fs->writeSingle(0); fs->writeSingle(0); fs->writeSingle(0);
+		fs->writeSingle(1); fs->writeSingle(1); fs->writeSingle(1);
+
+		const Point cores[] = {
+			Point(0.3f, 0.4f, 0.5f), Point(0.7f, 0.6f, 0.4f),
+			Point(0.5f, 0.3f, 0.7f), Point(0.45f, 0.75f, 0.3f)
+		};
+		std::vector<float> data((size_t) res * res);
+		for (int z=0; z<res; ++z) {
+			for (int y=0; y<res; ++y) {
+				for (int x=0; x<res; ++x) {
+					Point p(x / (Float) (res-1), y / (Float) (res-1), z / (Float) (res-1));
+					Float density = 0.01f * (1 + std::sin(12*p.x) * std::sin(9*p.y) * std::sin(7*p.z));
+					for (size_t i=0; i<sizeof(cores)/sizeof(cores[0]); ++i)
+						density += std::exp(-(p - cores[i]).lengthSquared() / (2*0.03f*0.03f));
+					data[(size_t) y*res + x] = (float) std::min(density, (Float) 1.0f);
+				}
+			}
+			fs->writeSingleArray(data.data(), data.size());
+		}
+	}
+
+	int run(int argc, char **argv) {
+		int optchar;
+		char *end_ptr = NULL;
+		int resolution = 128;
+		Float scale = 50;
+		size_t rayCount = 1000000;
+		std::vector<std::string> gridResolutions = tokenize("1,4,8,16,32", ",");
+		optind = 1;
+
+		/* Parse command-line arguments */
+		while ((optchar = getopt(argc, argv, "r:s:n:g:h")) != -1) {
+			switch (optchar) {
+				case 'h': {
+						help();
+						return 0;
+					}
+					break;
+				case 'r':
+					resolution = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || resolution < 2)
+						SLog(EError, "Could not parse the resolution!");
+					break;
+				case 's':
+					scale = (Float) strtod(optarg, &end_ptr);
+					if (*end_ptr != '\0' || scale <= 0)
+						SLog(EError, "Could not parse the density scale!");
+					break;
+				case 'n':
+					rayCount = (size_t) strtoll(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || rayCount == 0)
+						SLog(EError, "Could not parse the ray count!");
+					break;
+				case 'g':
+					gridResolutions = tokenize(optarg, ",");
+					break;
+			};
+		}
+
+		fs::path tempDir;
+		fs::pathstr filename;
+		if (optind < argc) {
+			filename = fs::pathstr(argv[optind]);
+		} else {
+			ref<Random> random = new Random();
+			tempDir = fs::temp_directory_path() / formatString("mtsvolbench-%08x",
+				(uint32_t) random->nextULong());
+			fs::create_directories(tempDir);
+			filename = fs::encode_pathstr(tempDir / "density.vol");
+			Log(EInfo, "Writing a synthetic %i^3 volume ..", resolution);
+			writeSyntheticVolume(filename, resolution);
+		}
+
+		PluginManager *pluginMgr = PluginManager::getInstance();
+		Properties albedoProps("constvolume");
+		albedoProps.setSpectrum("value", Spectrum(0.8f));
+		ref<VolumeDataSource> albedo = static_cast<VolumeDataSource *> (
+			pluginMgr->createObject(MTS_CLASS(VolumeDataSource), albedoProps));
+		albedo->configure();
+
+		Properties densityProps("gridvolume");
+		densityProps.setString("filename", filename.s);
+		ref<VolumeDataSource> density = static_cast<VolumeDataSource *> (
+			pluginMgr->createObject(MTS_CLASS(VolumeDataSource), densityProps));
+		density->configure();
+
+		/* Rays from random points on the bounding sphere towards random points in the volume */
+		const AABB aabb = density->getAABB();
+		const BSphere bsphere = aabb.getBSphere();
+		ref<Random> random = new Random();
+		std::vector<Ray> rays(rayCount);
+		for (size_t i=0; i<rayCount; ++i) {
+			Point o = bsphere.center + warp::squareToUniformSphere(
+				Point2(random->nextFloat(), random->nextFloat())) * bsphere.radius;
+			const Vector extents = aabb.getExtents();
+			Point target = aabb.min + Vector(random->nextFloat() * extents.x,
+				random->nextFloat() * extents.y, random->nextFloat() * extents.z);
+			rays[i] = Ray(o, normalize(target - o), 0);
+		}
+
+		Log(EInfo, "Tracing " SIZE_T_FMT " rays through a medium with density scale %g", rayCount, scale);
+		Log(EInfo, "%8s %14s %14s %10s %12s %20s", "grid", "sampling [M/s]",
+			"transm. [M/s]", "speedup", "P(scatter)", "avg. transmittance");
+
+		Float baseTime = 0;
+		for (size_t g=0; g<gridResolutions.size(); ++g) {
+			int gridRes = strtol(gridResolutions[g].c_str(), &end_ptr, 10);
+			if (*end_ptr != '\0' || gridRes < 1)
+				SLog(EError, "Could not parse the majorant grid resolution \"%s\"!",
+					gridResolutions[g].c_str());
+
+			Properties mediumProps("heterogeneous");
+			mediumProps.setFloat("scale", scale);
+			mediumProps.setInteger("majorantResolution", gridRes);
+			ref<Medium> medium = static_cast<Medium *> (
+				pluginMgr->createObject(MTS_CLASS(Medium), mediumProps));
+			medium->addChild("density", density);
+			medium->addChild("albedo", albedo);
+			medium->configure();
+
+			ref<Sampler> sampler = static_cast<Sampler *> (
+				pluginMgr->createObject(MTS_CLASS(Sampler), Properties("independent")));
+			sampler->configure();
+
+			ref<Timer> timer = new Timer();
+			size_t scattered = 0;
+			for (size_t i=0; i<rayCount; ++i) {
+				MediumSamplingRecord mRec;
+				if (medium->sampleDistance(rays[i], mRec, sampler))
+					++scattered;
+			}
+			Float samplingTime = timer->lap();
+
+			double transmittance = 0;
+			for (size_t i=0; i<rayCount; ++i)
+				transmittance += medium->evalTransmittance(rays[i], sampler)[0];
+			Float transmittanceTime = timer->lap();
+
+			if (g == 0)
+				baseTime = samplingTime + transmittanceTime;
+
+			Log(EInfo, "%8i %14.3f %14.3f %9.2fx %12.4f %20.4f", gridRes,
+				rayCount / (samplingTime * 1e6f), rayCount / (transmittanceTime * 1e6f),
+				baseTime / (samplingTime + transmittanceTime),
+				scattered / (Float) rayCount, transmittance / rayCount);
+		}
+
+		if (!tempDir.empty())
+			fs::remove_all(tempDir);
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(VolBench, "Woodcock tracking benchmark")
+MTS_NAMESPACE_END
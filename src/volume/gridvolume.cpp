@@ -584,6 +584,43 @@ public:
 		return 1.0f;
 	}
 
+	Float getLocalMaximumFloatValue(const AABB &aabb) const {
+		if (m_channels != 1)
+			return getMaximumFloatValue();
+
+		/* Find the voxels that influence trilinear lookups within the
+		   region (with a small margin to be robust to round-off) */
+		const Float margin = 1e-3f;
+		AABB gridAABB;
+		for (int i=0; i<8; ++i)
+			gridAABB.expandBy(m_worldToGrid.transformAffine(aabb.getCorner(i)));
+		Vector3i lo, hi;
+		for (int i=0; i<3; ++i) {
+			lo[i] = std::max(0, math::floorToInt(gridAABB.min[i] - margin));
+			hi[i] = std::min(m_res[i] - 1, math::floorToInt(gridAABB.max[i] + margin) + 1);
+			if (lo[i] > hi[i])
+				return 0.0f;
+		}
+
+		Float result = 0.0f;
+		for (int z=lo.z; z<=hi.z; ++z) {
+			for (int y=lo.y; y<=hi.y; ++y) {
+				const size_t offset = ((size_t) z*m_res.y + y)*m_res.x;
+				for (int x=lo.x; x<=hi.x; ++x) {
+					Float value;
+					if (m_volumeType == EFloat32)
+						value = ((const float *) m_data)[offset + x];
+					else if (m_volumeType == EUInt8)
+						value = m_densityMap[m_data[offset + x]];
+					else
+						value = 0.0f;
+					result = std::max(result, value);
+				}
+			}
+		}
+		return result;
+	}
+
 	std::string toString() const {
 		std::ostringstream oss;
 		oss << "GridVolume[" << endl
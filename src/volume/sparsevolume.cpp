@@ -0,0 +1,351 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/volume.h>
+#include <mitsuba/render/sparsevol.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/properties.h>
+#include <mitsuba/core/mmap.h>
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{sparsevolume}{Sparse brick-based volume data source}
+ * \parameters{
+ *     \parameter{filename}{\String}{
+ *       Specifies the filename of the sparse volume file to be loaded
+ *     }
+ *     \parameter{toWorld}{\Transform}{
+ *         Optional linear transformation that should be applied to the data
+ *     }
+ * }
+ *
+ * This class provides access to memory-mapped volume data that is mostly
+ * empty, e.g. the output of smoke and cloud simulations. The volume is split
+ * into bricks of $8^3$ (or another power of two) cells, and only bricks with
+ * nonzero content are stored. Each brick carries one extra layer of samples
+ * so that lookups never need to consult a neighboring brick. Optionally,
+ * the samples are quantized to 8 bits using a per-brick value range.
+ *
+ * The files are created from dense \pluginref{gridvolume} files using
+ * \code{mtsutil sparsevol}; the format is documented in
+ * \code{include/mitsuba/render/sparsevol.h}.
+ *
+ * The maxima of the bricks are organized into a hierarchy, which lets
+ * participating media such as \pluginref{heterogeneous} quickly find the
+ * empty parts of the volume and skip them during Woodcock tracking.
+ */
+class SparseDataSource : public VolumeDataSource {
+public:
+	SparseDataSource(const Properties &props)
+		: VolumeDataSource(props) {
+		m_volumeToWorld = props.getTransform("toWorld", Transform());
+		loadFromFile(fs::pathstr(props.getString("filename")));
+	}
+
+	SparseDataSource(Stream *stream, InstanceManager *manager)
+			: VolumeDataSource(stream, manager) {
+		m_volumeToWorld = Transform(stream);
+		loadFromFile(fs::pathstr(stream->readString()));
+		configure();
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		VolumeDataSource::serialize(stream, manager);
+		m_volumeToWorld.serialize(stream);
+		stream->writeString(m_filename.s);
+	}
+
+	void configure() {
+		const AABB dataAABB(
+			Point(m_header->aabbMin[0], m_header->aabbMin[1], m_header->aabbMin[2]),
+			Point(m_header->aabbMax[0], m_header->aabbMax[1], m_header->aabbMax[2]));
+		Vector extents(dataAABB.getExtents());
+		m_worldToVolume = m_volumeToWorld.inverse();
+		m_worldToGrid = Transform::scale(Vector(
+				(m_res[0] - 1) / extents[0],
+				(m_res[1] - 1) / extents[1],
+				(m_res[2] - 1) / extents[2])
+			) * Transform::translate(-Vector(dataAABB.min)) * m_worldToVolume;
+		m_stepSize = std::numeric_limits<Float>::infinity();
+		for (int i=0; i<3; ++i)
+			m_stepSize = std::min(m_stepSize, 0.5f * extents[i] / (Float) (m_res[i]-1));
+		m_aabb.reset();
+		for (int i=0; i<8; ++i)
+			m_aabb.expandBy(m_volumeToWorld(dataAABB.getCorner(i)));
+	}
+
+	void loadFromFile(const fs::pathstr &filename) {
+		m_filename = filename;
+		fs::pathstr resolved = Thread::getThread()->getFileResolver()->resolve(filename);
+		m_mmap = new MemoryMappedFile(resolved);
+		const uint8_t *data = (const uint8_t *) m_mmap->getData();
+
+		if (m_mmap->getSize() < sizeof(SparseVolumeHeader))
+			Log(EError, "\"%s\": the file is truncated!", filename.s.c_str());
+		m_header = (const SparseVolumeHeader *) data;
+		if (memcmp(m_header->magic, "SVOL", 4) != 0)
+			Log(EError, "\"%s\": invalid sparse volume file (incorrect header identifier)",
+				filename.s.c_str());
+		if (m_header->version != MTS_SPARSEVOL_VERSION)
+			Log(EError, "\"%s\": unsupported sparse volume file version %u", filename.s.c_str(),
+				m_header->version);
+		if (m_header->channels != 1 && m_header->channels != 3)
+			Log(EError, "\"%s\": unsupported number of channels (%u, only 1 and 3 are supported)",
+				filename.s.c_str(), m_header->channels);
+		if (m_header->encoding != SparseVolumeHeader::EFloat32
+				&& m_header->encoding != SparseVolumeHeader::EUInt8)
+			Log(EError, "\"%s\": unknown sample encoding %u", filename.s.c_str(), m_header->encoding);
+		if (m_header->brickSize < 2 || (m_header->brickSize & (m_header->brickSize - 1)) != 0)
+			Log(EError, "\"%s\": the brick size must be a power of two", filename.s.c_str());
+		for (int i=0; i<3; ++i) {
+			if (m_header->res[i] < 2)
+				Log(EError, "\"%s\": invalid resolution", filename.s.c_str());
+		}
+		if (m_mmap->getSize() < m_header->getFileSize())
+			Log(EError, "\"%s\": the file is truncated!", filename.s.c_str());
+
+		m_res = Vector3i(m_header->res[0], m_header->res[1], m_header->res[2]);
+		m_brickRes = Vector3i(m_header->getBrickRes(0), m_header->getBrickRes(1),
+			m_header->getBrickRes(2));
+		m_channels = (int) m_header->channels;
+		m_quantized = m_header->encoding == SparseVolumeHeader::EUInt8;
+		m_brickSize = (int) m_header->brickSize;
+		m_brickShift = math::log2i((uint32_t) m_brickSize);
+		m_brickDataSize = m_header->getBrickDataSize();
+		m_index = (const uint32_t *) (data + m_header->getIndexOffset());
+		m_bricks = (const SparseVolumeBrick *) (data + m_header->getBrickOffset());
+		m_data = data + m_header->getDataOffset();
+
+		for (size_t i=0; i<m_header->getIndexSize(); ++i) {
+			if (m_index[i] != MTS_SPARSEVOL_EMPTY && m_index[i] >= m_header->brickCount)
+				Log(EError, "\"%s\": invalid brick index", filename.s.c_str());
+		}
+
+		buildHierarchy();
+
+		Log(EDebug, "Mapped \"%s\" into memory: %ix%ix%i (%i channels, %s), "
+			"%u of " SIZE_T_FMT " bricks stored, %s", resolved.s.c_str(), m_res.x, m_res.y,
+			m_res.z, m_channels, m_quantized ? "uint8" : "float32", m_header->brickCount,
+			m_header->getIndexSize(), memString(m_mmap->getSize()).c_str());
+	}
+
+	/**
+	 * Build a pyramid of brick maxima. Level 0 holds the maximum of every
+	 * brick (zero for empty ones), each following level the maximum over
+	 * 2x2x2 entries of the previous one, up to a single entry
+	 */
+	void buildHierarchy() {
+		m_levels.clear();
+		m_levelRes.clear();
+		m_levelRes.push_back(m_brickRes);
+		m_levels.push_back(std::vector<float>(m_header->getIndexSize(), 0.0f));
+		for (size_t i=0; i<m_header->getIndexSize(); ++i) {
+			if (m_index[i] != MTS_SPARSEVOL_EMPTY)
+				m_levels[0][i] = m_bricks[m_index[i]].maxValue;
+		}
+
+		while (m_levelRes.back().x > 1 || m_levelRes.back().y > 1 || m_levelRes.back().z > 1) {
+			const Vector3i prevRes = m_levelRes.back();
+			const Vector3i res((prevRes.x + 1) / 2, (prevRes.y + 1) / 2, (prevRes.z + 1) / 2);
+			std::vector<float> level((size_t) res.x * res.y * res.z, 0.0f);
+			const std::vector<float> &prev = m_levels.back();
+			for (int z=0; z<prevRes.z; ++z) {
+				for (int y=0; y<prevRes.y; ++y) {
+					for (int x=0; x<prevRes.x; ++x) {
+						float &target = level[((z/2) * res.y + y/2) * res.x + x/2];
+						target = std::max(target, prev[((size_t) z * prevRes.y + y) * prevRes.x + x]);
+					}
+				}
+			}
+			m_levelRes.push_back(res);
+			m_levels.push_back(level);
+		}
+	}
+
+	/**
+	 * Return the maximum over the bricks in the range [lo, hi] that
+	 * exceeds \c result (or \c result itself), starting at the given
+	 * node of the pyramid
+	 */
+	Float queryMaximum(int level, const Vector3i &node, const Vector3i &lo,
+			const Vector3i &hi, Float result) const {
+		const Vector3i &res = m_levelRes[level];
+		const Float value = m_levels[level][((size_t) node.z * res.y + node.y) * res.x + node.x];
+		if (value <= result)
+			return result;
+
+		bool contained = true;
+		for (int i=0; i<3; ++i) {
+			int nodeLo = node[i] << level, nodeHi = ((node[i] + 1) << level) - 1;
+			if (nodeHi < lo[i] || nodeLo > hi[i])
+				return result;
+			contained &= nodeLo >= lo[i] && nodeHi <= hi[i];
+		}
+		if (contained || level == 0)
+			return value;
+
+		const Vector3i &childRes = m_levelRes[level-1];
+		for (int z=2*node.z; z<std::min(2*node.z+2, childRes.z); ++z)
+			for (int y=2*node.y; y<std::min(2*node.y+2, childRes.y); ++y)
+				for (int x=2*node.x; x<std::min(2*node.x+2, childRes.x); ++x)
+					result = queryMaximum(level-1, Vector3i(x, y, z), lo, hi, result);
+		return result;
+	}
+
+	/**
+	 * Locate the brick containing a lookup. On success, \c brick is the
+	 * number of the stored brick, \c offset the index of the first of the
+	 * eight samples within the brick and \c f the interpolation weights
+	 */
+	inline bool locate(const Point &_p, uint32_t &brick, size_t &offset, Vector &f) const {
+		const Point p = m_worldToGrid.transformAffine(_p);
+		const int x = math::floorToInt(p.x),
+			  y = math::floorToInt(p.y),
+			  z = math::floorToInt(p.z);
+
+		if (x < 0 || y < 0 || z < 0 || x >= m_res.x - 1 ||
+			y >= m_res.y - 1 || z >= m_res.z - 1)
+			return false;
+
+		const int bx = x >> m_brickShift, by = y >> m_brickShift, bz = z >> m_brickShift;
+		brick = m_index[((size_t) bz * m_brickRes.y + by) * m_brickRes.x + bx];
+		if (brick == MTS_SPARSEVOL_EMPTY)
+			return false;
+
+		const size_t stride = (size_t) m_brickSize + 1;
+		offset = (((size_t) (z - (bz << m_brickShift)) * stride
+			+ (size_t) (y - (by << m_brickShift))) * stride
+			+ (size_t) (x - (bx << m_brickShift))) * m_channels;
+		f = Vector(p.x - x, p.y - y, p.z - z);
+		return true;
+	}
+
+	/// Trilinearly interpolate channel \c c of the samples starting at \c d
+	template <typename T> inline Float interpolate(const T *d, int c, const Vector &f) const {
+		const size_t sx = m_channels, sy = sx * (m_brickSize + 1), sz = sy * (m_brickSize + 1);
+		const Float _fx = 1.0f - f.x, _fy = 1.0f - f.y, _fz = 1.0f - f.z;
+		d += c;
+		return (((Float) d[0]*_fx + (Float) d[sx]*f.x)*_fy +
+				((Float) d[sy]*_fx + (Float) d[sy+sx]*f.x)*f.y)*_fz +
+			   (((Float) d[sz]*_fx + (Float) d[sz+sx]*f.x)*_fy +
+				((Float) d[sz+sy]*_fx + (Float) d[sz+sy+sx]*f.x)*f.y)*f.z;
+	}
+
+	Float lookupFloat(const Point &p) const {
+		uint32_t brick;
+		size_t offset;
+		Vector f;
+		if (!locate(p, brick, offset, f))
+			return 0.0f;
+
+		const uint8_t *data = m_data + brick * m_brickDataSize;
+		if (m_quantized) {
+			const SparseVolumeBrick &info = m_bricks[brick];
+			return interpolate(data + offset, 0, f) * info.scale[0] + info.offset[0];
+		} else {
+			return interpolate((const float *) data + offset, 0, f);
+		}
+	}
+
+	Spectrum lookupSpectrum(const Point &p) const {
+		uint32_t brick;
+		size_t offset;
+		Vector f;
+		if (!locate(p, brick, offset, f))
+			return Spectrum(0.0f);
+
+		const uint8_t *data = m_data + brick * m_brickDataSize;
+		Float value[3];
+		if (m_quantized) {
+			const SparseVolumeBrick &info = m_bricks[brick];
+			for (int c=0; c<3; ++c)
+				value[c] = interpolate(data + offset, c, f) * info.scale[c] + info.offset[c];
+		} else {
+			for (int c=0; c<3; ++c)
+				value[c] = interpolate((const float *) data + offset, c, f);
+		}
+		Spectrum result;
+		result.fromLinearRGB(value[0], value[1], value[2]);
+		return result;
+	}
+
+	bool supportsFloatLookups() const { return m_channels == 1; }
+	bool supportsSpectrumLookups() const { return m_channels == 3; }
+	Float getStepSize() const { return m_stepSize; }
+
+	Float getMaximumFloatValue() const {
+		return m_levels.back()[0];
+	}
+
+	Float getLocalMaximumFloatValue(const AABB &aabb) const {
+		/* Find the bricks that influence lookups within the region
+		   (with a small margin to be robust to round-off) */
+		const Float margin = 1e-3f;
+		AABB gridAABB;
+		for (int i=0; i<8; ++i)
+			gridAABB.expandBy(m_worldToGrid.transformAffine(aabb.getCorner(i)));
+		Vector3i lo, hi;
+		for (int i=0; i<3; ++i) {
+			int cellLo = math::floorToInt(gridAABB.min[i] - margin),
+			    cellHi = math::floorToInt(gridAABB.max[i] + margin);
+			cellLo = std::max(cellLo, 0);
+			cellHi = std::min(cellHi, m_res[i] - 2);
+			if (cellLo > cellHi)
+				return 0.0f;
+			lo[i] = cellLo >> m_brickShift;
+			hi[i] = cellHi >> m_brickShift;
+		}
+		return queryMaximum((int) m_levels.size() - 1, Vector3i(0), lo, hi, 0.0f);
+	}
+
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "SparseVolume[" << endl
+			<< "  filename = \"" << m_filename.s << "\"," << endl
+			<< "  res = " << m_res.toString() << "," << endl
+			<< "  channels = " << m_channels << "," << endl
+			<< "  encoding = " << (m_quantized ? "uint8" : "float32") << "," << endl
+			<< "  brickSize = " << m_brickSize << "," << endl
+			<< "  bricks = " << m_header->brickCount << " of " << m_header->getIndexSize() << endl
+			<< "]";
+		return oss.str();
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	fs::pathstr m_filename;
+	ref<MemoryMappedFile> m_mmap;
+	const SparseVolumeHeader *m_header;
+	const uint32_t *m_index;
+	const SparseVolumeBrick *m_bricks;
+	const uint8_t *m_data;
+	Vector3i m_res, m_brickRes;
+	int m_channels, m_brickSize, m_brickShift;
+	size_t m_brickDataSize;
+	bool m_quantized;
+	std::vector<std::vector<float> > m_levels;
+	std::vector<Vector3i> m_levelRes;
+	Transform m_worldToGrid;
+	Transform m_worldToVolume;
+	Transform m_volumeToWorld;
+	Float m_stepSize;
+};
+
+MTS_IMPLEMENT_CLASS_S(SparseDataSource, false, VolumeDataSource);
+MTS_EXPORT_PLUGIN(SparseDataSource, "Sparse volume data source");
+MTS_NAMESPACE_END
@@ -322,6 +322,10 @@ public:
 		return m_nested->getMaximumFloatValue();
 	}
 
+	Float getLocalMaximumFloatValue(const AABB &aabb) const {
+		return m_nested->getLocalMaximumFloatValue(aabb);
+	}
+
 	MTS_DECLARE_CLASS()
 protected:
 	ref<VolumeDataSource> m_nested;